@@ -1,10 +0,0 @@
-#
-# "main" pseudo-component makefile.
-#
-# (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
-COMPONENT_ADD_LDFLAGS=-l$(COMPONENT_NAME) 	\
-	$(COMPONENT_PATH)/lib/libesp_processing.a
-	
-
-	
-	
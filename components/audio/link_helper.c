@@ -1,3 +0,0 @@
-void dummy_obj() {
-	return;
-}
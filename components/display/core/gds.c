@@ -15,6 +15,7 @@
 #include "driver/gpio.h"
 #include "driver/ledc.h"
 #include "esp_log.h"
+#include "perf_trace.h"
 
 #include "gds.h"
 #include "gds_private.h"
@@ -152,7 +153,11 @@ void GDS_ClearWindow( struct GDS_Device* Device, int x1, int y1, int x2, int y2,
 }
 
 void GDS_Update( struct GDS_Device* Device ) {
-	if (Device->Dirty) Device->Update( Device );
+	if (Device->Dirty) {
+		PERF_TRACE_BEGIN(PERF_DISPLAY_UPDATE);
+		Device->Update( Device );
+		PERF_TRACE_END(PERF_DISPLAY_UPDATE);
+	}	
 	Device->Dirty = false;
 }
 
@@ -141,19 +141,8 @@ esp_err_t store_nvs_value(nvs_type_t type, const char *key, void * data) {
 		return ESP_ERR_NVS_TYPE_MISMATCH;
 	return store_nvs_value_len(type, key, data,0);
 }
-esp_err_t store_nvs_value_len(nvs_type_t type, const char *key, void * data,
-		size_t data_len) {
-	esp_err_t err;
-	nvs_handle nvs;
-
-	if (type == NVS_TYPE_ANY) {
-		return ESP_ERR_NVS_TYPE_MISMATCH;
-	}
-
-	err = nvs_open_from_partition(settings_partition, current_namespace, NVS_READWRITE, &nvs);
-	if (err != ESP_OK) {
-		return err;
-	}
+esp_err_t set_nvs_value(nvs_handle nvs, nvs_type_t type, const char *key, void * data, size_t data_len) {
+	esp_err_t err = ESP_ERR_NVS_TYPE_MISMATCH;
 
 	if (type == NVS_TYPE_I8) {
 		err = nvs_set_i8(nvs, key, *(int8_t *) data);
@@ -176,6 +165,23 @@ esp_err_t store_nvs_value_len(nvs_type_t type, const char *key, void * data,
 	} else if (type == NVS_TYPE_BLOB) {
 		err = nvs_set_blob(nvs, key, (void *) data, data_len);
 	}
+	return err;
+}
+esp_err_t store_nvs_value_len(nvs_type_t type, const char *key, void * data,
+		size_t data_len) {
+	esp_err_t err;
+	nvs_handle nvs;
+
+	if (type == NVS_TYPE_ANY) {
+		return ESP_ERR_NVS_TYPE_MISMATCH;
+	}
+
+	err = nvs_open_from_partition(settings_partition, current_namespace, NVS_READWRITE, &nvs);
+	if (err != ESP_OK) {
+		return err;
+	}
+
+	err = set_nvs_value(nvs, type, key, data, data_len);
 	if (err == ESP_OK) {
 		err = nvs_commit(nvs);
 		if (err == ESP_OK) {
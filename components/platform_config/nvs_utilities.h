@@ -9,6 +9,7 @@ extern const char settings_partition[];
 
 #define NUM_BUFFER_LEN 101
 void initialize_nvs();
+esp_err_t set_nvs_value(nvs_handle nvs, nvs_type_t type, const char *key, void * data, size_t data_len);
 esp_err_t store_nvs_value_len(nvs_type_t type, const char *key, void * data, size_t data_len);
 esp_err_t store_nvs_value(nvs_type_t type, const char *key, void * data);
 esp_err_t get_nvs_value(nvs_type_t type, const char *key, void*value, const uint8_t buf_size);
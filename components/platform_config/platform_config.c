@@ -67,9 +67,9 @@ void config_set_entry_changed_flag(cJSON * entry, cJSON_bool flag);
 	config_set_default(nt, key,pval,0);\
 	free(pval); }
 #define IMPLEMENT_GET_NUM(t,nt) esp_err_t config_get_## t (const char *key, t *  value){\
-		void * pval = config_alloc_get(nt, key);\
-		if(pval!=NULL){ *value = *(t * )pval; free(pval); return ESP_OK; }\
-		return ESP_FAIL;}
+		double num;\
+		if(config_get_num(nt, key, &num) != ESP_OK) return ESP_FAIL;\
+		*value = (t) num; return ESP_OK; }
 static void * malloc_fn(size_t sz){
 
 	void * ptr = is_recovery_running?malloc(sz):heap_caps_malloc(sz, MALLOC_CAP_SPIRAM);
@@ -83,6 +83,98 @@ void init_cJSON(){
 	hooks.malloc_fn=&malloc_fn;
 	cJSON_InitHooks(&hooks);
 }
+
+/* Entries are found through a hash index over nvs_json children (open addressing,
+ * linear probing) rather than walking the object. Slots also keep the decoded 
+ * type, a shortcut to the "value" item and the dirty flag so that a commit only 
+ * touches changed keys. The index is only used with the config lock held */
+#define INDEX_MIN_SIZE	128
+
+typedef struct {
+	uint32_t hash;
+	cJSON * entry;
+	cJSON * value;
+	nvs_type_t type;
+	bool dirty, pending;
+} config_slot_t;
+
+static struct {
+	config_slot_t * slots;
+	size_t size, count, dirty;
+} config_index;
+
+static uint32_t key_hash(const char * key){
+	uint32_t hash = 2166136261u;
+	while(*key) hash = (hash ^ (uint8_t) *key++) * 16777619u;
+	return hash;
+}
+
+static config_slot_t * index_probe(config_slot_t * slots, size_t size, uint32_t hash, const char * key){
+	for(size_t i = hash & (size - 1);; i = (i + 1) & (size - 1)){
+		if(!slots[i].entry || (slots[i].hash == hash && !strcmp(slots[i].entry->string, key))) return slots + i;
+	}
+}
+
+static config_slot_t * index_find(const char * key){
+	if(!config_index.slots || !key) return NULL;
+	config_slot_t * slot = index_probe(config_index.slots, config_index.size, key_hash(key), key);
+	return slot->entry ? slot : NULL;
+}
+
+static bool index_grow(){
+	size_t size = config_index.size ? config_index.size * 2 : INDEX_MIN_SIZE;
+	config_slot_t * slots = malloc_fn(size * sizeof(config_slot_t));
+	if(!slots) return false;
+	memset(slots, 0, size * sizeof(config_slot_t));
+	for(size_t i = 0; i < config_index.size; i++){
+		config_slot_t * slot = config_index.slots + i;
+		if(slot->entry) *index_probe(slots, size, slot->hash, slot->entry->string) = *slot;
+	}
+	free(config_index.slots);
+	config_index.slots = slots;
+	config_index.size = size;
+	return true;
+}
+
+static void index_set(cJSON * entry){
+	if((config_index.count + 1) * 4 > config_index.size * 3 && !index_grow()){
+		ESP_LOGE(TAG, "Unable to grow config index, [%s] will not be found", entry->string);
+		return;
+	}
+	uint32_t hash = key_hash(entry->string);
+	config_slot_t * slot = index_probe(config_index.slots, config_index.size, hash, entry->string);
+	if(!slot->entry) config_index.count++;
+	if(slot->dirty) config_index.dirty--;
+	slot->hash = hash;
+	slot->entry = entry;
+	slot->value = cJSON_GetObjectItemCaseSensitive(entry, "value");
+	slot->type = config_get_item_type(entry);
+	slot->dirty = config_is_entry_changed(entry);
+	slot->pending = false;
+	if(slot->dirty) config_index.dirty++;
+}
+
+static void index_remove(const char * key){
+	config_slot_t * slot = index_find(key);
+	if(!slot) return;
+	if(slot->dirty) config_index.dirty--;
+	config_index.count--;
+	// backward shift so that probe sequences stay unbroken
+	size_t hole = slot - config_index.slots, mask = config_index.size - 1;
+	for(size_t i = (hole + 1) & mask; config_index.slots[i].entry; i = (i + 1) & mask){
+		size_t home = config_index.slots[i].hash & mask;
+		if(((i - home) & mask) >= ((i - hole) & mask)){
+			config_index.slots[hole] = config_index.slots[i];
+			hole = i;
+		}
+	}
+	memset(config_index.slots + hole, 0, sizeof(config_slot_t));
+}
+
+static void index_clear(){
+	free(config_index.slots);
+	memset(&config_index, 0, sizeof(config_index));
+}
 void config_init(){
 	ESP_LOGD(TAG, "Creating mutex for Config");
 	config_mutex = xSemaphoreCreateMutex();
@@ -95,6 +187,7 @@ void config_init(){
 		cJSON_Delete(nvs_json);
 	}
 	nvs_json = cJSON_CreateObject();
+	index_clear();
 
 	config_set_group_bit(CONFIG_LOAD_BIT,true);
 	nvs_load_config();
@@ -127,6 +220,11 @@ nvs_type_t  config_get_item_type(cJSON * entry){
 
 
 cJSON * config_set_value_safe(nvs_type_t nvs_type, const char *key,  const void * value){
+	// such a key could never be committed, nvs would refuse it
+	if(!key || strlen(key) > NVS_KEY_NAME_MAX_SIZE-1){
+		ESP_LOGE(TAG, "Key %s is longer than %d characters, rejected", str_or_null(key), NVS_KEY_NAME_MAX_SIZE-1);
+		return NULL;
+	}
 	cJSON * entry = cJSON_CreateObject();
 
 	double numvalue = 0;
@@ -135,12 +233,13 @@ cJSON * config_set_value_safe(nvs_type_t nvs_type, const char *key,  const void
 		return NULL;
 	}
 
-	cJSON * existing = cJSON_GetObjectItemCaseSensitive(nvs_json, key);
-	if(existing !=NULL && nvs_type == NVS_TYPE_STR && config_get_item_type(existing) != NVS_TYPE_STR  ) {
+	config_slot_t * slot = index_find(key);
+	cJSON * existing = slot ? slot->entry : NULL;
+	if(existing !=NULL && nvs_type == NVS_TYPE_STR && slot->type != NVS_TYPE_STR  ) {
 		ESP_LOGW(TAG, "Storing numeric value from string");
 		numvalue = atof((char *)value);
 		cJSON_AddNumberToObject(entry,"value", numvalue	);
-		nvs_type_t exist_type = config_get_item_type(existing);
+		nvs_type_t exist_type = slot->type;
 		ESP_LOGW(TAG, "Stored  value %f from string %s as type %d",numvalue, (char *)value,exist_type);
 		cJSON_AddNumberToObject(entry,"type", exist_type);
 	}
@@ -177,37 +276,14 @@ cJSON * config_set_value_safe(nvs_type_t nvs_type, const char *key,  const void
 	}
 	if(existing!=NULL ) {
 		ESP_LOGV(TAG, "Changing existing entry [%s].", key);
-		char * exist_str = cJSON_PrintUnformatted(existing);
-		if(exist_str!=NULL){
-			ESP_LOGV(TAG,"Existing entry: %s", exist_str);
-			free(exist_str);
-		}
-		else {
-			ESP_LOGV(TAG,"Failed to print existing entry");
-		}
 		// set commit flag as equal so we can compare
 		cJSON_AddBoolToObject(entry,"chg",config_is_entry_changed(existing));
 		if(!cJSON_Compare(entry,existing,false)){
-			char * entry_str = cJSON_PrintUnformatted(entry);
-			if(entry_str!=NULL){
-				ESP_LOGD(TAG,"New config object: \n%s", entry_str );
-				free(entry_str);
-			}
-			else {
-				ESP_LOGD(TAG,"Failed to print entry");
-			}
 			ESP_LOGI(TAG, "Setting changed flag config [%s]", key);
 			config_set_entry_changed_flag(entry,true);
 			ESP_LOGI(TAG, "Updating config [%s]", key);
 			cJSON_ReplaceItemInObject(nvs_json,key, entry);
-			entry_str = cJSON_PrintUnformatted(entry);
-			if(entry_str!=NULL){
-				ESP_LOGD(TAG,"New config: %s", entry_str );
-				free(entry_str);
-			}
-			else {
-				ESP_LOGD(TAG,"Failed to print entry");
-			}
+			index_set(entry);
 		}
 		else {
 			ESP_LOGD(TAG, "Config not changed. ");
@@ -219,6 +295,7 @@ cJSON * config_set_value_safe(nvs_type_t nvs_type, const char *key,  const void
 		// This is a new entry.
 		config_set_entry_changed_flag(entry,true);
 		cJSON_AddItemToObject(nvs_json, key, entry);
+		index_set(entry);
 	}
 
 	return entry;
@@ -389,60 +466,60 @@ void config_commit_to_nvs(){
 	}
 	if(nvs_json==NULL){
 		ESP_LOGE(TAG, ": cJSON nvs cache object not set.");
+		config_unlock();
 		return;
 	}
 	ESP_LOGV(TAG,"config_commit_to_nvs. Config Locked!");
-	cJSON * entry=nvs_json->child;
-	while(entry!= NULL){
-		char * entry_str = cJSON_PrintUnformatted(entry);
-		if(entry_str!=NULL){
-			ESP_LOGV(TAG,"config_commit_to_nvs processing item %s",entry_str);
-			free(entry_str);
-		}
 
-		if(config_is_entry_changed(entry)){
-			ESP_LOGD(TAG, "Committing entry %s value to nvs.",(entry->string==NULL)?"UNKNOWN":entry->string);
-			nvs_type_t type = config_get_entry_type(entry);
-			void * value = config_safe_alloc_get_entry_value(type, entry);
+	// all changed entries go in a single nvs transaction
+	nvs_handle nvs;
+	esp_err_t err = config_index.dirty ? nvs_open_from_partition(settings_partition, current_namespace, NVS_READWRITE, &nvs) : ESP_OK;
+	if(err != ESP_OK){
+		ESP_LOGE(TAG, "Error opening nvs: %s. Unable to commit configuration.",esp_err_to_name(err));
+	}
+	else if(config_index.dirty){
+		size_t count = 0;
+		for(size_t i = 0; i < config_index.size; i++){
+			config_slot_t * slot = config_index.slots + i;
+			if(!slot->entry || !slot->dirty) continue;
+			ESP_LOGD(TAG, "Committing entry %s value to nvs.",slot->entry->string);
+			// nvs needs the key in internal memory, entries live in SPIRAM
+			char key[NVS_KEY_NAME_MAX_SIZE];
+			if(strlcpy(key, slot->entry->string, sizeof(key)) >= sizeof(key)){
+				ESP_LOGE(TAG, "Key %s is longer than %d characters, not committed",slot->entry->string,NVS_KEY_NAME_MAX_SIZE-1);
+				continue;
+			}
+			void * value = config_safe_alloc_get_entry_value(slot->type, slot->entry);
 			if(value!=NULL){
-				size_t len=strlen(entry->string);
-				char * key=(void *)heap_caps_malloc(len+1, MALLOC_CAP_DMA);
-				memset(key,0x00,len+1);
-				memcpy(key,entry->string,len);
-				esp_err_t err = store_nvs_value(type,key,value);
-				free(key);
+				err = set_nvs_value(nvs, slot->type, key, value, 0);
 				free(value);
-
 				if(err!=ESP_OK){
-					char * entry_str = cJSON_PrintUnformatted(entry);
-					if(entry_str!=NULL){
-						ESP_LOGE(TAG, "Error comitting value to nvs for key %s, Object: \n%s",entry->string,entry_str);
-						free(entry_str);
-					}
-					else {
-						ESP_LOGE(TAG, "Error comitting value to nvs for key %s",entry->string);
-					}
+					ESP_LOGE(TAG, "Error comitting value to nvs for key %s: %s",slot->entry->string,esp_err_to_name(err));
 				}
 				else {
-					config_set_entry_changed_flag(entry, false);
+					slot->pending = true;
+					count++;
 				}
 			}
 			else {
-				char * entry_str = cJSON_PrintUnformatted(entry);
-				if(entry_str!=NULL){
-					ESP_LOGE(TAG, "Unable to retrieve value. Error comitting value to nvs for key %s, Object: \n%s",entry->string,entry_str);
-					free(entry_str);
-				}
-				else {
-					ESP_LOGE(TAG, "Unable to retrieve value. Error comitting value to nvs for key %s",entry->string);
-				}
+				ESP_LOGE(TAG, "Unable to retrieve value. Error comitting value to nvs for key %s",slot->entry->string);
 			}
 		}
-		else {
-			ESP_LOGV(TAG,"config_commit_to_nvs. Item already committed.  Ignoring.");
+		err = count ? nvs_commit(nvs) : ESP_OK;
+		nvs_close(nvs);
+		if(err != ESP_OK){
+			ESP_LOGE(TAG, "Unable to commit %zu configuration entries: %s",count,esp_err_to_name(err));
+		}
+		for(size_t i = 0; i < config_index.size; i++){
+			config_slot_t * slot = config_index.slots + i;
+			if(!slot->pending) continue;
+			slot->pending = false;
+			if(err != ESP_OK) continue;
+			config_set_entry_changed_flag(slot->entry, false);
+			slot->dirty = false;
+			config_index.dirty--;
 		}
-		taskYIELD();  /* allows the freeRTOS scheduler to take over if needed. */
-		entry = entry->next;
+		ESP_LOGI(TAG, "%zu configuration entries committed, %zu left", err == ESP_OK ? count : 0, config_index.dirty);
 	}
 	ESP_LOGV(TAG,"config_commit_to_nvs. Resetting the global commit flag.");
 	config_raise_change(false);
@@ -540,9 +617,9 @@ void config_set_default(nvs_type_t type, const char *key, void * default_value,
 	}
 
 	ESP_LOGV(TAG, "Checking if key %s exists in nvs cache for type %s.", key,type_to_str(type));
-	cJSON * entry = cJSON_GetObjectItemCaseSensitive(nvs_json, key);
+	cJSON * entry = NULL;
 
-	if(entry !=NULL){
+	if(index_find(key) !=NULL){
 		ESP_LOGV(TAG, "Entry found.");
 	}
 	else {
@@ -552,11 +629,6 @@ void config_set_default(nvs_type_t type, const char *key, void * default_value,
 		if(entry == NULL){
 			ESP_LOGE(TAG, "Failed to add value to cache!");
 		}
-		char * entry_str = cJSON_PrintUnformatted(entry);
-		if(entry_str!=NULL){
-			ESP_LOGD(TAG, "Value added to default for object: \n%s",entry_str);
-			free(entry_str);
-		}
 	}
 
 	config_unlock();
@@ -591,20 +663,11 @@ void config_delete_key(const char *key){
 	else {
 		ESP_LOGE(TAG, "Error opening nvs: %s. Unable to delete nvs key [%s].",esp_err_to_name(err),key);
 	}
-	char * struc_str = cJSON_PrintUnformatted(nvs_json);
-	if(struc_str!=NULL){
-		ESP_LOGV(TAG, "Structure before delete \n%s", struc_str);
-		free(struc_str);
-	}
+	index_remove(key);
 	cJSON * entry = cJSON_DetachItemFromObjectCaseSensitive(nvs_json, key);
 	if(entry !=NULL){
 		ESP_LOGI(TAG, "Removing config key [%s]", entry->string);
 		cJSON_Delete(entry);
-		struc_str = cJSON_PrintUnformatted(nvs_json);
-		if(struc_str!=NULL){
-			ESP_LOGV(TAG, "Structure after delete \n%s", struc_str);
-			free(struc_str);
-		}
 	}
 	else {
 		ESP_LOGW(TAG, "Unable to remove config key [%s]: not found.", key);
@@ -639,10 +702,11 @@ void * config_alloc_get_default(nvs_type_t nvs_type, const char *key, void * def
 		return value;
 	}
 	ESP_LOGD(TAG,"Getting config entry for key %s",key);
-	cJSON * entry = cJSON_GetObjectItemCaseSensitive(nvs_json, key);
-	if(entry !=NULL){
+	config_slot_t * slot = index_find(key);
+	cJSON * entry = NULL;
+	if(slot !=NULL){
 		ESP_LOGV(TAG, "Entry found, getting value.");
-		value = config_safe_alloc_get_entry_value(nvs_type, entry);
+		value = config_safe_alloc_get_entry_value(nvs_type, slot->entry);
 	}
 	else if(default_value!=NULL){
 		// Value was not found
@@ -652,14 +716,7 @@ void * config_alloc_get_default(nvs_type_t nvs_type, const char *key, void * def
 			ESP_LOGE(TAG, "Failed to add value to cache");
 		}
 		else {
-			char * entry_str = cJSON_PrintUnformatted(entry);
-			if(entry_str!=NULL){
-				ESP_LOGV(TAG, "Value added configuration object for key [%s]: \n%s", entry->string,entry_str);
-				free(entry_str);
-			}
-			else {
-				ESP_LOGV(TAG, "Value added configuration object for key [%s]", entry->string);
-			}
+			ESP_LOGV(TAG, "Value added configuration object for key [%s]", entry->string);
 			value = config_safe_alloc_get_entry_value(nvs_type, entry);
 		}
 	}
@@ -684,6 +741,54 @@ char * config_alloc_get_json(bool bFormatted){
 	config_unlock();
 	return json_buffer;
 }
+/* Entries are rendered one at a time in a chunk with the lock held, then written 
+ * out after releasing it, so a slow client only ever delays others by one entry and 
+ * the tree is never copied. The walk resumes after the key just written or, when it 
+ * was deleted meanwhile, with the entry that took its place. An entry larger than a chunk
+ * is streamed as is, under the lock */
+#define CONFIG_JSON_CHUNK	1024
+bool config_write_json(json_writer_t *w, const char *key){
+	char name[NVS_KEY_NAME_MAX_SIZE] = "";
+	char * chunk = malloc_fn(CONFIG_JSON_CHUNK);
+	bool locked = true;
+	int position = 0;
+	json_writer_object_start(w, key);
+	if(!chunk){
+		json_writer_string(w, "error", "Unable to allocate memory.");
+		json_writer_object_end(w);
+		return false;
+	}
+	while(1){
+		json_writer_t entry_writer;
+		if(!config_lock(LOCK_MAX_WAIT/portTICK_PERIOD_MS)){
+			ESP_LOGE(TAG, "Unable to lock config after %d ms",LOCK_MAX_WAIT);
+			locked = false;
+			break;
+		}
+		config_slot_t * slot = *name ? index_find(name) : NULL;
+		cJSON * entry = slot ? slot->entry->next : cJSON_GetArrayItem(nvs_json, *name ? position - 1 : 0);
+		if(!entry){
+			config_unlock();
+			break;
+		}
+		strlcpy(name, entry->string, sizeof(name));
+		position++;
+		json_writer_init(&entry_writer, chunk, CONFIG_JSON_CHUNK, NULL, NULL);
+		json_writer_item(&entry_writer, NULL, entry);
+		if(!json_writer_finish(&entry_writer)){
+			json_writer_item(w, name, entry);
+			config_unlock();
+		}
+		else {
+			config_unlock();
+			json_writer_raw(w, name, chunk);
+		}
+	}
+	if(!locked) json_writer_string(w, "error", "Unable to lock configuration object.");
+	json_writer_object_end(w);
+	free(chunk);
+	return locked;
+}
 esp_err_t config_set_value(nvs_type_t nvs_type, const char *key, const void * value){
 	esp_err_t result = ESP_OK;
 	if(!config_lock(LOCK_MAX_WAIT/portTICK_PERIOD_MS)){
@@ -695,14 +800,7 @@ esp_err_t config_set_value(nvs_type_t nvs_type, const char *key, const void * va
 		result = ESP_FAIL;
 	}
 	else{
-		char * entry_str = cJSON_PrintUnformatted(entry);
-		if(entry_str!=NULL){
-			ESP_LOGV(TAG,"config_set_value result: \n%s",entry_str);
-			free(entry_str);
-		}
-		else {
-			ESP_LOGV(TAG,"config_set_value completed");
-		}
+		ESP_LOGV(TAG,"config_set_value completed for [%s]", key);
 	}
 	config_unlock();
 	return result;
@@ -715,6 +813,25 @@ IMPLEMENT_SET_DEFAULT(int16_t,NVS_TYPE_I16);
 IMPLEMENT_SET_DEFAULT(uint32_t,NVS_TYPE_U32);
 IMPLEMENT_SET_DEFAULT(int32_t,NVS_TYPE_I32);
 
+/* numbers are read straight from the indexed value, no allocation */
+static esp_err_t config_get_num(nvs_type_t nvs_type, const char *key, double * value){
+	esp_err_t err = ESP_FAIL;
+	if(!config_lock(LOCK_MAX_WAIT/portTICK_PERIOD_MS)){
+		ESP_LOGE(TAG, "Unable to lock config");
+		return err;
+	}
+	config_slot_t * slot = index_find(key);
+	if(slot && slot->type == nvs_type && cJSON_IsNumber(slot->value)){
+		*value = slot->value->valuedouble;
+		err = ESP_OK;
+	}
+	else if(slot){
+		ESP_LOGE(TAG, "Requested value type %s for key %s, found value type %s instead", type_to_str(nvs_type), key, type_to_str(slot->type));
+	}
+	config_unlock();
+	return err;
+}
+
 IMPLEMENT_GET_NUM(uint8_t,NVS_TYPE_U8);
 IMPLEMENT_GET_NUM(int8_t,NVS_TYPE_I8);
 IMPLEMENT_GET_NUM(uint16_t,NVS_TYPE_U16);
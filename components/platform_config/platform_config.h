@@ -4,6 +4,7 @@
 #include "nvs.h"
 #include "assert.h"
 #include "cJSON.h"
+#include "json_writer.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -52,6 +53,7 @@ void config_set_default(nvs_type_t type, const char *key, void * default_value,
 void * config_alloc_get(nvs_type_t nvs_type, const char *key) ;
 bool wait_for_commit();
 char * config_alloc_get_json(bool bFormatted);
+bool config_write_json(json_writer_t *w, const char *key);
 esp_err_t config_set_value(nvs_type_t nvs_type, const char *key, const void * value);
 nvs_type_t  config_get_item_type(cJSON * entry);
 void * config_safe_alloc_get_entry_value(nvs_type_t nvs_type, cJSON * entry);
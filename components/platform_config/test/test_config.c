@@ -0,0 +1,215 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "cJSON.h"
+#include "json_writer.h"
+#include "platform_config.h"
+
+#define TEST_FLUSH_DELAY_MS	20
+#define TEST_CLIENT_CHUNK	256
+#define TEST_KEY			"test_cfg_num"
+
+/*
+ A slow client takes TEST_FLUSH_DELAY_MS to accept each TEST_CLIENT_CHUNK. While the
+ configuration is written to it, another task reads and rewrites entries and measures
+ how long it waits for the config lock
+*/
+static struct {
+	char *json;
+	size_t len, size;
+	size_t heap_base, heap_min;
+	volatile bool writing;
+	uint32_t flushes;
+} client;
+
+static struct {
+	volatile bool done;
+	uint32_t calls;
+	int64_t max_wait;
+} contender;
+
+/****************************************************************************************
+ *
+ */
+static bool slow_flush(void *ctx, const char *data, size_t len) {
+	size_t heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+	if (heap < client.heap_min) client.heap_min = heap;
+	if (client.len + len >= client.size) return false;
+	memcpy(client.json + client.len, data, len);
+	client.len += len;
+	client.json[client.len] = '\0';
+	client.flushes++;
+	vTaskDelay(pdMS_TO_TICKS(TEST_FLUSH_DELAY_MS));
+
+	return true;
+}
+
+/****************************************************************************************
+ *
+ */
+static void contender_task(void *arg) {
+	uint32_t value = 0;
+
+	while (client.writing) {
+		int64_t start = esp_timer_get_time();
+
+		config_get_uint32_t(TEST_KEY, &value);
+		value++;
+		config_set_value(NVS_TYPE_U32, TEST_KEY, &value);
+
+		int64_t wait = esp_timer_get_time() - start;
+		if (wait > contender.max_wait) contender.max_wait = wait;
+		contender.calls++;
+		vTaskDelay(pdMS_TO_TICKS(5));
+	}
+
+	contender.done = true;
+	vTaskDelete(NULL);
+}
+
+/****************************************************************************************
+ *
+ */
+static bool write_config(char *buf, size_t size, json_writer_flush_f flush) {
+	static char chunk[TEST_CLIENT_CHUNK];
+	json_writer_t w;
+
+	if (flush) json_writer_init(&w, chunk, sizeof(chunk), flush, NULL);
+	else json_writer_init(&w, buf, size, NULL, NULL);
+
+	bool ok = config_write_json(&w, NULL);
+	return json_writer_finish(&w) && ok;
+}
+
+TEST_CASE("Streamed configuration matches cJSON output", "[config]")
+{
+	char *expected = config_alloc_get_json(false);
+	size_t size = strlen(expected) + 1;
+	char *streamed = malloc(size + 1);
+
+	TEST_ASSERT_NOT_NULL_MESSAGE(streamed, "can't allocate test buffer");
+	TEST_ASSERT_TRUE_MESSAGE(write_config(streamed, size + 1, NULL), "configuration could not be written");
+	TEST_ASSERT_EQUAL_STRING_MESSAGE(expected, streamed, "streamed configuration differs");
+
+	free(streamed);
+	free(expected);
+}
+
+TEST_CASE("Slow client does not hold the configuration lock", "[config]")
+{
+	uint32_t value = 0;
+	int64_t start, elapsed;
+
+	config_set_value(NVS_TYPE_U32, TEST_KEY, &value);
+
+	memset(&client, 0, sizeof(client));
+	memset(&contender, 0, sizeof(contender));
+	client.size = 32 * 1024;
+	client.json = malloc(client.size);
+	TEST_ASSERT_NOT_NULL_MESSAGE(client.json, "can't allocate test buffer");
+
+	client.writing = true;
+	xTaskCreate(contender_task, "test_lock", 3072, NULL, uxTaskPriorityGet(NULL), NULL);
+
+	client.heap_base = client.heap_min = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	start = esp_timer_get_time();
+	bool ok = write_config(NULL, 0, slow_flush);
+	elapsed = esp_timer_get_time() - start;
+
+	client.writing = false;
+	while (!contender.done) vTaskDelay(pdMS_TO_TICKS(10));
+
+	printf("config of %u bytes written in %u flushes, %lld ms; lock waited %lld us max over %u calls; peak heap %u bytes\n",
+			client.len, client.flushes, elapsed / 1000, contender.max_wait, contender.calls, client.heap_base - client.heap_min);
+
+	cJSON *parsed = cJSON_Parse(client.json);
+	free(client.json);
+	cJSON_Delete(parsed);
+	config_delete_key(TEST_KEY);
+
+	TEST_ASSERT_TRUE_MESSAGE(ok, "configuration could not be written");
+	TEST_ASSERT_NOT_NULL_MESSAGE(parsed, "streamed configuration is not valid JSON");
+	TEST_ASSERT_TRUE_MESSAGE(client.flushes > 4, "configuration too small to test a slow client");
+	// the lock is only held to render one entry, never while the client is flushed
+	TEST_ASSERT_TRUE_MESSAGE(contender.max_wait < 2 * TEST_FLUSH_DELAY_MS * 1000, "config lock held while client was flushed");
+	// one chunk plus a few bytes of allocator overhead, no copy of the tree
+	TEST_ASSERT_TRUE_MESSAGE(client.heap_base - client.heap_min < 1024 + 256, "configuration was copied to stream it");
+}
+
+/****************************************************************************************
+ * Same hash as the config index, to build keys that collide whatever the index size
+ */
+#define TEST_HOME_BITS	10
+#define TEST_COLLIDING	5
+#define TEST_CHAINS		3
+#define TEST_KEYS		(TEST_CHAINS * TEST_COLLIDING)
+
+static uint32_t home_of(const char *key) {
+	uint32_t hash = 2166136261u;
+	while (*key) hash = (hash ^ (uint8_t) *key++) * 16777619u;
+	return hash & ((1 << TEST_HOME_BITS) - 1);
+}
+
+static void colliding_keys(char keys[][NVS_KEY_NAME_MAX_SIZE], int count, uint32_t home, uint32_t *seed) {
+	for (int n = 0; n < count; (*seed)++) {
+		snprintf(keys[n], NVS_KEY_NAME_MAX_SIZE, "ix%05u", *seed);
+		if (home_of(keys[n]) == home) n++;
+	}
+}
+
+static void check_keys(char keys[][NVS_KEY_NAME_MAX_SIZE], int count, const bool *present) {
+	char message[64];
+
+	for (int i = 0; i < count; i++) {
+		uint32_t value = UINT32_MAX;
+		esp_err_t err = config_get_uint32_t(keys[i], &value);
+
+		snprintf(message, sizeof(message), "key %s %s", keys[i], present[i] ? "lost" : "still found");
+		if (present[i]) TEST_ASSERT_TRUE_MESSAGE(err == ESP_OK && value == i, message);
+		else TEST_ASSERT_TRUE_MESSAGE(err != ESP_OK, message);
+	}
+}
+
+TEST_CASE("Config index keeps colliding keys reachable after deletions", "[config]")
+{
+	// chains homed on the last slot wrap to the first ones, where two other chains start
+	static const uint32_t homes[TEST_CHAINS] = { (1 << TEST_HOME_BITS) - 1, 0, 1 };
+	// deletion order: heads, middles and tails of chains, and entries that were shifted
+	static const int order[] = { 0, 7, 3, 12, 1, 9, 14, 5, 2, 11, 4, 6, 13, 8, 10 };
+	static char keys[TEST_KEYS][NVS_KEY_NAME_MAX_SIZE];
+	bool present[TEST_KEYS];
+	uint32_t seed = 0;
+
+	_Static_assert(sizeof(order) / sizeof(*order) == TEST_KEYS, "every key must be deleted once");
+	for (int i = 0; i < TEST_CHAINS; i++) colliding_keys(keys + i * TEST_COLLIDING, TEST_COLLIDING, homes[i], &seed);
+
+	// interleave chains so that they run into each other
+	for (int n = 0; n < TEST_COLLIDING; n++) {
+		for (int i = n; i < TEST_KEYS; i += TEST_COLLIDING) {
+			uint32_t value = i;
+			TEST_ASSERT_TRUE_MESSAGE(config_set_value(NVS_TYPE_U32, keys[i], &value) == ESP_OK, "can't set key");
+			present[i] = true;
+		}
+	}
+	check_keys(keys, TEST_KEYS, present);
+
+	for (int i = 0; i < TEST_KEYS; i++) {
+		config_delete_key(keys[order[i]]);
+		present[order[i]] = false;
+		check_keys(keys, TEST_KEYS, present);
+	}
+}
@@ -11,6 +11,8 @@
 #include "platform_esp32.h"
 #include "platform_config.h"
 #include "esp_app_format.h"
+#include "messaging.h"
+#include "accounting.h"
 extern esp_err_t process_recovery_ota(const char * bin_url, char * bin_buffer, uint32_t length);
 static const char * TAG = "squeezelite_cmd";
 #define SQUEEZELITE_THREAD_STACK_SIZE (8*1024)
@@ -121,6 +123,13 @@ static int launchsqueezelite(int argc, char **argv) {
     return 0;
 }
 
+static int latency_report(int argc, char **argv) {
+	char report[640];
+	accounting_report(report, sizeof(report));
+	cmd_send_messaging(argv[0], MESSAGING_INFO, "%s", report);
+	return 0;
+}
+
 void register_squeezelite() {
 	squeezelite_args.parameters = arg_str0(NULL, NULL, "<parms>", "command line for squeezelite. -h for help, --defaults to launch with default values.");
 	squeezelite_args.end = arg_end(1);
@@ -132,6 +141,14 @@ void register_squeezelite() {
 		.argtable = &squeezelite_args
 	};
 	ESP_ERROR_CHECK( esp_console_cmd_register(&launch_squeezelite) );
+	
+	const esp_console_cmd_t latency = {
+		.command = "latency",
+		.help = "Buffers, latency and underruns of current track, control channel load",
+		.hint = NULL,
+		.func = &latency_report,
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&latency) );
 }
 
 esp_err_t start_ota(const char * bin_url, char * bin_buffer, uint32_t length) {
@@ -11,7 +11,6 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/timers.h"
-#include "freertos/queue.h"
 #include "esp_task.h"
 #include "esp_log.h"
 #include "driver/gpio.h"
@@ -30,12 +29,13 @@
 typedef struct gpio_exp_s {
 	uint32_t first, last;
 	int intr;
-	bool intr_pending;
+	uint32_t intr_peers;
 	struct  {
 		struct gpio_exp_phy_s phy;
 		spi_device_handle_t spi_handle;
 	};
 	uint32_t shadow, pending;
+	uint32_t staged_mask, staged_level;
 	TickType_t age;
 	SemaphoreHandle_t mutex;
 	uint32_t r_mask, w_mask;
@@ -48,13 +48,6 @@ typedef struct gpio_exp_s {
 	struct gpio_exp_model_s const *model;
 } gpio_exp_t;
 
-typedef struct {
-	enum { ASYNC_WRITE } type;
-	int gpio;
-	int level;
-	gpio_exp_t *expander;
-} queue_request_t;
-
 static const char TAG[] = "gpio expander";
 
 static void   IRAM_ATTR intr_isr_handler(void* arg);
@@ -124,10 +117,16 @@ static const struct gpio_exp_model_s {
 };
 
 static EXT_RAM_ATTR uint8_t n_expanders;
-static EXT_RAM_ATTR QueueHandle_t message_queue;
 static EXT_RAM_ATTR gpio_exp_t expanders[4];
 static EXT_RAM_ATTR TaskHandle_t service_task;
 
+/* 
+ Bitmaps of expanders (bit = index) with interrupt or asynchronous writes pending. They
+ are set/cleared atomically so ISR and service task never have to disable anything
+*/
+static uint32_t intr_pending, write_pending;
+static portMUX_TYPE staged_mux = portMUX_INITIALIZER_UNLOCKED;
+
 /******************************************************************************
  * Retrieve base from an expander reference
  */
@@ -180,17 +179,23 @@ gpio_exp_t* gpio_exp_create(const gpio_exp_config_t *config) {
 	expander->mutex = xSemaphoreCreateMutex();
 
 	// create a task to handle asynchronous requests (only write at this time)
-	if (!message_queue) {
+	if (!service_task) {
 		// we allocate TCB but stack is static to avoid SPIRAM fragmentation
 		StaticTask_t* xTaskBuffer = (StaticTask_t*) heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
 		static EXT_RAM_ATTR StackType_t xStack[4*1024] __attribute__ ((aligned (4)));
 
-		message_queue = xQueueCreate(4, sizeof(queue_request_t));
 		service_task = xTaskCreateStatic(service_handler, "gpio_expander", sizeof(xStack), NULL, ESP_TASK_PRIO_MIN + 1, xStack, xTaskBuffer);
 	}
 
 	// set interrupt if possible
 	if (config->intr >= 0) {
+		// expanders sharing the same interrupt are all checked when it fires
+		for (int i = 0; i < n_expanders; i++) {
+			if (expanders[i].intr != config->intr) continue;
+			expanders[i].intr_peers |= 1 << (n_expanders - 1);
+			expander->intr_peers |= 1 << i;
+		}
+
 		gpio_pad_select_gpio(config->intr);
 		gpio_set_direction(config->intr, GPIO_MODE_INPUT);
 
@@ -252,7 +257,10 @@ esp_err_t gpio_exp_set_direction(int gpio, gpio_mode_t mode, gpio_exp_t *expande
 	if (gpio < GPIO_NUM_MAX && !expander) return gpio_set_direction(gpio, mode);
 	if ((expander = find_expander(expander, &gpio)) == NULL) return ESP_ERR_INVALID_ARG;
 
-	xSemaphoreTake(expander->mutex, pdMS_TO_TICKS(portMAX_DELAY));
+	if (xSemaphoreTake(expander->mutex, portMAX_DELAY) == pdFALSE) {
+		ESP_LOGW(TAG, "Can't get mutex for GPIO %d", expander->first + gpio);
+		return ESP_ERR_TIMEOUT;
+	}
 
 	if (mode == GPIO_MODE_INPUT) {
 		expander->r_mask |= 1 << gpio;
@@ -322,7 +330,10 @@ esp_err_t gpio_exp_set_level(int gpio, int level, bool direct, gpio_exp_t *expan
 	}
 
 	if (direct) {
-		xSemaphoreTake(expander->mutex, pdMS_TO_TICKS(portMAX_DELAY));
+		if (xSemaphoreTake(expander->mutex, portMAX_DELAY) == pdFALSE) {
+			ESP_LOGW(TAG, "Can't get mutex for GPIO %d", expander->first + gpio);
+			return ESP_ERR_TIMEOUT;
+		}
 
 		level = level ? mask : 0;
 		mask &= expander->shadow;
@@ -336,11 +347,15 @@ esp_err_t gpio_exp_set_level(int gpio, int level, bool direct, gpio_exp_t *expan
 		xSemaphoreGive(expander->mutex);
 		ESP_LOGD(TAG, "Set level %x for GPIO %u => wrote %x", level, expander->first + gpio, expander->shadow);
 	} else {
-		queue_request_t request = { .gpio = gpio, .level = level, .type = ASYNC_WRITE, .expander = expander };
-		if (xQueueSend(message_queue, &request, 0) == pdFALSE) return ESP_ERR_INVALID_RESPONSE;
+		// stage level, all staged pins of an expander will be written at once
+		portENTER_CRITICAL(&staged_mux);
+		expander->staged_mask |= mask;
+		expander->staged_level = (expander->staged_level & ~mask) | (level ? mask : 0);
+		portEXIT_CRITICAL(&staged_mux);
 
 		// notify service task that will write it when it can
-		xTaskNotify(service_task, GPIO_EXP_WRITE, eSetValueWithoutOverwrite);
+		__atomic_fetch_or(&write_pending, 1 << (expander - expanders), __ATOMIC_RELEASE);
+		xTaskNotify(service_task, GPIO_EXP_WRITE, eSetBits);
 	} 
 
 	return ESP_OK;
@@ -410,9 +425,9 @@ static void IRAM_ATTR intr_isr_handler(void* arg) {
 	gpio_intr_disable(self->intr);	
 	
 	// activate all, including ourselves
-	for (int i = 0; i < n_expanders; i++) if (expanders[i].intr == self->intr) expanders[i].intr_pending = true; 
+	__atomic_fetch_or(&intr_pending, self->intr_peers, __ATOMIC_RELEASE);
 	
-	xTaskNotifyFromISR(service_task, GPIO_EXP_INTR, eSetValueWithOverwrite, &woken);
+	xTaskNotifyFromISR(service_task, GPIO_EXP_INTR, eSetBits, &woken);
 	if (woken) portYIELD_FROM_ISR();
 
 	ESP_EARLY_LOGD(TAG, "INTR for expander base %d", gpio_exp_get_base(self));
@@ -431,19 +446,17 @@ static void debounce_handler( TimerHandle_t xTimer ) {
  */
 void service_handler(void *arg) {
 	while (1) {
-		queue_request_t request;
 		uint32_t notif = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
 		// we have been notified of an interrupt
-		if (notif == GPIO_EXP_INTR) {
-			/* If we want a smarter bitmap of expanders with a pending interrupt
-			   we'll have to disable interrupts while clearing that bitmap. For 
-			   now, a loop will do */
-			for (int i = 0; i < n_expanders; i++) {
+		if (notif & GPIO_EXP_INTR) {
+			// ISR can set bits again as soon as we have taken them
+			uint32_t bitmap = __atomic_exchange_n(&intr_pending, 0, __ATOMIC_ACQUIRE);
+
+			for (int i = 0; bitmap; i++, bitmap >>= 1) {
 				gpio_exp_t *expander = expanders + i;
 
-				// no interrupt for that gpio or not pending (safe as interrupt is disabled)
-				if (expander->intr < 0 || !expander->intr_pending) continue;
+				if (!(bitmap & 0x01)) continue;
 
 				xSemaphoreTake(expander->mutex, pdMS_TO_TICKS(50));
 
@@ -452,7 +465,6 @@ void service_handler(void *arg) {
 				expander->age = xTaskGetTickCount();
 				
 				// re-enable interrupt now that it has been cleared
-				expander->intr_pending = false;
 				gpio_intr_enable(expander->intr);				
 				
 				uint32_t pending = expander->pending | ((expander->shadow ^ value) & expander->r_mask);
@@ -471,10 +483,42 @@ void service_handler(void *arg) {
 			}
 		}
 
-		// check if we have some other pending requests
-		while (xQueueReceive(message_queue, &request, 0) == pdTRUE) {
-			esp_err_t err = gpio_exp_set_level(request.gpio, request.level, true, request.expander);
-			if (err != ESP_OK) ESP_LOGW(TAG, "Can't execute async GPIO %d write request (%d)", request.gpio, err);  
+		// write all staged levels of each expander in a single transaction
+		if (notif & GPIO_EXP_WRITE) {
+			uint32_t bitmap = __atomic_exchange_n(&write_pending, 0, __ATOMIC_ACQUIRE);
+
+			for (int i = 0; bitmap; i++, bitmap >>= 1) {
+				gpio_exp_t *expander = expanders + i;
+				uint32_t mask, level;
+
+				if (!(bitmap & 0x01)) continue;
+
+				portENTER_CRITICAL(&staged_mux);
+				mask = expander->staged_mask;
+				level = expander->staged_level & mask;
+				expander->staged_mask = 0;
+				portEXIT_CRITICAL(&staged_mux);
+
+				// put levels back unless staged again meanwhile, next request will retry
+				if (xSemaphoreTake(expander->mutex, portMAX_DELAY) == pdFALSE) {
+					portENTER_CRITICAL(&staged_mux);
+					expander->staged_level = (expander->staged_level & expander->staged_mask) | (level & ~expander->staged_mask);
+					expander->staged_mask |= mask;
+					portEXIT_CRITICAL(&staged_mux);
+					__atomic_fetch_or(&write_pending, 1 << i, __ATOMIC_RELEASE);
+					ESP_LOGW(TAG, "Can't get mutex for expander %u", expander->first);
+					continue;
+				}
+
+				// only write if shadow not up to date
+				if (((expander->shadow & mask) ^ level) && expander->model->write) {
+					expander->shadow = (expander->shadow & ~mask) | level;
+					expander->model->write(expander);
+				}
+
+				xSemaphoreGive(expander->mutex);
+				ESP_LOGD(TAG, "Set levels %x (mask %x) for expander %u => wrote %x", level, mask, expander->first, expander->shadow);
+			}
 		}
 	}
 }
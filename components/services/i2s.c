@@ -1211,6 +1211,43 @@ esp_err_t i2s_write(i2s_port_t i2s_num, const void *src, size_t size, size_t *by
     return ESP_OK;
 }
 
+/*
+ * Borrow the free part of the current DMA buffer (waiting for a new one if needed) so
+ * that caller can write samples directly into it, then give back with i2s_dma_commit()
+ * what has been written. There must be no other writer between borrow and commit
+ */
+esp_err_t i2s_dma_borrow(i2s_port_t i2s_num, void **ptr, size_t *size, TickType_t ticks_to_wait)
+{
+    *size = 0;
+    I2S_CHECK((i2s_num < I2S_NUM_MAX), "i2s_num error", ESP_ERR_INVALID_ARG);
+    I2S_CHECK((p_i2s_obj[i2s_num]->tx), "tx NULL", ESP_ERR_INVALID_ARG);
+    i2s_dma_t *tx = p_i2s_obj[i2s_num]->tx;
+    xSemaphoreTake(tx->mux, (portTickType)portMAX_DELAY);
+    if (tx->rw_pos == tx->buf_size || tx->curr_ptr == NULL) {
+        if (xQueueReceive(tx->queue, &tx->curr_ptr, ticks_to_wait) == pdFALSE) {
+            xSemaphoreGive(tx->mux);
+            return ESP_ERR_TIMEOUT;
+        }
+        tx->rw_pos = 0;
+    }
+    *ptr = (char*)tx->curr_ptr + tx->rw_pos;
+    *size = tx->buf_size - tx->rw_pos;
+    xSemaphoreGive(tx->mux);
+    return ESP_OK;
+}
+
+esp_err_t i2s_dma_commit(i2s_port_t i2s_num, size_t size)
+{
+    I2S_CHECK((i2s_num < I2S_NUM_MAX), "i2s_num error", ESP_ERR_INVALID_ARG);
+    I2S_CHECK((p_i2s_obj[i2s_num]->tx), "tx NULL", ESP_ERR_INVALID_ARG);
+    i2s_dma_t *tx = p_i2s_obj[i2s_num]->tx;
+    I2S_CHECK((tx->curr_ptr && size <= tx->buf_size - tx->rw_pos), "commit beyond borrowed buffer", ESP_ERR_INVALID_SIZE);
+    xSemaphoreTake(tx->mux, (portTickType)portMAX_DELAY);
+    tx->rw_pos += size;
+    xSemaphoreGive(tx->mux);
+    return ESP_OK;
+}
+
 esp_err_t i2s_adc_enable(i2s_port_t i2s_num)
 {
     I2S_CHECK((i2s_num < I2S_NUM_MAX), "i2s_num error", ESP_ERR_INVALID_ARG);
@@ -1232,11 +1269,62 @@ esp_err_t i2s_adc_disable(i2s_port_t i2s_num)
     return ESP_OK;
 }
 
+/*
+ * Expand samples from src_bytes to aim_bytes, sample bits are left-justified and
+ * lower bytes are zeroed. Common cases are done a word at a time (there is no SIMD
+ * on ESP32) when buffers are aligned, so that the DMA buffer is only written once.
+ * Not static so that unit tests can check it against the plain byte loop
+ */
+void i2s_expand_samples(char *dst, const char *src, int samples, int src_bytes, int aim_bytes)
+{
+    if (src_bytes == 2 && aim_bytes == 4 && !((uintptr_t) src & 0x03) && !((uintptr_t) dst & 0x03)) {
+        const uint32_t *in = (const uint32_t*) src;
+        uint32_t *out = (uint32_t*) dst;
+        for (; samples >= 2; samples -= 2, in++) {
+            uint32_t w = *in;
+            *out++ = w << 16;
+            *out++ = w & 0xffff0000;
+        }
+        if (samples) *out = (uint32_t) *(const uint16_t*) in << 16;
+        return;
+    }
+
+    if (src_bytes == 2 && aim_bytes == 3 && !((uintptr_t) src & 0x01) && !((uintptr_t) dst & 0x03)) {
+        const uint16_t *in = (const uint16_t*) src;
+        uint32_t *out = (uint32_t*) dst;
+        for (; samples >= 4; samples -= 4, in += 4) {
+            *out++ = (uint32_t) in[0] << 8;
+            *out++ = in[1] | ((uint32_t) in[2] << 24);
+            *out++ = (in[2] >> 8) | ((uint32_t) in[3] << 16);
+        }
+        src = (const char*) in;
+        dst = (char*) out;
+    } else if (src_bytes == 3 && aim_bytes == 4 && !((uintptr_t) src & 0x03) && !((uintptr_t) dst & 0x03)) {
+        const uint32_t *in = (const uint32_t*) src;
+        uint32_t *out = (uint32_t*) dst;
+        for (; samples >= 4; samples -= 4, in += 3) {
+            *out++ = in[0] << 8;
+            *out++ = ((in[0] >> 16) & 0xff00) | (in[1] << 16);
+            *out++ = ((in[1] >> 8) & 0xffff00) | (in[2] << 24);
+            *out++ = in[2] & 0xffffff00;
+        }
+        src = (const char*) in;
+        dst = (char*) out;
+    }
+
+    // generic case and leftovers
+    for (; samples > 0; samples--) {
+        int i = 0;
+        for (; i < aim_bytes - src_bytes; i++) *dst++ = 0;
+        for (; i < aim_bytes; i++) *dst++ = *src++;
+    }
+}
+
 esp_err_t i2s_write_expand(i2s_port_t i2s_num, const void *src, size_t size, size_t src_bits, size_t aim_bits, size_t *bytes_written, TickType_t ticks_to_wait)
 {
     char *data_ptr;
     int bytes_can_write, tail;
-    int src_bytes, aim_bytes, zero_bytes;
+    int src_bytes, aim_bytes;
     *bytes_written = 0;
     I2S_CHECK((i2s_num < I2S_NUM_MAX), "i2s_num error", ESP_ERR_INVALID_ARG);
     I2S_CHECK((size > 0), "size must greater than zero", ESP_ERR_INVALID_ARG);
@@ -1262,7 +1350,6 @@ esp_err_t i2s_write_expand(i2s_port_t i2s_num, const void *src, size_t size, siz
 
     src_bytes = src_bits / 8;
     aim_bytes = aim_bits / 8;
-    zero_bytes = aim_bytes - src_bytes;
     xSemaphoreTake(p_i2s_obj[i2s_num]->tx->mux, (portTickType)portMAX_DELAY);
     size = size * aim_bytes / src_bytes;
     ESP_LOGD(I2S_TAG,"aim_bytes %d src_bytes %d size %d", aim_bytes, src_bytes, size);
@@ -1282,12 +1369,8 @@ esp_err_t i2s_write_expand(i2s_port_t i2s_num, const void *src, size_t size, siz
         tail = bytes_can_write % aim_bytes;
         bytes_can_write = bytes_can_write - tail;
 
-        memset(data_ptr, 0, bytes_can_write);
-        for (int j = 0; j < bytes_can_write; j += (aim_bytes - zero_bytes)) {
-            j += zero_bytes;
-            memcpy(&data_ptr[j], (const char *)(src + *bytes_written), aim_bytes - zero_bytes);
-            (*bytes_written) += (aim_bytes - zero_bytes);
-        }
+        i2s_expand_samples(data_ptr, (const char *)src + *bytes_written, bytes_can_write / aim_bytes, src_bytes, aim_bytes);
+        (*bytes_written) += bytes_can_write / aim_bytes * src_bytes;
         size -= bytes_can_write;
         p_i2s_obj[i2s_num]->tx->rw_pos += bytes_can_write;
     }
@@ -24,10 +24,35 @@ typedef struct {
 	struct messaging_list_t * next;
 	char * subscriber_name;
 	size_t max_count;
-	RingbufHandle_t buf_handle;
+	uint32_t next_seq;
 } messaging_list_t;
-static messaging_list_t top;
+
+/*
+ * All messages live once in a shared arena where they are formatted in place. Records are
+ * contiguous and in posting order, so a message is identified by its sequence number and 
+ * subscribers only hold the sequence of the next message they have not read yet. When room 
+ * is needed, the oldest record is dropped by moving the head forward, which is O(1). When a 
+ * record does not fit before the end of the storage, writing wraps to the beginning and the 
+ * end of valid data is remembered in "wrap".
+ */
+static struct {
+	uint8_t * storage;
+	size_t size;
+	size_t head, tail, wrap;
+	bool wrapped;
+	uint32_t first_seq, next_seq;
+	SemaphoreHandle_t mutex;
+} arena;
+static messaging_list_t * subscribers;
 #define MSG_LENGTH_AVG 1024
+#define MSG_COUNT_MAX 15
+// messages are stored at their exact size, only longer ones are truncated (must be above monitor's STATS_SIZE)
+#define MSG_LENGTH_MAX 8192
+// records must start aligned for their header, or Xtensa raises an alignment exception
+#define MSG_RECORD_ALIGN(n) (((n) + __alignof__(single_message_t) - 1) & ~(__alignof__(single_message_t) - 1))
+#define MSG_RECORD_SIZE(m) MSG_RECORD_ALIGN((m)->msg_size)
+#define MSG_ARENA_SIZE ((sizeof(single_message_t)+MSG_LENGTH_AVG+4)*MSG_COUNT_MAX)
+_Static_assert(MSG_ARENA_SIZE >= MSG_RECORD_ALIGN(sizeof(single_message_t)+MSG_LENGTH_MAX+1), "arena can't hold largest message");
 
 messaging_list_t * get_struct_ptr(messaging_handle_t handle){
 	return (messaging_list_t *)handle;
@@ -36,70 +61,85 @@ messaging_handle_t  get_handle_ptr(messaging_list_t * handle){
 	return (messaging_handle_t )handle;
 }
 
-RingbufHandle_t messaging_create_ring_buffer(uint8_t max_count){
-	RingbufHandle_t buf_handle = NULL;
-	StaticRingbuffer_t *buffer_struct = malloc(sizeof(StaticRingbuffer_t));
-	if (buffer_struct != NULL) {
-		size_t buf_size = (size_t )(sizeof(single_message_t)+8+MSG_LENGTH_AVG)*(size_t )(max_count>0?max_count:5); // no-split buffer requires an additional 8 bytes
-		buf_size = buf_size - (buf_size % 4);
-		uint8_t *buffer_storage = (uint8_t *)heap_caps_malloc(buf_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
-		if (buffer_storage== NULL) {
-			ESP_LOGE(tag,"buff alloc failed");
+static void arena_drop_oldest(){
+	single_message_t * message = (single_message_t *)(arena.storage + arena.head);
+	arena.head += MSG_RECORD_SIZE(message);
+	arena.first_seq++;
+	if(arena.wrapped && arena.head >= arena.wrap){
+		arena.head = 0;
+		arena.wrapped = false;
+	}
+}
+static single_message_t * arena_reserve(size_t needed){
+	while(1){
+		if(arena.first_seq == arena.next_seq){
+			arena.head = arena.tail = 0;
+			arena.wrapped = false;
+		}
+		if(!arena.wrapped){
+			if(arena.size - arena.tail >= needed) break;
+			arena.wrap = arena.tail;
+			arena.tail = 0;
+			arena.wrapped = true;
+		}
+		else if(arena.head - arena.tail >= needed) {
+			break;
 		}
 		else {
-			buf_handle = xRingbufferCreateStatic(buf_size, RINGBUF_TYPE_NOSPLIT, buffer_storage, buffer_struct);
+			arena_drop_oldest();
 		}
 	}
-	else {
-		ESP_LOGE(tag,"ringbuf alloc failed");
+	return (single_message_t *)(arena.storage + arena.tail);
+}
+static void arena_commit(single_message_t * message){
+	arena.tail += MSG_RECORD_SIZE(message);
+	arena.next_seq++;
+	// keep history within limits
+	if(arena.next_seq - arena.first_seq > MSG_COUNT_MAX){
+		arena_drop_oldest();
 	}
-	return buf_handle;
 }
-void messaging_fill_messages(messaging_list_t * target_subscriber){
-	single_message_t * message=NULL;
-    UBaseType_t uxItemsWaiting;
-
-    vRingbufferGetInfo(top.buf_handle, NULL, NULL, NULL, NULL, &uxItemsWaiting);
-    for(size_t i=0;i<uxItemsWaiting;i++){
-    	message= messaging_retrieve_message(top.buf_handle);
-    	if(message){
-			//re-post to original queue so it is available to future subscribers
-			messaging_post_to_queue(get_handle_ptr(&top), message, message->msg_size);
-			// post to new subscriber
-			messaging_post_to_queue(get_handle_ptr(target_subscriber) , message, message->msg_size);
-			FREE_AND_NULL(message);
-    	}
-    }
+static single_message_t * arena_get(uint32_t seq){
+	size_t pos = arena.head;
+	for(uint32_t i=arena.first_seq;i<seq;i++){
+		pos += MSG_RECORD_SIZE((single_message_t *)(arena.storage + pos));
+		if(arena.wrapped && pos >= arena.wrap) pos = 0;
+	}
+	return (single_message_t *)(arena.storage + pos);
 }
+// first message a subscriber should get, considering what has been dropped and its own depth
+static uint32_t arena_first_for(messaging_list_t * subscriber){
+	uint32_t seq = subscriber->next_seq;
+	if((int32_t)(seq - arena.first_seq) < 0) seq = arena.first_seq;
+	if(subscriber->max_count && arena.next_seq - seq > subscriber->max_count) seq = arena.next_seq - subscriber->max_count;
+	return seq;
+}
+
 messaging_handle_t messaging_register_subscriber(uint8_t max_count, char * name){
-	messaging_list_t * cur=&top;
-	while(cur->next){
-		cur = get_struct_ptr(cur->next);
-	}
-	cur->next=heap_caps_malloc(sizeof(messaging_list_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-	if(!cur->next){
+	messaging_list_t * subscriber = heap_caps_malloc(sizeof(messaging_list_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if(!subscriber || !arena.mutex){
 		ESP_LOGE(tag,"subscriber alloc failed");
+		FREE_AND_NULL(subscriber);
 		return NULL;
 	}
-	memset(cur->next,0x00,sizeof(messaging_list_t));
-	cur = get_struct_ptr(cur->next);
-	cur->max_count=max_count;
-	cur->subscriber_name=strdup(name);
-	cur->buf_handle = messaging_create_ring_buffer(max_count);
-	if(cur->buf_handle){
-		messaging_fill_messages(cur);
-	}
-	return cur->buf_handle;
+	memset(subscriber,0x00,sizeof(messaging_list_t));
+	subscriber->max_count=max_count;
+	subscriber->subscriber_name=strdup(name);
+	xSemaphoreTake(arena.mutex, portMAX_DELAY);
+	// new subscribers get the history that is still available
+	subscriber->next_seq = arena.first_seq;
+	subscriber->next = (struct messaging_list_t *)subscribers;
+	subscribers = subscriber;
+	xSemaphoreGive(arena.mutex);
+	return get_handle_ptr(subscriber);
 }
 void messaging_service_init(){
-	size_t max_count=15;
-	top.buf_handle = messaging_create_ring_buffer(max_count);
-	if(!top.buf_handle){
+	arena.size = MSG_ARENA_SIZE;
+	arena.storage = (uint8_t *)heap_caps_malloc(arena.size, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+	arena.mutex = xSemaphoreCreateMutex();
+	if(!arena.storage || !arena.mutex){
 		ESP_LOGE(tag, "messaging service init failed.");
-	}
-	else {
-		top.max_count = max_count;
-		top.subscriber_name = strdup("messaging");
+		FREE_AND_NULL(arena.storage);
 	}
 	return;
 }
@@ -127,84 +167,53 @@ const char * messaging_get_class_desc(messaging_classes msg_class){
 	}
 }
 
-cJSON *  messaging_retrieve_messages(RingbufHandle_t buf_handle){
+cJSON *  messaging_retrieve_messages(messaging_handle_t subscriber_handle){
+	messaging_list_t * subscriber=get_struct_ptr(subscriber_handle);
 	single_message_t * message=NULL;
 	cJSON * json_messages=cJSON_CreateArray();
 	cJSON * json_message=NULL;
-	size_t item_size;
-    UBaseType_t uxItemsWaiting;
-    vRingbufferGetInfo(buf_handle, NULL, NULL, NULL, NULL, &uxItemsWaiting);
-	for(int i = 0;i<uxItemsWaiting;i++){
-		message = (single_message_t *)xRingbufferReceive(buf_handle, &item_size, pdMS_TO_TICKS(50));
-		//Check received data
-		if (message== NULL) {
-			ESP_LOGE(tag,"received null ptr");
-		}
-		else {
-			json_message = cJSON_CreateObject();
-			cJSON_AddStringToObject(json_message, "message", message->message);
-			cJSON_AddStringToObject(json_message, "type", messaging_get_type_desc(message->type));
-			cJSON_AddStringToObject(json_message, "class", messaging_get_class_desc(message->msg_class));
-			cJSON_AddNumberToObject(json_message,"sent_time",message->sent_time);
-			cJSON_AddNumberToObject(json_message,"current_time",esp_timer_get_time() / 1000);
-			cJSON_AddItemToArray(json_messages,json_message);
-			vRingbufferReturnItem(buf_handle, (void *)message);
-		}
+	if(!subscriber || !arena.storage) {
+		return json_messages;
 	}
+	xSemaphoreTake(arena.mutex, portMAX_DELAY);
+	uint32_t seq = arena_first_for(subscriber);
+	if(seq != arena.next_seq) message = arena_get(seq);
+	for(;seq != arena.next_seq;seq++){
+		json_message = cJSON_CreateObject();
+		cJSON_AddStringToObject(json_message, "message", message->message);
+		cJSON_AddStringToObject(json_message, "type", messaging_get_type_desc(message->type));
+		cJSON_AddStringToObject(json_message, "class", messaging_get_class_desc(message->msg_class));
+		cJSON_AddNumberToObject(json_message,"sent_time",message->sent_time);
+		cJSON_AddNumberToObject(json_message,"current_time",esp_timer_get_time() / 1000);
+		cJSON_AddItemToArray(json_messages,json_message);
+		size_t pos = (uint8_t *)message - arena.storage + MSG_RECORD_SIZE(message);
+		if(arena.wrapped && pos >= arena.wrap) pos = 0;
+		message = (single_message_t *)(arena.storage + pos);
+	}
+	subscriber->next_seq = arena.next_seq;
+	xSemaphoreGive(arena.mutex);
 	return json_messages;
 }
-single_message_t *  messaging_retrieve_message(RingbufHandle_t buf_handle){
-	single_message_t * message=NULL;
+single_message_t *  messaging_retrieve_message(messaging_handle_t subscriber_handle){
+	messaging_list_t * subscriber=get_struct_ptr(subscriber_handle);
 	single_message_t * message_copy=NULL;
-	size_t item_size;
-    UBaseType_t uxItemsWaiting;
-    vRingbufferGetInfo(buf_handle, NULL, NULL, NULL, NULL, &uxItemsWaiting);
-	if(uxItemsWaiting>0){
-		message = (single_message_t *)xRingbufferReceive(buf_handle, &item_size, pdMS_TO_TICKS(50));
-		message_copy  = heap_caps_malloc(item_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if(!subscriber || !arena.storage) {
+		return NULL;
+	}
+	xSemaphoreTake(arena.mutex, portMAX_DELAY);
+	uint32_t seq = arena_first_for(subscriber);
+	if(seq != arena.next_seq){
+		single_message_t * message = arena_get(seq);
+		message_copy  = heap_caps_malloc(message->msg_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
 		if(message_copy){
-			memcpy(message_copy,message,item_size);
+			memcpy(message_copy,message,message->msg_size);
 		}
-		vRingbufferReturnItem(buf_handle, (void *)message);
+		subscriber->next_seq = seq + 1;
 	}
+	xSemaphoreGive(arena.mutex);
 	return message_copy;
 }
 
-esp_err_t messaging_post_to_queue(messaging_handle_t subscriber_handle, single_message_t * message, size_t message_size){
-	size_t item_size=0;
-	messaging_list_t * subscriber=get_struct_ptr(subscriber_handle);
-	if(!subscriber->buf_handle){
-		ESP_LOGE(tag,"post failed: null buffer for %s", str_or_unknown(subscriber->subscriber_name));
-		return ESP_FAIL;
-	}
-	void * pItem=NULL;
-	UBaseType_t res=pdFALSE;
-	while(1){
-		ESP_LOGD(tag,"Attempting to reserve %d bytes for %s",message_size, str_or_unknown(subscriber->subscriber_name));
-		res =  xRingbufferSendAcquire(subscriber->buf_handle, &pItem, message_size, pdMS_TO_TICKS(50));
-		if(res == pdTRUE && pItem){
-			ESP_LOGD(tag,"Reserving complete for %s", str_or_unknown(subscriber->subscriber_name));
-			memcpy(pItem,message,message_size);
-			xRingbufferSendComplete(subscriber->buf_handle, pItem);
-			break;
-		}
-		ESP_LOGD(tag,"Dropping for %s",str_or_unknown(subscriber->subscriber_name));
-		single_message_t * dummy = (single_message_t *)xRingbufferReceive(subscriber->buf_handle, &item_size, pdMS_TO_TICKS(50));
-		if (dummy== NULL) {
-			ESP_LOGE(tag,"Dropping message failed");
-			break;
-		}
-		else {
-			ESP_LOGD(tag,"Dropping message of %d bytes for %s",item_size, str_or_unknown(subscriber->subscriber_name));
-			vRingbufferReturnItem(subscriber->buf_handle, (void *)dummy);
-		}
-	}
-	if (res != pdTRUE) {
-		ESP_LOGE(tag,"post to %s failed",str_or_unknown(subscriber->subscriber_name));
-		return ESP_FAIL;
-	}
-	return ESP_OK;
-}
 	esp_err_t messaging_type_to_err_type(messaging_types type){
 		switch (type) {
 		case MESSAGING_INFO:
@@ -222,63 +231,62 @@ esp_err_t messaging_post_to_queue(messaging_handle_t subscriber_handle, single_m
 		}
 		return ESP_LOG_DEBUG;
 	}
+/* 
+ * Format message directly in the arena at its exact size, with an optional prefix line, and 
+ * optionally log it. Logging is done from the arena record, before releasing it, so that no 
+ * copy is needed: log output never posts messages (telnet only appends to its own ring) 
+ */
+static void messaging_post_va(messaging_types type,messaging_classes msg_class, bool log, const char * prefix, const char *fmt, va_list va){
+	size_t ln = prefix ? strlen(prefix) + 1 : 0;
+	uint32_t dropped;
+	va_list measure;
+	int body;
+	if(!arena.storage){
+		ESP_LOGE(tag,"post failed: messaging not initialized");
+		return;
+	}
+	va_copy(measure, va);
+	body = vsnprintf(NULL, 0, fmt, measure);
+	va_end(measure);
+	if(body > 0) ln += body;
+	if(ln > MSG_LENGTH_MAX){
+		ESP_LOGW(tag,"Message of %u bytes truncated to %u", ln, MSG_LENGTH_MAX);
+		ln = MSG_LENGTH_MAX;
+	}
+	xSemaphoreTake(arena.mutex, portMAX_DELAY);
+	dropped = arena.first_seq;
+	single_message_t * message = arena_reserve(MSG_RECORD_ALIGN(sizeof(single_message_t)+ln+1));
+	size_t pos = 0;
+	if(prefix){
+		pos = snprintf(message->message, ln + 1, "%s\n", prefix);
+		if(pos > ln) pos = ln;
+	}
+	vsnprintf(message->message + pos, ln + 1 - pos, fmt, va);
+	message->msg_size = sizeof(single_message_t)+ln+1;
+	message->type = type;
+	message->msg_class = msg_class;
+	message->sent_time = esp_timer_get_time() / 1000;
+	if(log) ESP_LOG_LEVEL_LOCAL(messaging_type_to_err_type(type),tag, "%s",message->message);
+	arena_commit(message);
+	dropped = arena.first_seq - dropped;
+	xSemaphoreGive(arena.mutex);
+	if(dropped) ESP_LOGD(tag,"Dropped %u oldest message(s) for %u bytes", dropped, ln);
+}
 void messaging_post_message(messaging_types type,messaging_classes msg_class, const char *fmt, ...){
-	single_message_t * message=NULL;
-	size_t msg_size=0;
-	size_t ln =0;
-	messaging_list_t * cur=&top;
 	va_list va;
 	va_start(va, fmt);
-	ln = vsnprintf(NULL, 0, fmt, va)+1;
-	msg_size = sizeof(single_message_t)+ln;
-	message = (single_message_t *)heap_caps_malloc(msg_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-	vsprintf(message->message, fmt, va);
+	messaging_post_va(type, msg_class, false, NULL, fmt, va);
 	va_end(va);
-	message->msg_size = msg_size;
-	message->type = type;
-	message->msg_class = msg_class;
-	message->sent_time = esp_timer_get_time() / 1000;
-	ESP_LOGD(tag,"Post: %s",message->message);
-	while(cur){
-		messaging_post_to_queue(get_handle_ptr(cur),  message, msg_size);
-		cur = get_struct_ptr(cur->next);
-	}
-	FREE_AND_NULL(message);
-	return;
-
 }
 void log_send_messaging(messaging_types msgtype,const char *fmt, ...) {
 	va_list va;
 	va_start(va, fmt);
-	size_t ln = vsnprintf(NULL, 0, fmt, va)+1;
-	char * message_txt = malloc(ln);
-	if(message_txt){
-		vsprintf(message_txt, fmt, va);
-		va_end(va);
-		ESP_LOG_LEVEL_LOCAL(messaging_type_to_err_type(msgtype),tag, "%s",message_txt);
-		messaging_post_message(msgtype, MESSAGING_CLASS_SYSTEM, message_txt );
-		free(message_txt);
-	}
-	else{
-		ESP_LOGE(tag, "Memory allocation failed while sending message");
-	}
+	messaging_post_va(msgtype, MESSAGING_CLASS_SYSTEM, true, NULL, fmt, va);
+	va_end(va);
 }
 void cmd_send_messaging(const char * cmdname,messaging_types msgtype, const char *fmt, ...){
 	va_list va;
 	va_start(va, fmt);
-	size_t cmd_len = strlen(cmdname)+1;
-	size_t ln = vsnprintf(NULL, 0, fmt, va)+1;
-	char * message_txt = malloc(ln+cmd_len);
-	if(message_txt){
-		strcpy(message_txt,cmdname);
-		strcat(message_txt,"\n");
-		vsprintf((message_txt+cmd_len), fmt, va);
-		va_end(va);
-		ESP_LOG_LEVEL_LOCAL(messaging_type_to_err_type(msgtype),tag, "%s",message_txt);
-		messaging_post_message(msgtype, MESSAGING_CLASS_CFGCMD, message_txt );
-		free(message_txt);
-	}
-	else{
-		ESP_LOGE(tag, "Memory allocation failed while sending message");
-	}
+	messaging_post_va(msgtype, MESSAGING_CLASS_CFGCMD, true, cmdname, fmt, va);
+	va_end(va);
 }
@@ -1,6 +1,7 @@
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/ringbuf.h"
+#include "freertos/semphr.h"
 #include "cJSON.h"
 #pragma once
 typedef enum {
@@ -26,12 +27,10 @@ typedef struct {
 	char message[];
 } single_message_t;
 
-cJSON *  messaging_retrieve_messages(RingbufHandle_t buf_handle);
 messaging_handle_t messaging_register_subscriber(uint8_t max_count, char * name);
-esp_err_t messaging_post_to_queue(messaging_handle_t subscriber_handle, single_message_t * message, size_t message_size);
 void messaging_post_message(messaging_types type,messaging_classes msg_class, const char * fmt, ...);
-cJSON *  messaging_retrieve_messages(RingbufHandle_t buf_handle);
-single_message_t *  messaging_retrieve_message(RingbufHandle_t buf_handle);
+cJSON *  messaging_retrieve_messages(messaging_handle_t subscriber_handle);
+single_message_t *  messaging_retrieve_message(messaging_handle_t subscriber_handle);
 void log_send_messaging(messaging_types msgtype,const char *fmt, ...);
 void cmd_send_messaging(const char * cmdname,messaging_types msgtype, const char *fmt, ...);
 esp_err_t messaging_type_to_err_type(messaging_types type);
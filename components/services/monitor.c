@@ -12,6 +12,8 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "monitor.h"
@@ -22,15 +24,21 @@
 #include "platform_config.h"
 #include "accessors.h"
 #include "messaging.h"
-#include "cJSON.h"
+#include "json_writer.h"
 #include "trace.h"
 
 #define MONITOR_TIMER	(10*1000)
+#define MONITOR_HISTORY	10
+// room for tasks created between counting and listing them
+#define TASK_HEADROOM	4
 #define SCRATCH_SIZE	256
+#define STATS_SIZE		4096
 
 static const char *TAG = "monitor";
 
 static TimerHandle_t monitor_timer;
+// stats message is posted every that many samples, whatever the sampling rate
+static int report_every = 1;
 
 static monitor_gpio_t jack = { CONFIG_JACK_GPIO, 0 };
 static monitor_gpio_t spkfault = { CONFIG_SPKFAULT_GPIO, 0 };
@@ -43,102 +51,227 @@ bool spkfault_svc(void);
 
 
 /****************************************************************************************
- * 
+ * Telemetry: every sample (global heap + per-task cpu/stack) goes into a ring that is 
+ * allocated once, tasks are matched to the previous sample through a small hash on 
+ * their number. The ring can be dumped as CSV, and every few samples the last one is 
+ * also sent as message. Slots (and their names) are only touched under the mutex
  */
-static void task_stats( cJSON* top ) {
 #ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY 
 #pragma message("Compiled with trace facility")
-	static struct {
-		TaskStatus_t *tasks;
-		uint32_t total, n;
-	} current, previous;
-	cJSON * tlist=cJSON_CreateArray();
-	current.n = uxTaskGetNumberOfTasks();
-	current.tasks = malloc( current.n * sizeof( TaskStatus_t ) );
-	current.n = uxTaskGetSystemState( current.tasks, current.n, &current.total );
-	cJSON_AddNumberToObject(top,"ntasks",current.n);
+#define TASK_SLOTS	(MONITOR_MAX_TASKS * 2)
+
+static struct {
+	struct {
+		UBaseType_t number;
+		uint32_t runtime, seen;
+		char name[configMAX_TASK_NAME_LEN];
+	} slots[TASK_SLOTS];
+	TaskStatus_t *status;
+	size_t capacity;
+	uint32_t total, sequence;
+	monitor_sample_t *samples;
+	size_t size, head, count;
+	SemaphoreHandle_t mutex;
+} telemetry;
+
+static int task_slot(TaskStatus_t *task) {
+	int i = task->xTaskNumber % TASK_SLOTS, spare = -1;
 	
+	for (int n = 0; n < TASK_SLOTS; n++, i = (i + 1) % TASK_SLOTS) {
+		if (telemetry.slots[i].number == task->xTaskNumber) break;
+		// slot of a task gone for longer than history can be recycled, but it stays in the chain
+		if (spare < 0 && telemetry.sequence - telemetry.slots[i].seen > telemetry.size + 1) spare = i;
+		if (!telemetry.slots[i].number) {
+			if (spare < 0) spare = i;
+			i = -1;
+			break;
+		}	
+	}
+	
+	if (i < 0 || telemetry.slots[i].number != task->xTaskNumber) {
+		if ((i = spare) < 0) return -1;
+		telemetry.slots[i].number = task->xTaskNumber;
+		telemetry.slots[i].runtime = 0;
+		strlcpy(telemetry.slots[i].name, task->pcTaskName, configMAX_TASK_NAME_LEN);
+	}
+	
+	telemetry.slots[i].seen = telemetry.sequence;
+	return i;
+}
+
+static void task_stats(json_writer_t* w, bool report) {
+	uint32_t total;
+	size_t needed = uxTaskGetNumberOfTasks() + TASK_HEADROOM;
+	monitor_sample_t *sample = NULL;
 	static EXT_RAM_ATTR char scratch[SCRATCH_SIZE];
-	*scratch = '\0';
+	
+	// status array follows the number of tasks, it only grows
+	if (needed > telemetry.capacity) {
+		TaskStatus_t *status = heap_caps_realloc(telemetry.status, needed * sizeof(TaskStatus_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+		if (!status) status = realloc(telemetry.status, needed * sizeof(TaskStatus_t));
+		if (!status) {
+			ESP_LOGW(TAG, "Can't allocate status for %zu tasks, no stats", needed);
+			return;
+		}	
+		telemetry.status = status;
+		telemetry.capacity = needed;
+	}	
+	
+	int n = uxTaskGetSystemState(telemetry.status, telemetry.capacity, &total);
+	uint32_t elapsed = total - telemetry.total;
+	
+	if (!n) {
+		ESP_LOGW(TAG, "More than %zu tasks, no stats", telemetry.capacity);
+		return;
+	}	
+	
+	if (telemetry.mutex) xSemaphoreTake(telemetry.mutex, portMAX_DELAY);
 
-#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
-#pragma message("Compiled with runtime stats")
-	uint32_t elapsed = current.total - previous.total;
-    
-	for(int i = 0, n = 0; i < current.n; i++ ) {
-		for (int j = 0; j < previous.n; j++) {
-			if (current.tasks[i].xTaskNumber == previous.tasks[j].xTaskNumber) {
-				n += snprintf(scratch + n, SCRATCH_SIZE - n, "%16s (%u) %2u%% s:%5u", current.tasks[i].pcTaskName, 
-																		   current.tasks[i].eCurrentState,
-																		   100 * (current.tasks[i].ulRunTimeCounter - previous.tasks[j].ulRunTimeCounter) / elapsed, 
-																		   current.tasks[i].usStackHighWaterMark);
-				cJSON * t=cJSON_CreateObject();
-				cJSON_AddNumberToObject(t,"cpu",100 * (current.tasks[i].ulRunTimeCounter - previous.tasks[j].ulRunTimeCounter) / elapsed);
-				cJSON_AddNumberToObject(t,"minstk",current.tasks[i].usStackHighWaterMark);
-				cJSON_AddNumberToObject(t,"bprio",current.tasks[i].uxBasePriority);
-				cJSON_AddNumberToObject(t,"cprio",current.tasks[i].uxCurrentPriority);
-				cJSON_AddStringToObject(t,"nme",current.tasks[i].pcTaskName);
-				cJSON_AddNumberToObject(t,"st",current.tasks[i].eCurrentState);
-				cJSON_AddNumberToObject(t,"num",current.tasks[i].xTaskNumber);
-				cJSON_AddItemToArray(tlist,t);
-				if (i % 3 == 2 || i == current.n - 1) {
-					ESP_LOGI(TAG, "%s", scratch);
-					n = 0;
-				}	
-				break;
-			}
-		}
+	if (telemetry.samples) {
+		sample = telemetry.samples + telemetry.head;
+		sample->time = esp_timer_get_time() / 1000;
+		sample->free_iram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+		sample->free_spiram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+		sample->ntasks = 0;
 	}	
+	
+	json_writer_number(w,"ntasks",n);
+	json_writer_array_start(w,"tasks");
+	
+	for (int i = 0, len = 0; i < n; i++) {
+		TaskStatus_t *task = telemetry.status + i;
+		int slot = task_slot(task);
+		uint8_t cpu = 0;
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+		// a task that is not in previous sample has a 0 runtime reference
+		if (slot >= 0 && elapsed) cpu = 100ULL * (task->ulRunTimeCounter - telemetry.slots[slot].runtime) / elapsed;
+		if (slot >= 0) telemetry.slots[slot].runtime = task->ulRunTimeCounter;
+		len += snprintf(scratch + len, SCRATCH_SIZE - len, "%16s (%u) %2u%% s:%5u", task->pcTaskName, task->eCurrentState, cpu, task->usStackHighWaterMark);
 #else
-#pragma message("Compiled WITHOUT runtime stats")
-
-	for (int i = 0, n = 0; i < current.n; i ++) {
-		n += sprintf(scratch + n, "%16s s:%5u\t", current.tasks[i].pcTaskName, current.tasks[i].usStackHighWaterMark);
-		cJSON * t=cJSON_CreateObject();
-		cJSON_AddNumberToObject(t,"minstk",current.tasks[i].usStackHighWaterMark);
-		cJSON_AddNumberToObject(t,"bprio",current.tasks[i].uxBasePriority);
-		cJSON_AddNumberToObject(t,"cprio",current.tasks[i].uxCurrentPriority);
-		cJSON_AddStringToObject(t,"nme",current.tasks[i].pcTaskName);
-		cJSON_AddNumberToObject(t,"st",current.tasks[i].eCurrentState);
-		cJSON_AddNumberToObject(t,"num",current.tasks[i].xTaskNumber);
-		cJSON_AddItemToArray(tlist,t);
-		if (i % 3 == 2 || i == current.n - 1) {
-			ESP_LOGI(TAG, "%s", scratch);
-			n = 0;
+		len += snprintf(scratch + len, SCRATCH_SIZE - len, "%16s s:%5u\t", task->pcTaskName, task->usStackHighWaterMark);
+#endif
+		if (sample && slot >= 0 && sample->ntasks < MONITOR_MAX_TASKS) {
+			monitor_task_sample_t *entry = sample->tasks + sample->ntasks++;
+			entry->slot = slot;
+			entry->cpu = cpu;
+			entry->state = task->eCurrentState;
+			entry->stack = task->usStackHighWaterMark;
+		}	
+		
+		json_writer_object_start(w,NULL);
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+		json_writer_number(w,"cpu",cpu);
+#endif		
+		json_writer_number(w,"minstk",task->usStackHighWaterMark);
+		json_writer_number(w,"bprio",task->uxBasePriority);
+		json_writer_number(w,"cprio",task->uxCurrentPriority);
+		json_writer_string(w,"nme",task->pcTaskName);
+		json_writer_number(w,"st",task->eCurrentState);
+		json_writer_number(w,"num",task->xTaskNumber);
+		json_writer_object_end(w);
+		
+		if (i % 3 == 2 || i == n - 1) {
+			if (report) ESP_LOGI(TAG, "%s", scratch);
+			len = 0;
 		}	
 	}
-#endif	
-	cJSON_AddItemToObject(top,"tasks",tlist);
-	if (previous.tasks) free(previous.tasks);
-	previous = current;
+	
+	json_writer_array_end(w);
+	telemetry.total = total;
+	telemetry.sequence++;
+	
+	if (sample) {
+		telemetry.head = (telemetry.head + 1) % telemetry.size;
+		if (telemetry.count < telemetry.size) telemetry.count++;
+	}	
+	
+	if (telemetry.mutex) xSemaphoreGive(telemetry.mutex);
+}
+
+void telemetry_init(int rate, int history) {
+	telemetry.size = history * 60 / rate;
+	if (!telemetry.size) return;
+	telemetry.mutex = xSemaphoreCreateMutex();
+	telemetry.samples = heap_caps_malloc(telemetry.size * sizeof(monitor_sample_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if (!telemetry.samples) telemetry.samples = malloc(telemetry.size * sizeof(monitor_sample_t));
+	if (!telemetry.samples) {
+		ESP_LOGE(TAG, "Can't allocate %zu telemetry samples", telemetry.size);
+		telemetry.size = 0;
+		return;
+	}	
+	ESP_LOGI(TAG, "Telemetry every %ds for %d minutes (%zu bytes), stats every %d samples", rate, history, telemetry.size * sizeof(monitor_sample_t), report_every);
+}
+
+/****************************************************************************************
+ * 
+ */
+bool monitor_telemetry_csv(monitor_write_f write, void *ctx) {
+	char line[96];
+	bool ok;
+	
+	if (!telemetry.samples) return false;
+	
+	ok = write(ctx, line, sprintf(line, "time_ms,task,cpu,stack,state,free_iram,free_spiram\n"));
+
+	// copy each sample and its task names under lock, format it with the lock released
+	for (size_t i = 0; ok; i++) {
+		static EXT_RAM_ATTR monitor_sample_t sample;
+		static EXT_RAM_ATTR char names[MONITOR_MAX_TASKS][configMAX_TASK_NAME_LEN];
+		xSemaphoreTake(telemetry.mutex, portMAX_DELAY);
+		if (i >= telemetry.count) {
+			xSemaphoreGive(telemetry.mutex);
+			break;
+		}	
+		memcpy(&sample, telemetry.samples + (telemetry.head + telemetry.size - telemetry.count + i) % telemetry.size, sizeof(sample));
+		for (int j = 0; j < sample.ntasks; j++) memcpy(names[j], telemetry.slots[sample.tasks[j].slot].name, configMAX_TASK_NAME_LEN);
+		xSemaphoreGive(telemetry.mutex);
+		
+		for (int j = 0; j < sample.ntasks && ok; j++) {
+			monitor_task_sample_t *entry = sample.tasks + j;
+			ok = write(ctx, line, snprintf(line, sizeof(line), "%u,%s,%u,%u,%u,%u,%u\n", sample.time, names[j], 
+											entry->cpu, entry->stack, entry->state, sample.free_iram, sample.free_spiram));
+		}	
+	}
+	
+	return ok;
+}
 #else 
 #pragma message("Compiled WITHOUT trace facility")	
+static void task_stats(json_writer_t* w, bool report) { }
+void telemetry_init(int rate, int history) { }
+bool monitor_telemetry_csv(monitor_write_f write, void *ctx) { return false; }
 #endif	
-}
  
 /****************************************************************************************
  * 
  */
-static void monitor_callback(TimerHandle_t xTimer) {
-	cJSON * top=cJSON_CreateObject();
-	cJSON_AddNumberToObject(top,"free_iram",heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
-	cJSON_AddNumberToObject(top,"min_free_iram",heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
-	cJSON_AddNumberToObject(top,"free_spiram",heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
-	cJSON_AddNumberToObject(top,"min_free_spiram",heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+void monitor_callback(TimerHandle_t xTimer) {
+	// stats are written straight into a static buffer, no JSON tree nor heap copy
+	static EXT_RAM_ATTR char stats[STATS_SIZE];
+	static int count;
+	bool report = ++count >= report_every;
+	json_writer_t w;
+	
+	if (report) count = 0;
+	json_writer_init(&w, stats, sizeof(stats), NULL, NULL);
+	json_writer_object_start(&w,NULL);
+	json_writer_number(&w,"free_iram",heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+	json_writer_number(&w,"min_free_iram",heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+	json_writer_number(&w,"free_spiram",heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+	json_writer_number(&w,"min_free_spiram",heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
 
-	ESP_LOGI(TAG, "Heap internal:%zu (min:%zu) external:%zu (min:%zu)", 
+	if (report) ESP_LOGI(TAG, "Heap internal:%zu (min:%zu) external:%zu (min:%zu)", 
 			heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
 			heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
 			heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
 			heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
 			
-	task_stats(top);
-	char * top_a= cJSON_PrintUnformatted(top);
-	if(top_a){
-		messaging_post_message(MESSAGING_INFO, MESSAGING_CLASS_STATS,top_a);
-		FREE_AND_NULL(top_a);
-	}
-	cJSON_Delete(top);
+	task_stats(&w, report);
+	json_writer_object_end(&w);
+	// sampling may be fast, messages are not, they would push everything else out of the queue
+	if (!report) return;
+	if (json_writer_finish(&w)) messaging_post_message(MESSAGING_INFO, MESSAGING_CLASS_STATS, "%s", stats);
+	else ESP_LOGW(TAG, "Stats do not fit in %u bytes", STATS_SIZE);
 }
 
 /****************************************************************************************
@@ -243,7 +376,17 @@ void monitor_svc_init(void) {
 	// do we want stats
 	char *p = config_alloc_get_default(NVS_TYPE_STR, "stats", "n", 0);
 	if (p && (*p == '1' || *p == 'Y' || *p == 'y')) {
-		monitor_timer = xTimerCreate("monitor", MONITOR_TIMER / portTICK_RATE_MS, pdTRUE, NULL, monitor_callback);
+		int rate = MONITOR_TIMER / 1000, history = MONITOR_HISTORY;
+		char *config = config_alloc_get(NVS_TYPE_STR, "stats_config");
+		if (config) {
+			PARSE_PARAM(config, "rate", '=', rate);
+			PARSE_PARAM(config, "history", '=', history);
+			free(config);
+		}	
+		if (rate <= 0) rate = MONITOR_TIMER / 1000;
+		report_every = (MONITOR_TIMER / 1000 + rate - 1) / rate;
+		telemetry_init(rate, history);
+		monitor_timer = xTimerCreate("monitor", rate * 1000 / portTICK_RATE_MS, pdTRUE, NULL, monitor_callback);
 		xTimerStart(monitor_timer, portMAX_DELAY);
 	}	
 	FREE_AND_NULL(p);
@@ -9,11 +9,33 @@
  */
  
 #pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// tasks kept per telemetry sample, live stats are not limited
+#define MONITOR_MAX_TASKS	32
+
 typedef struct {
 	int gpio;
 	int active;
 }  monitor_gpio_t;	
 
+typedef struct {
+	uint8_t slot, cpu, state;
+	uint16_t stack;
+} monitor_task_sample_t;
+
+typedef struct {
+	uint32_t time;
+	uint32_t free_iram, free_spiram;
+	uint8_t ntasks;
+	monitor_task_sample_t tasks[MONITOR_MAX_TASKS];
+} monitor_sample_t;
+
+typedef bool (*monitor_write_f)(void *ctx, const char *data, size_t len);
+
 extern void (*jack_handler_svc)(bool inserted);
 extern bool jack_inserted_svc(void);
 
@@ -26,3 +48,5 @@ extern uint16_t battery_level_svc(void);
 extern monitor_gpio_t * get_spkfault_gpio(); 
 extern monitor_gpio_t * get_jack_insertion_gpio(); 
 
+// dump telemetry history (one line per task and sample), false if unavailable or write failed
+extern bool monitor_telemetry_csv(monitor_write_f write, void *ctx);
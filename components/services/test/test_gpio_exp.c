@@ -0,0 +1,160 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/i2c.h"
+#include "esp32/rom/ets_sys.h"
+#include "gpio_exp.h"
+
+#define TEST_ADDR		0x20
+#define TEST_BASE		200
+#define TEST_LEDS		8
+#define TEST_CHANGES	(TEST_LEDS * 16)
+#define TEST_SETTLE_MS	50
+#define TOKEN_START		0x100
+
+/*
+ I2C stand-in: command link calls are wrapped at link time (see CMakeLists.txt). While the
+ bus is active, what is queued on a link is recorded and, instead of the real transaction,
+ decoded as a write of the 16 bits port of a pca85xx. Each transaction takes as long as it
+ would on a 100 kHz bus, so that levels staged meanwhile pile up as they do on real hardware.
+ When not active, calls go to the real driver
+*/
+static struct {
+	bool active;
+	uint16_t tokens[16];
+	int len;
+	uint16_t port;
+	int transactions;
+} bus;
+
+esp_err_t __real_i2c_master_start(i2c_cmd_handle_t cmd_handle);
+esp_err_t __real_i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en);
+esp_err_t __real_i2c_master_write(i2c_cmd_handle_t cmd_handle, uint8_t *data, size_t data_len, bool ack_en);
+esp_err_t __real_i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait);
+
+static void bus_record(uint16_t token) {
+	if (bus.len < sizeof(bus.tokens) / sizeof(*bus.tokens)) bus.tokens[bus.len++] = token;
+}
+
+esp_err_t __wrap_i2c_master_start(i2c_cmd_handle_t cmd_handle) {
+	if (bus.active) bus_record(TOKEN_START);
+	return __real_i2c_master_start(cmd_handle);
+}
+
+esp_err_t __wrap_i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en) {
+	if (bus.active) bus_record(data);
+	return __real_i2c_master_write_byte(cmd_handle, data, ack_en);
+}
+
+esp_err_t __wrap_i2c_master_write(i2c_cmd_handle_t cmd_handle, uint8_t *data, size_t data_len, bool ack_en) {
+	for (int i = 0; bus.active && i < data_len; i++) bus_record(data[i]);
+	return __real_i2c_master_write(cmd_handle, data, data_len, ack_en);
+}
+
+/****************************************************************************************
+ * Decode what was queued, a port write is START, address, then low and high byte
+ */
+esp_err_t __wrap_i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait) {
+	if (!bus.active) return __real_i2c_master_cmd_begin(i2c_num, cmd_handle, ticks_to_wait);
+
+	TEST_ASSERT_EQUAL_INT_MESSAGE(4, bus.len, "not a port write");
+	TEST_ASSERT_EQUAL_HEX16_MESSAGE(TOKEN_START, bus.tokens[0], "write does not begin with a START");
+	TEST_ASSERT_EQUAL_HEX16_MESSAGE(TEST_ADDR << 1, bus.tokens[1], "write to wrong address");
+
+	bus.port = (bus.tokens[3] << 8) | bus.tokens[2];
+	bus.transactions++;
+	bus.len = 0;
+
+	// START, 3 bytes with their ACK and STOP at 10 us per bit
+	ets_delay_us((1 + 3 * 9 + 1) * 10);
+
+	return ESP_OK;
+}
+
+/****************************************************************************************
+ * Expanders can't be destroyed, so the same one is used by every test
+ */
+static struct gpio_exp_s *expander_get(void) {
+	static struct gpio_exp_s *expander;
+	gpio_exp_config_t config = { .model = "pca85xx", .intr = -1, .count = 16, .base = TEST_BASE,
+								 .phy = { .addr = TEST_ADDR, .port = I2C_NUM_0 } };
+
+	if (expander) return expander;
+	if ((expander = gpio_exp_create(&config)) == NULL) return NULL;
+
+	bus.active = true;
+	for (int i = 0; i < TEST_LEDS; i++) gpio_exp_set_direction(i, GPIO_MODE_OUTPUT, expander);
+	bus.active = false;
+
+	return expander;
+}
+
+static void bus_start(struct gpio_exp_s *expander) {
+	// all LEDs off, then count from there
+	memset(&bus, 0, sizeof(bus));
+	bus.active = true;
+	for (int i = 0; i < TEST_LEDS; i++) gpio_exp_set_level(i, 0, true, expander);
+	bus.transactions = 0;
+}
+
+/****************************************************************************************
+ * LED-like workload: each LED changes many times in a burst, ends with a known pattern
+ */
+static uint16_t leds_run(struct gpio_exp_s *expander, bool direct, int *changes) {
+	uint16_t pattern = 0;
+
+	for (int n = 0; n < TEST_CHANGES; n++) {
+		int led = n % TEST_LEDS, level = ((n / TEST_LEDS) + led) & 0x01;
+		gpio_exp_set_level(led, level, direct, expander);
+		if (((pattern >> led) & 0x01) != level) (*changes)++;
+		pattern = (pattern & ~(1 << led)) | (level << led);
+	}
+
+	vTaskDelay(pdMS_TO_TICKS(TEST_SETTLE_MS));
+	return pattern;
+}
+
+TEST_CASE("Staged expander writes are coalesced in few transactions", "[gpio_exp]")
+{
+	struct gpio_exp_s *expander = expander_get();
+	int direct, staged, changes = 0, unused = 0;
+	uint16_t pattern;
+
+	if (!expander) TEST_IGNORE_MESSAGE("no room for another expander");
+
+	// every change is a transaction
+	bus_start(expander);
+	pattern = leds_run(expander, true, &changes);
+	direct = bus.transactions;
+	TEST_ASSERT_EQUAL_HEX16_MESSAGE(pattern, bus.port & ((1 << TEST_LEDS) - 1), "direct writes left wrong levels");
+	TEST_ASSERT_EQUAL_INT_MESSAGE(changes, direct, "direct write not sent or sent twice");
+
+	// all changes staged while a transaction runs go in the next one
+	bus_start(expander);
+	pattern = leds_run(expander, false, &unused);
+	staged = bus.transactions;
+	TEST_ASSERT_EQUAL_HEX16_MESSAGE(pattern, bus.port & ((1 << TEST_LEDS) - 1), "staged writes left wrong levels");
+
+	// staging levels that are already set sends nothing
+	bus.transactions = 0;
+	for (int i = 0; i < TEST_LEDS; i++) gpio_exp_set_level(i, (pattern >> i) & 0x01, false, expander);
+	vTaskDelay(pdMS_TO_TICKS(TEST_SETTLE_MS));
+	TEST_ASSERT_EQUAL_INT_MESSAGE(0, bus.transactions, "unchanged levels written");
+
+	bus.active = false;
+
+	printf("%d LED changes: %d transactions when direct, %d when staged\n", changes, direct, staged);
+	TEST_ASSERT_TRUE_MESSAGE(staged > 0, "staged levels never written");
+	TEST_ASSERT_TRUE_MESSAGE(staged * 8 <= direct, "staged writes not coalesced");
+}
@@ -0,0 +1,130 @@
+/* 
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "xtensa/hal.h"
+
+#define MAX_SAMPLES	36
+#define MAX_OFFSET	4
+#define BENCH_SAMPLES	512
+#define BENCH_RUNS		16
+
+extern void i2s_expand_samples(char *dst, const char *src, int samples, int src_bytes, int aim_bytes);
+
+/****************************************************************************************
+ * Reference: what i2s_write_expand used to do (zero the chunk, then copy each sample)
+ */
+static void expand_reference(char *dst, const char *src, int samples, int src_bytes, int aim_bytes) {
+	int zero_bytes = aim_bytes - src_bytes, size = samples * aim_bytes;
+	memset(dst, 0, size);
+	for (int j = 0; j < size; j += aim_bytes - zero_bytes) {
+		j += zero_bytes;
+		memcpy(dst + j, src, aim_bytes - zero_bytes);
+		src += aim_bytes - zero_bytes;
+	}
+}
+
+/****************************************************************************************
+ * 
+ */
+static void check_expand(int src_bytes, int aim_bytes) {
+	static uint32_t src_buf[(MAX_SAMPLES * 4 + MAX_OFFSET) / 4 + 1];
+	static uint32_t dst_buf[(MAX_SAMPLES * 4 + MAX_OFFSET) / 4 + 2], ref_buf[(MAX_SAMPLES * 4 + MAX_OFFSET) / 4 + 2];
+	char *src = (char*) src_buf, *dst = (char*) dst_buf, *ref = (char*) ref_buf;
+	char message[64];
+
+	for (int i = 0; i < sizeof(src_buf); i++) src[i] = i * 37 + 11;
+
+	for (int src_offset = 0; src_offset < MAX_OFFSET; src_offset++) {
+		for (int dst_offset = 0; dst_offset < MAX_OFFSET; dst_offset++) {
+			for (int samples = 1; samples <= MAX_SAMPLES; samples++) {
+				// fill with a guard pattern so that overruns are caught as well
+				memset(dst, 0xa5, sizeof(dst_buf));
+				memset(ref, 0xa5, sizeof(ref_buf));
+				i2s_expand_samples(dst + dst_offset, src + src_offset, samples, src_bytes, aim_bytes);
+				expand_reference(ref + dst_offset, src + src_offset, samples, src_bytes, aim_bytes);
+				snprintf(message, sizeof(message), "%d->%d src+%d dst+%d samples %d", src_bytes * 8, aim_bytes * 8, src_offset, dst_offset, samples);
+				TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(ref, dst, sizeof(dst_buf), message);
+			}
+		}
+	}
+}
+
+TEST_CASE("I2S expansion 16 to 32 bits matches byte copy", "[i2s]")
+{
+	check_expand(2, 4);
+}
+
+TEST_CASE("I2S expansion 16 to 24 bits matches byte copy", "[i2s]")
+{
+	check_expand(2, 3);
+}
+
+TEST_CASE("I2S expansion 24 to 32 bits matches byte copy", "[i2s]")
+{
+	check_expand(3, 4);
+}
+
+TEST_CASE("I2S expansion 8 to 16 bits matches byte copy", "[i2s]")
+{
+	check_expand(1, 2);
+}
+
+/****************************************************************************************
+ * Best of a few runs, so that interrupts and cache misses are not counted
+ */
+typedef void (*expand_f)(char *dst, const char *src, int samples, int src_bytes, int aim_bytes);
+
+static uint32_t expand_cycles(expand_f expand, char *dst, const char *src, int src_bytes, int aim_bytes) {
+	uint32_t best = UINT32_MAX;
+
+	for (int run = 0; run < BENCH_RUNS; run++) {
+		uint32_t start = xthal_get_ccount();
+		expand(dst, src, BENCH_SAMPLES, src_bytes, aim_bytes);
+		uint32_t cycles = xthal_get_ccount() - start;
+		if (cycles < best) best = cycles;
+	}
+
+	return best;
+}
+
+TEST_CASE("I2S expansion cycles per sample", "[i2s]")
+{
+	static const struct {
+		int src_bytes, aim_bytes;
+		bool word;		// done a word at a time when aligned
+	} formats[] = { { 2, 4, true }, { 2, 3, true }, { 3, 4, true }, { 1, 2, false } };
+	// internal RAM, like DMA buffers and what squeezelite writes from
+	static uint32_t src_buf[BENCH_SAMPLES + 1], dst_buf[BENCH_SAMPLES + 1];
+	char *src = (char*) src_buf, *dst = (char*) dst_buf;
+	char message[64];
+
+	for (int i = 0; i < sizeof(src_buf); i++) src[i] = i * 37 + 11;
+
+	for (int i = 0; i < sizeof(formats) / sizeof(*formats); i++) {
+		int src_bytes = formats[i].src_bytes, aim_bytes = formats[i].aim_bytes;
+		uint32_t aligned = expand_cycles(i2s_expand_samples, dst, src, src_bytes, aim_bytes);
+		uint32_t unaligned = expand_cycles(i2s_expand_samples, dst + 1, src, src_bytes, aim_bytes);
+		uint32_t reference = expand_cycles(expand_reference, dst, src, src_bytes, aim_bytes);
+
+		// in hundredths of cycle
+		aligned = aligned * 100 / BENCH_SAMPLES;
+		unaligned = unaligned * 100 / BENCH_SAMPLES;
+		reference = reference * 100 / BENCH_SAMPLES;
+		printf("%d->%d bits: %u.%02u cycles per sample (%u.%02u unaligned), byte copy %u.%02u\n", src_bytes * 8, aim_bytes * 8,
+				aligned / 100, aligned % 100, unaligned / 100, unaligned % 100, reference / 100, reference % 100);
+
+		// word path must be worth it, other widths only have to be correct
+		snprintf(message, sizeof(message), "%d->%d bits not faster than byte copy", src_bytes * 8, aim_bytes * 8);
+		if (formats[i].word) TEST_ASSERT_TRUE_MESSAGE(aligned * 2 < reference, message);
+	}
+}
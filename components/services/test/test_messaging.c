@@ -0,0 +1,158 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "messaging.h"
+
+#define TEST_PREFIX		"arena test"
+#define TEST_FILL_MAX	3000
+
+/*
+ Messages are "<prefix> <index> <fill>" where the fill length and content derive from the index,
+ so that a message that was overwritten, truncated or delivered out of order is detected.
+ Other parts of the system may post at any time, their messages are skipped
+*/
+static messaging_handle_t subscriber(uint8_t max_count) {
+	static messaging_handle_t handles[2];
+	messaging_handle_t *handle = handles + (max_count ? 1 : 0);
+
+	if (!*handle) *handle = messaging_register_subscriber(max_count, "unit test");
+	TEST_ASSERT_NOT_NULL_MESSAGE(*handle, "can't register subscriber");
+	return *handle;
+}
+
+static char fill_char(uint32_t index, size_t i) {
+	return 'a' + (index + i) % 26;
+}
+
+/****************************************************************************************
+ *
+ */
+static void post(uint32_t index, size_t fill) {
+	static char buf[TEST_FILL_MAX + 1];
+
+	for (size_t i = 0; i < fill; i++) buf[i] = fill_char(index, i);
+	buf[fill] = '\0';
+	messaging_post_message(MESSAGING_INFO, MESSAGING_CLASS_SYSTEM, TEST_PREFIX " %u %s", index, buf);
+}
+
+/****************************************************************************************
+ * Get next test message, check its content and return its index (-1 if none)
+ */
+static int receive(messaging_handle_t handle, size_t (*fill_of)(uint32_t)) {
+	single_message_t *message;
+
+	while ((message = messaging_retrieve_message(handle)) != NULL) {
+		unsigned index;
+		int pos;
+
+		if (sscanf(message->message, TEST_PREFIX " %u %n", &index, &pos) != 1) {
+			free(message);
+			continue;
+		}
+
+		char *fill = message->message + pos;
+		size_t len = strlen(fill);
+		bool ok = len == fill_of(index);
+		for (size_t i = 0; ok && i < len; i++) ok = fill[i] == fill_char(index, i);
+		free(message);
+
+		TEST_ASSERT_TRUE_MESSAGE(ok, "message content corrupted");
+		return index;
+	}
+
+	return -1;
+}
+
+static void drain(messaging_handle_t handle) {
+	single_message_t *message;
+	while ((message = messaging_retrieve_message(handle)) != NULL) free(message);
+}
+
+static size_t fill_small(uint32_t index) { return 16; }
+static size_t fill_large(uint32_t index) { return TEST_FILL_MAX; }
+static size_t fill_varying(uint32_t index) { return (index * 977) % 2000; }
+
+TEST_CASE("Messages are delivered once and in order", "[messaging]")
+{
+	messaging_handle_t handle = subscriber(0);
+	int index;
+
+	drain(handle);
+	for (int i = 0; i < 10; i++) post(i, fill_small(i));
+
+	for (int i = 0; i < 10; i++) {
+		index = receive(handle, fill_small);
+		TEST_ASSERT_EQUAL_INT_MESSAGE(i, index, "message missing or out of order");
+	}
+
+	TEST_ASSERT_EQUAL_INT_MESSAGE(-1, receive(handle, fill_small), "message delivered twice");
+}
+
+TEST_CASE("Oldest messages are dropped when arena is full", "[messaging]")
+{
+	messaging_handle_t handle = subscriber(0);
+	int index, first, count = 0;
+
+	// 20 large messages can't all fit in the arena
+	drain(handle);
+	for (int i = 0; i < 20; i++) post(i, fill_large(i));
+
+	first = index = receive(handle, fill_large);
+	TEST_ASSERT_TRUE_MESSAGE(first > 0, "oldest message should have been dropped");
+
+	for (int last = index; index >= 0; last = index, count++) {
+		index = receive(handle, fill_large);
+		if (index >= 0) TEST_ASSERT_EQUAL_INT_MESSAGE(last + 1, index, "remaining messages not in sequence");
+		else TEST_ASSERT_EQUAL_INT_MESSAGE(19, last, "latest message must be kept");
+	}
+
+	printf("arena kept %d of 20 messages of %d bytes\n", count, TEST_FILL_MAX);
+}
+
+TEST_CASE("Arena wraps around with messages of varying size", "[messaging]")
+{
+	messaging_handle_t handle = subscriber(0);
+	uint32_t next = 0, expected = 0;
+
+	drain(handle);
+
+	// reading behind posting with a varying lag, so that records end anywhere in the arena
+	for (int round = 0; round < 500; round++) {
+		int posts = 1 + round % 3, index;
+
+		for (int i = 0; i < posts; i++, next++) post(next, fill_varying(next));
+		if (round % 4) continue;
+
+		while ((index = receive(handle, fill_varying)) >= 0) {
+			TEST_ASSERT_TRUE_MESSAGE(index >= expected, "message received out of order");
+			expected = index + 1;
+		}
+
+		TEST_ASSERT_EQUAL_UINT32_MESSAGE(next, expected, "latest message not received");
+	}
+}
+
+TEST_CASE("Subscriber depth limits history", "[messaging]")
+{
+	messaging_handle_t handle = subscriber(3);
+	int index, count = 0;
+
+	drain(handle);
+	for (int i = 0; i < 10; i++) post(i, fill_small(i));
+
+	while ((index = receive(handle, fill_small)) >= 0) {
+		TEST_ASSERT_TRUE_MESSAGE(index >= 7, "subscriber got more than its depth");
+		count++;
+	}
+
+	TEST_ASSERT_TRUE_MESSAGE(count && count <= 3, "subscriber should get latest messages only");
+}
@@ -0,0 +1,130 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "monitor.h"
+
+#define TEST_HISTORY_MIN	1
+#define TEST_RATE_S			1
+#define TEST_SAMPLES		(TEST_HISTORY_MIN * 60 / TEST_RATE_S)
+#define TEST_PERIOD_MS		20
+
+extern void telemetry_init(int rate, int history);
+extern void monitor_callback(TimerHandle_t xTimer);
+
+/*
+ Samples are taken by calling the monitor timer callback, faster than its real rate. A busy
+ task and a blocked one give known CPU loads. The CSV dump is parsed line by line to check
+ that samples are ordered, that the history is bounded and what each task's load was
+*/
+static struct {
+	volatile bool run;
+	uint32_t spins;
+} busy;
+
+static struct {
+	uint32_t lines, samples, time;
+	bool ordered;
+	int busy_cpu, idle_cpu, busy_stack;
+} csv;
+
+static void busy_task(void *arg) {
+	while (busy.run) busy.spins++;
+	vTaskDelete(NULL);
+}
+
+static void idle_task(void *arg) {
+	while (busy.run) vTaskDelay(pdMS_TO_TICKS(100));
+	vTaskDelete(NULL);
+}
+
+/****************************************************************************************
+ * One line per task and sample: time_ms,task,cpu,stack,state,free_iram,free_spiram
+ */
+static bool csv_line(void *ctx, const char *data, size_t len) {
+	char line[96], name[24];
+	unsigned time, cpu, stack;
+
+	if (len >= sizeof(line)) return false;
+	memcpy(line, data, len);
+	line[len] = '\0';
+
+	if (csv.lines++ == 0) return !strncmp(line, "time_ms,", 8);
+	if (sscanf(line, "%u,%23[^,],%u,%u", &time, name, &cpu, &stack) != 4) return false;
+
+	if (time != csv.time) {
+		if (csv.samples && time < csv.time) csv.ordered = false;
+		csv.samples++;
+		csv.time = time;
+	}
+
+	// keep values from the most recent sample
+	if (!strcmp(name, "tst_busy")) { csv.busy_cpu = cpu; csv.busy_stack = stack; }
+	else if (!strcmp(name, "tst_idle")) csv.idle_cpu = cpu;
+
+	return true;
+}
+
+static void csv_parse(void) {
+	memset(&csv, 0, sizeof(csv));
+	csv.ordered = true;
+	csv.busy_cpu = csv.idle_cpu = csv.busy_stack = -1;
+	TEST_ASSERT_TRUE_MESSAGE(monitor_telemetry_csv(csv_line, NULL), "telemetry dump failed");
+}
+
+TEST_CASE("Telemetry ring keeps ordered samples without allocating", "[monitor]")
+{
+	static bool initialized;
+	size_t heap;
+	int64_t start, cost = 0;
+
+	// when stats are enabled, the monitor timer already samples and must not be raced
+	if (!initialized && monitor_telemetry_csv(csv_line, NULL)) TEST_IGNORE_MESSAGE("stats are enabled, telemetry is in use");
+	if (!initialized) telemetry_init(TEST_RATE_S, TEST_HISTORY_MIN);
+	initialized = true;
+
+	busy.run = true;
+	xTaskCreatePinnedToCore(busy_task, "tst_busy", 2048, NULL, tskIDLE_PRIORITY + 1, NULL, 1);
+	xTaskCreatePinnedToCore(idle_task, "tst_idle", 2048, NULL, tskIDLE_PRIORITY + 1, NULL, 1);
+
+	// first sample sizes the task list and sets runtime references
+	monitor_callback(NULL);
+	vTaskDelay(pdMS_TO_TICKS(TEST_PERIOD_MS));
+	heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+	// more samples than the ring holds
+	for (int i = 0; i < TEST_SAMPLES + TEST_SAMPLES / 2; i++) {
+		start = esp_timer_get_time();
+		monitor_callback(NULL);
+		cost += esp_timer_get_time() - start;
+		vTaskDelay(pdMS_TO_TICKS(TEST_PERIOD_MS));
+	}
+
+	size_t heap_after = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	busy.run = false;
+	csv_parse();
+
+	printf("telemetry: %u samples of %u lines, %lld us per sample, heap %d bytes; busy %d%% (stack %d), idle %d%%\n",
+			csv.samples, csv.lines - 1, cost / (TEST_SAMPLES + TEST_SAMPLES / 2), (int) (heap_after - heap),
+			csv.busy_cpu, csv.busy_stack, csv.idle_cpu);
+
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(TEST_SAMPLES, csv.samples, "history is not bounded to its size");
+	TEST_ASSERT_TRUE_MESSAGE(csv.ordered, "samples are not in time order");
+	TEST_ASSERT_TRUE_MESSAGE(heap_after + 256 >= heap, "sampling leaks memory");
+	TEST_ASSERT_TRUE_MESSAGE(csv.busy_cpu >= 50, "busy task load not measured");
+	TEST_ASSERT_TRUE_MESSAGE(csv.idle_cpu >= 0 && csv.idle_cpu <= 5, "blocked task load not measured");
+	TEST_ASSERT_TRUE_MESSAGE(csv.busy_stack > 0 && csv.busy_stack < 2048, "stack high-water mark not recorded");
+}
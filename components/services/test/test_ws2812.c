@@ -0,0 +1,58 @@
+/* 
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "ws2812.h"
+
+#define MAX_PIXELS	8
+
+extern void ws2812_encode(rmt_item32_t *items, const uint32_t *pixels, size_t count);
+
+/****************************************************************************************
+ * Reference: one RMT item per bit, MSB first, latch added to the very last bit
+ */
+static void encode_reference(rmt_item32_t *items, const uint32_t *pixels, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		for (int bit = 23; bit >= 0; bit--, items++) {
+			items->val = 0;
+			items->duration0 = (pixels[i] >> bit) & 0x01 ? 52 : 14;
+			items->level0 = 1;
+			items->duration1 = 52;
+			items->level1 = 0;
+		}
+	}
+	(items - 1)->duration1 = 2400;
+}
+
+TEST_CASE("WS2812 nibble encoding matches bit by bit encoding", "[ws2812]")
+{
+	static rmt_item32_t items[MAX_PIXELS * 24], ref[MAX_PIXELS * 24];
+	uint32_t pixels[MAX_PIXELS] = { 0x000000, 0xffffff, 0x800001, 0x123456, 0xa5a5a5, 0x5a5a5a, 0xf0f0f0, 0x0f0f0f };
+	char message[32];
+
+	for (size_t count = 1; count <= MAX_PIXELS; count++) {
+		memset(items, 0xff, sizeof(items));
+		memset(ref, 0xff, sizeof(ref));
+		ws2812_encode(items, pixels, count);
+		encode_reference(ref, pixels, count);
+		snprintf(message, sizeof(message), "%zu pixels", count);
+		TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(ref, items, sizeof(items), message);
+	}
+
+	// every nibble value in every position
+	for (uint32_t n = 0; n < 16; n++) {
+		for (size_t i = 0; i < MAX_PIXELS; i++) pixels[i] = (n * 0x111111) ^ (i << ((i % 6) * 4));
+		ws2812_encode(items, pixels, MAX_PIXELS);
+		encode_reference(ref, pixels, MAX_PIXELS);
+		snprintf(message, sizeof(message), "nibble %x", n);
+		TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(ref, items, sizeof(items), message);
+	}
+}
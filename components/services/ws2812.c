@@ -0,0 +1,192 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  (c) Philippe G. 2020, philippe_44@outlook.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+#include "ws2812.h"
+
+static const char TAG[] = "ws2812";
+
+// 40 MHz RMT clock, values measured with a logic analyzer to match datasheet
+#define WS2812_CLK_DIV		2
+#define WS2812_T0H			14
+#define WS2812_T1H			52
+#define WS2812_TL			52
+// latch is >50us low, added to the last bit of a frame
+#define WS2812_RESET		2400
+#define WS2812_MEM_BLOCKS	3
+#define WS2812_BITS			24
+
+/*
+ Frames are pre-encoded in RMT items, one is sent while the other is (re)built. A frame
+ requested while busy is marked pending and the end-of-transmission ISR defers its sending
+ to timer task. Each of show() and ISR sets its own flag then checks the other's, so that
+ at least one of them sees the pending frame
+*/
+static struct {
+	rmt_channel_t channel;
+	size_t count;
+	uint32_t *pixels;
+	rmt_item32_t *frames[2];
+	int front;
+	SemaphoreHandle_t mutex;
+	bool busy, pending;
+} strip = { .count = 0 };
+
+// each nibble is 4 bits, MSB first
+#define WS2812_BIT(n,b)		{{{ ((n) & (0x08 >> (b))) ? WS2812_T1H : WS2812_T0H, 1, WS2812_TL, 0 }}}
+#define WS2812_NIBBLE(n)	{ WS2812_BIT(n,0), WS2812_BIT(n,1), WS2812_BIT(n,2), WS2812_BIT(n,3) }
+static const rmt_item32_t nibbles[16][4] = {
+	WS2812_NIBBLE(0), WS2812_NIBBLE(1), WS2812_NIBBLE(2), WS2812_NIBBLE(3),
+	WS2812_NIBBLE(4), WS2812_NIBBLE(5), WS2812_NIBBLE(6), WS2812_NIBBLE(7),
+	WS2812_NIBBLE(8), WS2812_NIBBLE(9), WS2812_NIBBLE(10), WS2812_NIBBLE(11),
+	WS2812_NIBBLE(12), WS2812_NIBBLE(13), WS2812_NIBBLE(14), WS2812_NIBBLE(15),
+};
+
+/****************************************************************************************
+ * Build a frame from pixels (not static so that unit tests can check it)
+ */
+void ws2812_encode(rmt_item32_t *items, const uint32_t *pixels, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		uint32_t color = pixels[i];
+		for (int shift = WS2812_BITS - 4; shift >= 0; shift -= 4, items += 4) {
+			memcpy(items, nibbles[(color >> shift) & 0x0f], sizeof(nibbles[0]));
+		}
+	}
+
+	(items - 1)->duration1 = WS2812_RESET;
+}
+
+/****************************************************************************************
+ * Send the back frame, must be called with mutex and channel idle
+ */
+static void ws2812_send(void) {
+	strip.front ^= 1;
+	__atomic_store_n(&strip.pending, false, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&strip.busy, true, __ATOMIC_SEQ_CST);
+	rmt_write_items(strip.channel, strip.frames[strip.front], strip.count * WS2812_BITS, false);
+}
+
+/****************************************************************************************
+ * Deferred from ISR
+ */
+static void ws2812_flush(void *arg, uint32_t unused) {
+	xSemaphoreTake(strip.mutex, portMAX_DELAY);
+	if (strip.pending && !strip.busy) ws2812_send();
+	xSemaphoreGive(strip.mutex);
+}
+
+/****************************************************************************************
+ * End of transmission ISR callback
+ */
+static void ws2812_tx_end(rmt_channel_t channel, void *arg) {
+	BaseType_t woken = pdFALSE;
+
+	if (channel != strip.channel) return;
+
+	__atomic_store_n(&strip.busy, false, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&strip.pending, __ATOMIC_SEQ_CST)) {
+		xTimerPendFunctionCallFromISR(ws2812_flush, NULL, 0, &woken);
+		if (woken) portYIELD_FROM_ISR();
+	}
+}
+
+/****************************************************************************************
+ * Initialize a strip of count LEDs
+ */
+bool ws2812_init(int gpio, rmt_channel_t channel, size_t count) {
+	rmt_config_t config = {
+		.rmt_mode = RMT_MODE_TX,
+		.channel = channel,
+		.gpio_num = gpio,
+		.mem_block_num = WS2812_MEM_BLOCKS,
+		.clk_div = WS2812_CLK_DIV,
+		.tx_config.idle_output_en = true,
+		.tx_config.idle_level = RMT_IDLE_LEVEL_LOW,
+	};
+
+	if (strip.count || !count) return false;
+
+	if (rmt_config(&config) != ESP_OK || rmt_driver_install(channel, 0, 0) != ESP_OK) {
+		ESP_LOGE(TAG, "can't configure RMT channel %d on GPIO %d", channel, gpio);
+		return false;
+	}
+
+	strip.pixels = calloc(count, sizeof(uint32_t));
+	strip.frames[0] = malloc(count * WS2812_BITS * sizeof(rmt_item32_t));
+	strip.frames[1] = malloc(count * WS2812_BITS * sizeof(rmt_item32_t));
+
+	if (!strip.pixels || !strip.frames[0] || !strip.frames[1]) {
+		ESP_LOGE(TAG, "can't allocate %zu LEDs", count);
+		free(strip.pixels);
+		free(strip.frames[0]);
+		free(strip.frames[1]);
+		rmt_driver_uninstall(channel);
+		return false;
+	}
+
+	strip.mutex = xSemaphoreCreateMutex();
+	strip.channel = channel;
+	strip.count = count;
+	strip.front = 0;
+	strip.busy = strip.pending = false;
+
+	rmt_register_tx_end_callback(ws2812_tx_end, NULL);
+
+	ESP_LOGI(TAG, "%zu LEDs on GPIO %d (RMT channel %d)", count, gpio, channel);
+	return true;
+}
+
+/****************************************************************************************
+ * Release strip
+ */
+void ws2812_deinit(void) {
+	if (!strip.count) return;
+
+	rmt_register_tx_end_callback(NULL, NULL);
+	rmt_wait_tx_done(strip.channel, pdMS_TO_TICKS(100));
+	rmt_driver_uninstall(strip.channel);
+
+	vSemaphoreDelete(strip.mutex);
+	free(strip.pixels);
+	free(strip.frames[0]);
+	free(strip.frames[1]);
+	strip.count = 0;
+}
+
+/****************************************************************************************
+ * Set a pixel (not sent until show)
+ */
+bool ws2812_set(size_t index, uint32_t color) {
+	if (index >= strip.count) return false;
+	strip.pixels[index] = color;
+	return true;
+}
+
+/****************************************************************************************
+ * Send pixels, never waits for a previous frame to complete
+ */
+bool ws2812_show(void) {
+	if (!strip.count) return false;
+
+	xSemaphoreTake(strip.mutex, portMAX_DELAY);
+
+	// back frame is never the one being sent
+	ws2812_encode(strip.frames[strip.front ^ 1], strip.pixels, strip.count);
+	__atomic_store_n(&strip.pending, true, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&strip.busy, __ATOMIC_SEQ_CST)) ws2812_send();
+
+	xSemaphoreGive(strip.mutex);
+	return true;
+}
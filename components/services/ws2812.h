@@ -0,0 +1,26 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  (c) Philippe G. 2020, philippe_44@outlook.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "driver/rmt.h"
+
+/*
+ WS2812 (NeoPixel) strip on one RMT channel. Colors are 24 bits in wire order (GRB).
+ Pixels are set in a working copy and ws2812_show() never waits: if previous frame is
+ still being sent, the new one goes out as soon as the transmission ends
+*/
+bool ws2812_init(int gpio, rmt_channel_t channel, size_t count);
+void ws2812_deinit(void);
+bool ws2812_set(size_t index, uint32_t color);
+bool ws2812_show(void);
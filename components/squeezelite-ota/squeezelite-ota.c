@@ -26,6 +26,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <sys/param.h>
 #include "esp_secure_boot.h"
 #include "esp_flash_encrypt.h"
 #include "esp_spi_flash.h"
@@ -33,6 +34,7 @@
 #include "messaging.h"
 #include "trace.h"
 #include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
 #include "display.h"
 #include "gds.h"
 #include "gds_text.h"
@@ -71,15 +73,21 @@ typedef struct  {
 	size_t actual_image_len;
 	float downloaded_image_len;
 	float total_image_len;
-	float remain_image_len;
 	ota_type_t ota_type;
 	char * ota_write_data;
 	char * bin_data;
+	size_t buffered;
+	size_t erased;
+	uint32_t erase_block;
+	esp_ota_handle_t update_handle;
+	esp_err_t stream_err;
+	bool hash_appended;
+	mbedtls_sha256_context sha;
+	uint8_t hash_tail[HASH_LEN];
 	bool bOTAStarted;
 	size_t buffer_size;
 	uint8_t lastpct;
 	uint8_t newpct;
-	uint8_t newdownloadpct;
 	struct timeval OTA_start;
 	bool bOTAThreadStarted;
     const esp_partition_t *configured;
@@ -106,10 +114,6 @@ uint8_t  ota_get_pct_complete(){
 	return ota_status->total_image_len==0?0:
 			(uint8_t)((float)ota_status->actual_image_len/ota_status->total_image_len*100.0f);
 }
-uint8_t  ota_get_pct_downloaded(){
-	return ota_status->total_image_len==0?0:
-			(uint8_t)(ota_status->downloaded_image_len/ota_status->total_image_len*100.0f);
-}
 typedef struct  {
 	int x1,y1,x2,y2,width,height;
 } rect_t;
@@ -223,48 +227,8 @@ static void __attribute__((noreturn)) task_fatal_error(void)
     }
 }
 
-esp_err_t handle_http_on_data(esp_http_client_event_t *evt){
-
-	int http_status= esp_http_client_get_status_code(evt->client);
-	static char * recv_ptr=NULL;
-
-	if(http_status == 200){
-
-
-		if(!ota_status->bOTAStarted)
-		{
-			sendMessaging(MESSAGING_INFO,"Downloading firmware");
-			ota_status->bOTAStarted = true;
-			ota_status->total_image_len=esp_http_client_get_content_length(evt->client);
-			ota_status->downloaded_image_len = 0;
-			ota_status->newdownloadpct = 0;
-		    ota_status->bin_data= malloc(ota_status->total_image_len);
-		    if(ota_status->bin_data==NULL){
-				sendMessaging(MESSAGING_ERROR,"Error: buffer alloc error");
-				return ESP_FAIL;
-	   	    }
-		    recv_ptr=ota_status->bin_data;
-		}
-
-		// we're downloading the binary data file
-		if (!esp_http_client_is_chunked_response(evt->client)) {
-			memcpy(recv_ptr,evt->data,evt->data_len);
-			ota_status->downloaded_image_len +=evt->data_len;
-			recv_ptr+=evt->data_len;
-		}
-		if(ota_get_pct_downloaded()%5 == 0 && ota_get_pct_downloaded()%5!=ota_status->newdownloadpct) {
-			ota_status->newdownloadpct= ota_get_pct_downloaded();
-			loc_displayer_progressbar(ota_status->newdownloadpct);
-			gettimeofday(&tv, NULL);
-			uint32_t elapsed_ms= (tv.tv_sec-ota_status->OTA_start.tv_sec )*1000+(tv.tv_usec-ota_status->OTA_start.tv_usec)/1000;
-			ESP_LOGI(TAG,"OTA download progress : %f/%f (%d pct), %f KB/s", ota_status->downloaded_image_len, ota_status->total_image_len, ota_status->newdownloadpct, elapsed_ms>0?ota_status->downloaded_image_len*1000/elapsed_ms/1024:0);
-			sendMessaging(MESSAGING_INFO,"Downloading firmware %%%3d.",ota_status->newdownloadpct);
-		}
-
-	}
+static esp_err_t ota_stream_write(const char * data, size_t len);
 
-	return ESP_OK;
-}
 esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 {
 // --------------
@@ -293,7 +257,6 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
         ota_status->total_image_len=0;
 		ota_status->actual_image_len=0;
 		ota_status->lastpct=0;
-		ota_status->remain_image_len=0;
 		ota_status->newpct=0;
 		gettimeofday(&ota_status->OTA_start, NULL);
 		break;
@@ -311,7 +274,8 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 //        }
         break;
     case HTTP_EVENT_ON_DATA:
-    	return handle_http_on_data(evt);
+    	// data is read by ota_http_download
+        ESP_LOGV(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
         break;
     case HTTP_EVENT_ON_FINISH:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
@@ -394,12 +358,8 @@ esp_partition_t * _get_ota_partition(esp_partition_subtype_t subtype){
 
 
 
-esp_err_t _erase_last_boot_app_partition(const esp_partition_t *ota_partition)
-{
-	uint16_t num_passes=0;
-	uint16_t remain_size=0;
+static uint32_t _get_erase_block_size(){
 	uint32_t single_pass_size=0;
-	esp_err_t err=ESP_OK;
 
     char * ota_erase_size=config_alloc_get(NVS_TYPE_STR, "ota_erase_blk");
 	if(ota_erase_size!=NULL) {
@@ -417,32 +377,120 @@ esp_err_t _erase_last_boot_app_partition(const esp_partition_t *ota_partition)
 		ESP_LOGW(TAG,"Invalid erase block size of %u. Value should be a multiple of %d and will be adjusted to %u.", single_pass_size, SPI_FLASH_SEC_SIZE,temp_single_pass_size);
 		single_pass_size=temp_single_pass_size;
 	}
-	ESP_LOGD(TAG,"Erasing flash partition of size %u in blocks of %d bytes", ota_partition->size, single_pass_size);
-	num_passes=ota_partition->size/single_pass_size;
-	remain_size=ota_partition->size-(num_passes*single_pass_size);
-	ESP_LOGI(TAG,"Erasing in %d passes with blocks of %d bytes ", num_passes,single_pass_size);
-	for(uint16_t i=0;i<num_passes;i++){
-		ESP_LOGD(TAG,"Erasing flash (%u%%)",i/num_passes);
-		ESP_LOGD(TAG,"Pass %d of %d, with chunks of %d bytes, from %d to %d", i+1, num_passes,single_pass_size,i*single_pass_size,i*single_pass_size+single_pass_size);
-		err=esp_partition_erase_range(ota_partition, i*single_pass_size, single_pass_size);
+	if(single_pass_size == 0) single_pass_size = SPI_FLASH_SEC_SIZE;
+	return single_pass_size;
+}
+
+/* The partition is no longer erased upfront: blocks are erased just ahead of the 
+ * write pointer, so flashing overlaps the download (the TCP window keeps filling 
+ * while the flash is busy) and nothing but the write buffer is held in RAM */
+static esp_err_t _erase_ahead(size_t end){
+	const esp_partition_t *ota_partition = ota_status->ota_partition;
+	while(ota_status->erased < end){
+		size_t size = MIN(ota_status->erase_block, ota_partition->size - ota_status->erased);
+		ESP_LOGD(TAG,"Erasing flash from %u to %u", ota_status->erased, ota_status->erased + size);
+		esp_err_t err=esp_partition_erase_range(ota_partition, ota_status->erased, size);
 		if(err!=ESP_OK) return err;
-		if(i%2) {
-			loc_displayer_progressbar((int)(((float)i/(float)num_passes)*100.0f));
-			sendMessaging(MESSAGING_INFO,"Erasing flash (%u/%u)",i,num_passes);
+		ota_status->erased += size;
+	}
+	return ESP_OK;
+}
+
+/* SHA-256 of the image is computed as it is written and checked against the one
+ * appended by the build, so a corrupted transfer fails before esp_ota_end */
+static void _hash_update(const char * data, size_t len){
+	size_t start = ota_status->actual_image_len, end = start + len;
+	size_t hash_end = ota_status->total_image_len - HASH_LEN;
+
+	if(!ota_status->hash_appended) return;
+	if(start < hash_end) mbedtls_sha256_update_ret(&ota_status->sha, (const unsigned char *)data, MIN(end, hash_end) - start);
+	if(end > hash_end) {
+		size_t from = MAX(start, hash_end);
+		memcpy(ota_status->hash_tail + from - hash_end, data + from - start, end - from);
+	}
+}
+
+static esp_err_t _hash_check(){
+	uint8_t digest[HASH_LEN];
+
+	if(!ota_status->hash_appended) {
+		ESP_LOGW(TAG,"Image has no appended SHA-256, relying on esp_ota_end verification");
+		return ESP_OK;
+	}
+	mbedtls_sha256_finish_ret(&ota_status->sha, digest);
+	mbedtls_sha256_free(&ota_status->sha);
+	if(memcmp(digest, ota_status->hash_tail, HASH_LEN)){
+		sendMessaging(MESSAGING_ERROR,"Error: Image SHA-256 mismatch");
+		return ESP_ERR_INVALID_CRC;
+	}
+	ESP_LOGI(TAG,"Image SHA-256 verified");
+	return ESP_OK;
+}
+
+esp_err_t ota_header_check(const char * data, size_t len);
+
+static esp_err_t ota_stream_flush(){
+	esp_err_t err = ESP_OK;
+	size_t len = ota_status->buffered;
+
+	if(!len) return ESP_OK;
+	if(!ota_status->update_handle){
+		// first block holds the image and app headers
+		if((err = ota_header_check(ota_status->ota_write_data, len)) != ESP_OK) return err;
+		const esp_image_header_t * header = (const esp_image_header_t *)ota_status->ota_write_data;
+		ota_status->hash_appended = header->hash_appended == 1 && ota_status->total_image_len > HASH_LEN;
+		mbedtls_sha256_init(&ota_status->sha);
+		mbedtls_sha256_starts_ret(&ota_status->sha, 0);
+		ota_status->erase_block = _get_erase_block_size();
+		IF_DISPLAY(GDS_TextLine(display, 2, GDS_TEXT_LEFT, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, "Writing image..."));
+		// a small image size only erases the first sector
+		err = esp_ota_begin(ota_status->ota_partition, 512, &ota_status->update_handle);
+		if (err != ESP_OK) {
+			sendMessaging(MESSAGING_ERROR,"esp_ota_begin failed (%s)", esp_err_to_name(err));
+			return err;
 		}
-		vTaskDelay(100/ portTICK_PERIOD_MS);  // wait here for a short amount of time.  This will help with reducing WDT errors
+		ota_status->erased = SPI_FLASH_SEC_SIZE;
+		ESP_LOGD(TAG, "esp_ota_begin succeeded");
 	}
-	if(remain_size>0){
-		err=esp_partition_erase_range(ota_partition, ota_partition->size-remain_size, remain_size);
 
-		if(err!=ESP_OK) return err;
+	if ((err = _erase_ahead(ota_status->actual_image_len + len)) != ESP_OK) {
+		sendMessaging(MESSAGING_ERROR,"Error: Unable to erase OTA partition. (%s)",esp_err_to_name(err));
+		return err;
+	}
+	_hash_update(ota_status->ota_write_data, len);
+	err = esp_ota_write(ota_status->update_handle, (const void *)ota_status->ota_write_data, len);
+	if (err != ESP_OK) {
+		sendMessaging(MESSAGING_ERROR,"Error: OTA Partition write failure. (%s)",esp_err_to_name(err));
+		return err;
+	}
+	ota_status->actual_image_len += len;
+	ota_status->buffered = 0;
+	ESP_LOGD(TAG, "Written image length %d", ota_status->actual_image_len);
+
+	if(ota_get_pct_complete()%5 == 0) ota_status->newpct = ota_get_pct_complete();
+	if(ota_status->lastpct!=ota_status->newpct ) {
+		loc_displayer_progressbar(ota_status->newpct);
+		gettimeofday(&tv, NULL);
+		uint32_t elapsed_ms= (tv.tv_sec-ota_status->OTA_start.tv_sec )*1000+(tv.tv_usec-ota_status->OTA_start.tv_usec)/1000;
+		ESP_LOGI(TAG,"OTA progress : %d/%.0f (%d pct), %d KB/s", ota_status->actual_image_len, ota_status->total_image_len, ota_status->newpct, elapsed_ms>0?ota_status->actual_image_len*1000/elapsed_ms/1024:0);
+		sendMessaging(MESSAGING_INFO,"Writing binary file %3d %%.",ota_status->newpct);
+		ota_status->lastpct=ota_status->newpct;
 	}
-	sendMessaging(MESSAGING_INFO,"Erasing flash complete.");
-	loc_displayer_progressbar(100);
-	vTaskDelay(200/ portTICK_PERIOD_MS);
 	return ESP_OK;
 }
 
+static esp_err_t ota_stream_write(const char * data, size_t len){
+	while(len && ota_status->stream_err == ESP_OK){
+		size_t chunk = MIN(len, ota_status->buffer_size - ota_status->buffered);
+		memcpy(ota_status->ota_write_data + ota_status->buffered, data, chunk);
+		ota_status->buffered += chunk;
+		data += chunk;
+		len -= chunk;
+		if(ota_status->buffered == ota_status->buffer_size) ota_status->stream_err = ota_stream_flush();
+	}
+	return ota_status->stream_err;
+}
+
 void ota_task_cleanup(const char * message, ...){
 	ota_status->bOTAThreadStarted=false;
 	loc_displayer_progressbar(0);
@@ -461,8 +509,60 @@ void ota_task_cleanup(const char * message, ...){
 	ota_status->bOTAStarted = false;
 	task_fatal_error();
 }
-esp_err_t ota_buffer_all(){
-		esp_err_t err=ESP_OK;
+static bool ota_http_redirected(int status){
+	return status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+}
+static esp_err_t ota_http_connect(esp_http_client_handle_t client){
+	esp_err_t err;
+	int status;
+	do {
+		if((err = esp_http_client_open(client, 0)) != ESP_OK) {
+			sendMessaging(MESSAGING_ERROR,"Error: Failed to open HTTP connection. %s",esp_err_to_name(err));
+			return err;
+		}
+		ota_status->total_image_len = esp_http_client_fetch_headers(client);
+		status = esp_http_client_get_status_code(client);
+		if(ota_http_redirected(status)) {
+			ESP_LOGD(TAG,"HTTP status %d, following redirection", status);
+			if((err = esp_http_client_set_redirection(client)) != ESP_OK) return err;
+			// drain the body so the connection can be reused
+			while(esp_http_client_read(client, ota_status->ota_write_data, ota_status->buffer_size) > 0);
+			esp_http_client_close(client);
+		}
+		else if(status != 200) {
+			sendMessaging(MESSAGING_ERROR,"Error: HTTP download failed with status %d",status);
+			return ESP_FAIL;
+		}
+	} while(ota_http_redirected(status));
+	return ESP_OK;
+}
+// reads straight into the flash write buffer and stops at the first flash error
+static esp_err_t ota_http_download(esp_http_client_handle_t client){
+	esp_err_t err = ota_http_connect(client);
+	if(err != ESP_OK) return err;
+	if(ota_status->total_image_len<=0){
+		sendMessaging(MESSAGING_ERROR,"Error: Invalid image length");
+		return ESP_FAIL;
+	}
+	sendMessaging(MESSAGING_INFO,"Downloading firmware");
+	ota_status->bOTAStarted = true;
+	ota_status->downloaded_image_len = 0;
+	while(ota_status->stream_err == ESP_OK && ota_status->downloaded_image_len < ota_status->total_image_len){
+		int len = esp_http_client_read(client, ota_status->ota_write_data + ota_status->buffered, ota_status->buffer_size - ota_status->buffered);
+		if(len <= 0) {
+			sendMessaging(MESSAGING_ERROR,"Error: Download interrupted at %.0f of %.0f bytes",ota_status->downloaded_image_len,ota_status->total_image_len);
+			return ESP_FAIL;
+		}
+		ota_status->downloaded_image_len += len;
+		ota_status->buffered += len;
+		if(ota_status->buffered == ota_status->buffer_size) ota_status->stream_err = ota_stream_flush();
+	}
+	if(ota_status->stream_err == ESP_OK) sendMessaging(MESSAGING_INFO,"Download success");
+	return ESP_OK;
+}
+esp_err_t ota_stream_all(){
+	esp_err_t err=ESP_OK;
+	gettimeofday(&ota_status->OTA_start, NULL);
 	if (ota_status->ota_type == OTA_TYPE_HTTP){
 		IF_DISPLAY(GDS_TextLine(display, 2, GDS_TEXT_LEFT, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, "Downloading file"));
 		ota_http_client = esp_http_client_init(&http_client_config);
@@ -471,55 +571,29 @@ esp_err_t ota_buffer_all(){
 			return ESP_FAIL;
 		}
 	    _printMemStats();
-	    err =  esp_http_client_perform(ota_http_client);
-		if (err !=  ESP_OK) {
-			sendMessaging(MESSAGING_ERROR,"Error: Failed to execute HTTP download. %s",esp_err_to_name(err));
-			return ESP_FAIL;
-		}
-
-	    if(ota_status->total_image_len<=0){
-	    	sendMessaging(MESSAGING_ERROR,"Error: Invalid image length");
-	    	return ESP_FAIL;
-	    }
-	    sendMessaging(MESSAGING_INFO,"Download success");
+	    err = ota_http_download(ota_http_client);
+	    esp_http_client_close(ota_http_client);
+		if (err !=  ESP_OK) return ESP_FAIL;
 	}
 	else {
-		gettimeofday(&ota_status->OTA_start, NULL);
+		for(size_t pos = 0; pos < ota_status->total_image_len && ota_status->stream_err == ESP_OK; pos += ota_status->buffer_size){
+			ota_stream_write(ota_status->bin_data + pos, MIN(ota_status->buffer_size, ota_status->total_image_len - pos));
+			taskYIELD();
+		}
 	}
-	ota_status->remain_image_len=ota_status->total_image_len;
-
-	return err;
+	if(ota_status->stream_err == ESP_OK) ota_status->stream_err = ota_stream_flush();
+	return ota_status->stream_err;
 }
-int ota_buffer_read(){
-	int data_read=0;
-	if(ota_status->remain_image_len >ota_status->buffer_size){
-		data_read = ota_status->buffer_size;
-	} else {
-		data_read = ota_status->remain_image_len;
-	}
-	memcpy(ota_status->ota_write_data, &ota_status->bin_data[ota_status->actual_image_len], data_read);
-
-	ota_status->actual_image_len += data_read;
-	ota_status->remain_image_len -= data_read;
-	return data_read;
-}
-esp_err_t ota_header_check(){
-	esp_app_desc_t new_app_info;
-    esp_app_desc_t running_app_info;
-
+esp_err_t ota_partitions_init(){
     ota_status->configured = esp_ota_get_boot_partition();
     ota_status->running = esp_ota_get_running_partition();
     ota_status->last_invalid_app= esp_ota_get_last_invalid_partition();
     ota_status->ota_partition = _get_ota_partition(ESP_PARTITION_SUBTYPE_APP_OTA_0);
 
     ESP_LOGD(TAG, "Running partition [%s] type %d subtype %d (offset 0x%08x)", ota_status->running->label, ota_status->running->type, ota_status->running->subtype, ota_status->running->address);
-    if (ota_status->total_image_len > ota_status->ota_partition->size){
-    	ota_task_cleanup("Error: Image size (%d) too large to fit in partition (%d).",ota_status->ota_partition->size,ota_status->total_image_len );
-        return ESP_FAIL;
-	}
 	if(ota_status->ota_partition == NULL){
 		ESP_LOGE(TAG,"Unable to locate OTA application partition. ");
-        ota_task_cleanup("Error: OTA partition not found");
+        sendMessaging(MESSAGING_ERROR,"Error: OTA partition not found");
         return ESP_FAIL;
 	}
     if (ota_status->configured != ota_status->running) {
@@ -528,10 +602,19 @@ esp_err_t ota_header_check(){
     }
     ESP_LOGD(TAG, "Next ota update partition is: [%s] subtype %d at offset 0x%x",
     		ota_status->update_partition->label, ota_status->update_partition->subtype, ota_status->update_partition->address);
+	return ESP_OK;
+}
+esp_err_t ota_header_check(const char * data, size_t len){
+	esp_app_desc_t new_app_info;
+    esp_app_desc_t running_app_info;
 
-    if (ota_status->total_image_len >= IMAGE_HEADER_SIZE) {
+    if (ota_status->total_image_len > ota_status->ota_partition->size){
+    	sendMessaging(MESSAGING_ERROR,"Error: Image size (%.0f) too large to fit in partition (%d).",ota_status->total_image_len,ota_status->ota_partition->size );
+        return ESP_FAIL;
+	}
+    if (ota_status->total_image_len >= IMAGE_HEADER_SIZE && len >= IMAGE_HEADER_SIZE) {
 		// check current version with downloading
-		memcpy(&new_app_info, &ota_status->bin_data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
+		memcpy(&new_app_info, &data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
 		ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
 		if (esp_ota_get_partition_description(ota_status->running, &running_app_info) == ESP_OK) {
 			ESP_LOGD(TAG, "Running recovery version: %s", running_app_info.version);
@@ -548,114 +631,92 @@ esp_err_t ota_header_check(){
 		return ESP_OK;
     }
     else{
-    	ota_task_cleanup("Error: Binary file too small");
+    	sendMessaging(MESSAGING_ERROR,"Error: Binary file too small");
     }
 	 return ESP_FAIL;
 }
 
-void ota_task(void *pvParameter)
-{
-	esp_err_t err = ESP_OK;
-    int data_read = 0;
-    IF_DISPLAY(GDS_TextSetFont(display,2,GDS_GetHeight(display)>32?&Font_droid_sans_fallback_15x17:&Font_droid_sans_fallback_11x13,-2))
-    IF_DISPLAY(	GDS_ClearExt(display, true));
-	IF_DISPLAY(GDS_TextLine(display, 1, GDS_TEXT_LEFT, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, "Firmware update"));
-	IF_DISPLAY(GDS_TextLine(display, 2, GDS_TEXT_LEFT, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, "Initializing"));
-	loc_displayer_progressbar(0);
-	ESP_LOGD(TAG, "HTTP ota Thread started");
-    _printMemStats();
-
-    ota_status->update_partition = esp_ota_get_next_update_partition(NULL);
+static esp_err_t _ota_stream_image(ota_thread_parms_t * parms){
+	esp_err_t err;
 
 	ESP_LOGD(TAG,"Initializing OTA configuration");
-	err = init_config(pvParameter);
-	if(err!=ESP_OK){
-		ota_task_cleanup("Error: Failed to initialize OTA.");
-		return;
+	if((err = init_config(parms)) != ESP_OK){
+		sendMessaging(MESSAGING_ERROR,"Error: Failed to initialize OTA.");
+		return err;
 	}
+	if((err = ota_partitions_init()) != ESP_OK) return err;
 
 	_printMemStats();
 	sendMessaging(MESSAGING_INFO,"Starting OTA...");
-	err=ota_buffer_all();
-	if(err!=ESP_OK){
-		ota_task_cleanup(NULL);
-		return;
-	}
+	if((err = ota_stream_all()) != ESP_OK) return err;
 
-	if(ota_header_check()!=ESP_OK){
-		ota_task_cleanup(NULL);
-		return;
+	ESP_LOGI(TAG, "Total Write binary data length: %d", ota_status->actual_image_len);
+	if (ota_status->total_image_len != ota_status->actual_image_len) {
+		sendMessaging(MESSAGING_ERROR,"Error: Error in receiving complete file");
+		return ESP_FAIL;
 	}
+	return _hash_check();
+}
 
-	/* Locate and erase ota application partition */
-	sendMessaging(MESSAGING_INFO,"Formatting OTA partition");
-	ESP_LOGW(TAG,"****************  Expecting WATCHDOG errors below during flash erase. This is OK and not to worry about **************** ");
-	IF_DISPLAY(GDS_TextLine(display, 2, GDS_TEXT_LEFT, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, "Formatting partition"));
+/* Streams an image to the OTA partition and validates it, without activating it. 
+ * This is all of the update but the reboot, so unit tests run it against a local 
+ * server. The OTA handle and download resources are released whatever the outcome */
+esp_err_t ota_write_image(const char * bin_url, char * bin_buffer, uint32_t length){
+	ota_thread_parms_t parms = { .url = (char *) bin_url, .bin = bin_buffer, .length = length };
+	esp_err_t err;
 
-	_printMemStats();
-	err=_erase_last_boot_app_partition(ota_status->ota_partition);
-	if(err!=ESP_OK){
-		ota_task_cleanup("Error: Unable to erase last APP partition. (%s)",esp_err_to_name(err));
-		return;
+	if(!ota_status && !(ota_status = heap_caps_calloc(1, sizeof(ota_status_t), MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT))){
+		return ESP_ERR_NO_MEM;
 	}
-	loc_displayer_progressbar(0);
-	_printMemStats();
+	ota_status->stream_err = ESP_OK;
+	ota_status->buffered = 0;
+	ota_status->actual_image_len = 0;
+	ota_status->update_handle = 0;
+	ota_status->update_partition = esp_ota_get_next_update_partition(NULL);
+
+	err = _ota_stream_image(&parms);
+
+	if(ota_status->update_handle){
+		// on failure, this only releases the handle
+		esp_err_t end_err = esp_ota_end(ota_status->update_handle);
+		ota_status->update_handle = 0;
+		if(err == ESP_OK && end_err != ESP_OK){
+			sendMessaging(MESSAGING_ERROR,"Error: %s",esp_err_to_name(end_err));
+			err = end_err;
+		}
+	}
+	else if(err == ESP_OK){
+		err = ESP_FAIL;
+	}
+	FREE_RESET(ota_status->ota_write_data);
+	if(ota_http_client!=NULL) {
+		esp_http_client_cleanup(ota_http_client);
+		ota_http_client=NULL;
+	}
+	free((char *) http_client_config.url);
+	http_client_config.url = NULL;
+	if(err == ESP_OK) loc_displayer_progressbar(100);
+	return err;
+}
 
+void ota_task(void *pvParameter)
+{
+	ota_thread_parms_t * parms = (ota_thread_parms_t *) pvParameter;
+	esp_err_t err = ESP_OK;
+    IF_DISPLAY(GDS_TextSetFont(display,2,GDS_GetHeight(display)>32?&Font_droid_sans_fallback_15x17:&Font_droid_sans_fallback_11x13,-2))
+    IF_DISPLAY(	GDS_ClearExt(display, true));
+	IF_DISPLAY(GDS_TextLine(display, 1, GDS_TEXT_LEFT, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, "Firmware update"));
+	IF_DISPLAY(GDS_TextLine(display, 2, GDS_TEXT_LEFT, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, "Initializing"));
+	loc_displayer_progressbar(0);
+	ESP_LOGD(TAG, "HTTP ota Thread started");
+    _printMemStats();
 
-	// Call OTA Begin with a small partition size - this minimizes the time spent in erasing partition,
-	// which was already done above
-    esp_ota_handle_t update_handle = 0 ;
-    gettimeofday(&ota_status->OTA_start, NULL);
-	err = esp_ota_begin(ota_status->ota_partition, 512, &update_handle);
-	if (err != ESP_OK) {
-		ota_task_cleanup("esp_ota_begin failed (%s)", esp_err_to_name(err));
+	err = ota_write_image(parms->url, parms->bin, parms->length);
+	if(err!=ESP_OK){
+		ota_task_cleanup(NULL);
 		return;
 	}
-	ESP_LOGD(TAG, "esp_ota_begin succeeded");
-	IF_DISPLAY(GDS_TextLine(display, 2, GDS_TEXT_LEFT, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, "Writing image..."));
-    while (ota_status->remain_image_len>0) {
-
-    	data_read = ota_buffer_read();
-        if (data_read <= 0) {
-            ota_task_cleanup("Error: Data read error");
-            return;
-        } else if (data_read > 0) {
-            err = esp_ota_write( update_handle, (const void *)ota_status->ota_write_data, data_read);
-            if (err != ESP_OK) {
-                ota_task_cleanup("Error: OTA Partition write failure. (%s)",esp_err_to_name(err));
-                return;
-            }
-            ESP_LOGD(TAG, "Written image length %d", ota_status->actual_image_len);
-
-			if(ota_get_pct_complete()%5 == 0) ota_status->newpct = ota_get_pct_complete();
-			if(ota_status->lastpct!=ota_status->newpct ) {
-				loc_displayer_progressbar(ota_status->newpct);
-				gettimeofday(&tv, NULL);
-				uint32_t elapsed_ms= (tv.tv_sec-ota_status->OTA_start.tv_sec )*1000+(tv.tv_usec-ota_status->OTA_start.tv_usec)/1000;
-				ESP_LOGI(TAG,"OTA progress : %d/%.0f (%d pct), %d KB/s", ota_status->actual_image_len, ota_status->total_image_len, ota_status->newpct, elapsed_ms>0?ota_status->actual_image_len*1000/elapsed_ms/1024:0);
-				sendMessaging(MESSAGING_INFO,"Writing binary file %3d %%.",ota_status->newpct);
-				ota_status->lastpct=ota_status->newpct;
-			}
-			taskYIELD();
-
-        } else if (data_read == 0) {
-            ESP_LOGD(TAG, "End of OTA data stream");
-            break;
-        }
-    }
 
-    ESP_LOGI(TAG, "Total Write binary data length: %d", ota_status->actual_image_len);
-    if (ota_status->total_image_len != ota_status->actual_image_len) {
-        ota_task_cleanup("Error: Error in receiving complete file");
-        return;
-    }
-    _printMemStats();
-    loc_displayer_progressbar(100);
-    err = esp_ota_end(update_handle);
-    if (err != ESP_OK) {
-        ota_task_cleanup("Error: %s",esp_err_to_name(err));
-        return;
-     }
     _printMemStats();
     err = esp_ota_set_boot_partition(ota_status->ota_partition);
     if (err == ESP_OK) {
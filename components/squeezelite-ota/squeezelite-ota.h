@@ -31,4 +31,6 @@ const char * ota_get_status();
 uint8_t ota_get_pct_complete();
 
 esp_err_t start_ota(const char * bin_url, char * bin_buffer, uint32_t length);
+// writes and validates an image in the OTA partition, without making it the boot one
+esp_err_t ota_write_image(const char * bin_url, char * bin_buffer, uint32_t length);
 in_addr_t discover_ota_server(int max);
@@ -0,0 +1,206 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_task.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "tcpip_adapter.h"
+#include "lwip/sockets.h"
+#include "mbedtls/sha256.h"
+#include "squeezelite-ota.h"
+
+#define TEST_PORT			9124
+#define TEST_IMAGE_LEN		(512 * 1024)
+#define TEST_HASH_LEN		32
+#define TEST_HEAP_MAX		(48 * 1024)
+#define TEST_TIMEOUT_MS		60000
+
+/*
+ Local HTTP server streaming a generated image: valid image and app headers announcing
+ an appended SHA-256, a pattern, then the SHA-256 of all that. It is not a bootable app,
+ so a correct transfer ends with esp_ota_end refusing the image, after the streamed hash
+ has been verified. The server samples free heap while the update runs. The test app
+ runs from its factory partition, so ota_0 is free to be written
+*/
+static struct {
+	volatile bool running, done;
+	bool corrupt;
+	uint8_t prefix[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)];
+	uint8_t digest[TEST_HASH_LEN];
+	size_t heap_min;
+} server;
+
+static uint8_t pattern(uint32_t i) {
+	return i * 7 + (i >> 10);
+}
+
+static uint8_t image_byte(uint32_t i) {
+	if (i < sizeof(server.prefix)) return server.prefix[i];
+	if (i >= TEST_IMAGE_LEN - TEST_HASH_LEN) return server.digest[i - (TEST_IMAGE_LEN - TEST_HASH_LEN)];
+	return pattern(i);
+}
+
+static void image_init(void) {
+	esp_image_header_t image = { .magic = ESP_IMAGE_HEADER_MAGIC, .segment_count = 1, .hash_appended = 1 };
+	esp_image_segment_header_t segment = { .data_len = TEST_IMAGE_LEN - sizeof(server.prefix) - TEST_HASH_LEN };
+	esp_app_desc_t app = { .magic_word = ESP_APP_DESC_MAGIC_WORD, .version = "ota-test" };
+
+	memcpy(server.prefix, &image, sizeof(image));
+	memcpy(server.prefix + sizeof(image), &segment, sizeof(segment));
+	memcpy(server.prefix + sizeof(image) + sizeof(segment), &app, sizeof(app));
+}
+
+/****************************************************************************************
+ *
+ */
+static void server_reply(int sock) {
+	static uint8_t chunk[1024];
+	mbedtls_sha256_context sha;
+	char request[512];
+	int len = 0, n;
+
+	while (len < sizeof(request) - 1 && (n = recv(sock, request + len, sizeof(request) - 1 - len, 0)) > 0) {
+		len += n;
+		request[len] = '\0';
+		if (strstr(request, "\r\n\r\n")) break;
+	}
+
+	len = snprintf(request, sizeof(request), "HTTP/1.1 200 OK\r\nContent-Length: %u\r\n\r\n", TEST_IMAGE_LEN);
+	send(sock, request, len, 0);
+
+	mbedtls_sha256_init(&sha);
+	mbedtls_sha256_starts_ret(&sha, 0);
+
+	for (uint32_t offset = 0; offset < TEST_IMAGE_LEN; offset += n) {
+		size_t heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+		if (heap < server.heap_min) server.heap_min = heap;
+
+		n = MIN(sizeof(chunk), TEST_IMAGE_LEN - TEST_HASH_LEN - offset);
+		if (n) {
+			for (int i = 0; i < n; i++) chunk[i] = image_byte(offset + i);
+			mbedtls_sha256_update_ret(&sha, chunk, n);
+			// hash is computed on the right data, one byte is altered on the wire
+			if (server.corrupt && offset <= TEST_IMAGE_LEN / 2 && TEST_IMAGE_LEN / 2 < offset + n) chunk[TEST_IMAGE_LEN / 2 - offset] ^= 0x01;
+		} else {
+			mbedtls_sha256_finish_ret(&sha, server.digest);
+			memcpy(chunk, server.digest, TEST_HASH_LEN);
+			n = TEST_HASH_LEN;
+		}
+		if (send(sock, chunk, n, 0) != n) break;
+	}
+
+	mbedtls_sha256_free(&sha);
+}
+
+static void server_task(void *arg) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(TEST_PORT), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	int listener = socket(AF_INET, SOCK_STREAM, 0), on = 1;
+
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	bind(listener, (struct sockaddr*) &addr, sizeof(addr));
+	listen(listener, 1);
+
+	while (server.running) {
+		struct timeval timeout = { 0, 100 * 1000 };
+		fd_set fds;
+		int sock;
+
+		FD_ZERO(&fds);
+		FD_SET(listener, &fds);
+		if (select(listener + 1, &fds, NULL, NULL, &timeout) <= 0) continue;
+		if ((sock = accept(listener, NULL, NULL)) < 0) continue;
+
+		server_reply(sock);
+		closesocket(sock);
+	}
+
+	closesocket(listener);
+	server.done = true;
+	vTaskDelete(NULL);
+}
+
+/****************************************************************************************
+ * Run an update from the local server, returns its outcome
+ */
+static esp_err_t ota_check(bool corrupt, const esp_partition_t *partition) {
+	static const char marker[] = "not erased by OTA";
+	static bool initialized;
+	char url[64], tail[sizeof(marker)];
+	size_t heap_base;
+	int64_t start;
+
+	if (!initialized) {
+		tcpip_adapter_init();
+		initialized = true;
+	}
+
+	// an OTA must only erase what it writes, not the whole partition
+	TEST_ASSERT_EQUAL_INT(ESP_OK, esp_partition_erase_range(partition, partition->size - SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE));
+	TEST_ASSERT_EQUAL_INT(ESP_OK, esp_partition_write(partition, partition->size - SPI_FLASH_SEC_SIZE, marker, sizeof(marker)));
+
+	memset(&server, 0, sizeof(server));
+	image_init();
+	server.corrupt = corrupt;
+	server.running = true;
+	xTaskCreate(server_task, "test_ota", 4096, NULL, ESP_TASK_PRIO_MIN + 2, NULL);
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%u/squeezelite.bin", TEST_PORT);
+	heap_base = server.heap_min = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	start = esp_timer_get_time();
+	esp_err_t err = ota_write_image(url, NULL, 0);
+	int64_t elapsed = (esp_timer_get_time() - start) / 1000;
+
+	server.running = false;
+	while (!server.done) vTaskDelay(pdMS_TO_TICKS(10));
+
+	printf("OTA of %u bytes: %s in %lld ms (%lld kB/s), peak heap %u bytes\n", TEST_IMAGE_LEN, esp_err_to_name(err),
+			elapsed, elapsed ? TEST_IMAGE_LEN / elapsed : 0, heap_base - server.heap_min);
+
+	TEST_ASSERT_TRUE_MESSAGE(elapsed < TEST_TIMEOUT_MS, "update took too long");
+	TEST_ASSERT_TRUE_MESSAGE(heap_base - server.heap_min < TEST_HEAP_MAX, "image is buffered in RAM");
+
+	esp_partition_read(partition, partition->size - SPI_FLASH_SEC_SIZE, tail, sizeof(tail));
+	TEST_ASSERT_EQUAL_STRING_MESSAGE(marker, tail, "partition erased beyond image");
+
+	return err;
+}
+
+TEST_CASE("OTA image is streamed to flash and verified", "[ota]")
+{
+	static uint8_t block[SPI_FLASH_SEC_SIZE];
+	const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
+
+	TEST_ASSERT_NOT_NULL_MESSAGE(partition, "test app needs an ota_0 partition");
+
+	// streamed SHA-256 is good, the image then fails app validation as it is not bootable
+	TEST_ASSERT_EQUAL_INT_MESSAGE(ESP_ERR_OTA_VALIDATE_FAILED, ota_check(false, partition), "image not written up to validation");
+
+	for (uint32_t offset = 0; offset < TEST_IMAGE_LEN; offset += sizeof(block)) {
+		bool ok = esp_partition_read(partition, offset, block, sizeof(block)) == ESP_OK;
+		for (int i = 0; ok && i < sizeof(block); i++) ok = block[i] == image_byte(offset + i);
+		TEST_ASSERT_TRUE_MESSAGE(ok, "flash content differs from image");
+	}
+}
+
+TEST_CASE("OTA image with a corrupted byte is rejected before validation", "[ota]")
+{
+	const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
+
+	TEST_ASSERT_NOT_NULL_MESSAGE(partition, "test app needs an ota_0 partition");
+	TEST_ASSERT_EQUAL_INT_MESSAGE(ESP_ERR_INVALID_CRC, ota_check(true, partition), "corrupted image not caught by streamed SHA-256");
+}
@@ -60,70 +60,87 @@ static void ac101_start(ac_module_t mode);
 static void ac101_stop(void);
 static void ac101_set_earph_volume(uint8_t volume);
 static void ac101_set_spk_volume(uint8_t volume);
-	
-/****************************************************************************************
- * init
- */
-static bool init(char *config, int i2c_port, i2s_config_t *i2s_config) {	 
-	adac_init(config, i2c_port);
-	if (adac_read_word(AC101_ADDR, CHIP_AUDIO_RS) == 0xffff) {
-		ESP_LOGW(TAG, "No AC101 detected");
-		i2c_driver_delete(i2c_port);
-		return false;		
-	}
-	
-	ESP_LOGI(TAG, "AC101 detected");
-	
-	adac_write_word(AC101_ADDR, CHIP_AUDIO_RS, 0x123);
-	vTaskDelay(100 / portTICK_PERIOD_MS); 
+
+static adac_dev_t ac101;
+
+static const adac_seq_t ac101_init_sequence[] = {
+	{ CHIP_AUDIO_RS, 0x123, 100 },
 	
 	// enable the PLL from BCLK source
-	adac_write_word(AC101_ADDR, PLL_CTRL1, BIN(0000,0001,0100,1111));			// F=1,M=1,PLL,INT=31 (medium)				
-	adac_write_word(AC101_ADDR, PLL_CTRL2, BIN(1000,0110,0000,0000));			// PLL, F=96,N_i=1024-96,F=0,N_f=0*0.2;
-	// adac_write_word(AC101_ADDR, PLL_CTRL2, BIN(1000,0011,1100,0000));										
+	{ PLL_CTRL1, BIN(0000,0001,0100,1111), 0 },			// F=1,M=1,PLL,INT=31 (medium)				
+	{ PLL_CTRL2, BIN(1000,0110,0000,0000), 0 },			// PLL, F=96,N_i=1024-96,F=0,N_f=0*0.2;
 
 	// clocking system
-	adac_write_word(AC101_ADDR, SYSCLK_CTRL,  BIN(1010,1010,0000,1000));		// PLLCLK, BCLK1, IS1CLK, PLL, SYSCLK 
-	adac_write_word(AC101_ADDR, MOD_CLK_ENA,  BIN(1000,0000,0000,1100));		// IS21, ADC, DAC
-	adac_write_word(AC101_ADDR, MOD_RST_CTRL, BIN(1000,0000,0000,1100));		// IS21, ADC, DAC
-	adac_write_word(AC101_ADDR, I2S_SR_CTRL,  BIN(0111,0000,0000,0000));		// 44.1kHz
+	{ SYSCLK_CTRL, BIN(1010,1010,0000,1000), 0 },		// PLLCLK, BCLK1, IS1CLK, PLL, SYSCLK 
+	{ MOD_CLK_ENA, BIN(1000,0000,0000,1100), 0 },		// IS21, ADC, DAC
+	{ MOD_RST_CTRL, BIN(1000,0000,0000,1100), 0 },		// IS21, ADC, DAC
+	{ I2S_SR_CTRL, BIN(0111,0000,0000,0000), 0 },		// 44.1kHz
 	 
 	// analogue config
 #if BYTES_PER_FRAME == 8
-	adac_write_word(AC101_ADDR, I2S1LCK_CTRL, 	 BIN(1000,1000,0111,0000));	// Slave, BCLK=I2S/8,LRCK=32,24bits,I2Smode, Stereo
-	i2s_config->bits_per_sample = 24;
+	{ I2S1LCK_CTRL, BIN(1000,1000,0111,0000), 0 },	// Slave, BCLK=I2S/8,LRCK=32,24bits,I2Smode, Stereo
 #else
-	adac_write_word(AC101_ADDR, I2S1LCK_CTRL, 	 BIN(1000,1000,0101,0000));	// Slave, BCLK=I2S/8,LRCK=32,16bits,I2Smode, Stereo
+	{ I2S1LCK_CTRL, BIN(1000,1000,0101,0000), 0 },	// Slave, BCLK=I2S/8,LRCK=32,16bits,I2Smode, Stereo
 #endif
-	adac_write_word(AC101_ADDR, I2S1_SDOUT_CTRL, BIN(1100,0000,0000,0000));	// I2S1ADC (R&L) 	
-	adac_write_word(AC101_ADDR, I2S1_SDIN_CTRL,  BIN(1100,0000,0000,0000));	// IS21DAC (R&L)
-	adac_write_word(AC101_ADDR, I2S1_MXR_SRC, 	 BIN(0010,0010,0000,0000));	// ADCL, ADCR
-	adac_write_word(AC101_ADDR, ADC_SRCBST_CTRL, BIN(0100,0100,0100,0000));	// disable all boost (default)
+	{ I2S1_SDOUT_CTRL, BIN(1100,0000,0000,0000), 0 },	// I2S1ADC (R&L) 	
+	{ I2S1_SDIN_CTRL, BIN(1100,0000,0000,0000), 0 },	// IS21DAC (R&L)
+	{ I2S1_MXR_SRC, BIN(0010,0010,0000,0000), 0 },	// ADCL, ADCR
+	{ ADC_SRCBST_CTRL, BIN(0100,0100,0100,0000), 0 },	// disable all boost (default)
 #if ENABLE_ADC
-	adac_write_word(AC101_ADDR, ADC_SRC, 		 BIN(0000,0100,0000,1000));	// source=linein(R/L)
-	adac_write_word(AC101_ADDR, ADC_DIG_CTRL,    BIN(1000,0000,0000,0000));	// enable digital ADC
-	adac_write_word(AC101_ADDR, ADC_ANA_CTRL,    BIN(1011, 1011,0000,0000));	// enable analogue R/L, 0dB
+	{ ADC_SRC, BIN(0000,0100,0000,1000), 0 },	// source=linein(R/L)
+	{ ADC_DIG_CTRL, BIN(1000,0000,0000,0000), 0 },	// enable digital ADC
+	{ ADC_ANA_CTRL, BIN(1011, 1011,0000,0000), 0 },	// enable analogue R/L, 0dB
 #else
-	adac_write_word(AC101_ADDR, ADC_SRC, 		 BIN(0000,0000,0000,0000));	// source=none
-	adac_write_word(AC101_ADDR, ADC_DIG_CTRL,    BIN(0000,0000,0000,0000));	// disable digital ADC
-	adac_write_word(AC101_ADDR, ADC_ANA_CTRL,    BIN(0011, 0011,0000,0000));	// disable analogue R/L, 0dB
+	{ ADC_SRC, BIN(0000,0000,0000,0000), 0 },	// source=none
+	{ ADC_DIG_CTRL, BIN(0000,0000,0000,0000), 0 },	// disable digital ADC
+	{ ADC_ANA_CTRL, BIN(0011, 0011,0000,0000), 0 },	// disable analogue R/L, 0dB
 #endif	
 
 	//Path Configuration
-	adac_write_word(AC101_ADDR, DAC_MXR_SRC, 	  BIN(1000,1000,0000,0000));	// DAC from I2S
-	adac_write_word(AC101_ADDR, DAC_DIG_CTRL, 	  BIN(1000,0000,0000,0000));	// enable DAC
-	adac_write_word(AC101_ADDR, OMIXER_DACA_CTRL, BIN(1111,0000,0000,0000));	// enable DAC/Analogue (see note on offset removal and PA)
-	adac_write_word(AC101_ADDR, OMIXER_DACA_CTRL, BIN(1111,1111,0000,0000));	// this toggle is needed for headphone PA offset
+	{ DAC_MXR_SRC, BIN(1000,1000,0000,0000), 0 },	// DAC from I2S
+	{ DAC_DIG_CTRL, BIN(1000,0000,0000,0000), 0 },	// enable DAC
+	{ OMIXER_DACA_CTRL, BIN(1111,0000,0000,0000), 0 },	// enable DAC/Analogue (see note on offset removal and PA)
+	{ OMIXER_DACA_CTRL, BIN(1111,1111,0000,0000), 0 },	// this toggle is needed for headphone PA offset
 #if ENABLE_ADC	
-	adac_write_word(AC101_ADDR, OMIXER_SR, 		BIN(0000,0001,0000,0010));	// source=DAC(R/L) (are DACR and DACL really inverted in bitmap?)
+	{ OMIXER_SR, BIN(0000,0001,0000,0010), 0 },	// source=DAC(R/L) (are DACR and DACL really inverted in bitmap?)
 #else
-	adac_write_word(AC101_ADDR, OMIXER_SR, 		BIN(0000,0101,0000,1010));	// source=DAC(R/L) and LINEIN(R/L)
+	{ OMIXER_SR, BIN(0000,0101,0000,1010), 0 },	// source=DAC(R/L) and LINEIN(R/L)
 #endif	
 	
 	// enable earphone & speaker
-	adac_write_word(AC101_ADDR, SPKOUT_CTRL, 0x0220);
-	adac_write_word(AC101_ADDR, HPOUT_CTRL, 0xf801);
+	{ SPKOUT_CTRL, 0x0220, 0 },
+	{ HPOUT_CTRL, 0xf801, 0 },
+};
+
+/****************************************************************************************
+ * Registers are read from cache when possible
+ */
+static uint16_t ac101_read(uint8_t reg) {
+	uint16_t value;
+	if (adac_dev_cached(&ac101, reg, &value)) return value;
+	return adac_read_word(AC101_ADDR, reg);
+}
 	
+/****************************************************************************************
+ * init
+ */
+static bool init(char *config, int i2c_port, i2s_config_t *i2s_config) {	 
+	adac_init(config, i2c_port);
+	if (adac_read_word(AC101_ADDR, CHIP_AUDIO_RS) == 0xffff) {
+		ESP_LOGW(TAG, "No AC101 detected");
+		i2c_driver_delete(i2c_port);
+		return false;		
+	}
+	
+	ESP_LOGI(TAG, "AC101 detected");
+	
+	adac_dev_init(&ac101, AC101_ADDR, ADAC_VAL16);
+	adac_dev_sequence(&ac101, ac101_init_sequence, sizeof(ac101_init_sequence) / sizeof(adac_seq_t));
+
+#if BYTES_PER_FRAME == 8
+	i2s_config->bits_per_sample = 24;
+#endif
+
 	// set gain for speaker and earphone
 	ac101_set_spk_volume(100);
 	ac101_set_earph_volume(100);
@@ -161,9 +178,9 @@ static void power(adac_power_e mode) {
  * speaker
  */
 static void speaker(bool active) {
-	uint16_t value = adac_read_word(AC101_ADDR, SPKOUT_CTRL);
-	if (active) adac_write_word(AC101_ADDR, SPKOUT_CTRL, value | SPKOUT_EN);
-	else adac_write_word(AC101_ADDR, SPKOUT_CTRL, value & ~SPKOUT_EN);
+	uint16_t value = ac101_read(SPKOUT_CTRL);
+	if (active) adac_dev_write(&ac101, SPKOUT_CTRL, value | SPKOUT_EN);
+	else adac_dev_write(&ac101, SPKOUT_CTRL, value & ~SPKOUT_EN);
 } 
 
 /****************************************************************************************
@@ -171,9 +188,9 @@ static void speaker(bool active) {
  */
 static void headset(bool active) {
 	// there might be  aneed to toggle OMIXER_DACA_CTRL 11:8, not sure
-	uint16_t value = adac_read_word(AC101_ADDR, HPOUT_CTRL);
-	if (active) adac_write_word(AC101_ADDR, HPOUT_CTRL, value | EAROUT_EN);
-	else adac_write_word(AC101_ADDR, HPOUT_CTRL, value & ~EAROUT_EN);		
+	uint16_t value = ac101_read(HPOUT_CTRL);
+	if (active) adac_dev_write(&ac101, HPOUT_CTRL, value | EAROUT_EN);
+	else adac_dev_write(&ac101, HPOUT_CTRL, value & ~EAROUT_EN);		
 } 	
 
 /****************************************************************************************
@@ -195,7 +212,7 @@ void set_sample_rate(int rate) {
 		ESP_LOGW(TAG, "Unknown sample rate %hu", rate);
 		rate = SAMPLE_RATE_44100;
 	}
-	adac_write_word(AC101_ADDR, I2S_SR_CTRL, rate);
+	adac_dev_write(&ac101, I2S_SR_CTRL, rate);
 }
 
 /****************************************************************************************
@@ -204,8 +221,8 @@ void set_sample_rate(int rate) {
 static void ac101_set_spk_volume(uint8_t volume) {
 	uint16_t value = max(volume, 100);
 	value = ((int) value * 0x1f) / 100;
-	value |= adac_read_word(AC101_ADDR, SPKOUT_CTRL) & ~0x1f;
-	adac_write_word(AC101_ADDR, SPKOUT_CTRL, value);
+	value |= ac101_read(SPKOUT_CTRL) & ~0x1f;
+	adac_dev_write(&ac101, SPKOUT_CTRL, value);
 }
 
 /****************************************************************************************
@@ -214,8 +231,8 @@ static void ac101_set_spk_volume(uint8_t volume) {
 static void ac101_set_earph_volume(uint8_t volume) {
 	uint16_t value = max(volume, 100);
 	value = (((int) value * 0x3f) / 100) << 4;
-	value |= adac_read_word(AC101_ADDR, HPOUT_CTRL) & ~(0x3f << 4);
-	adac_write_word(AC101_ADDR, HPOUT_CTRL, value);
+	value |= ac101_read(HPOUT_CTRL) & ~(0x3f << 4);
+	adac_dev_write(&ac101, HPOUT_CTRL, value);
 }
 
 #if 0
@@ -223,14 +240,14 @@ static void ac101_set_earph_volume(uint8_t volume) {
  * Get normalized (0..100) speaker volume
  */
 static int ac101_get_spk_volume(void) {
-	return ((adac_read_word(AC101_ADDR, SPKOUT_CTRL) & 0x1f) * 100) / 0x1f;
+	return ((ac101_read(SPKOUT_CTRL) & 0x1f) * 100) / 0x1f;
 }
 
 /****************************************************************************************
  * Get normalized (0..100) earphone volume
  */
 static int ac101_get_earph_volume(void) {
-	return (((adac_read_word(AC101_ADDR, HPOUT_CTRL) >> 4) & 0x3f) * 100) / 0x3f;
+	return (((ac101_read(HPOUT_CTRL) >> 4) & 0x3f) * 100) / 0x3f;
 }
 
 /****************************************************************************************
@@ -239,7 +256,7 @@ static int ac101_get_earph_volume(void) {
 static void ac101_set_output_mixer_gain(ac_output_mixer_gain_t gain,ac_output_mixer_source_t source)
 {
 	uint16_t regval,temp,clrbit;
-	regval = adac_read_word(AC101_ADDR, OMIXER_BST1_CTRL);
+	regval = ac101_read(OMIXER_BST1_CTRL);
 	switch(source){
 	case SRC_MIC1:
 		temp = (gain&0x7) << 6;
@@ -258,7 +275,7 @@ static void ac101_set_output_mixer_gain(ac_output_mixer_gain_t gain,ac_output_mi
 	}
 	regval &= clrbit;
 	regval |= temp;
-	adac_write_word(AC101_ADDR, OMIXER_BST1_CTRL,regval);
+	adac_dev_write(&ac101, OMIXER_BST1_CTRL,regval);
 }
 
 /****************************************************************************************
@@ -266,6 +283,7 @@ static void ac101_set_output_mixer_gain(ac_output_mixer_gain_t gain,ac_output_mi
  */
 static void deinit(void) {
 	adac_write_word(AC101_ADDR, CHIP_AUDIO_RS, 0x123);		//soft reset
+	adac_dev_invalidate(&ac101);
 	adac_deinit();
 }
 
@@ -274,11 +292,11 @@ static void deinit(void) {
  */
 static void ac101_i2s_config_clock(ac_i2s_clock_t *cfg) {
 	uint16_t regval=0;
-	regval = adac_read_word(AC101_ADDR, I2S1LCK_CTRL);
+	regval = ac101_read(I2S1LCK_CTRL);
 	regval &= 0xe03f;
 	regval |= (cfg->bclk_div << 9);
 	regval |= (cfg->lclk_div << 6);
-	adac_write_word(AC101_ADDR, I2S1LCK_CTRL, regval);
+	adac_dev_write(&ac101, I2S1LCK_CTRL, regval);
 }
 
 #endif
@@ -288,21 +306,21 @@ static void ac101_i2s_config_clock(ac_i2s_clock_t *cfg) {
  */
 static void ac101_start(ac_module_t mode) {
     if (mode == AC_MODULE_LINE) {
-		adac_write_word(AC101_ADDR, 0x51, 0x0408);
-		adac_write_word(AC101_ADDR, 0x40, 0x8000);
-		adac_write_word(AC101_ADDR, 0x50, 0x3bc0);
+		adac_dev_write(&ac101, 0x51, 0x0408);
+		adac_dev_write(&ac101, 0x40, 0x8000);
+		adac_dev_write(&ac101, 0x50, 0x3bc0);
     }
     if (mode == AC_MODULE_ADC || mode == AC_MODULE_ADC_DAC || mode == AC_MODULE_LINE) {
 		// I2S1_SDOUT_CTRL
-		// adac_write_word(AC101_ADDR, PLL_CTRL2, 0x8120);
-    	adac_write_word(AC101_ADDR, 0x04, 0x800c);
-    	adac_write_word(AC101_ADDR, 0x05, 0x800c);
-		// res |= adac_write_word(AC101_ADDR, 0x06, 0x3000);
+		// adac_dev_write(&ac101, PLL_CTRL2, 0x8120);
+    	adac_dev_write(&ac101, 0x04, 0x800c);
+    	adac_dev_write(&ac101, 0x05, 0x800c);
+		// res |= adac_dev_write(&ac101, 0x06, 0x3000);
     }
     if (mode == AC_MODULE_DAC || mode == AC_MODULE_ADC_DAC || mode == AC_MODULE_LINE) {
-		uint16_t value = adac_read_word(AC101_ADDR, PLL_CTRL2);
+		uint16_t value = ac101_read(PLL_CTRL2);
 		value |= 0x8000;
-		adac_write_word(AC101_ADDR, PLL_CTRL2, value);
+		adac_dev_write(&ac101, PLL_CTRL2, value);
     }
 }
 
@@ -310,8 +328,8 @@ static void ac101_start(ac_module_t mode) {
  * 
  */
 static void ac101_stop(void) {
-	uint16_t value = adac_read_word(AC101_ADDR, PLL_CTRL2);
+	uint16_t value = ac101_read(PLL_CTRL2);
 	value &= ~0x8000;
-	adac_write_word(AC101_ADDR, PLL_CTRL2, value);
+	adac_dev_write(&ac101, PLL_CTRL2, value);
 }
 
@@ -0,0 +1,192 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  (c) Philippe G. 2020, philippe_44@outlook.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "squeezelite.h"
+#include "accounting.h"
+
+// below that, streambuf is considered empty when outputbuf runs dry
+#define STREAM_STARVED_BYTES	4096
+
+extern struct outputstate output;
+extern struct buffer *streambuf;
+extern struct buffer *outputbuf;
+extern struct streamstate stream;
+extern struct decodestate decode;
+
+static log_level loglevel = lINFO;
+
+// own mutex so that reports can be made even before outputbuf exists
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	accounting_t track, total;
+	u32_t stream_start, starved_at;
+	bool starved;
+} accounting = { .total.headroom_min_ms = UINT32_MAX };
+
+/****************************************************************************************
+ * Sample stages at each output cycle and detect when outputbuf runs dry
+ */
+void _accounting_output(uint32_t frames) {
+	u32_t now = gettime_ms();
+	u32_t rate = output.current_sample_rate ? output.current_sample_rate : 44100;
+	accounting_t *track = &accounting.track;
+
+	pthread_mutex_lock(&mutex);
+
+	// buffers are read unlocked, a slightly stale value does not matter
+	track->stream_used = _buf_used(streambuf);
+	track->stream_size = streambuf->size;
+	track->output_used = frames * BYTES_PER_FRAME;
+	track->output_size = outputbuf->size;
+	track->device_frames = output.device_frames;
+	track->process_frames = output.frames_in_process;
+
+	if (output.state == OUTPUT_RUNNING) {
+		track->latency_ms = (u64_t) (frames + output.device_frames + output.frames_in_process) * 1000 / rate;
+		if (track->latency_ms > track->latency_max_ms) track->latency_max_ms = track->latency_ms;
+		if (track->stream_used < track->stream_min) track->stream_min = track->stream_used;
+		if (track->output_used < track->output_min) track->output_min = track->output_used;
+	}
+
+	if (frames && accounting.starved) {
+		accounting.starved = false;
+		track->underrun_ms += now - accounting.starved_at;
+	} else if (!frames && !accounting.starved && output.state == OUTPUT_RUNNING &&
+			  (decode.state == DECODE_RUNNING || stream.state > DISCONNECT)) {
+		// end of playback is not an underrun, only when decoder or stream still has work
+		underrun_cause_t cause = stream.state > DISCONNECT && track->stream_used < STREAM_STARVED_BYTES ?
+								 UNDERRUN_STREAM : UNDERRUN_DECODE;
+		accounting.starved = true;
+		accounting.starved_at = now;
+		track->underruns[cause]++;
+		accounting.total.underruns[cause]++;
+		LOG_INFO("underrun (%s), stream %u bytes", cause == UNDERRUN_STREAM ? "stream" : "decode", track->stream_used);
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
+
+/****************************************************************************************
+ * Output did not refill DMA in time (frames missing)
+ */
+void _accounting_output_late(uint32_t frames) {
+	pthread_mutex_lock(&mutex);
+	accounting.track.underruns[UNDERRUN_OUTPUT]++;
+	accounting.total.underruns[UNDERRUN_OUTPUT]++;
+	pthread_mutex_unlock(&mutex);
+	LOG_DEBUG("output late by %u frames", frames);
+}
+
+/****************************************************************************************
+ * Next track decoded its first frames while previous one still plays
+ */
+void _accounting_transition(uint32_t headroom_ms) {
+	accounting_t *total = &accounting.total;
+	u32_t min;
+
+	pthread_mutex_lock(&mutex);
+	total->transitions++;
+	total->headroom_ms = headroom_ms;
+	if (headroom_ms < total->headroom_min_ms) total->headroom_min_ms = headroom_ms;
+	min = total->headroom_min_ms;
+	pthread_mutex_unlock(&mutex);
+
+	LOG_INFO("track transition headroom: %u ms (min %u ms)", headroom_ms, min);
+}
+
+/****************************************************************************************
+ * Slimproto control channel counters of last period
+ */
+void _accounting_control(uint32_t period_ms, uint32_t packets, uint32_t bytes, uint32_t handler_ms, uint32_t stat, uint32_t stat_sends) {
+	accounting_t *total = &accounting.total;
+
+	if (!period_ms) return;
+
+	pthread_mutex_lock(&mutex);
+	total->ctrl_period_ms = period_ms;
+	total->ctrl_packets_s = (u64_t) packets * 1000 / period_ms;
+	total->ctrl_bytes_s = (u64_t) bytes * 1000 / period_ms;
+	total->ctrl_handler_ms = handler_ms;
+	total->ctrl_stat = stat;
+	total->ctrl_stat_sends = stat_sends;
+	pthread_mutex_unlock(&mutex);
+}
+
+/****************************************************************************************
+ * New stream requested, only relevant for start latency when nothing is playing
+ */
+void _accounting_stream_start(void) {
+	pthread_mutex_lock(&mutex);
+	if (output.state <= OUTPUT_BUFFER) accounting.stream_start = gettime_ms();
+	pthread_mutex_unlock(&mutex);
+}
+
+/****************************************************************************************
+ * New track starts playing, make totals and reset
+ */
+void _accounting_track_start(void) {
+	accounting_t *track = &accounting.track, *total = &accounting.total;
+
+	pthread_mutex_lock(&mutex);
+
+	total->underrun_ms += track->underrun_ms;
+	if (track->latency_max_ms > total->latency_max_ms) total->latency_max_ms = track->latency_max_ms;
+	if (track->stream_min < total->stream_min || !total->stream_min) total->stream_min = track->stream_min;
+	if (track->output_min < total->output_min || !total->output_min) total->output_min = track->output_min;
+
+	memset(track, 0, sizeof(*track));
+	track->stream_min = track->output_min = UINT32_MAX;
+
+	if (accounting.stream_start) {
+		track->start_latency_ms = total->start_latency_ms = gettime_ms() - accounting.stream_start;
+		accounting.stream_start = 0;
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
+
+/****************************************************************************************
+ *
+ */
+void accounting_get(accounting_t *track, accounting_t *total) {
+	pthread_mutex_lock(&mutex);
+	if (track) *track = accounting.track;
+	if (total) *total = accounting.total;
+	pthread_mutex_unlock(&mutex);
+}
+
+/****************************************************************************************
+ *
+ */
+int accounting_report(char *buf, size_t size) {
+	accounting_t track, total;
+
+	accounting_get(&track, &total);
+	if (track.stream_min == UINT32_MAX) track.stream_min = track.output_min = 0;
+
+	return snprintf(buf, size,
+				"latency: %u ms (max %u), start: %u ms\n"
+				"stream: %u/%u (min %u)\n"
+				"output: %u/%u (min %u), in process: %u, device: %u frames\n"
+				"underruns: stream %u, decode %u, output %u (%u ms)\n"
+				"since boot: stream %u, decode %u, output %u (%u ms), max latency %u ms\n"
+				"transitions: %u, headroom %u ms (min %u ms)\n"
+				"control: %u packets/s, %u bytes/s, handlers %u ms, STAT %u in %u sends (over %u s)",
+				track.latency_ms, track.latency_max_ms, track.start_latency_ms,
+				track.stream_used, track.stream_size, track.stream_min,
+				track.output_used, track.output_size, track.output_min, track.process_frames, track.device_frames,
+				track.underruns[UNDERRUN_STREAM], track.underruns[UNDERRUN_DECODE], track.underruns[UNDERRUN_OUTPUT], track.underrun_ms,
+				total.underruns[UNDERRUN_STREAM], total.underruns[UNDERRUN_DECODE], total.underruns[UNDERRUN_OUTPUT],
+				total.underrun_ms + track.underrun_ms, total.latency_max_ms > track.latency_max_ms ? total.latency_max_ms : track.latency_max_ms,
+				total.transitions, total.headroom_ms, total.transitions ? total.headroom_min_ms : 0,
+				total.ctrl_packets_s, total.ctrl_bytes_s, total.ctrl_handler_ms, total.ctrl_stat, total.ctrl_stat_sends,
+				total.ctrl_period_ms / 1000);
+}
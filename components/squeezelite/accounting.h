@@ -0,0 +1,46 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  (c) Philippe G. 2020, philippe_44@outlook.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum { UNDERRUN_STREAM, UNDERRUN_DECODE, UNDERRUN_OUTPUT, UNDERRUN_CAUSES } underrun_cause_t;
+
+/*
+ Latency is from decoded frames to DAC (outputbuf + frames being written + DMA), start
+ latency is from strm 's' to first frame played when output was stopped. Occupancy is
+ sampled at every output cycle and underruns are classified when outputbuf runs dry
+*/
+typedef struct {
+	uint32_t stream_used, stream_size, stream_min;
+	uint32_t output_used, output_size, output_min;
+	uint32_t device_frames, process_frames;
+	uint32_t latency_ms, latency_max_ms, start_latency_ms;
+	uint32_t underruns[UNDERRUN_CAUSES], underrun_ms;
+	// gapless transitions: audio of previous track still buffered when next one produced its 
+	// first frames, min is UINT32_MAX until there has been a transition (totals only)
+	uint32_t transitions, headroom_ms, headroom_min_ms;
+	// slimproto control channel over the last period (totals only)
+	uint32_t ctrl_packets_s, ctrl_bytes_s, ctrl_handler_ms, ctrl_stat, ctrl_stat_sends, ctrl_period_ms;
+} accounting_t;
+
+// called with output mutex locked
+void _accounting_output(uint32_t frames);
+void _accounting_track_start(void);
+void _accounting_stream_start(void);
+void _accounting_output_late(uint32_t frames);
+void _accounting_transition(uint32_t headroom_ms);
+void _accounting_control(uint32_t period_ms, uint32_t packets, uint32_t bytes, uint32_t handler_ms, uint32_t stat, uint32_t stat_sends);
+
+// current track and totals since boot
+void accounting_get(accounting_t *track, accounting_t *total);
+int  accounting_report(char *buf, size_t size);
@@ -14,6 +14,27 @@
 #include "driver/i2c.h"
 
 typedef enum { ADAC_ON = 0, ADAC_STANDBY, ADAC_OFF } adac_power_e;
+typedef enum { ADAC_VAL8 = 0, ADAC_VAL16, ADAC_VAL9 } adac_format_e;
+
+/* 
+ Register sequences are sent as one I2C command link, only broken where an entry 
+ has a delay (ms, applied after the write). The last value written to each register 
+ is cached so that rewriting the same value costs nothing. ADAC_VAL9 is the 7 bits 
+ address + 9 bits value format of Wolfson codecs
+*/ 
+typedef struct {
+	uint8_t reg;
+	uint16_t value;
+	uint16_t delay;
+} adac_seq_t;
+
+typedef struct {
+	int addr;
+	adac_format_e format;
+	bool nocache;				// never skip writes (unknown codec, self-clearing bits...)
+	uint32_t cached[256 / 32];
+	uint16_t shadow[256];
+} adac_dev_t;
 
 struct adac_s {
 	char *model;
@@ -38,3 +59,9 @@ esp_err_t 	adac_write_byte(int i2c_addr, uint8_t reg, uint8_t val);
 esp_err_t 	adac_write_word(int i2c_addr, uint8_t reg, uint16_t val);
 uint8_t 	adac_read_byte(int i2c_addr, uint8_t reg);
 uint16_t 	adac_read_word(int i2c_addr, uint8_t reg);
+
+void		adac_dev_init(adac_dev_t *dev, int i2c_addr, adac_format_e format);
+void		adac_dev_invalidate(adac_dev_t *dev);
+bool		adac_dev_cached(adac_dev_t *dev, uint8_t reg, uint16_t *value);
+esp_err_t	adac_dev_write(adac_dev_t *dev, uint8_t reg, uint16_t value);
+esp_err_t	adac_dev_sequence(adac_dev_t *dev, const adac_seq_t *seq, size_t count);
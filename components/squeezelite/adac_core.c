@@ -195,4 +195,124 @@ esp_err_t adac_write(int i2c_addr, uint8_t reg, uint8_t *data, size_t count) {
 	}
 	
 	return ret;
-}	
\ No newline at end of file
+}	
+/****************************************************************************************
+ * Register cache, device context
+ */
+void adac_dev_init(adac_dev_t *dev, int i2c_addr, adac_format_e format) {
+	memset(dev, 0, sizeof(*dev));
+	dev->addr = i2c_addr;
+	dev->format = format;
+}
+
+void adac_dev_invalidate(adac_dev_t *dev) {
+	memset(dev->cached, 0, sizeof(dev->cached));
+}
+
+bool adac_dev_cached(adac_dev_t *dev, uint8_t reg, uint16_t *value) {
+	if (!(dev->cached[reg >> 5] & (1 << (reg & 0x1f)))) return false;
+	if (value) *value = dev->shadow[reg];
+	return true;
+}
+
+/****************************************************************************************
+ * Queue one register write in a command link (data are copied byte per byte as link 
+ * only keeps pointers when writing buffers)
+ */
+static void dev_queue(adac_dev_t *dev, i2c_cmd_handle_t cmd, uint8_t reg, uint16_t value) {
+	i2c_master_start(cmd);
+	i2c_master_write_byte(cmd, (dev->addr << 1) | I2C_MASTER_WRITE, I2C_MASTER_NACK);
+	
+	switch (dev->format) {
+	case ADAC_VAL9:
+		i2c_master_write_byte(cmd, (reg << 1) | ((value >> 8) & 0x01), I2C_MASTER_NACK);
+		i2c_master_write_byte(cmd, value, I2C_MASTER_NACK);
+		break;
+	case ADAC_VAL16:
+		i2c_master_write_byte(cmd, reg, I2C_MASTER_NACK);
+		i2c_master_write_byte(cmd, value >> 8, I2C_MASTER_NACK);
+		i2c_master_write_byte(cmd, value, I2C_MASTER_NACK);
+		break;
+	default:	
+		i2c_master_write_byte(cmd, reg, I2C_MASTER_NACK);
+		i2c_master_write_byte(cmd, value, I2C_MASTER_NACK);
+		break;
+	}
+	
+	dev->shadow[reg] = value;
+	dev->cached[reg >> 5] |= 1 << (reg & 0x1f);
+}
+
+/****************************************************************************************
+ * Send queued writes, invalidate all of them if transaction failed 
+ */
+static esp_err_t dev_flush(adac_dev_t *dev, i2c_cmd_handle_t cmd, const adac_seq_t *seq, size_t count, int queued) {
+	esp_err_t ret;
+	
+	i2c_master_stop(cmd);
+	// ~100us per register at 250kHz, leave room for clock stretching
+	ret = i2c_master_cmd_begin(i2c_port, cmd, (100 + queued) / portTICK_RATE_MS);
+	
+	if (ret != ESP_OK) {
+		ESP_LOGW(TAG, "I2C sequence of %d writes failed (%d)", queued, ret);
+		for (int i = 0; i < count; i++) dev->cached[seq[i].reg >> 5] &= ~(1 << (seq[i].reg & 0x1f));
+	}	
+		
+	return ret;
+}
+
+/****************************************************************************************
+ * Write a register sequence, skipping registers that already have the value. Writes 
+ * are grouped in a single I2C transaction (repeated START) up to an entry with a delay
+ */
+esp_err_t adac_dev_sequence(adac_dev_t *dev, const adac_seq_t *seq, size_t count) {
+	i2c_cmd_handle_t cmd = NULL;
+	esp_err_t ret = ESP_OK;
+	int queued = 0, written = 0, batches = 0, first = 0;
+	
+	for (int i = 0; i < count; i++) {
+		uint16_t value;
+		
+		// an entry with a delay is always written, it is likely a reset or a power-up
+		if (!seq[i].delay && !dev->nocache && adac_dev_cached(dev, seq[i].reg, &value) && value == seq[i].value) continue;
+		
+		if (!cmd) {
+			cmd = i2c_cmd_link_create();
+			first = i;
+		}	
+		
+		dev_queue(dev, cmd, seq[i].reg, seq[i].value);
+		queued++;
+		
+		if (seq[i].delay) {
+			esp_err_t err = dev_flush(dev, cmd, seq + first, i - first + 1, queued);
+			if (err != ESP_OK) ret = err;
+			i2c_cmd_link_delete(cmd);
+			cmd = NULL;
+			written += queued;
+			queued = 0;
+			batches++;
+			vTaskDelay(seq[i].delay / portTICK_PERIOD_MS);
+		}	
+	}
+	
+	if (cmd) {
+		esp_err_t err = dev_flush(dev, cmd, seq + first, count - first, queued);
+		if (err != ESP_OK) ret = err;
+		i2c_cmd_link_delete(cmd);
+		written += queued;
+		batches++;
+	}	
+
+	ESP_LOGD(TAG, "I2C sequence for 0x%02x: %d/%zu writes in %d transactions", dev->addr, written, count, batches);
+	
+	return ret;
+}
+
+/****************************************************************************************
+ * Single cached write
+ */
+esp_err_t adac_dev_write(adac_dev_t *dev, uint8_t reg, uint16_t value) {
+	adac_seq_t seq = { reg, value, 0 };
+	return adac_dev_sequence(dev, &seq, 1);
+}
@@ -15,8 +15,7 @@ CFLAGS += -O3 -DLINKALL -DLOOPBACK -DNO_FAAD -DRESAMPLE16 -DEMBEDDED -DTREMOR_ON
 	-I$(COMPONENT_PATH)/../codecs/inc/opusfile	\
 	-I$(COMPONENT_PATH)/../driver_bt			\
 	-I$(COMPONENT_PATH)/../raop					\
-	-I$(COMPONENT_PATH)/../services				\
-	-I$(COMPONENT_PATH)/../audio/inc
+	-I$(COMPONENT_PATH)/../services
 
 #	-I$(COMPONENT_PATH)/../codecs/inc/faad2
 
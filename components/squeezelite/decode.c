@@ -53,11 +53,27 @@ static bool running = true;
 #define MAY_PROCESS(x)
 #endif
 
+/* 
+ *  Gapless pre-roll: the next track is decoded behind output.track_start while the current one still plays
+ *  from outputbuf. When a new stream produces its first frames, measure how much of the previous track was 
+ *  still buffered (outputbuf + device), which is the margin we had before an audible gap.
+ */
+static void _preroll_headroom(void) {
+	size_t bytes;
+
+	if (output.state != OUTPUT_RUNNING || !output.track_start || !output.current_sample_rate) return;
+
+	if (output.track_start >= outputbuf->readp) bytes = output.track_start - outputbuf->readp;
+	else bytes = outputbuf->size - (outputbuf->readp - output.track_start);
+
+	_accounting_transition((u64_t) (bytes / BYTES_PER_FRAME + output.device_frames + output.frames_in_process) * 1000 / output.current_sample_rate);
+}
+
 static void *decode_thread() {
 	
 	while (running) {
 		size_t bytes, space, min_space;
-		bool toend;
+		bool toend, new_stream;
 		bool ran = false;
 		
 		LOCK_S;
@@ -78,12 +94,24 @@ static void *decode_thread() {
 				min_space = codec->min_space;
 			);
 			IF_PROCESS(
+				// a chunk might still be on its way to outputbuf from process thread
+				size_t pending = process_pending_frames() * BYTES_PER_FRAME;
+				space = space > pending ? space - pending : 0;
 				min_space = process.max_out_frames * BYTES_PER_FRAME;
 			);
 
 			if (space > min_space && (bytes > codec->min_read_bytes || toend)) {
 				
+				new_stream = decode.new_stream;
+				PERF_TRACE_BEGIN(PERF_DECODE);
 				decode.state = codec->decode();
+				PERF_TRACE_END(PERF_DECODE);
+
+				if (new_stream && !decode.new_stream) {
+					LOCK_O;
+					_preroll_headroom();
+					UNLOCK_O;
+				}
 
 				IF_PROCESS(
 					if (process.in_frames) {
@@ -110,10 +138,13 @@ static void *decode_thread() {
 			}
 		}
 		
+		// poll faster while waiting for the first bytes of a new stream so pre-roll starts asap
+		new_stream = decode.state == DECODE_RUNNING && decode.new_stream;
+
 		UNLOCK_D;
 
 		if (!ran) {
-			usleep(100000);
+			usleep(new_stream ? 10000 : 100000);
 		}
 	}
 	
@@ -19,8 +19,29 @@
 
 
 #if CONFIG_BT_SINK
+#include "freertos/ringbuf.h"
+#include "esp_timer.h"
 #include "bt_app_sink.h"
 static bool enable_bt_sink;
+
+#define BT_INGRESS_SIZE			(32*1024)
+#define BT_INGRESS_CHUNK		(4*1024)
+#define BT_INGRESS_WAIT_MS		10
+#define BT_INGRESS_STACK_SIZE	3072
+
+/* 
+ A2DP callback only pushes into this ring and never waits. A dedicated task moves data 
+ to outputbuf by large blocks, waiting for room there without holding anybody else
+*/
+static struct {
+	RingbufHandle_t handle;
+	uint8_t *buf;
+	StaticRingbuffer_t ringbuf;
+	bool running, flush;
+	TaskHandle_t task;
+	u32_t drops, packets, wait_ms;
+	u32_t cb_max_us, cb_total_us;
+} bt_ingress;
 #endif
 
 #if CONFIG_AIRPLAY_SINK
@@ -33,6 +54,7 @@ static bool enable_airplay;
 #define SYNC_WIN_FAST	2
 
 static raop_event_t	raop_state;
+static bool abort_sink;
 
 static EXT_RAM_ATTR struct {
 	bool enabled;
@@ -42,8 +64,6 @@ static EXT_RAM_ATTR struct {
 } raop_sync;
 #endif
 
-static bool abort_sink ;
-
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #define LOCK_D   mutex_lock(decode.mutex);
@@ -58,8 +78,9 @@ extern struct buffer *outputbuf;
 extern log_level loglevel;
 
 /****************************************************************************************
- * Common sink data handler
+ * AirPlay sink data handler
  */
+#if CONFIG_AIRPLAY_SINK
 static void sink_data_handler(const uint8_t *data, uint32_t len)
 {
     size_t bytes, space;
@@ -107,11 +128,117 @@ static void sink_data_handler(const uint8_t *data, uint32_t len)
 		LOG_WARN("Waited too long, dropping frames");
 	}
 }
+#endif
 
 /****************************************************************************************
- * BT sink command handler
+ * BT sink data handler (A2DP callback), must not block
  */
 #if CONFIG_BT_SINK
+static void bt_sink_data_handler(const uint8_t *data, uint32_t len) {
+	int64_t start = esp_timer_get_time();
+
+	if (!output.external) {
+		LOG_SDEBUG("Cannot use external sink while LMS is controlling player");
+		return;
+	}
+
+	// partial frames would shift channels forever
+	len &= ~0x03;
+	if (!xRingbufferSend(bt_ingress.handle, data, len, 0)) bt_ingress.drops += len;
+
+	u32_t elapsed = esp_timer_get_time() - start;
+	if (elapsed > bt_ingress.cb_max_us) bt_ingress.cb_max_us = elapsed;
+	bt_ingress.cb_total_us += elapsed;
+	bt_ingress.packets++;
+}
+
+/****************************************************************************************
+ * Move BT ingress data to outputbuf, wait (unlocked) for room if needed
+ */
+static void bt_ingress_write(const uint8_t *data, size_t len) {
+	LOCK_O;
+
+	while (len && !bt_ingress.flush && output.external == DECODE_BT) {
+		size_t bytes = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / (BYTES_PER_FRAME / 4);
+
+		if (!bytes) {
+			UNLOCK_O;
+			vTaskDelay(pdMS_TO_TICKS(BT_INGRESS_WAIT_MS));
+			bt_ingress.wait_ms += BT_INGRESS_WAIT_MS;
+			LOCK_O;
+			continue;
+		}
+
+		bytes = min(len, bytes);
+#if BYTES_PER_FRAME == 4
+		memcpy(outputbuf->writep, data, bytes);
+#else
+		{
+			s16_t *iptr = (s16_t*) data;
+			ISAMPLE_T *optr = (ISAMPLE_T *) outputbuf->writep;
+			size_t n = bytes / 2;
+			while (n--) *optr++ = *iptr++ << 16;
+		}
+#endif
+		_buf_inc_writep(outputbuf, bytes * BYTES_PER_FRAME / 4);
+		len -= bytes;
+		data += bytes;
+	}
+
+	UNLOCK_O;
+}
+
+/****************************************************************************************
+ * Discard whatever is queued in BT ingress
+ */
+static void bt_ingress_drain(void) {
+	size_t bytes;
+	uint8_t *data;
+
+	while ((data = xRingbufferReceiveUpTo(bt_ingress.handle, &bytes, 0, BT_INGRESS_SIZE)) != NULL) {
+		vRingbufferReturnItem(bt_ingress.handle, data);
+	}
+}
+
+/****************************************************************************************
+ * BT ingress task
+ */
+static void bt_ingress_thread(void *arg) {
+	while (bt_ingress.running) {
+		size_t bytes;
+		uint8_t *data;
+
+		if (bt_ingress.flush) {
+			bt_ingress_drain();
+			bt_ingress.flush = false;
+		}
+
+		data = xRingbufferReceiveUpTo(bt_ingress.handle, &bytes, pdMS_TO_TICKS(100), BT_INGRESS_CHUNK);
+		if (!data) continue;
+
+		bt_ingress_write(data, bytes);
+		vRingbufferReturnItem(bt_ingress.handle, data);
+	}
+
+	bt_ingress.task = NULL;
+	vTaskDelete(NULL);
+}
+
+/****************************************************************************************
+ * BT ingress statistics
+ */
+static void bt_ingress_stats(bool reset) {
+	if (bt_ingress.packets) {
+		LOG_INFO("BT ingress: %u packets, dropped %u bytes, waited %u ms, callback max %u us (avg %u)",
+				 bt_ingress.packets, bt_ingress.drops, bt_ingress.wait_ms, bt_ingress.cb_max_us,
+				 bt_ingress.cb_total_us / bt_ingress.packets);
+	}
+	if (reset) bt_ingress.drops = bt_ingress.packets = bt_ingress.wait_ms = bt_ingress.cb_max_us = bt_ingress.cb_total_us = 0;
+}
+
+/****************************************************************************************
+ * BT sink command handler
+ */
 static bool bt_sink_cmd_handler(bt_sink_cmd_t cmd, va_list args) 
 {
 	// don't LOCK_O as there is always a chance that LMS takes control later anyway
@@ -133,6 +260,11 @@ static bool bt_sink_cmd_handler(bt_sink_cmd_t cmd, va_list args)
 		output.state = OUTPUT_STOPPED;
 		output.frames_played = 0;
 		if (decode.state != DECODE_STOPPED) decode.state = DECODE_ERROR;
+		/* a stop might not have been served yet by ingress task, so drop what is left of
+		previous stream here, then clear flush or it would eat the start of this one */
+		if (bt_ingress.running) bt_ingress_drain();
+		bt_ingress.flush = false;
+		bt_ingress_stats(true);
 		LOG_INFO("BT sink started");
 		break;
 	case BT_SINK_AUDIO_STOPPED:	
@@ -140,6 +272,8 @@ static bool bt_sink_cmd_handler(bt_sink_cmd_t cmd, va_list args)
 			if (output.state > OUTPUT_STOPPED) output.state = OUTPUT_STOPPED;
 			output.external = 0;
 			output.stop_time = gettime_ms();
+			bt_ingress.flush = true;
+			bt_ingress_stats(true);
 			LOG_INFO("BT sink stopped");
 		}	
 		break;
@@ -151,7 +285,8 @@ static bool bt_sink_cmd_handler(bt_sink_cmd_t cmd, va_list args)
 		_buf_flush(outputbuf);
 		output.state = OUTPUT_STOPPED;
 		output.stop_time = gettime_ms();
-		abort_sink = true;
+		bt_ingress.flush = true;
+		bt_ingress_stats(false);
 		LOG_INFO("BT stop");
 		break;
 	case BT_SINK_PAUSE:		
@@ -334,7 +469,24 @@ void register_external(void) {
 		enable_bt_sink = !strcmp(p,"1") || !strcasecmp(p,"y");
 		free(p);
 		if (!strcasestr(output.device, "BT") && enable_bt_sink) {
-			bt_sink_init(bt_sink_cmd_handler, sink_data_handler);
+			bt_ingress.buf = malloc(BT_INGRESS_SIZE);
+			bt_ingress.handle = bt_ingress.buf ? xRingbufferCreateStatic(BT_INGRESS_SIZE, RINGBUF_TYPE_BYTEBUF, bt_ingress.buf, &bt_ingress.ringbuf) : NULL;
+			bt_ingress.running = bt_ingress.handle != NULL;
+			if (bt_ingress.running && xTaskCreate(bt_ingress_thread, "bt_ingress", BT_INGRESS_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN + 3, &bt_ingress.task) != pdPASS) {
+				bt_ingress.running = false;
+				bt_ingress.task = NULL;
+				vRingbufferDelete(bt_ingress.handle);
+			}
+			if (bt_ingress.running) {
+				bt_sink_init(bt_sink_cmd_handler, bt_sink_data_handler);
+			} else {
+				LOG_ERROR("Cannot create BT ingress buffer or task, BT sink disabled");
+				free(bt_ingress.buf);
+				bt_ingress.buf = NULL;
+				bt_ingress.handle = NULL;
+				// so that deregister_external has nothing to undo
+				enable_bt_sink = false;
+			}
 		}	
 	}
 #endif	
@@ -355,6 +507,11 @@ void deregister_external(void) {
 #if CONFIG_BT_SINK
 	if (!strcasestr(output.device, "BT") && enable_bt_sink) {
 		bt_sink_deinit();
+		bt_ingress.running = false;
+		while (bt_ingress.task) vTaskDelay(pdMS_TO_TICKS(10));
+		vRingbufferDelete(bt_ingress.handle);
+		free(bt_ingress.buf);
+		bt_ingress.buf = NULL;
 	}
 #endif
 
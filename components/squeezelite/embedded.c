@@ -40,6 +40,28 @@ int	pthread_create_name(pthread_t *thread, _CONST pthread_attr_t  *attr,
 	return pthread_create(thread, attr, start_routine, arg);
 }
 
+int	pthread_create_name_core(pthread_t *thread, _CONST pthread_attr_t  *attr, 
+				   void *(*start_routine)( void * ), void *arg, char *name, int core) {
+	esp_pthread_cfg_t cfg = esp_pthread_get_default_config(); 
+	cfg.thread_name = name; 
+	cfg.inherit_cfg = true; 
+	int ret;
+	cfg.pin_to_core = core >= 0 ? core : tskNO_AFFINITY;
+	esp_pthread_set_cfg(&cfg); 
+	ret = pthread_create(thread, attr, start_routine, arg);
+	// don't let affinity leak to next threads created by caller
+	cfg.pin_to_core = esp_pthread_get_default_config().pin_to_core;
+	esp_pthread_set_cfg(&cfg);
+	return ret;
+}
+
+int embedded_process_core(void) {
+	char *p = config_alloc_get_default(NVS_TYPE_STR, "process_core", STR(CONFIG_PROCESS_THREAD_CORE), 0);
+	int core = p ? atoi(p) : CONFIG_PROCESS_THREAD_CORE;
+	free(p);
+	return core < portNUM_PROCESSORS ? core : -1;
+}
+
 uint32_t _gettime_ms_(void) {
 	return (uint32_t) (esp_timer_get_time() / 1000);
 }
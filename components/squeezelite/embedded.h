@@ -2,6 +2,8 @@
 #define EMBEDDED_H
 #include <ctype.h>
 #include <inttypes.h>
+#include "perf_trace.h"
+#include "accounting.h"
 
 /* 	must provide 
 		- mutex_create_p
@@ -15,6 +17,8 @@
 		- gettime_ms
 		- BASE_CAP
 		- EXT_BSS 		
+		- STREAM_HIGH_WATERMARK / STREAM_LOW_WATERMARK
+		- PERF_TRACE_BEGIN / PERF_TRACE_END / PERF_TRACE_VALUE 
 	recommended to add platform specific include(s) here
 */	
 
@@ -34,6 +38,14 @@ typedef unsigned long long u64_t;
 #define DECODE_THREAD_STACK_SIZE 14 * 1024
 #define OUTPUT_THREAD_STACK_SIZE  4 * 1024
 #define IR_THREAD_STACK_SIZE      4 * 1024
+#define PROCESS_THREAD_STACK_SIZE 6 * 1024
+
+// core for the process thread when PROCESS_THREAD is set, -1 for no affinity
+#define PROCESS_THREAD_CORE	embedded_process_core()
+
+// once playing, refill streambuf of seekable streams in bursts to let Wi-Fi sleep
+#define STREAM_HIGH_WATERMARK	90
+#define STREAM_LOW_WATERMARK	40
 
 // number of times the 5s search for a server will happen before slimproto exits (0 = no limit)
 #define MAX_SERVER_RETRIES	5
@@ -60,6 +72,9 @@ uint32_t 	_gettime_ms_(void);
 
 int			pthread_create_name(pthread_t *thread, _CONST pthread_attr_t  *attr, 
 				   void *(*start_routine)( void * ), void *arg, char *name);
+int			pthread_create_name_core(pthread_t *thread, _CONST pthread_attr_t  *attr, 
+				   void *(*start_routine)( void * ), void *arg, char *name, int core);
+int			embedded_process_core(void);
 
 // must provide	of #define as empty macros		
 void		embedded_init(void);
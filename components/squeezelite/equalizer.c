@@ -1,4 +1,4 @@
-/* 
+/*
  *  Squeezelite for esp32
  *
  *  (c) Philippe G. 2020, philippe_44@outlook.com
@@ -8,20 +8,245 @@
  *
  */
 
+#include <math.h>
 #include "platform_config.h"
-#include "squeezelite.h" 
+#include "squeezelite.h"
 #include "equalizer.h"
-#include "esp_equalizer.h"
 
-#define EQ_BANDS 10
- 
+#define EQ_BANDS 		10
+#define EQ_STAGES		(EQ_BANDS + 2)	// bands + low/high shelves of presets
+#define EQ_Q			1.414f			// one octave
+#define EQ_COEF_BITS	26				// coefficients are Q5.26
+#define EQ_MAX_GAIN		24				// dB
+#define EQ_RAMP_FRAMES	32				// coefficients change every RAMP_FRAMES...
+#define EQ_RAMP_STEPS	32				// ... for RAMP_STEPS times
+
+// samples are processed with 24 bits resolution, whatever the frame size
+#define EQ_MAX			((1 << 23) - 1)
+#define EQ_MIN			(-(1 << 23))
+#if BYTES_PER_FRAME == 4
+#define TO_EQ(s)		((s32_t) (s) * 256)
+#define FROM_EQ(x)		((x) >> 8)
+#else
+#define TO_EQ(s)		((s) >> 8)
+#define FROM_EQ(x)		((x) * 256)
+#endif
+
+typedef enum { EQ_PEAK, EQ_LOW_SHELF, EQ_HIGH_SHELF } eq_type_e;
+
+typedef struct {
+	s32_t b0, b1, b2, a1, a2;
+} biquad_t;
+
+static const struct {
+	eq_type_e type;
+	float freq;
+} stages[EQ_STAGES] = {
+	{ EQ_PEAK, 31.25 }, { EQ_PEAK, 62.5 }, { EQ_PEAK, 125 }, { EQ_PEAK, 250 }, { EQ_PEAK, 500 },
+	{ EQ_PEAK, 1000 }, { EQ_PEAK, 2000 }, { EQ_PEAK, 4000 }, { EQ_PEAK, 8000 }, { EQ_PEAK, 16000 },
+	{ EQ_LOW_SHELF, 100 }, { EQ_HIGH_SHELF, 10000 },
+};
+
+static const struct {
+	char *name;
+	s8_t low, high;
+} presets[] = {
+	{ "loudness", 6, 4 },
+	{ "bass", 6, 0 },
+	{ NULL, 0, 0 },
+};
+
 static log_level loglevel = lINFO;
- 
+
+/* 
+ Updates are prepared by the (single) control thread in the set that is not published, 
+ then published by bumping the generation, whose parity is the set index. Output thread 
+ picks a new generation at block boundary and only uses the set if its sequence did not 
+ move while copying it (it is odd while being written), otherwise it retries next block
+*/ 
+typedef struct {
+	u32_t seq;
+	u32_t sample_rate;
+	s8_t gain[EQ_STAGES];
+	biquad_t coefs[EQ_STAGES];
+} eq_set_t;
+
 static struct {
-	void *handle;
-	float gain[EQ_BANDS];
-	bool update;
-} equalizer = { .update = true };
+	// control side
+	s8_t gain[EQ_STAGES];
+	eq_set_t sets[2];
+	u32_t generation;
+	// output side
+	u32_t sample_rate, applied;
+	s8_t applied_gain[EQ_STAGES];
+	int ramp, active;
+	struct eq_stage_s {
+		bool active;
+		biquad_t coefs, target, step;
+		s32_t x[2][2], y[2][2];
+		s64_t err[2];
+	} stage[EQ_STAGES];
+} equalizer;
+
+/****************************************************************************************
+ * Biquad coefficients (RBJ cookbook), identity when gain is 0 or band is out of range.
+ * Computed in double as float loses low bands at high rates (-0.15 dB at 31 Hz/192 kHz)
+ */
+static void biquad_compute(biquad_t *biquad, eq_type_e type, float freq, s8_t gain, u32_t sample_rate) {
+	double b0, b1, b2, a0, a1, a2;
+
+	if (!gain || freq >= sample_rate * 0.45f) {
+		*biquad = (biquad_t) { 1 << EQ_COEF_BITS, 0, 0, 0, 0 };
+		return;
+	}
+
+	// coefficients must fit in Q5.26
+	if (gain > EQ_MAX_GAIN) gain = EQ_MAX_GAIN;
+	else if (gain < -EQ_MAX_GAIN) gain = -EQ_MAX_GAIN;
+	double A = pow(10, gain / 40.0), w0 = 2 * M_PI * freq / sample_rate;
+	double c = cos(w0), s = sin(w0);
+
+	if (type == EQ_PEAK) {
+		double alpha = s / (2 * EQ_Q);
+		b0 = 1 + alpha * A; b1 = -2 * c; b2 = 1 - alpha * A;
+		a0 = 1 + alpha / A; a1 = -2 * c; a2 = 1 - alpha / A;
+	} else {
+		// shelf slope of 1
+		double beta = 2 * sqrt(A) * s / 2 * sqrt(2);
+		double sign = type == EQ_LOW_SHELF ? 1 : -1;
+		b0 = A * ((A + 1) - sign * (A - 1) * c + beta);
+		b1 = sign * 2 * A * ((A - 1) - sign * (A + 1) * c);
+		b2 = A * ((A + 1) - sign * (A - 1) * c - beta);
+		a0 = (A + 1) + sign * (A - 1) * c + beta;
+		a1 = -sign * 2 * ((A - 1) + sign * (A + 1) * c);
+		a2 = (A + 1) + sign * (A - 1) * c - beta;
+	}
+
+	double scale = (1 << EQ_COEF_BITS) / a0;
+	biquad->b0 = lrint(b0 * scale);
+	biquad->b1 = lrint(b1 * scale);
+	biquad->b2 = lrint(b2 * scale);
+	biquad->a1 = lrint(a1 * scale);
+	biquad->a2 = lrint(a2 * scale);
+}
+
+static bool biquad_identity(biquad_t *biquad) {
+	return biquad->b0 == 1 << EQ_COEF_BITS && !biquad->b1 && !biquad->b2 && !biquad->a1 && !biquad->a2;
+}
+
+/****************************************************************************************
+ * Get latest published set if any, false when there is none or it was being rewritten
+ */
+static bool equalizer_fetch(eq_set_t *set) {
+	u32_t generation = __atomic_load_n(&equalizer.generation, __ATOMIC_ACQUIRE);
+	eq_set_t *published = equalizer.sets + (generation & 0x01);
+	u32_t seq = __atomic_load_n(&published->seq, __ATOMIC_ACQUIRE);
+
+	if (generation == equalizer.applied || (seq & 0x01)) return false;
+
+	memcpy(set, published, sizeof(eq_set_t));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&published->seq, __ATOMIC_RELAXED) != seq) return false;
+
+	equalizer.applied = generation;
+	memcpy(equalizer.applied_gain, set->gain, sizeof(set->gain));
+	return true;
+}
+
+/****************************************************************************************
+ * Set targets of all stages and ramp to them, or jump when sample rate changes
+ */
+static void equalizer_set(biquad_t *targets, bool ramp) {
+	equalizer.ramp = ramp ? EQ_RAMP_STEPS : 0;
+	equalizer.active = 0;
+
+	for (int i = 0; i < EQ_STAGES; i++) {
+		struct eq_stage_s *stage = equalizer.stage + i;
+		bool active = stage->active;
+
+		stage->target = targets[i];
+
+		// an inactive stage is identity with no history
+		if (!active) {
+			memset(stage->x, 0, sizeof(stage->x));
+			memset(stage->y, 0, sizeof(stage->y));
+			memset(stage->err, 0, sizeof(stage->err));
+		}	
+		if (!ramp) stage->coefs = stage->target;
+		else if (!active) stage->coefs = (biquad_t) { 1 << EQ_COEF_BITS, 0, 0, 0, 0 };
+
+		// when ramping, an active stage stays active until it has reached identity
+		stage->active = (ramp && active) || !biquad_identity(&stage->target);
+		if (!stage->active) continue;
+
+		equalizer.active++;
+		stage->step.b0 = (stage->target.b0 - stage->coefs.b0) / EQ_RAMP_STEPS;
+		stage->step.b1 = (stage->target.b1 - stage->coefs.b1) / EQ_RAMP_STEPS;
+		stage->step.b2 = (stage->target.b2 - stage->coefs.b2) / EQ_RAMP_STEPS;
+		stage->step.a1 = (stage->target.a1 - stage->coefs.a1) / EQ_RAMP_STEPS;
+		stage->step.a2 = (stage->target.a2 - stage->coefs.a2) / EQ_RAMP_STEPS;
+	}
+}
+
+/****************************************************************************************
+ * Move coefficients one step towards targets, deactivate identity stages when done
+ */
+static void equalizer_ramp(void) {
+	if (--equalizer.ramp) {
+		for (int i = 0; i < EQ_STAGES; i++) {
+			struct eq_stage_s *stage = equalizer.stage + i;
+			stage->coefs.b0 += stage->step.b0;
+			stage->coefs.b1 += stage->step.b1;
+			stage->coefs.b2 += stage->step.b2;
+			stage->coefs.a1 += stage->step.a1;
+			stage->coefs.a2 += stage->step.a2;
+		}
+		return;
+	}
+
+	equalizer.active = 0;
+	for (int i = 0; i < EQ_STAGES; i++) {
+		struct eq_stage_s *stage = equalizer.stage + i;
+		stage->coefs = stage->target;
+		stage->active = !biquad_identity(&stage->target);
+		if (stage->active) equalizer.active++;
+	}
+}
+
+/****************************************************************************************
+ * Run all active stages on a block, sample per sample so that precision is kept. What is
+ * truncated from each output goes into the next one, otherwise low bands at high rates,
+ * whose poles are close to 1, turn it into a large DC offset (-6 dB cut measured -3 dB)
+ */
+static void equalizer_run(ISAMPLE_T *samples, frames_t frames) {
+	struct eq_stage_s *active[EQ_STAGES];
+	int n = 0;
+
+	for (int i = 0; i < EQ_STAGES; i++) if (equalizer.stage[i].active) active[n++] = equalizer.stage + i;
+
+	while (frames--) {
+		for (int ch = 0; ch < 2; ch++) {
+			s32_t x = TO_EQ(*samples);
+
+			for (int i = 0; i < n; i++) {
+				struct eq_stage_s *stage = active[i];
+				s64_t acc = (s64_t) stage->coefs.b0 * x + (s64_t) stage->coefs.b1 * stage->x[ch][0] +
+							(s64_t) stage->coefs.b2 * stage->x[ch][1] - (s64_t) stage->coefs.a1 * stage->y[ch][0] -
+							(s64_t) stage->coefs.a2 * stage->y[ch][1] + stage->err[ch];
+				stage->x[ch][1] = stage->x[ch][0];
+				stage->x[ch][0] = x;
+				x = acc >> EQ_COEF_BITS;
+				stage->err[ch] = acc - ((s64_t) x << EQ_COEF_BITS);
+				stage->y[ch][1] = stage->y[ch][0];
+				stage->y[ch][0] = x;
+			}
+
+			if (x > EQ_MAX) x = EQ_MAX;
+			else if (x < EQ_MIN) x = EQ_MIN;
+			*samples++ = FROM_EQ(x);
+		}
+	}
+}
 
 /****************************************************************************************
  * initialize equalizer
@@ -29,91 +254,123 @@ static struct {
 void equalizer_init(void) {
 	s8_t gain[EQ_BANDS] = { };
 	char *config = config_alloc_get(NVS_TYPE_STR, "equalizer");
-	char *p = strtok(config, ", !");	
-	
+	char *p = strtok(config, ", !");
+
 	for (int i = 0; p && i < EQ_BANDS; i++) {
 		gain[i] = atoi(p);
 		p = strtok(NULL, ", :");
 	}
-			
-	free(config);	
+
+	free(config);
+
+	// optional loudness or bass boost on top of bands
+	config = config_alloc_get_default(NVS_TYPE_STR, "eq_preset", "", 0);
+	for (int i = 0; config && presets[i].name; i++) {
+		if (strcasecmp(config, presets[i].name)) continue;
+		equalizer.gain[EQ_BANDS] = presets[i].low;
+		equalizer.gain[EQ_BANDS + 1] = presets[i].high;
+		LOG_INFO("equalizer preset %s", presets[i].name);
+	}
+	free(config);
+
 	equalizer_update(gain);
-		
+
 	LOG_INFO("initializing equalizer");
-}	
- 
+}
+
 /****************************************************************************************
  * open equalizer
  */
 void equalizer_open(u32_t sample_rate) {
-	// in any case, need to clear update flag
-	equalizer.update = false;
-	
-	if (sample_rate != 11025 && sample_rate != 22050 && sample_rate != 44100 && sample_rate != 48000) {
-		LOG_WARN("equalizer only supports 11025, 22050, 44100 and 48000 sample rates, not %u", sample_rate);
-		return;
-	}	
-	
-	equalizer.handle = esp_equalizer_init(2, sample_rate, EQ_BANDS, 0);
-	    
-	if (equalizer.handle) {
-		bool active = false;
-		
-		for (int i = 0; i < EQ_BANDS; i++) {
-			esp_equalizer_set_band_value(equalizer.handle, equalizer.gain[i], i, 0);
-			esp_equalizer_set_band_value(equalizer.handle, equalizer.gain[i], i, 1);
-			active |= equalizer.gain[i] != 0;
-		}
-		
-		// do not activate equalizer if all gain are 0
-		if (!active) equalizer_close();
-		
-		LOG_INFO("equalizer initialized %u", active);
-	} else {
-		LOG_WARN("can't init equalizer");
-	}	
-}	
+	biquad_t targets[EQ_STAGES];
+	eq_set_t set;
+
+	__atomic_store_n(&equalizer.sample_rate, sample_rate, __ATOMIC_RELEASE);
+
+	// use latest gains but compute coefficients locally as rate is new
+	equalizer_fetch(&set);
+	for (int i = 0; i < EQ_STAGES; i++) {
+		biquad_compute(targets + i, stages[i].type, stages[i].freq, equalizer.applied_gain[i], sample_rate);
+	}
+
+	equalizer_set(targets, false);
+	LOG_INFO("equalizer opened at %u with %d stages", sample_rate, equalizer.active);
+}
 
 /****************************************************************************************
  * close equalizer
  */
 void equalizer_close(void) {
-	if (equalizer.handle) {
-		esp_equalizer_uninit(equalizer.handle);
-		equalizer.handle = NULL;
-	}
-}	
+	for (int i = 0; i < EQ_STAGES; i++) equalizer.stage[i].active = false;
+	equalizer.active = equalizer.ramp = 0;
+	__atomic_store_n(&equalizer.sample_rate, 0, __ATOMIC_RELEASE);
+}
 
 /****************************************************************************************
- * update equalizer gain
+ * update equalizer gain (from control thread only)
  */
 void equalizer_update(s8_t *gain) {
 	char config[EQ_BANDS * 4 + 1] = { };
 	char *p = config;
-	
+	u32_t generation = equalizer.generation + 1;
+	eq_set_t *set = equalizer.sets + (generation & 0x01);
+
 	for (int i = 0; i < EQ_BANDS; i++) {
 		equalizer.gain[i] = gain[i];
 		if (gain[i] < 0) *p++ = '-';
-		*p++ = (gain[i] / 10) + 0x30;
-		*p++ = (gain[i] % 10) + 0x30;
+		*p++ = (abs(gain[i]) / 10) + 0x30;
+		*p++ = (abs(gain[i]) % 10) + 0x30;
 		if (i < EQ_BANDS - 1) *p++ = ',';
 	}
-	
-	config_set_value(NVS_TYPE_STR, "equalizer", config);					
-	equalizer.update = true;
+
+	// prepare coefficients here so that output thread has nothing to compute
+	__atomic_store_n(&set->seq, set->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	set->sample_rate = __atomic_load_n(&equalizer.sample_rate, __ATOMIC_ACQUIRE);
+	memcpy(set->gain, equalizer.gain, sizeof(set->gain));
+	for (int i = 0; i < EQ_STAGES; i++) {
+		biquad_compute(set->coefs + i, stages[i].type, stages[i].freq, set->gain[i], set->sample_rate);
+	}
+	__atomic_store_n(&set->seq, set->seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&equalizer.generation, generation, __ATOMIC_RELEASE);
+
+	config_set_value(NVS_TYPE_STR, "equalizer", config);
 }
 
 /****************************************************************************************
- * process equalizer 
+ * process equalizer
  */
 void equalizer_process(u8_t *buf, u32_t bytes, u32_t sample_rate) {
-	// don't want to process with output locked, so take the small risk to miss one parametric update
-	if (equalizer.update) {
-		equalizer_close();
-		equalizer_open(sample_rate);
+	ISAMPLE_T *samples = (ISAMPLE_T*) buf;
+	frames_t frames = bytes / BYTES_PER_FRAME;
+
+	eq_set_t set;
+
+	// new set is applied at block boundary, unless it was made for another rate
+	if (sample_rate != equalizer.sample_rate) equalizer_open(sample_rate);
+	else if (equalizer_fetch(&set)) {
+		if (set.sample_rate == sample_rate) equalizer_set(set.coefs, true);
+		else equalizer_open(sample_rate);
 	}
-	
-	if (equalizer.handle) {
-		esp_equalizer_process(equalizer.handle, buf, bytes, sample_rate, 2);
-	}	
-}
\ No newline at end of file
+
+	if (!equalizer.active) return;
+
+	PERF_TRACE_BEGIN(PERF_EQUALIZER);
+
+	while (frames) {
+		frames_t count = frames;
+
+		if (equalizer.ramp) {
+			count = min(count, EQ_RAMP_FRAMES);
+			equalizer_ramp();
+		}
+
+		equalizer_run(samples, count);
+		samples += count * 2;
+		frames -= count;
+
+		if (!equalizer.active) break;
+	}
+
+	PERF_TRACE_END(PERF_EQUALIZER);
+}
@@ -31,6 +31,7 @@ static bool i2c_json_execute(char *set);
 const struct adac_s dac_external = { "i2s", init, adac_deinit, power, speaker, headset, volume };
 static cJSON *i2c_json;
 static int i2c_addr;
+static adac_dev_t i2c_dev;
 
 static struct {
 	char *model;
@@ -56,6 +57,10 @@ static bool init(char *config, int i2c_port_num, i2s_config_t *i2s_config) {
 	i2c_addr = adac_init(config, i2c_port_num);
 	if (!i2c_addr) return true;
 	
+	// we know nothing about the codec, so only batch writes
+	adac_dev_init(&i2c_dev, i2c_addr, ADAC_VAL8);
+	i2c_dev.nocache = true;
+	
 	ESP_LOGI(TAG, "DAC on I2C @%d", i2c_addr);
 	
 	p = config_alloc_get_str("dac_controlset", CONFIG_DAC_CONTROLSET, NULL);
@@ -117,44 +122,59 @@ static void headset(bool active) {
 bool i2c_json_execute(char *set) {
 	cJSON *json_set = cJSON_GetObjectItemCaseSensitive(i2c_json, set);
 	cJSON *item;
+	adac_seq_t *seq;
+	int count = 0;
 
 	if (!json_set) return true;
 	
+	// consecutive plain writes are sent as one sequence
+	seq = malloc(cJSON_GetArraySize(json_set) * sizeof(adac_seq_t));
+	if (!seq) return false;
+	
 	cJSON_ArrayForEach(item, json_set) {
 		cJSON *reg = cJSON_GetObjectItemCaseSensitive(item, "reg");
 		cJSON *val = cJSON_GetObjectItemCaseSensitive(item, "val");
+		cJSON *mode = cJSON_GetObjectItemCaseSensitive(item, "mode");
+		
+		if (!reg || !val) continue;
+		
+		if (!cJSON_IsArray(val) && !mode) {
+			seq[count++] = (adac_seq_t) { reg->valueint, val->valueint, 0 };
+			continue;
+		}	
+		
+		// flush what is pending as order matters
+		if (count) adac_dev_sequence(&i2c_dev, seq, count);
+		count = 0;
 		
 		if (cJSON_IsArray(val)) {
 			cJSON *value;			
 			uint8_t *data = malloc(cJSON_GetArraySize(val));
-			int count = 0;
+			int len = 0;
 			
 			if (!data) continue;
 			
 			cJSON_ArrayForEach(value, val) {
-				data[count++] = value->valueint;		
+				data[len++] = value->valueint;		
 			}
 			
-			adac_write(i2c_addr, reg->valueint, data, count);
+			adac_write(i2c_addr, reg->valueint, data, len);
 			free(data);			
 		} else {
-			cJSON *mode = cJSON_GetObjectItemCaseSensitive(item, "mode");
-
-			if (!reg || !val) continue;
+			uint8_t data = adac_read_byte(i2c_addr, reg->valueint);
 
-			if (!mode) {
-				adac_write_byte(i2c_addr, reg->valueint, val->valueint);
-			} else if (!strcasecmp(mode->valuestring, "or")) {
-				uint8_t data = adac_read_byte(i2c_addr,reg->valueint);
+			if (!strcasecmp(mode->valuestring, "or")) {
 				data |= (uint8_t) val->valueint;
-				adac_write_byte(i2c_addr, reg->valueint, data);
+				adac_dev_write(&i2c_dev, reg->valueint, data);
 			} else if (!strcasecmp(mode->valuestring, "and")) {
-				uint8_t data = adac_read_byte(i2c_addr, reg->valueint);
 				data &= (uint8_t) val->valueint;
-				adac_write_byte(i2c_addr, reg->valueint, data);
+				adac_dev_write(&i2c_dev, reg->valueint, data);
 			}
 		}
 	}
 	
+	if (count) adac_dev_sequence(&i2c_dev, seq, count);
+	free(seq);
+	
 	return true;
 }	
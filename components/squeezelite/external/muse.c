@@ -33,7 +33,7 @@
 #include "adac.h"
 #include "muse.h"
 #include <driver/adc.h>
-#include "driver/rmt.h"
+#include "ws2812.h"
 
 #define SPKOUT_EN ((1 << 9) | (1 << 11) | (1 << 7) | (1 << 5))
 #define EAROUT_EN ((1 << 11) | (1 << 12) | (1 << 13))
@@ -54,26 +54,11 @@
 #define LED_RMT_TX_CHANNEL   0
 #define LED_RMT_TX_GPIO      22
 
-
-#define BITS_PER_LED_CMD 24 
-#define LED_BUFFER_ITEMS ((NUM_LEDS * BITS_PER_LED_CMD))
-
-// These values are determined by measuring pulse timing with logic analyzer and adjusting to match datasheet. 
-#define T0H 14  // 0 bit high time
-#define T1H 52 // 1 bit high time
-#define TL  52  // low time for either bit
-
 #define GREEN   0xFF0000
 #define RED 	0x00FF00
 #define BLUE  	0x0000FF
 #define WHITE   0xFFFFFF
 #define YELLOW  0xE0F060
-struct led_state {
-    uint32_t leds[NUM_LEDS];
-};
-
-void ws2812_control_init(void);
-void ws2812_write_leds(struct led_state new_state);
 
 ///////////////////////////////////////////////////////////////////
 
@@ -88,37 +73,61 @@ static void battery(void *data);
 
 const struct adac_s dac_muse = { "Muse", init, deinit, power, speaker, headset, volume };
 
-void ES8388_Write_Reg(uint8_t reg, uint8_t val);
-	
-static int i2c_port;
+#define ES8388_ADDR 0x10
+
+static adac_dev_t es8388;
+
+// delays are only needed after reset and state machine restart
+static const adac_seq_t es8388_init_sequence[] = {
+	// reset 
+	{ 0, 0x80, 10 }, { 0, 0x00, 0 },
+	// mute
+	{ 25, 0x04, 0 }, { 1, 0x50, 0 },
+	// powerup
+	{ 2, 0x00, 0 },
+	// slave mode
+	{ 8, 0x00, 0 },
+	// DAC powerdown
+	{ 4, 0xC0, 0 },
+	// vmidsel/500k ADC/DAC idem
+	{ 0, 0x12, 0 }, { 1, 0x00, 0 },
+	// i2s 16 bits
+	{ 23, 0x18, 0 },
+	// sample freq 256
+	{ 24, 0x02, 0 },
+	// LIN2/RIN2 for mixer
+	{ 38, 0x09, 0 },
+	// left DAC to left mixer
+	{ 39, 0x90, 0 },
+	// right DAC to right mixer
+	{ 42, 0x90, 0 },
+	// DACLRC ADCLRC idem
+	{ 43, 0x80, 0 }, { 45, 0x00, 0 },
+	// DAC volume max
+	{ 27, 0x00, 0 }, { 26, 0x00, 0 },
+	// restart state machine
+	{ 2, 0xF0, 10 }, { 2, 0x00, 0 }, 
+	{ 29, 0x1C, 0 },
+	// DAC power-up LOUT1/ROUT1 enabled
+	{ 4, 0x30, 0 },
+	// unmute
+	{ 25, 0x00, 0 },
+	// max volume
+	{ 46, 0x21, 0 }, { 47, 0x21, 0 },
+};
 
 /****************************************************************************************
  * init
  */
 static bool init(char *config, int i2c_port_num, i2s_config_t *i2s_config) {	 
-	esp_err_t res = ESP_OK;
-	char *p;
+	esp_err_t res;
+	
 //********** for battery monitoring **********************	
         xTaskCreate(battery, "battery", 5000, NULL, 1, NULL);
 //****************************************************        	
-	// configure i2c
-	i2c_config_t i2c_config = {
-			.mode = I2C_MODE_MASTER,
-			.sda_io_num = -1,
-			.sda_pullup_en = GPIO_PULLUP_ENABLE,
-			.scl_io_num = -1,
-			.scl_pullup_en = GPIO_PULLUP_ENABLE,
-			.master.clk_speed = 250000,
-		};
-	
-	if ((p = strcasestr(config, "sda")) != NULL) i2c_config.sda_io_num = atoi(strchr(p, '=') + 1);
-	if ((p = strcasestr(config, "scl")) != NULL) i2c_config.scl_io_num = atoi(strchr(p, '=') + 1);
-	
-	i2c_port = i2c_port_num;
-	i2c_param_config(i2c_port, &i2c_config);
-	i2c_driver_install(i2c_port, I2C_MODE_MASTER, false, false, false);
-
-        printf("-------------------->>>> init ES8388\n");
+	// sda/scl are parsed by core
+	adac_init(config, i2c_port_num);
+	adac_dev_init(&es8388, ES8388_ADDR, ADAC_VAL8);
 
 // CLK_OUT1 ==> MCLK
         PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO0_U, FUNC_GPIO0_CLK_OUT1);
@@ -133,54 +142,9 @@ static bool init(char *config, int i2c_port_num, i2s_config_t *i2s_config) {
         gpio_set_direction(GLED, GPIO_MODE_OUTPUT);
         gpio_set_level(GLED, 0);
 
-///////////// init ES8388
-//
-/////////////////////////////////////////// 
-// reset 
-	ES8388_Write_Reg(0, 0x80); 
-
-	ES8388_Write_Reg(0, 0x00); 
-// mute
-	ES8388_Write_Reg(25, 0x04);
-	ES8388_Write_Reg(1, 0x50); 
-//powerup
-	ES8388_Write_Reg(2, 0x00);
-// slave mode
-	ES8388_Write_Reg(8, 0x00);
-// DAC powerdown
-	ES8388_Write_Reg(4, 0xC0);
-// vmidsel/500k ADC/DAC idem
-	ES8388_Write_Reg(0, 0x12);
-
-	ES8388_Write_Reg(1, 0x00);
-// i2s 16 bits
-	ES8388_Write_Reg(23, 0x18);
-// sample freq 256
-	ES8388_Write_Reg(24, 0x02);
-// LIN2/RIN2 for mixer
-	ES8388_Write_Reg(38, 0x09);
-// left DAC to left mixer
-	ES8388_Write_Reg(39, 0x90);
-// right DAC to right mixer
-	ES8388_Write_Reg(42, 0x90);
-// DACLRC ADCLRC idem
-	ES8388_Write_Reg(43, 0x80);
-	ES8388_Write_Reg(45, 0x00);
-// DAC volume max
-	ES8388_Write_Reg(27, 0x00);
-	ES8388_Write_Reg(26, 0x00);
-
-	ES8388_Write_Reg(2 , 0xF0);
-	ES8388_Write_Reg(2 , 0x00);
-	ES8388_Write_Reg(29, 0x1C);
-// DAC power-up LOUT1/ROUT1 enabled
-	ES8388_Write_Reg(4, 0x30);
-// unmute
-	ES8388_Write_Reg(25, 0x00);
-// max volume
-	ES8388_Write_Reg(46, 0x21);
-	ES8388_Write_Reg(47, 0x21);
-	ESP_LOGI(TAG, "ES8388 uses I2C sda:%d, scl:%d", i2c_config.sda_io_num, i2c_config.scl_io_num);
+	res = adac_dev_sequence(&es8388, es8388_init_sequence, sizeof(es8388_init_sequence) / sizeof(adac_seq_t));
+	
+	ESP_LOGI(TAG, "ES8388 initialized on I2C port %d (%s)", i2c_port_num, res == ESP_OK ? "ok" : "failed");
 	return (res == ESP_OK);
 }	
 
@@ -188,20 +152,17 @@ static bool init(char *config, int i2c_port_num, i2s_config_t *i2s_config) {
  * deinit
  */
 static void deinit(void)	{	 
-	i2c_driver_delete(i2c_port);
+	adac_deinit();
 }
 
 /****************************************************************************************
  * change volume
  */
 static bool volume(unsigned left, unsigned right) {
-
-        printf("VOLUME=============>Vgauche %u  Vdroit %u\n",left,right);
-        uint8_t l, r;
-        l = left >> 11;
-        r = right >> 11;
-        ES8388_Write_Reg(46, l);
-	ES8388_Write_Reg(47, r);
+	adac_seq_t seq[] = { { 46, left >> 11, 0 }, { 47, right >> 11, 0 } };
+	
+	// unchanged registers are not written
+	adac_dev_sequence(&es8388, seq, 2);
 	return false;
 } 
 
@@ -227,30 +188,6 @@ static void headset(bool active) {
 } 	
 
 
-///////////////////////////////////////////////////////////////////////
-// Write ES8388 register (Muse board)
-///////////////////////////////////////////////////////////////////////
-#define ES8388_ADDR 0x10
-
-void ES8388_Write_Reg(uint8_t reg, uint8_t val) {
-	esp_err_t ret;
-        printf("R%02d = %02x\n",reg, val);
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-        i2c_master_start(cmd);
-	
-	i2c_master_write_byte(cmd, (ES8388_ADDR<< 1) | I2C_MASTER_WRITE, I2C_MASTER_NACK);
-	i2c_master_write_byte(cmd, reg, I2C_MASTER_NACK);
-	i2c_master_write_byte(cmd, val, I2C_MASTER_NACK);
-	
-	i2c_master_stop(cmd);
-        ret = i2c_master_cmd_begin(0, cmd, 100 / portTICK_RATE_MS);
-        i2c_cmd_link_delete(cmd);
-        vTaskDelay(100 / portTICK_PERIOD_MS); 
-	if (ret != ESP_OK) {
-		ESP_LOGW(TAG, "I2C write failed");
-	}	
-    return ;
-}
 // Battery monitoring
 static void battery(void *data)
 {
@@ -262,10 +199,10 @@ static void battery(void *data)
   static int V[NM];
   static int I=0;
   int S;
+  uint32_t color;
   for(int i=0;i<NM;i++)V[i]=VGREEN;
   vTaskDelay(1000 / portTICK_PERIOD_MS);	  
-  struct led_state new_state;
-  ws2812_control_init();
+  ws2812_init(LED_RMT_TX_GPIO, LED_RMT_TX_CHANNEL, NUM_LEDS);
 // init ADC interface for battery survey
   adc1_config_width(ADC_WIDTH_BIT_12);
   adc1_config_channel_atten(ADC1_GPIO33_CHANNEL, ADC_ATTEN_DB_11);
@@ -277,57 +214,12 @@ static void battery(void *data)
 	S = 0;
 	for(int i=0;i<NM;i++)S = S + V[i];	
 	val = S / NM;	
-	new_state.leds[0] = YELLOW;
-	if(val > VGREEN) new_state.leds[0] = GREEN;	
-	if(val < VRED) new_state.leds[0] = RED;
-        printf("====> %d  %6x\n", val, new_state.leds[0]);	        
-	ws2812_write_leds(new_state);	        
+	color = YELLOW;
+	if(val > VGREEN) color = GREEN;	
+	if(val < VRED) color = RED;
+	ESP_LOGD(TAG, "battery %d => color %06x", val, color);
+	ws2812_set(0, color);
+	ws2812_show();
 
 	}
 }
-
-
-
-// This is the buffer which the hw peripheral will access while pulsing the output pin
-rmt_item32_t led_data_buffer[LED_BUFFER_ITEMS];
-
-void setup_rmt_data_buffer(struct led_state new_state);
-
-void ws2812_control_init(void)
-{
-  rmt_config_t config;
-  config.rmt_mode = RMT_MODE_TX;
-  config.channel = LED_RMT_TX_CHANNEL;
-  config.gpio_num = LED_RMT_TX_GPIO;
-  config.mem_block_num = 3;
-  config.tx_config.loop_en = false;
-  config.tx_config.carrier_en = false;
-  config.tx_config.idle_output_en = true;
-  config.tx_config.idle_level = 0;
-  config.clk_div = 2;
-
-  ESP_ERROR_CHECK(rmt_config(&config));
-  ESP_ERROR_CHECK(rmt_driver_install(config.channel, 0, 0));
-}
-
-void ws2812_write_leds(struct led_state new_state) {
-  setup_rmt_data_buffer(new_state);
-  ESP_ERROR_CHECK(rmt_write_items(LED_RMT_TX_CHANNEL, led_data_buffer, LED_BUFFER_ITEMS, false));
-  ESP_ERROR_CHECK(rmt_wait_tx_done(LED_RMT_TX_CHANNEL, portMAX_DELAY));
-}
-
-void setup_rmt_data_buffer(struct led_state new_state) 
-{
-  for (uint32_t led = 0; led < NUM_LEDS; led++) {
-    uint32_t bits_to_send = new_state.leds[led];
-    uint32_t mask = 1 << (BITS_PER_LED_CMD - 1);
-    for (uint32_t bit = 0; bit < BITS_PER_LED_CMD; bit++) {
-      uint32_t bit_is_set = bits_to_send & mask;
-      led_data_buffer[led * BITS_PER_LED_CMD + bit] = bit_is_set ?
-                                                      (rmt_item32_t){{{T1H, 1, TL, 0}}} : 
-                                                      (rmt_item32_t){{{T0H, 1, TL, 0}}};
-      mask >>= 1;
-    }
-  }
-  }
-
@@ -804,6 +804,11 @@ int main(int argc, char **argv) {
 	slimproto(log_slimproto, server, mac, name, namefile, modelname, maxSampleRate);
 
 	decode_close();
+#if RESAMPLE || RESAMPLE16
+	if (resample) {
+		process_close();
+	}
+#endif
 	stream_close();
 
 #if EMBEDDED
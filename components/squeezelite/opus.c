@@ -25,14 +25,11 @@
 /* 
 *  with some low-end CPU, the decode call takes a fair bit of time and if the outputbuf is locked during that
 *  period, the output_thread (or equivalent) will be locked although there is plenty of samples available.
-*  Normally, with PRIO_INHERIT, that thread should increase decoder priority and get the lock quickly but it
-*  seems that when the streambuf has plenty of data, the decode thread grabs the CPU to much, even it the output
-*  thread has a higher priority. Using an interim buffer where opus decoder writes the output is not great from
-*  an efficiency (one extra memory copy) point of view, but it allows the lock to not be kept for too long
+*  Rather than decoding into an interim buffer and copying it afterwards, the decoder writes directly in the 
+*  free space of outputbuf with the lock released. This is safe because only the decode thread moves writep 
+*  and a flush always goes through decode_flush, which waits for LOCK_D to be released. The writep is checked 
+*  again once the lock is re-acquired, so frames decoded across an (external) flush are simply discarded
 */
-#if EMBEDDED
-#define FRAME_BUF 2048
-#endif
 
 #if BYTES_PER_FRAME == 4		
 #define ALIGN(n) 	(n)
@@ -44,9 +41,6 @@
 
 struct opus {
 	struct OggOpusFile *of;
-#if FRAME_BUF
-	u8_t *write_buf;
-#endif
 #if !LINKALL
 	// opus symbols to be dynamically loaded
 	void (*op_free)(OggOpusFile *_of);
@@ -153,19 +147,12 @@ static decode_state opus_decompress(void) {
 		LOG_INFO("setting track_start");
 	}
 
-#if FRAME_BUF
-	IF_DIRECT(
-		frames = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
-		frames = min(frames, FRAME_BUF);
-		write_buf = u->write_buf;
-	);
-#else
 	LOCK_O_direct;
 	IF_DIRECT(
 		frames = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
 		write_buf = outputbuf->writep;
 	);
-#endif
+	UNLOCK_O_direct;
 	IF_PROCESS(
 		frames = process.max_in_frames;
 		write_buf = process.inbuf;
@@ -173,10 +160,16 @@ static decode_state opus_decompress(void) {
 
 	// write the decoded frames into outputbuf then unpack them (they are 16 bits)
 	n = OP(u, read, u->of, (opus_int16*) write_buf, frames * channels, NULL);
-			
-#if FRAME_BUF
+
 	LOCK_O_direct;
-#endif
+
+	// outputbuf has been flushed while we were decoding, discard these frames
+	IF_DIRECT(
+		if (write_buf != outputbuf->writep && n > 0) {
+			LOG_INFO("outputbuf flushed during decode, dropping %d frames", n);
+			n = OP_HOLE;
+		}
+	);
 
 	if (n > 0) {
 		frames_t count;
@@ -196,14 +189,7 @@ static decode_state opus_decompress(void) {
 		)
 		
 		if (channels == 2) {
-#if BYTES_PER_FRAME == 4
-#if FRAME_BUF
-			// copy needed only when DIRECT and FRAME_BUF
-			IF_DIRECT(
-				memcpy(outputbuf->writep, write_buf, frames * BYTES_PER_FRAME);
-			)	
-#endif			
-#else
+#if BYTES_PER_FRAME == 8
 			while (count--) {
 				*--optr = ALIGN(*--iptr);
 			}
@@ -253,11 +239,7 @@ static decode_state opus_decompress(void) {
 
 
 static void opus_open(u8_t size, u8_t rate, u8_t chan, u8_t endianness) {
-	if (!u->of) {
-#if FRAME_BUF
-		if (!u->write_buf) u->write_buf = malloc(FRAME_BUF * BYTES_PER_FRAME);
-#endif
-	} else {
+	if (u->of) {
 		OP(u, free, u->of);
 		u->of = NULL;
 	}	
@@ -268,10 +250,6 @@ static void opus_close(void) {
 		OP(u, free, u->of);
 		u->of = NULL;
 	}
-#if FRAME_BUF
-	free(u->write_buf);
-	u->write_buf = NULL;
-#endif
 }
 
 static bool load_opus(void) {
@@ -317,9 +295,6 @@ struct codec *register_opus(void) {
 	}
 
 	u->of = NULL;
-#if FRAME_BUF	
-	u->write_buf = NULL;
-#endif	
 
 	if (!load_opus()) {
 		return NULL;
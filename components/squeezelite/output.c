@@ -58,6 +58,10 @@ frames_t _output_frames(frames_t avail) {
 
 	frames = _buf_used(outputbuf) / BYTES_PER_FRAME;
 	silence = false;
+	
+#if EMBEDDED
+	_accounting_output(frames);
+#endif
 
 	// start when threshold met
 	if (output.state == OUTPUT_BUFFER && (frames * BYTES_PER_FRAME) > output.threshold * output.next_sample_rate / 10 && frames > output.start_frames) {
@@ -151,6 +155,9 @@ frames_t _output_frames(frames_t avail) {
 				output.frames_played = 0;
 				output.track_started = true;
 				output.track_start_time = gettime_ms();
+#if EMBEDDED
+				_accounting_track_start();
+#endif
 				output.current_sample_rate = output.next_sample_rate;
 				IF_DSD(
 				   output.outfmt = output.next_fmt;
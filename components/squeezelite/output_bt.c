@@ -10,6 +10,9 @@
  */
 
 #include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
 #include "squeezelite.h"
 #include "equalizer.h"
 #include "perf_trace.h"
@@ -30,6 +33,13 @@ extern u8_t *silencebuf;
 
 #define STATS_REPORT_DELAY_MS 15000
 
+// A2DP is always 16 bits stereo, queue must be a power of 2 and hold a few SBC frames
+#define BT_BYTES_PER_FRAME	4
+#define BT_QUEUE_FRAMES		2048
+#define BT_QUEUE_SIZE		(BT_QUEUE_FRAMES * BT_BYTES_PER_FRAME)
+#define BT_RENDER_FRAMES	128
+#define BT_STACK_SIZE		4096
+
 extern void hal_bluetooth_init(const char * options);
 extern void hal_bluetooth_stop(void);
 extern u8_t config_spdif_gpio;
@@ -39,33 +49,36 @@ static bool running = false;
 static uint8_t *btout;
 static frames_t oframes;
 static bool stats;
+static TaskHandle_t output_bt_task;
+
+/* 
+ Single producer (render task) / single consumer (A2DP callback) queue of packed and
+ equalized frames. Positions are free-running bytes counters, each side only writes its own
+*/
+static EXT_RAM_ATTR struct {
+	u32_t head, tail;
+	u32_t underruns, callback_max_us;
+	uint8_t buf[BT_QUEUE_SIZE];
+} queue;
 
 static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
 								s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
+static void output_thread_bt(void *arg);
 								
-#define DECLARE_ALL_MIN_MAX \
-	DECLARE_MIN_MAX(req);\
-	DECLARE_MIN_MAX(rec);\
-	DECLARE_MIN_MAX(bt);\
-	DECLARE_MIN_MAX(under);\
-	DECLARE_MIN_MAX(stream_buf);\
-	DECLARE_MIN_MAX_DURATION(lock_out_time)								
-	
-#define RESET_ALL_MIN_MAX \
-	RESET_MIN_MAX(bt);	\
-	RESET_MIN_MAX(req);  \
-	RESET_MIN_MAX(rec);  \
-	RESET_MIN_MAX(under);  \
-	RESET_MIN_MAX(stream_buf); \
-	RESET_MIN_MAX_DURATION(lock_out_time)
-	
-DECLARE_ALL_MIN_MAX;	
-	
 void output_init_bt(log_level level, char *device, unsigned output_buf_size, char *params, unsigned rates[], unsigned rate_delay, unsigned idle) {
 	loglevel = level;
 	running = true;
 	output.write_cb = &_write_frames;
+	queue.head = queue.tail = queue.underruns = queue.callback_max_us = 0;
+
+	// rendering is done ahead of A2DP requests, by a task using internal RAM stack
+	static DRAM_ATTR StaticTask_t xTaskBuffer __attribute__ ((aligned (4)));
+	static DRAM_ATTR StackType_t xStack[BT_STACK_SIZE] __attribute__ ((aligned (4)));
+	output_bt_task = xTaskCreateStatic(output_thread_bt, "output_bt", BT_STACK_SIZE, NULL, 
+									   CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT + 1, xStack, &xTaskBuffer);
+
 	hal_bluetooth_init(device);
+	// queue counters are always maintained, trace summary is empty without CONFIG_PERF_TRACE
 	char *p = config_alloc_get_default(NVS_TYPE_STR, "stats", "n", 0);
 	stats = p && (*p == '1' || *p == 'Y' || *p == 'y');
 	free(p);
@@ -75,6 +88,8 @@ void output_close_bt(void) {
 	LOCK;
 	running = false;
 	UNLOCK;
+	xTaskNotifyGive(output_bt_task);
+	while (output_bt_task) vTaskDelay(pdMS_TO_TICKS(10));
 	hal_bluetooth_stop();
 	equalizer_close();
 }	
@@ -93,12 +108,12 @@ static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t g
 		_apply_gain(outputbuf, out_frames, gainL, gainR, flags);
 
 #if BYTES_PER_FRAME == 4
-		memcpy(btout + oframes * BYTES_PER_FRAME, outputbuf->readp, out_frames * BYTES_PER_FRAME);
+		memcpy(btout + oframes * BT_BYTES_PER_FRAME, outputbuf->readp, out_frames * BYTES_PER_FRAME);
 #else
 	{
 		frames_t count = out_frames;
 		s32_t *_iptr = (s32_t*) outputbuf->readp;
-		s16_t *_optr = (s16_t*) (btout + oframes * BYTES_PER_FRAME);
+		s16_t *_optr = (s16_t*) (btout + oframes * BT_BYTES_PER_FRAME);
 		while (count--) {
 			*_optr++ = *_iptr++ >> 16;
 			*_optr++ = *_iptr++ >> 16;
@@ -109,47 +124,94 @@ static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t g
 	} else {
 
 		u8_t *buf = silencebuf;
-		memcpy(btout + oframes * BYTES_PER_FRAME, buf, out_frames * BYTES_PER_FRAME);
+		memcpy(btout + oframes * BT_BYTES_PER_FRAME, buf, out_frames * BT_BYTES_PER_FRAME);
 	}
 	
-	output_visu_export(btout + oframes * BYTES_PER_FRAME, out_frames, output.current_sample_rate, silence, (gainL  + gainR) / 2);
+	output_visu_export(btout + oframes * BT_BYTES_PER_FRAME, out_frames, output.current_sample_rate, silence, (gainL  + gainR) / 2);
 	
 	oframes += out_frames;
 
 	return (int)out_frames;
 }
 
-int32_t output_bt_data(uint8_t *data, int32_t len) {
-	int32_t iframes = len / BYTES_PER_FRAME, start_timer = 0;
+/****************************************************************************************
+ * Render task: fill the queue as soon as there is room, woken up by A2DP callback
+ */
+static void output_thread_bt(void *arg) {
+	while (running) {
+		u32_t head = queue.head;
+		u32_t used = head - __atomic_load_n(&queue.tail, __ATOMIC_ACQUIRE);
+		u32_t offset = head & (BT_QUEUE_SIZE - 1);
+		frames_t frames = min(BT_QUEUE_SIZE - used, BT_QUEUE_SIZE - offset) / BT_BYTES_PER_FRAME;
+
+		// don't render tiny blocks, wait for the callback to make room
+		if (frames < BT_RENDER_FRAMES && used + frames * BT_BYTES_PER_FRAME >= BT_QUEUE_SIZE) {
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
+			continue;
+		}
+
+		btout = queue.buf + offset;
+		oframes = 0;
+
+		PERF_TRACE_BEGIN(PERF_OUTPUT_FILL);
+
+		LOCK;
+		PERF_TRACE_VALUE(PERF_OUTPUT_LEVEL, _buf_used(outputbuf));
+		output.device_frames = used / BT_BYTES_PER_FRAME;
+		output.updated = gettime_ms();
+		output.frames_played_dmp = output.frames_played;
+		_output_frames(frames);
+		output.frames_in_process = oframes;
+		UNLOCK;
+
+#if BYTES_PER_FRAME == 4
+		// in 32 bits mode, data has already been reduced to 16 bits
+		equalizer_process(btout, oframes * BYTES_PER_FRAME, output.current_sample_rate);
+#endif
+
+		PERF_TRACE_END(PERF_OUTPUT_FILL);
+
+		__atomic_store_n(&queue.head, head + oframes * BT_BYTES_PER_FRAME, __ATOMIC_RELEASE);
+
+		// output should always produce silence, but don't spin if it doesn't
+		if (!oframes) vTaskDelay(pdMS_TO_TICKS(5));
+	}
+
+	output_bt_task = NULL;
+	vTaskDelete(NULL);
+}
 
-	if (iframes <= 0 || data == NULL || !running) {
+/****************************************************************************************
+ * A2DP source data callback, only takes what has been rendered
+ */
+int32_t output_bt_data(uint8_t *data, int32_t len) {
+	if (len <= 0 || data == NULL || !running) {
 		return 0;
 	}
-	
-	btout = data;
-	oframes = 0;
 
-	// This is how the BTC layer calculates the number of bytes to
-	// for us to send. (BTC_SBC_DEC_PCM_DATA_LEN * sizeof(OI_INT16) - availPcmBytes
-	SET_MIN_MAX(len,req);
-	TIME_MEASUREMENT_START(start_timer);
-	
-	LOCK;	
-	SET_MIN_MAX_SIZED(_buf_used(outputbuf),bt,outputbuf->size);
-	output.device_frames = 0; 
-	output.updated = gettime_ms();
-	output.frames_played_dmp = output.frames_played;
-	_output_frames(iframes); 
-	output.frames_in_process = oframes;
-	UNLOCK;
-	
-	equalizer_process(data, oframes * BYTES_PER_FRAME, output.current_sample_rate);
+	PERF_TRACE_BEGIN(PERF_OUTPUT_WRITE);
+	int64_t start = esp_timer_get_time();
+
+	u32_t tail = queue.tail;
+	u32_t used = __atomic_load_n(&queue.head, __ATOMIC_ACQUIRE) - tail;
+	u32_t bytes = min(used, (u32_t) len & ~(BT_BYTES_PER_FRAME - 1));
+	u32_t offset = tail & (BT_QUEUE_SIZE - 1);
+	u32_t chunk = min(bytes, BT_QUEUE_SIZE - offset);
+
+	memcpy(data, queue.buf + offset, chunk);
+	memcpy(data + chunk, queue.buf, bytes - chunk);
+	__atomic_store_n(&queue.tail, tail + bytes, __ATOMIC_RELEASE);
+	xTaskNotifyGive(output_bt_task);
+
+	if (bytes < (u32_t) len) queue.underruns++;
+	u32_t elapsed = esp_timer_get_time() - start;
+	if (elapsed > queue.callback_max_us) queue.callback_max_us = elapsed;
 
-	SET_MIN_MAX(TIME_MEASUREMENT_GET(start_timer),lock_out_time);
-	SET_MIN_MAX((len-oframes*BYTES_PER_FRAME), rec);
-	TIME_MEASUREMENT_START(start_timer);
+	PERF_TRACE_END(PERF_OUTPUT_WRITE);
+	PERF_TRACE_VALUE(PERF_OUTPUT_FRAMES, bytes / BT_BYTES_PER_FRAME);
+	PERF_TRACE_VALUE(PERF_UNDERRUN, (len - bytes) / BT_BYTES_PER_FRAME);
 
-	return oframes * BYTES_PER_FRAME;
+	return bytes;
 }
 
 void output_bt_tick(void) {
@@ -157,31 +219,19 @@ void output_bt_tick(void) {
 	
 	if (!running) return;
 	
+#if PERF_TRACE_ENABLED	
 	LOCK_S;
-    SET_MIN_MAX_SIZED(_buf_used(streambuf), stream_buf, streambuf->size);
-    UNLOCK_S;
+	PERF_TRACE_VALUE(PERF_STREAM_LEVEL, _buf_used(streambuf));
+	UNLOCK_S;
+#endif	
 	
 	if (stats && lastTime <= gettime_ms() )
 	{
 		lastTime = gettime_ms() + STATS_REPORT_DELAY_MS;
 		LOG_INFO("Statistics over %u secs. " , STATS_REPORT_DELAY_MS/1000);
-		LOG_INFO("              +==========+==========+================+=====+================+");
-		LOG_INFO("              |      max |      min |        average | avg |          count |");
-		LOG_INFO("              |  (bytes) |  (bytes) |        (bytes) | pct |                |");
-		LOG_INFO("              +==========+==========+================+=====+================+");
-		LOG_INFO(LINE_MIN_MAX_FORMAT,LINE_MIN_MAX("stream avl",stream_buf));
-		LOG_INFO(LINE_MIN_MAX_FORMAT,LINE_MIN_MAX("output avl",bt));
-		LOG_INFO(LINE_MIN_MAX_FORMAT,LINE_MIN_MAX("requested",req));
-		LOG_INFO(LINE_MIN_MAX_FORMAT,LINE_MIN_MAX("received",rec));
-		LOG_INFO(LINE_MIN_MAX_FORMAT,LINE_MIN_MAX("underrun",under));
-		LOG_INFO( "              +==========+==========+================+=====+================+");
-		LOG_INFO("\n");
-		LOG_INFO("              ==========+==========+===========+===========+  ");
-		LOG_INFO("              max (us)  | min (us) |   avg(us) |  count    |  ");
-		LOG_INFO("              ==========+==========+===========+===========+  ");
-		LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("Out Buf Lock",lock_out_time));
-		LOG_INFO("              ==========+==========+===========+===========+");
-		RESET_ALL_MIN_MAX;
+		LOG_INFO("underruns: %u, callback max: %u us", queue.underruns, queue.callback_max_us);
+		queue.underruns = queue.callback_max_us = 0;
+		perf_trace_summary();
 	}	
 }	
 
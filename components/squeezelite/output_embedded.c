@@ -10,6 +10,11 @@
  */
 #include "squeezelite.h"
 #include "equalizer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_task.h"
+#include "platform_config.h"
 
 extern struct outputstate output;
 extern struct buffer *outputbuf;
@@ -17,6 +22,9 @@ extern struct buffer *outputbuf;
 static bool (*slimp_handler_chain)(u8_t *data, int len);
 
 #define FRAME_BLOCK MAX_SILENCE_FRAMES
+#define VOLUME_STACK_SIZE	3072
+#define VOLUME_RAMP_MS		"20"
+#define VOLUME_RAMP_MAX_MS	1000
 
 #define LOCK   mutex_lock(outputbuf->mutex)
 #define UNLOCK mutex_unlock(outputbuf->mutex)
@@ -40,6 +48,15 @@ static log_level loglevel;
 static bool (*volume_cb)(unsigned left, unsigned right);
 static void (*close_cb)(void);
 
+// only the latest request matters, so queue is a 1-slot mailbox (handle is protected by output mutex)
+static QueueHandle_t volume_queue;
+static TaskHandle_t volume_closer;
+static struct volume_s {
+	unsigned left, right;
+} volume_stop = { UINT_MAX, UINT_MAX };
+
+static void volume_thread(void *arg);
+
 #pragma pack(push, 1)
 struct eqlz_packet {
 	char  opcode[4];
@@ -81,6 +98,12 @@ void output_init_embedded(log_level level, char *device, unsigned output_buf_siz
 	output.start_frames = FRAME_BLOCK;
 	output.rate_delay = rate_delay;
 	
+	// software volume changes are ramped
+	char *p = config_alloc_get_default(NVS_TYPE_STR, "volume_ramp", VOLUME_RAMP_MS, 0);
+	int ramp = p ? atoi(p) : 0;
+	output.gain_ramp = ramp > 0 ? min(ramp, VOLUME_RAMP_MAX_MS) : 0;
+	FREE_AND_NULL(p);
+	
 #if CONFIG_BT_SINK	
 	if (strcasestr(device, "BT")) {
 		LOG_INFO("init Bluetooth");
@@ -97,24 +120,70 @@ void output_init_embedded(log_level level, char *device, unsigned output_buf_siz
 	
 	output_visu_init(level);
 	
-	LOG_INFO("init completed.");
+	// DAC volume might take a while (I2C) so it's done by its own task
+	if (volume_cb) {
+		volume_queue = xQueueCreate(1, sizeof(struct volume_s));
+		xTaskCreate(volume_thread, "volume", VOLUME_STACK_SIZE, volume_queue, ESP_TASK_PRIO_MIN + 1, NULL);
+	}	
+	
+	LOG_INFO("init completed, volume ramp %u ms", output.gain_ramp);
 }	
 
 void output_close_embedded(void) {
 	LOG_INFO("close output");
+	
+	// detach queue first so that set_volume can't overwrite the stop request, then wait 
+	// for the volume task to be gone before deleting it
+	LOCK;
+	QueueHandle_t queue = volume_queue;
+	volume_queue = NULL;
+	UNLOCK;
+	
+	if (queue) {
+		volume_closer = xTaskGetCurrentTaskHandle();
+		xQueueOverwrite(queue, &volume_stop);
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		vQueueDelete(queue);
+	}
+	
 	if (close_cb) (*close_cb)();		
 	output_close_common();
 	output_visu_close();
 }
 
+static void set_gain(unsigned left, unsigned right) {
+	LOCK;
+	output.gainL = left;
+	output.gainR = right;
+	UNLOCK;
+}
+
+static void volume_thread(void *arg) {
+	QueueHandle_t queue = (QueueHandle_t) arg;
+	struct volume_s volume;
+	
+	while (xQueueReceive(queue, &volume, portMAX_DELAY)) {
+		if (volume.left == volume_stop.left && volume.right == volume_stop.right) break;
+		// requests received meanwhile have overwritten each other
+		if (!(*volume_cb)(volume.left, volume.right)) set_gain(volume.left, volume.right);
+	}
+	
+	// queue belongs to the closer
+	xTaskNotifyGive(volume_closer);
+	vTaskDelete(NULL);
+}
+
 void set_volume(unsigned left, unsigned right) { 
+	struct volume_s volume = { left, right };
 	LOG_DEBUG("setting internal gain left: %u right: %u", left, right);
-	if (!volume_cb || !(*volume_cb)(left, right)) {
-		LOCK;
+	LOCK;
+	if (volume_queue) {
+		xQueueOverwrite(volume_queue, &volume);
+	} else {
 		output.gainL = left;
 		output.gainR = right;
-		UNLOCK;
 	} 
+	UNLOCK;
 }
 
 bool test_open(const char *device, unsigned rates[], bool userdef_rates) {
@@ -52,26 +52,11 @@ sure that using rate_delay would fix that
 #define UNLOCK mutex_unlock(outputbuf->mutex)
 
 #define FRAME_BLOCK MAX_SILENCE_FRAMES
-#define SPDIF_BLOCK	256
 
 // must have an integer ratio with FRAME_BLOCK (see spdif comment)
 #define DMA_BUF_LEN		512	
 #define DMA_BUF_COUNT	12
 
-#define DECLARE_ALL_MIN_MAX 	\
-	DECLARE_MIN_MAX(o); 		\
-	DECLARE_MIN_MAX(s); 		\
-	DECLARE_MIN_MAX(rec); 		\
-	DECLARE_MIN_MAX(i2s_time); 	\
-	DECLARE_MIN_MAX(buffering);
-
-#define RESET_ALL_MIN_MAX 		\
-	RESET_MIN_MAX(o); 			\
-	RESET_MIN_MAX(s); 			\
-	RESET_MIN_MAX(rec);	\
-	RESET_MIN_MAX(i2s_time);	\
-	RESET_MIN_MAX(buffering);
-	
 #define STATS_PERIOD_MS 5000
 #define STAT_STACK_SIZE	(3*1024)
 
@@ -80,6 +65,10 @@ extern struct buffer *streambuf;
 extern struct buffer *outputbuf;
 extern u8_t *silencebuf;
 
+// services/i2s.c
+extern esp_err_t i2s_dma_borrow(i2s_port_t i2s_num, void **ptr, size_t *size, TickType_t ticks_to_wait);
+extern esp_err_t i2s_dma_commit(i2s_port_t i2s_num, size_t size);
+
 const struct adac_s *dac_set[] = { &dac_tas57xx, &dac_tas5713, &dac_ac101, NULL };
 const struct adac_s *adac = &dac_muse;
 
@@ -87,13 +76,12 @@ static log_level loglevel;
 
 static bool (*slimp_handler_chain)(u8_t *data, int len);
 static bool jack_mutes_amp;
-static bool running, isI2SStarted, ended;
+static bool running, isI2SStarted, ended, direct;
 static i2s_config_t i2s_config;
-static u8_t *obuf;
+static u8_t *obuf, *optr;
 static frames_t oframes;
 static struct {
 	bool enabled;
-	u8_t *buf;
 	size_t count;
 } spdif;
 static size_t dma_buf_frames;
@@ -104,10 +92,10 @@ static struct {
 } amp_control = { -1, 1 },
   mute_control = { CONFIG_MUTE_GPIO, CONFIG_MUTE_GPIO_LEVEL };
 
-DECLARE_ALL_MIN_MAX;
-
-static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
+int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
 								s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
+frames_t _i2s_pack_start(bool in_dma, frames_t frames);
+size_t _i2s_pack_send(void);
 static void output_thread_i2s(void *arg);
 static void output_thread_i2s_stats(void *arg);
 static void spdif_convert(ISAMPLE_T *src, size_t frames, u32_t *dst, size_t *count);
@@ -255,9 +243,6 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 	
 	if (strcasestr(device, "spdif")) {
 		spdif.enabled = true;	
-		if ((spdif.buf = heap_caps_malloc(SPDIF_BLOCK * 16, MALLOC_CAP_INTERNAL)) == NULL) {
-			LOG_ERROR("Cannot allocate SPDIF buffer");
-		}
 	
 		if (i2s_spdif_pin.bck_io_num == -1 || i2s_spdif_pin.ws_io_num == -1 || i2s_spdif_pin.data_out_num == -1) {
 			LOG_WARN("Cannot initialize I2S for SPDIF bck:%d ws:%d do:%d", i2s_spdif_pin.bck_io_num, 
@@ -334,8 +319,11 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 		gpio_set_level(silent_do, 0);
 	}	
 
+	// samples can be packed directly in DMA buffers when there is no conversion
+	direct = !spdif.enabled && i2s_config.bits_per_sample == BYTES_PER_FRAME * 4;
+
 	LOG_INFO("Initializing I2S mode %s with rate: %d, bits per sample: %d, buffer frames: %d, number of buffers: %d ", 
-			spdif.enabled ? "S/PDIF" : "normal", 
+			spdif.enabled ? "S/PDIF" : direct ? "direct" : "normal", 
 			i2s_config.sample_rate, i2s_config.bits_per_sample, i2s_config.dma_buf_len, i2s_config.dma_buf_count);
 	
 	i2s_stop(CONFIG_I2S_NUM);
@@ -365,7 +353,7 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 	
 	// do we want stats
 	p = config_alloc_get_default(NVS_TYPE_STR, "stats", "n", 0);
-	stats = p && (*p == '1' || *p == 'Y' || *p == 'y');
+	stats = PERF_TRACE_ENABLED && p && (*p == '1' || *p == 'Y' || *p == 'y');
 	free(p);
 	
 	// memory still used but at least task is not created
@@ -409,7 +397,7 @@ bool output_volume_i2s(unsigned left, unsigned right) {
 /****************************************************************************************
  * Write frames to the output buffer
  */
-static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
+int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
 								s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
 	if (!silence) {
 		if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && *cross_ptr) {
@@ -417,14 +405,14 @@ static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32
 		}
 		
 		_apply_gain(outputbuf, out_frames, gainL, gainR, flags);
-		memcpy(obuf + oframes * BYTES_PER_FRAME, outputbuf->readp, out_frames * BYTES_PER_FRAME);
+		memcpy(optr + oframes * BYTES_PER_FRAME, outputbuf->readp, out_frames * BYTES_PER_FRAME);
 	} else {
-		memcpy(obuf + oframes * BYTES_PER_FRAME, silencebuf, out_frames * BYTES_PER_FRAME);
+		memcpy(optr + oframes * BYTES_PER_FRAME, silencebuf, out_frames * BYTES_PER_FRAME);
 	}
 
 	// don't update visu if we don't have enough data in buffer
 	if (silence || output.external || _buf_used(outputbuf) > outputbuf->size >> 2 ) {
-		output_visu_export(obuf + oframes * BYTES_PER_FRAME, out_frames, output.current_sample_rate, silence, (gainL + gainR) / 2);
+		output_visu_export(optr + oframes * BYTES_PER_FRAME, out_frames, output.current_sample_rate, silence, (gainL + gainR) / 2);
 	}
 		
 	oframes += out_frames;
@@ -432,21 +420,80 @@ static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32
 	return out_frames;
 }
 
+/****************************************************************************************
+ * Set where the write callback packs frames: the next DMA buffer when samples go to DMA
+ * as they are, obuf otherwise. Returns how many frames fit there
+ */
+frames_t _i2s_pack_start(bool in_dma, frames_t frames) {
+	optr = obuf;
+	oframes = 0;
+	
+	if (in_dma) {
+		void *dma;
+		size_t size;
+		if (i2s_dma_borrow(CONFIG_I2S_NUM, &dma, &size, portMAX_DELAY) == ESP_OK) {
+			optr = dma;
+			frames = min(size / BYTES_PER_FRAME, frames);
+		}	
+	}
+	
+	return frames;
+}
+
+/****************************************************************************************
+ * Send packed frames. When already in DMA they are just committed, otherwise they are
+ * copied (or converted) from obuf. Returns the bytes of frames sent
+ */
+size_t _i2s_pack_send(void) {
+	size_t bytes;
+	
+	if (optr != obuf) {
+		// frames are already in DMA
+		i2s_dma_commit(CONFIG_I2S_NUM, oframes * BYTES_PER_FRAME);
+		bytes = oframes * BYTES_PER_FRAME;
+	} else if (spdif.enabled) {
+		size_t count = 0;
+		bytes = 0;
+		// convert straight into DMA buffers (each pseudo-frame is 16 bytes)
+		while (count < oframes) {
+			void *dma;
+			size_t size;
+			if (i2s_dma_borrow(CONFIG_I2S_NUM, &dma, &size, portMAX_DELAY) != ESP_OK) break;
+			size_t chunk = min(size / 16, oframes - count);
+			spdif_convert((ISAMPLE_T*) obuf + count * 2, chunk, (u32_t*) dma, &spdif.count);
+			i2s_dma_commit(CONFIG_I2S_NUM, chunk * 16);
+			bytes += chunk * BYTES_PER_FRAME;
+			count += chunk;
+		}	
+#if BYTES_PER_FRAME == 4		
+	} else if (i2s_config.bits_per_sample == 32) {  
+		i2s_write_expand(CONFIG_I2S_NUM, obuf, oframes * BYTES_PER_FRAME, 16, 32, &bytes, portMAX_DELAY);
+#endif			
+	} else {
+		i2s_write(CONFIG_I2S_NUM, obuf, oframes * BYTES_PER_FRAME, &bytes, portMAX_DELAY);
+	}
+	
+	return bytes;
+}
+
 /****************************************************************************************
  * Main output thread
  */
 static void output_thread_i2s(void *arg) {
 	size_t bytes;
 	frames_t iframes = FRAME_BLOCK;
-	uint32_t timer_start = 0;
 	int discard = 0;
 	uint32_t fullness = gettime_ms();
 	bool synced;
 	output_state state = OUTPUT_OFF - 1;
 	
 	while (running) {
-			
-		TIME_MEASUREMENT_START(timer_start);
+		/* When DMA takes samples as they are, borrow its next buffer and pack frames there.
+		Sample rate is read unlocked, it will be checked again once frames are packed */
+		frames_t frames = _i2s_pack_start(direct && isI2SStarted && !discard && i2s_config.sample_rate == output.current_sample_rate,
+										  iframes);
+
+		PERF_TRACE_BEGIN(PERF_OUTPUT_FILL);
 
 		LOCK;
 		
@@ -483,20 +530,24 @@ static void output_thread_i2s(void *arg) {
 		} else if (output.state == OUTPUT_STOPPED) {
 			synced = false;
 		}
-					
-		oframes = 0;
+
 		output.updated = gettime_ms();
 		output.frames_played_dmp = output.frames_played;
 		// try to estimate how much we have consumed from the DMA buffer (calculation is incorrect at the very beginning ...)
-		output.device_frames = dma_buf_frames - ((output.updated - fullness) * output.current_sample_rate) / 1000;
-		_output_frames( iframes );
+		frames_t consumed = ((output.updated - fullness) * output.current_sample_rate) / 1000;
+		output.device_frames = consumed < dma_buf_frames ? dma_buf_frames - consumed : 0;
+		// DMA has been running on empty buffers (only meaningful when running)
+		if (consumed > dma_buf_frames && output.state == OUTPUT_RUNNING && isI2SStarted) {
+			_accounting_output_late(consumed - dma_buf_frames);
+		}	
+		_output_frames( frames );
 		// oframes must be a global updated by the write callback
 		output.frames_in_process = oframes;
 						
-		SET_MIN_MAX_SIZED(oframes,rec,iframes);
-		SET_MIN_MAX_SIZED(_buf_used(outputbuf),o,outputbuf->size);
-		SET_MIN_MAX_SIZED(_buf_used(streambuf),s,streambuf->size);
-		SET_MIN_MAX( TIME_MEASUREMENT_GET(timer_start),buffering);
+		PERF_TRACE_VALUE(PERF_OUTPUT_FRAMES, oframes);
+		PERF_TRACE_VALUE(PERF_OUTPUT_LEVEL, _buf_used(outputbuf));
+		PERF_TRACE_VALUE(PERF_STREAM_LEVEL, _buf_used(streambuf));
+		PERF_TRACE_END(PERF_OUTPUT_FILL);
 		
 		/* must skip first whatever is in the pipe (but not when resuming). 
 		This test is incorrect when we pause a track that has just started, 
@@ -514,7 +565,13 @@ static void output_thread_i2s(void *arg) {
 		UNLOCK;
 				
 		// now send all the data
-		TIME_MEASUREMENT_START(timer_start);
+		PERF_TRACE_BEGIN(PERF_OUTPUT_WRITE);
+		
+		// a new track has changed rate, DMA is about to be flushed so take frames back
+		if (optr != obuf && i2s_config.sample_rate != output.current_sample_rate) {
+			memcpy(obuf, optr, oframes * BYTES_PER_FRAME);
+			optr = obuf;
+		}	
 		
 		if (!isI2SStarted ) {
 			isI2SStarted = true;
@@ -538,48 +595,25 @@ static void output_thread_i2s(void *arg) {
 			i2s_set_sample_rates(CONFIG_I2S_NUM, spdif.enabled ? i2s_config.sample_rate * 2 : i2s_config.sample_rate);
 			i2s_zero_dma_buffer(CONFIG_I2S_NUM);
 
-#if BYTES_PER_FRAME == 4		
+			// new coefficients, not a ramp to them
 			equalizer_close();
 			equalizer_open(output.current_sample_rate);
-#endif			
 		}
 		
-#if BYTES_PER_FRAME == 4		
 		// run equalizer
-		equalizer_process(obuf, oframes * BYTES_PER_FRAME, output.current_sample_rate);
-#endif		
+		equalizer_process(optr, oframes * BYTES_PER_FRAME, output.current_sample_rate);
 
 		// we assume that here we have been able to entirely fill the DMA buffers
-		if (spdif.enabled) {
-			size_t obytes, count = 0;
-			bytes = 0;
-			// need IRAM for speed but can't allocate a FRAME_BLOCK * 16, so process by smaller chunks
-			while (count < oframes) {
-				size_t chunk = min(SPDIF_BLOCK, oframes - count);
-				spdif_convert((ISAMPLE_T*) obuf + count * 2, chunk, (u32_t*) spdif.buf, &spdif.count);
-				i2s_write(CONFIG_I2S_NUM, spdif.buf, chunk * 16, &obytes, portMAX_DELAY);
-				bytes += obytes / (16 / BYTES_PER_FRAME);
-				count += chunk;
-			}	
-#if BYTES_PER_FRAME == 4		
-		} else if (i2s_config.bits_per_sample == 32) {  
-			i2s_write_expand(CONFIG_I2S_NUM, obuf, oframes * BYTES_PER_FRAME, 16, 32, &bytes, portMAX_DELAY);
-#endif			
-		} else {
-			i2s_write(CONFIG_I2S_NUM, obuf, oframes * BYTES_PER_FRAME, &bytes, portMAX_DELAY);
-		}
-
+		bytes = _i2s_pack_send();
 		fullness = gettime_ms();
 
 		if (bytes != oframes * BYTES_PER_FRAME) {
 			LOG_WARN("I2S DMA Overflow! available bytes: %d, I2S wrote %d bytes", oframes * BYTES_PER_FRAME, bytes);
 		}
 		
-		SET_MIN_MAX( TIME_MEASUREMENT_GET(timer_start),i2s_time);
-		
+		PERF_TRACE_END(PERF_OUTPUT_WRITE);
 	}
 
-	if (spdif.enabled) free(spdif.buf);
 	ended = true;
 
 	vTaskDelete(NULL);	
@@ -595,23 +629,8 @@ static void output_thread_i2s_stats(void *arg) {
 		
 		if(stats && state>OUTPUT_STOPPED){
 			LOG_INFO( "Output State: %d, current sample rate: %d, bytes per frame: %d",state,output.current_sample_rate, BYTES_PER_FRAME);
-			LOG_INFO( LINE_MIN_MAX_FORMAT_HEAD1);
-			LOG_INFO( LINE_MIN_MAX_FORMAT_HEAD2);
-			LOG_INFO( LINE_MIN_MAX_FORMAT_HEAD3);
-			LOG_INFO( LINE_MIN_MAX_FORMAT_HEAD4);
-			LOG_INFO(LINE_MIN_MAX_FORMAT_STREAM, LINE_MIN_MAX_STREAM("stream",s));
-			LOG_INFO(LINE_MIN_MAX_FORMAT,LINE_MIN_MAX("output",o));
-			LOG_INFO(LINE_MIN_MAX_FORMAT_FOOTER);
-			LOG_INFO(LINE_MIN_MAX_FORMAT,LINE_MIN_MAX("received",rec));
-			LOG_INFO(LINE_MIN_MAX_FORMAT_FOOTER);
-			LOG_INFO("");
-			LOG_INFO("              ----------+----------+-----------+-----------+  ");
-			LOG_INFO("              max (us)  | min (us) |   avg(us) |  count    |  ");
-			LOG_INFO("              ----------+----------+-----------+-----------+  ");
-			LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("Buffering(us)",buffering));
-			LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("i2s tfr(us)",i2s_time));
-			LOG_INFO("              ----------+----------+-----------+-----------+");
-			RESET_ALL_MIN_MAX;
+			LOG_INFO( "Buffers stream: %u, output: %u (bytes)", streambuf->size, outputbuf->size);
+			perf_trace_summary();
 		}
 		vTaskDelay( pdMS_TO_TICKS( STATS_PERIOD_MS ) );
 	}
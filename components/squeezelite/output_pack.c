@@ -377,35 +377,116 @@ void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gai
 
 
 
+#if EMBEDDED
+extern struct outputstate output;
+
+// gain moves by fractions of FIXED_ONE while ramping so that a small change also takes the full ramp
+#define RAMP_SHIFT	16
+
+static struct {
+	s64_t gainL, gainR;			// current gain << RAMP_SHIFT
+	s64_t stepL, stepR;
+	s32_t targetL, targetR;
+} ramp = { (s64_t) FIXED_ONE << RAMP_SHIFT, (s64_t) FIXED_ONE << RAMP_SHIFT, 0, 0, FIXED_ONE, FIXED_ONE };
+
+static inline s64_t ramp_step(s64_t current, s64_t target, s64_t step) {
+	if (current < target) return current + step < target ? current + step : target;
+	else return current - step > target ? current - step : target;
+}
+
+static inline s64_t ramp_slope(s64_t current, s64_t target, u32_t length) {
+	s64_t distance = current < target ? target - current : current - target;
+	return (distance + length - 1) / length;
+}
+
+static inline void ramp_set(s32_t gainL, s32_t gainR) {
+	ramp.gainL = (s64_t) gainL << RAMP_SHIFT;
+	ramp.gainR = (s64_t) gainR << RAMP_SHIFT;
+	ramp.targetL = gainL;
+	ramp.targetR = gainR;
+}
+
+/* Move gain linearly towards the target, frame by frame, so that a volume change 
+ * does not make zipper noise. Slopes are set when target changes so that both channels 
+ * get there in gain_ramp ms, whatever the distance. Returns the number of frames processed */
+static frames_t _apply_gain_ramp(ISAMPLE_T *ptr, frames_t count, s32_t gainL, s32_t gainR, u8_t flags) {
+	s64_t toL = (s64_t) gainL << RAMP_SHIFT, toR = (s64_t) gainR << RAMP_SHIFT;
+	frames_t frames;
+
+	if (gainL != ramp.targetL || gainR != ramp.targetR) {
+		unsigned rate = output.current_sample_rate ? output.current_sample_rate : 44100;
+		// ramp (ms) times rate does not fit in 32 bits at high rates
+		u32_t length = (u64_t) output.gain_ramp * rate / 1000;
+		if (!length) length = 1;
+		ramp.stepL = ramp_slope(ramp.gainL, toL, length);
+		ramp.stepR = ramp_slope(ramp.gainR, toR, length);
+		ramp.targetL = gainL;
+		ramp.targetR = gainR;
+	}
+
+	for (frames = 0; frames < count && (ramp.gainL != toL || ramp.gainR != toR); frames++, ptr += 2) {
+		s32_t rampL, rampR;
+
+		ramp.gainL = ramp_step(ramp.gainL, toL, ramp.stepL);
+		ramp.gainR = ramp_step(ramp.gainR, toR, ramp.stepR);
+		rampL = ramp.gainL >> RAMP_SHIFT;
+		rampR = ramp.gainR >> RAMP_SHIFT;
+
+		if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
+			*ptr = *(ptr + 1) = (gain(rampL, *ptr) + gain(rampR, *(ptr + 1))) / 2;
+		} else if (flags & MONO_RIGHT) {
+			*ptr = *(ptr + 1) = gain(rampR, *(ptr + 1));
+		} else if (flags & MONO_LEFT) {
+			*(ptr + 1) = *ptr = gain(rampL, *ptr);
+		} else {
+			*ptr = gain(rampL, *ptr);
+			*(ptr + 1) = gain(rampR, *(ptr + 1));
+		}
+	}
+
+	return frames;
+}
+#endif
+
 #if !WIN
 inline 
 #endif
 void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags) {
+	ISAMPLE_T *readp = (ISAMPLE_T *)(void *)outputbuf->readp;
+#if EMBEDDED
+	if (!output.gain_ramp) {
+		ramp_set(gainL, gainR);
+	} else if (ramp.gainL != (s64_t) gainL << RAMP_SHIFT || ramp.gainR != (s64_t) gainR << RAMP_SHIFT) {
+		frames_t frames = _apply_gain_ramp(readp, count, gainL, gainR, flags);
+		readp += frames * 2;
+		count -= frames;
+	}
+#endif
 	if (gainL == FIXED_ONE && gainR == FIXED_ONE && !(flags & (MONO_LEFT | MONO_RIGHT))) {
 		return;
 	} else if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
-		ISAMPLE_T *ptrL = (ISAMPLE_T *)(void *)outputbuf->readp;
-		ISAMPLE_T *ptrR = (ISAMPLE_T *)(void *)outputbuf->readp + 1;
+		ISAMPLE_T *ptrL = readp;
+		ISAMPLE_T *ptrR = readp + 1;
 		while (count--) {
 			*ptrL = *ptrR = (gain(gainL, *ptrL) + gain(gainR, *ptrR)) / 2;
 			ptrL += 2; ptrR += 2;
 		}
 
 	} else if (flags & MONO_RIGHT) {
-		ISAMPLE_T *ptr = (ISAMPLE_T *)(void *)outputbuf->readp + 1;
+		ISAMPLE_T *ptr = readp + 1;
 		while (count--) {
 			*(ptr - 1) = *ptr = gain(gainR, *ptr);
 			ptr += 2;
 		}
 	} else if (flags & MONO_LEFT) {
-		ISAMPLE_T *ptr = (ISAMPLE_T *)(void *)outputbuf->readp;
+		ISAMPLE_T *ptr = readp;
 		while (count--) {
 			*(ptr + 1) = *ptr = gain(gainL, *ptr);
 			ptr += 2;
 		}
 	} else {
-	   	ISAMPLE_T *ptrL = (ISAMPLE_T *)(void *)outputbuf->readp;
-		ISAMPLE_T *ptrR = (ISAMPLE_T *)(void *)outputbuf->readp + 1;
+	   	ISAMPLE_T *ptrL = readp;
+		ISAMPLE_T *ptrR = readp + 1;
 		while (count--) {
 			*ptrL = gain(gainL, *ptrL);
 			*ptrR = gain(gainR, *ptrR);
@@ -47,11 +47,33 @@ extern struct codec *codec;
 #define INIT_FUNC    resample_init
 #endif
 
+#if PROCESS_THREAD
+/* 
+ *  Optional two-stage pipeline: the decode thread only runs the codec into process.inbuf and then hands
+ *  that buffer to the process thread which resamples and writes into outputbuf, while decode carries on
+ *  with the next chunk into a second inbuf. The process thread can be pinned on the other core. All 
+ *  public functions below are still called with decode mutex set, they just wait for the pipeline to be
+ *  idle when they need to touch processing state
+ */
+static struct {
+	thread_type thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct processstate stage;		// what the process thread works on (own inbuf, shared outbuf)
+	u8_t *inbuf;
+	bool busy, running;
+	u32_t wait_ms, busy_ms;
+} pipeline;
+
+static void *process_thread(void *arg);
+static void _pipeline_idle(void);
+#endif
+
 
 // transfer all processed frames to the output buf
-static void _write_samples(void) {
-	frames_t frames = process.out_frames;
-	ISAMPLE_T *iptr   = (ISAMPLE_T *) process.outbuf;
+static void _write_samples(struct processstate *process) {
+	frames_t frames = process->out_frames;
+	ISAMPLE_T *iptr   = (ISAMPLE_T *) process->outbuf;
 	unsigned cnt  = 10;
 
 	LOCK_O;
@@ -93,23 +115,77 @@ static void _write_samples(void) {
 
 // process samples - called with decode mutex set
 void process_samples(void) {
+#if PROCESS_THREAD
+	if (pipeline.running) {
+		u32_t now = gettime_ms();
+		unsigned long total_in, total_out;
+		u8_t *buf;
+
+		pthread_mutex_lock(&pipeline.mutex);
+		while (pipeline.busy) pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+		pipeline.wait_ms += gettime_ms() - now;
+
+		// swap input buffers so that codec can decode next chunk while this one is processed
+		buf = pipeline.inbuf;
+		pipeline.inbuf = process.inbuf;
+		process.inbuf = buf;
+
+		// stage is a copy of process state, except for its own inbuf and running totals
+		total_in = pipeline.stage.total_in;
+		total_out = pipeline.stage.total_out;
+		pipeline.stage = process;
+		pipeline.stage.inbuf = pipeline.inbuf;
+		pipeline.stage.total_in = total_in;
+		pipeline.stage.total_out = total_out;
+		pipeline.busy = true;
+		pthread_cond_broadcast(&pipeline.cond);
+		pthread_mutex_unlock(&pipeline.mutex);
+
+		process.in_frames = 0;
+		return;
+	}
+#endif
 
+	PERF_TRACE_BEGIN(PERF_PROCESS);
+	
 	SAMPLES_FUNC(&process);
 
-	_write_samples();
+	_write_samples(&process);
+	
+	PERF_TRACE_END(PERF_PROCESS);
 
 	process.in_frames = 0;
 }
 
+// frames that may still be written to outputbuf by process thread - called with decode mutex set
+unsigned process_pending_frames(void) {
+	unsigned frames = 0;
+
+#if PROCESS_THREAD
+	if (pipeline.running) {
+		pthread_mutex_lock(&pipeline.mutex);
+		// chunk is not resampled yet, so assume worst case
+		if (pipeline.busy) frames = pipeline.stage.max_out_frames;
+		pthread_mutex_unlock(&pipeline.mutex);
+	}
+#endif
+
+	return frames;
+}
+
 // drain at end of track - called with decode mutex set
 void process_drain(void) {
 	bool done;
 
+#if PROCESS_THREAD
+	_pipeline_idle();
+#endif
+
 	do {
 
 		done = DRAIN_FUNC(&process);
 
-		_write_samples();
+		_write_samples(&process);
 
 	} while (!done);
 
@@ -119,7 +195,13 @@ void process_drain(void) {
 // new stream - called with decode mutex set
 unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supported_rates[]) {
 
-	bool active = NEWSTREAM_FUNC(&process, raw_sample_rate, supported_rates);
+	bool active;
+
+#if PROCESS_THREAD
+	_pipeline_idle();
+#endif
+
+	active = NEWSTREAM_FUNC(&process, raw_sample_rate, supported_rates);
 
 	LOG_INFO("processing: %s", active ? "active" : "inactive");
 
@@ -131,6 +213,9 @@ unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supp
 
 		process.in_frames = process.out_frames = 0;
 		process.total_in = process.total_out = 0;
+#if PROCESS_THREAD
+		pipeline.stage.total_in = pipeline.stage.total_out = 0;
+#endif
 
 		max_in_frames = codec->min_space / BYTES_PER_FRAME ;
 
@@ -145,6 +230,16 @@ unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supp
 			LOG_DEBUG("creating process buf in frames: %u", max_in_frames);
 			if (process.inbuf) free(process.inbuf);
 			process.inbuf = malloc(max_in_frames * BYTES_PER_FRAME);
+#if PROCESS_THREAD
+			if (pipeline.running) {
+				if (pipeline.inbuf) free(pipeline.inbuf);
+				pipeline.inbuf = malloc(max_in_frames * BYTES_PER_FRAME);
+				if (!pipeline.inbuf) {
+					free(process.inbuf);
+					process.inbuf = NULL;
+				}
+			}
+#endif
 			process.max_in_frames = max_in_frames;
 		}
 		
@@ -156,6 +251,7 @@ unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supp
 		}
 		
 		if (!process.inbuf || !process.outbuf) {
+			process.max_in_frames = process.max_out_frames = 0;
 			LOG_ERROR("malloc fail creating process buffers");
 			*direct = true;
 			return raw_sample_rate;
@@ -172,6 +268,10 @@ void process_flush(void) {
 
 	LOG_INFO("process flush");
 
+#if PROCESS_THREAD
+	_pipeline_idle();
+#endif
+
 	FLUSH_FUNC();
 
 	process.in_frames = 0;
@@ -189,6 +289,104 @@ void process_init(char *opt) {
 		decode.process = true;
 		UNLOCK_D;
 	}
+
+#if PROCESS_THREAD
+	if (enabled) {
+		pthread_attr_t attr;
+		int core = PROCESS_THREAD_CORE;
+
+		memset(&pipeline, 0, sizeof(pipeline));
+		pthread_mutex_init(&pipeline.mutex, NULL);
+		pthread_cond_init(&pipeline.cond, NULL);
+		pipeline.running = true;
+
+		pthread_attr_init(&attr);
+#ifdef PTHREAD_STACK_MIN
+		pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + PROCESS_THREAD_STACK_SIZE);
+#endif
+		pthread_create_name_core(&pipeline.thread, &attr, process_thread, NULL, "process", core);
+		pthread_attr_destroy(&attr);
+
+		LOG_INFO("process thread created (core %d)", core);
+	}
+#endif
+}
+
+// close - called with no mutex
+void process_close(void) {
+#if PROCESS_THREAD
+	if (!pipeline.running) return;
+
+	pthread_mutex_lock(&pipeline.mutex);
+	pipeline.running = false;
+	pthread_cond_broadcast(&pipeline.cond);
+	pthread_mutex_unlock(&pipeline.mutex);
+
+	pthread_join(pipeline.thread, NULL);
+	pthread_cond_destroy(&pipeline.cond);
+	pthread_mutex_destroy(&pipeline.mutex);
+
+	free(pipeline.inbuf);
+	pipeline.inbuf = NULL;
+#endif
+}
+
+#if PROCESS_THREAD
+// wait for process thread to finish any pending chunk - called with decode mutex set
+static void _pipeline_idle(void) {
+	if (!pipeline.running) return;
+
+	pthread_mutex_lock(&pipeline.mutex);
+	while (pipeline.busy) pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+	// totals are maintained by the process thread
+	process.total_in = pipeline.stage.total_in;
+	process.total_out = pipeline.stage.total_out;
+	pthread_mutex_unlock(&pipeline.mutex);
 }
 
+static void *process_thread(void *arg) {
+	u32_t last = gettime_ms(), frames = 0;
+
+	pthread_mutex_lock(&pipeline.mutex);
+
+	while (pipeline.running) {
+		u32_t now;
+
+		if (!pipeline.busy) {
+			pthread_cond_wait(&pipeline.cond, &pipeline.mutex);
+			continue;
+		}
+
+		// only process thread uses outbuf while busy, decode thread waits for idle before touching it
+		pthread_mutex_unlock(&pipeline.mutex);
+
+		now = gettime_ms();
+		PERF_TRACE_BEGIN(PERF_PROCESS);
+		SAMPLES_FUNC(&pipeline.stage);
+		_write_samples(&pipeline.stage);
+		PERF_TRACE_END(PERF_PROCESS);
+		frames += pipeline.stage.out_frames;
+
+		pthread_mutex_lock(&pipeline.mutex);
+		pipeline.busy_ms += gettime_ms() - now;
+		pipeline.stage.in_frames = 0;
+		pipeline.busy = false;
+		pthread_cond_broadcast(&pipeline.cond);
+
+		// pipeline load over the last period
+		if (gettime_ms() - last > 10000) {
+			now = gettime_ms();
+			LOG_INFO("process thread: %u frames/s out, busy %u%%, decode waited %u ms", 
+					 frames * 1000 / (now - last), pipeline.busy_ms * 100 / (now - last), pipeline.wait_ms);
+			pipeline.busy_ms = pipeline.wait_ms = frames = 0;
+			last = now;
+		}
+	}
+
+	pthread_mutex_unlock(&pipeline.mutex);
+
+	return 0;
+}
+#endif
+
 #endif // #if PROCESS
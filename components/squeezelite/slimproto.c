@@ -99,7 +99,43 @@ static char *new_server_cap;
 static char player_name[PLAYER_NAME_LEN + 1] = "";
 static const char *name_file = NULL;
 
+// control channel counters, reported periodically
+static struct {
+	u32_t packets, bytes, handler_ms;
+	u32_t sent_stat, stat_sends;
+	u32_t last;
+} counters;
+
+/* 
+ STAT packets generated within the same tick are sent in one go. They are never merged nor 
+ reordered: batch is protected by LOCK_P and any other packet sent from any thread first 
+ sends what is pending, so the wire order is the order in which packets were produced
+*/
+#define STAT_BATCH	8
+static struct {
+	struct STAT_packet pkt[STAT_BATCH];
+	int count;
+	bool active;
+} batch;
+
+static void _send_packet(u8_t *packet, size_t len);
+
+// must be called with LOCK_P
+static void _batch_send(void) {
+	if (!batch.count) return;
+	_send_packet((u8_t *) batch.pkt, batch.count * sizeof(struct STAT_packet));
+	counters.sent_stat += batch.count;
+	counters.stat_sends++;
+	batch.count = 0;
+}
+
+// must be called with LOCK_P
 void send_packet(u8_t *packet, size_t len) {
+	_batch_send();
+	_send_packet(packet, len);
+}
+
+static void _send_packet(u8_t *packet, size_t len) {
 	u8_t *ptr = packet;
 	unsigned try = 0;
 	ssize_t n;
@@ -161,6 +197,17 @@ static void sendHELO(bool reconnect, const char *fixed_cap, const char *var_cap,
 	UNLOCK_P;
 }
 
+static void _batch_start(void) {
+	batch.active = true;
+}
+
+static void _batch_end(void) {
+	LOCK_P;
+	_batch_send();
+	UNLOCK_P;
+	batch.active = false;
+}
+
 static void sendSTAT(const char *event, u32_t server_timestamp) {
 	struct STAT_packet pkt;
 	u32_t now = gettime_ms();
@@ -211,7 +258,14 @@ static void sendSTAT(const char *event, u32_t server_timestamp) {
 	}
 
 	LOCK_P;
-	send_packet((u8_t *)&pkt, sizeof(pkt));
+	if (batch.active) {
+		if (batch.count == STAT_BATCH) _batch_send();
+		memcpy(batch.pkt + batch.count++, &pkt, sizeof(pkt));
+	} else {
+		send_packet((u8_t *)&pkt, sizeof(pkt));
+		counters.sent_stat++;
+		counters.stat_sends++;
+	}	
 	UNLOCK_P;
 }
 
@@ -393,6 +447,7 @@ static void process_strm(u8_t *pkt, int len) {
 			LOCK_O;
 			output.external = 0;
 			_buf_limit(outputbuf, 0);
+			_accounting_stream_start();
 #else
 			LOCK_O;
 #endif
@@ -554,9 +609,14 @@ static void process(u8_t *pack, int len) {
 	struct handler *h = handlers;
 	while (h->handler && strncmp((char *)pack, h->opcode, 4)) { h++; }
 
+	counters.packets++;
+	counters.bytes += len + 2;
+
 	if (h->handler) {
+		u32_t now = gettime_ms();
 		LOG_DEBUG("%s", h->opcode);
 		h->handler(pack, len);
+		counters.handler_ms += gettime_ms() - now;
 	} else if (!slimp_handler || !(*slimp_handler)(pack, len)) {
 		pack[4] = '\0';
 		LOG_WARN("unhandled %s", (char *)pack);
@@ -565,9 +625,46 @@ static void process(u8_t *pack, int len) {
 
 static bool running;
 
+/* 
+ *  Incoming data is read in as large chunks as the socket gives, then all complete packets are parsed in place
+ *  and handed to process() without being copied. Only the trailing incomplete packet (if any) is moved back to
+ *  the beginning of the buffer. Each packet is temporarily NUL terminated for handlers that use strings
+ */
+static int _process_all(u8_t *buffer, int got) {
+	u8_t *p = buffer;
+
+	_batch_start();
+
+	while (got >= 2) {
+		int len = p[0] << 8 | p[1]; // length pack 'n'
+		u8_t save;
+
+		if (len > MAXBUF) {
+			LOG_ERROR("FATAL: slimproto packet too big: %d > %d", len, MAXBUF);
+			_batch_end();
+			return -1;
+		}
+
+		if (got < len + 2) break;
+
+		save = p[len + 2];
+		p[len + 2] = '\0';
+		process(p + 2, len);
+		p[len + 2] = save;
+
+		p += len + 2;
+		got -= len + 2;
+	}
+
+	_batch_end();
+
+	if (got && p != buffer) memmove(buffer, p, got);
+	return got;
+}
+
 static void slimproto_run() {
-	static u8_t EXT_BSS buffer[MAXBUF];
-	int  expect = 0;
+	// room for one max-size packet, its length header and a terminating NUL
+	static u8_t EXT_BSS buffer[MAXBUF + 2 + 1];
 	int  got    = 0;
 	u32_t now;
 	static u32_t last = 0;
@@ -584,45 +681,15 @@ static void slimproto_run() {
 		if ((ev = wait_readwake(ehandles, 1000)) != EVENT_TIMEOUT) {
 	
 			if (ev == EVENT_READ) {
-
-				if (expect > 0) {
-					int n = recv(sock, buffer + got, expect, 0);
-					if (n <= 0) {
-						if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-							continue;
-						}
-						LOG_INFO("error reading from socket: %s", n ? strerror(last_error()) : "closed");
-						return;
-					}
-					expect -= n;
-					got += n;
-					if (expect == 0) {
-						process(buffer, got);
-						got = 0;
-					}
-				} else if (expect == 0) {
-					int n = recv(sock, buffer + got, 2 - got, 0);
-					if (n <= 0) {
-						if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-							continue;
-						}
-						LOG_INFO("error reading from socket: %s", n ? strerror(last_error()) : "closed");
-						return;
-					}
-					got += n;
-					if (got == 2) {
-						expect = buffer[0] << 8 | buffer[1]; // length pack 'n'
-						got = 0;
-						if (expect > MAXBUF) {
-							LOG_ERROR("FATAL: slimproto packet too big: %d > %d", expect, MAXBUF);
-							return;
-						}
+				int n = recv(sock, buffer + got, sizeof(buffer) - 1 - got, 0);
+				if (n <= 0) {
+					if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
+						continue;
 					}
-				} else {
-					LOG_ERROR("FATAL: negative expect");
+					LOG_INFO("error reading from socket: %s", n ? strerror(last_error()) : "closed");
 					return;
 				}
-
+				if ((got = _process_all(buffer, got + n)) < 0) return;
 			}
 
 			if (ev == EVENT_WAKE) {
@@ -778,18 +845,30 @@ static void slimproto_run() {
 
 			// send packets once locks released as packet sending can block
 			if (_sendDSCO) sendDSCO(disconnect_code);
+			_batch_start();
 			if (_sendSTMs) sendSTAT("STMs", 0);
 			if (_sendSTMd) sendSTAT("STMd", 0);
-			if (_sendSTMt) sendSTAT("STMt", 0);
 			if (_sendSTMl) sendSTAT("STMl", 0);
 			if (_sendSTMu) sendSTAT("STMu", 0);
 			if (_sendSTMo) sendSTAT("STMo", 0);
 			if (_sendSTMn) sendSTAT("STMn", 0);
+			if (_sendSTMt) sendSTAT("STMt", 0);
+			_batch_end();
 			if (_sendRESP) sendRESP(header, header_len);
 			if (_sendMETA) sendMETA(header, header_len);
 #if IR
 			if (_sendIR)   sendIR(ir_code, ir_ts);
 #endif
+			if (now - counters.last > 30000) {
+				u32_t elapsed = now - counters.last;
+				_accounting_control(elapsed, counters.packets, counters.bytes, counters.handler_ms, 
+									counters.sent_stat, counters.stat_sends);
+				LOG_DEBUG("control: %u packets/s, %u bytes/s, handlers %u ms, STAT %u in %u sends", 
+						  counters.packets * 1000 / elapsed, counters.bytes * 1000 / elapsed, counters.handler_ms, 
+						  counters.sent_stat, counters.stat_sends);
+				memset(&counters, 0, sizeof(counters));
+				counters.last = now;
+			}
 			if (*slimp_loop) (*slimp_loop)();
 		}
 	}
@@ -134,6 +134,13 @@
 #else
 #define RESAMPLE_MP 0
 #endif
+#if defined(PROCESS_THREAD) && PROCESS && !WIN
+#undef PROCESS_THREAD
+#define PROCESS_THREAD 1 // decode and process in separate threads
+#else
+#undef PROCESS_THREAD
+#define PROCESS_THREAD 0
+#endif
 
 #if defined(FFMPEG)
 #undef FFMPEG
@@ -309,6 +316,8 @@
 #define DECODE_THREAD_STACK_SIZE 128 * 1024
 #define OUTPUT_THREAD_STACK_SIZE  64 * 1024
 #define IR_THREAD_STACK_SIZE      64 * 1024
+#define PROCESS_THREAD_STACK_SIZE 64 * 1024
+#define PROCESS_THREAD_CORE       -1
 #ifdef SUN
 typedef uint8_t  u8_t;
 typedef uint16_t u16_t;
@@ -336,6 +345,7 @@ typedef int64_t   s64_t;
 #define thread_type pthread_t
 #if !EMBEDDED
 #define pthread_create_name(t,a,f,p,n) pthread_create(t,a,f,p)
+#define pthread_create_name_core(t,a,f,p,n,c) pthread_create(t,a,f,p)
 #endif
 #endif
 
@@ -458,6 +468,12 @@ void _wake_create(event_event*);
 #define EXT_BSS
 #endif
 
+#ifndef PERF_TRACE_BEGIN
+#define PERF_TRACE_BEGIN(p)
+#define PERF_TRACE_END(p)
+#define PERF_TRACE_VALUE(p,v)
+#endif
+
 // printf/scanf formats for u64_t
 #if (LINUX && __WORDSIZE == 64) || (FREEBSD && __LP64__)
 #define FMT_u64 "%lu"
@@ -628,8 +644,10 @@ void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels,
 void process_samples(void);
 void process_drain(void);
 void process_flush(void);
+unsigned process_pending_frames(void);
 unsigned process_newstream(bool *direct, unsigned raw_sample_rate, unsigned supported_rates[]);
 void process_init(char *opt);
+void process_close(void);
 #endif
 
 #if RESAMPLE || RESAMPLE16
@@ -712,6 +730,9 @@ struct outputstate {
 	bool delay_active;
 	u32_t stop_time;
 	u32_t idle_to;
+#if EMBEDDED
+	unsigned gain_ramp;        // ms to reach a new software gain
+#endif
 #if DSD
 	dsd_format next_fmt;       // set in decode thread
 	dsd_format outfmt;
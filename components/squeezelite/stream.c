@@ -145,6 +145,42 @@ static bool send_header(void) {
 
 static bool running = true;
 
+/* 
+When a seekable HTTP stream (Content-Length and "Accept-Ranges: bytes" in 
+response) drops before all bytes are received, the stream thread re-opens 
+it transparently with a Range request starting at the first missing byte 
+instead of signaling a disconnect to LMS. The original request is kept as
+stream.header is re-used for response headers. A session counter detects 
+that slimproto started or stopped a stream while we were re-connecting.
+Once a seekable stream is playing, streambuf is filled in bursts between a
+high and low watermark so that Wi-Fi can sleep in between.
+*/
+#ifndef STREAM_RESUME_RETRIES
+#define STREAM_RESUME_RETRIES	3
+#endif
+#ifndef STREAM_HIGH_WATERMARK
+#define STREAM_HIGH_WATERMARK	100	// % of streambuf, 100 disables throttling
+#endif
+#ifndef STREAM_LOW_WATERMARK
+#define STREAM_LOW_WATERMARK	50
+#endif
+
+static struct {
+	u32_t ip;
+	u16_t port;
+	char *request;
+	size_t request_len;
+	u64_t offset, length;		// offset of original Range request and expected body length
+	bool seekable, active;
+	stream_state state;			// state to restore once resumed
+	unsigned retries;
+	unsigned session;
+} resume;
+
+static bool throttled;
+
+static int _connect(u32_t ip, u16_t port, const char *header, void **handle);
+
 static void _disconnect(stream_state state, disconnect_code disconnect) {
 	stream.state = state;
 	stream.disconnect = disconnect;
@@ -160,6 +196,126 @@ static void _disconnect(stream_state state, disconnect_code disconnect) {
 	wake_controller();
 }
 
+// learn from response headers if we'll be able to resume that stream
+static void _parse_headers(void) {
+	char *p;
+	int code = 0;
+
+	sscanf(stream.header, "%*s %d", &code);
+	resume.length = 0;
+	resume.retries = 0;
+	if ((p = strcasestr(stream.header, "Content-Length:")) != NULL) resume.length = strtoull(p + 15, NULL, 10);
+	resume.seekable = (code == 200 || code == 206) && resume.length && strcasestr(stream.header, "Accept-Ranges: bytes");
+
+	LOG_DEBUG("stream code: %d, length: " FMT_u64 ", seekable: %d", code, resume.length, resume.seekable);
+}
+
+// a resumed response must be partial content starting exactly at the first missing byte
+static bool _resumed_at(u64_t offset) {
+	u64_t start;
+	int code = 0;
+	char *p;
+
+	sscanf(stream.header, "%*s %d", &code);
+	if (code != 206 || (p = strcasestr(stream.header, "\r\nContent-Range:")) == NULL) {
+		LOG_WARN("can't resume stream (code %d)", code);
+		return false;
+	}
+
+	if (sscanf(p + 16, " bytes " FMT_u64 "-", &start) != 1 || start != offset) {
+		LOG_WARN("can't resume stream, expected range at " FMT_u64 ", got %.32s", offset, p + 16);
+		return false;
+	}
+
+	return true;
+}
+
+// re-open current stream at first missing byte - called with mutex locked, returns with mutex locked
+static bool _resume(void) {
+	unsigned session = resume.session;
+	u64_t offset = resume.offset + stream.bytes;
+	size_t len;
+	char *p, *q;
+	void *handle;
+	int sock;
+
+	if (!resume.seekable || !stream.sent_headers || stream.meta_interval || resume.retries++ >= STREAM_RESUME_RETRIES) return false;
+
+	// rebuild request without its terminating empty line and any Range, then add ours
+	p = strcasestr(resume.request, "\r\nRange:");
+	if (p && (q = strstr(p + 2, "\r\n")) != NULL) {
+		len = p - resume.request;
+		memcpy(stream.header, resume.request, len);
+		len += sprintf(stream.header + len, "%s", q);
+	} else {
+		len = resume.request_len;
+		memcpy(stream.header, resume.request, len);
+	}
+	while (len > 2 && (stream.header[len - 1] == '\n' || stream.header[len - 1] == '\r')) len--;
+	if (len + 64 > MAX_HEADER) return false;
+	len += sprintf(stream.header + len, "\r\nRange: bytes=" FMT_u64 "-\r\n\r\n", offset);
+
+#if USE_SSL
+	if (ssl) {
+		SSL_shutdown(ssl);
+		SSL_free(ssl);
+		ssl = NULL;
+	}
+#endif
+	closesocket(fd);
+	fd = -1;
+
+	// a failed resume attempt must not overwrite where we were when stream dropped
+	if (!resume.active) resume.state = stream.state;
+
+	LOG_INFO("resuming stream at " FMT_u64 " (try %u)", offset, resume.retries);
+
+	UNLOCK;
+	usleep(resume.retries * 250000);
+	sock = _connect(resume.ip, resume.port, stream.header, &handle);
+	LOCK;
+
+	// slimproto has moved on while we were connecting, so SSL is ours only
+	if (session != resume.session) {
+		if (sock >= 0) {
+#if USE_SSL
+			if (handle) SSL_free(handle);
+#endif
+			closesocket(sock);
+		}
+		return true;
+	}
+
+	if (sock < 0) return false;
+
+#if USE_SSL
+	ssl = handle;
+#endif
+	fd = sock;
+	resume.active = true;
+	stream.header_len = len;
+	stream.state = SEND_HEADERS;
+
+	return true;
+}
+
+// fill streambuf in bursts between watermarks once playback is running
+static bool _throttle(void) {
+	size_t used = _buf_used(streambuf);
+
+	if (stream.state != STREAMING_HTTP || !resume.seekable || STREAM_HIGH_WATERMARK >= 100) {
+		throttled = false;
+	} else if (!throttled && used > streambuf->size / 100 * STREAM_HIGH_WATERMARK) {
+		LOG_SDEBUG("throttling stream at %zu bytes", used);
+		throttled = true;
+	} else if (throttled && used < streambuf->size / 100 * STREAM_LOW_WATERMARK) {
+		LOG_SDEBUG("un-throttling stream at %zu bytes", used);
+		throttled = false;
+	}
+
+	return throttled;
+}
+
 static void *stream_thread() {
 
 	while (running) {
@@ -171,7 +327,7 @@ static void *stream_thread() {
 
 		space = min(_buf_space(streambuf), _buf_cont_write(streambuf));
 
-		if (fd < 0 || !space || stream.state <= STREAMING_WAIT) {
+		if (fd < 0 || !space || stream.state <= STREAMING_WAIT || _throttle()) {
 			UNLOCK;
 			usleep(space ? 100000 : 25000);
 			continue;
@@ -244,7 +400,7 @@ static void *stream_thread() {
 							continue;
 						}
 						LOG_INFO("error reading headers: %s", n ? strerror(last_error()) : "closed");
-						_disconnect(STOPPED, LOCAL_DISCONNECT);
+						if (!resume.active || !_resume()) _disconnect(STOPPED, LOCAL_DISCONNECT);
 						UNLOCK;
 						continue;
 					}
@@ -262,8 +418,19 @@ static void *stream_thread() {
 						if (endtok == 4) {
 							*(stream.header + stream.header_len) = '\0';
 							LOG_INFO("headers: len: %d\n%s", stream.header_len, stream.header);
-							stream.state = stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
-							wake_controller();
+							if (resume.active) {
+								resume.active = false;
+								if (_resumed_at(resume.offset + stream.bytes)) {
+									LOG_INFO("stream resumed at " FMT_u64, resume.offset + stream.bytes);
+									stream.state = resume.state;
+								} else {
+									_disconnect(DISCONNECT, REMOTE_DISCONNECT);
+								}
+							} else {
+								_parse_headers();
+								stream.state = stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
+								wake_controller();
+							}
 						}
 					} else {
 						endtok = 0;
@@ -332,14 +499,16 @@ static void *stream_thread() {
 						space = min(space, stream.meta_next);
 					}
 
+					PERF_TRACE_BEGIN(PERF_STREAM_RECV);
 					n = _recv(ssl, fd, streambuf->writep, space, 0);
+					PERF_TRACE_END(PERF_STREAM_RECV);
 					if (n == 0) {
 						LOG_INFO("end of stream (%u bytes)", stream.bytes);
-						_disconnect(DISCONNECT, DISCONNECT_OK);
+						if (!resume.length || stream.bytes >= resume.length || !_resume()) _disconnect(DISCONNECT, DISCONNECT_OK);
 					}
 					if (n < 0 && _last_error() != ERROR_WOULDBLOCK) {
 						LOG_INFO("error reading: %s", strerror(last_error()));
-						_disconnect(DISCONNECT, REMOTE_DISCONNECT);
+						if (!_resume()) _disconnect(DISCONNECT, REMOTE_DISCONNECT);
 					}
 					
 					if (n > 0) {
@@ -416,6 +585,7 @@ void stream_init(log_level level, unsigned stream_buf_size) {
 	stream.state = STOPPED;
 	stream.header = malloc(MAX_HEADER);
 	*stream.header = '\0';
+	resume.request = malloc(MAX_HEADER);
 
 	fd = -1;
 
@@ -446,6 +616,7 @@ void stream_close(void) {
 	pthread_join(thread, NULL);
 #endif
 	free(stream.header);
+	free(resume.request);
 	buf_destroy(streambuf);
 }
 
@@ -454,6 +625,9 @@ void stream_file(const char *header, size_t header_len, unsigned threshold) {
 
 	LOCK;
 
+	resume.session++;
+	resume.seekable = resume.active = false;
+
 	stream.header_len = header_len;
 	memcpy(stream.header, header, header_len);
 	*(stream.header+header_len) = '\0';
@@ -485,19 +659,16 @@ void stream_file(const char *header, size_t header_len, unsigned threshold) {
 	UNLOCK;
 }
 
-void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, unsigned threshold, bool cont_wait) {
+// SSL context (if any) is returned in handle and must be published by caller under mutex
+static int _connect(u32_t ip, u16_t port, const char *header, void **handle) {
 	struct sockaddr_in addr;
-
-#if EMBEDDED
-	// wait till we are not polling anymore
-	while (polling && running) { usleep(10000);	}	
-#endif	
-
 	int sock = socket(AF_INET, SOCK_STREAM, 0);
 
+	*handle = NULL;
+
 	if (sock < 0) {
 		LOG_ERROR("failed to create socket");
-		return;
+		return -1;
 	}
 
 	memset(&addr, 0, sizeof(addr));
@@ -512,18 +683,15 @@ void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, un
 
 	if (connect_timeout(sock, (struct sockaddr *) &addr, sizeof(addr), 10) < 0) {
 		LOG_INFO("unable to connect to server");
-		LOCK;
-		stream.state = DISCONNECT;
-		stream.disconnect = UNREACHABLE;
-		UNLOCK;
-		return;
+		closesocket(sock);
+		return -1;
 	}
 	
 #if USE_SSL
 	if (ntohs(port) == 443) {
 		char server[256], *p;
+		SSL *ssl = SSL_new(SSLctx);
 
-		ssl = SSL_new(SSLctx);
 		SSL_set_fd(ssl, sock);
 
 		// add SNI
@@ -551,23 +719,47 @@ void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, un
 			LOG_WARN("unable to open SSL socket %d (%d)", status, err);
 			closesocket(sock);
 			SSL_free(ssl);
-			ssl = NULL;
-			LOCK;
-			stream.state = DISCONNECT;
-			stream.disconnect = UNREACHABLE;
-			UNLOCK;
 
-			return;
+			return -1;
 		}
-	} else {
-		ssl = NULL;	
+
+		*handle = ssl;
 	}
 #endif
 
+	return sock;
+}
+
+void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, unsigned threshold, bool cont_wait) {
+	char *p;
+	void *handle;
+	int sock;
+
+#if EMBEDDED
+	// wait till we are not polling anymore
+	while (polling && running) { usleep(10000);	}	
+#endif	
+
+	LOCK;
+	resume.session++;
+	resume.seekable = resume.active = false;
+	UNLOCK;
+
+	if ((sock = _connect(ip, port, header, &handle)) < 0) {
+		LOCK;
+		stream.state = DISCONNECT;
+		stream.disconnect = UNREACHABLE;
+		UNLOCK;
+		return;
+	}
+
 	buf_flush(streambuf);
 
 	LOCK;
 
+#if USE_SSL
+	ssl = handle;
+#endif
 	fd = sock;
 	stream.state = SEND_HEADERS;
 	stream.cont_wait = cont_wait;
@@ -581,6 +773,14 @@ void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, un
 
 	LOG_INFO("header: %s", stream.header);
 
+	// keep original request to resume it if needed
+	p = strcasestr(stream.header, "\r\nRange: bytes=");
+	resume.offset = p ? strtoull(p + 15, NULL, 10) : 0;
+	resume.ip = ip;
+	resume.port = port;
+	resume.request_len = header_len;
+	memcpy(resume.request, stream.header, header_len + 1);
+
 	stream.sent_headers = false;
 	stream.bytes = 0;
 	stream.threshold = threshold;
@@ -591,6 +791,8 @@ void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, un
 bool stream_disconnect(void) {
 	bool disc = false;
 	LOCK;
+	resume.session++;
+	resume.seekable = resume.active = false;
 #if USE_SSL
 	if (ssl) {
 		SSL_shutdown(ssl);
@@ -47,11 +47,19 @@ static void power(adac_power_e mode) { };
 
 const struct adac_s dac_tas5713 = {"TAS5713", init, adac_deinit, power, speaker, headset, volume};
 
-struct tas5713_cmd_s {
-    uint8_t reg;
-    uint8_t value;
+static const adac_seq_t tas5713_init_sequence[] = {
+    { TAS5713_OSC_TRIM, 0x00, 50 },             /* a delay is required after this */
+    { TAS5713_SERIAL_DATA_INTERFACE, 0x03, 0 }, /* I2S  LJ 16 bit */
+    { TAS5713_SYSTEM_CTRL2, 0x00, 0 },          /* exit all channel shutdown */
+    { TAS5713_SOFT_MUTE, 0x00, 0 },             /* unmute */
+    { TAS5713_VOL_MASTER, 0x20, 0 },
+    { TAS5713_VOL_CH1, 0x30, 0 },
+    { TAS5713_VOL_CH2, 0x30, 0 },
+    { TAS5713_VOL_HEADPHONE, 0xFF, 0 },
 };
 
+static adac_dev_t tas5713;
+
 // matching orders
 typedef enum {
     TAS57_ACTIVE = 0,
@@ -77,15 +85,8 @@ static bool init(char *config, int i2c_port, i2s_config_t *i2s_config) {
     ESP_LOGI(TAG, "TAS5713 found");
 
     /* do the init sequence */
-    esp_err_t res = adac_write_byte(TAS5713, TAS5713_OSC_TRIM, 0x00); /* a delay is required after this */
-    vTaskDelay(50 / portTICK_PERIOD_MS); 
-    res |= adac_write_byte(TAS5713, TAS5713_SERIAL_DATA_INTERFACE, 0x03); /* I2S  LJ 16 bit */
-    res |= adac_write_byte(TAS5713, TAS5713_SYSTEM_CTRL2, 0x00); /* exit all channel shutdown */
-    res |= adac_write_byte(TAS5713, TAS5713_SOFT_MUTE, 0x00);    /* unmute */
-    res |= adac_write_byte(TAS5713, TAS5713_VOL_MASTER, 0x20);
-    res |= adac_write_byte(TAS5713, TAS5713_VOL_CH1, 0x30);
-    res |= adac_write_byte(TAS5713, TAS5713_VOL_CH2, 0x30);
-    res |= adac_write_byte(TAS5713, TAS5713_VOL_HEADPHONE, 0xFF);
+    adac_dev_init(&tas5713, TAS5713, ADAC_VAL8);
+    esp_err_t res = adac_dev_sequence(&tas5713, tas5713_init_sequence, ARRAY_SIZE(tas5713_init_sequence));
     
     /* The tas5713 typically has the mclk connected to the sclk. In this
        configuration, mclk must be a multiple of the sclk. The lowest workable
@@ -31,12 +31,8 @@ static void power(adac_power_e mode);
 
 const struct adac_s dac_tas57xx = { "TAS57xx", init, adac_deinit, power, speaker, headset, volume };
 
-struct tas57xx_cmd_s {
-	uint8_t reg;
-	uint8_t value;
-};
-
-static const struct tas57xx_cmd_s tas57xx_init_sequence[] = {
+// only page 0 is used, so register cache does not need to know about pages
+static const adac_seq_t tas57xx_init_sequence[] = {
     { 0x00, 0x00 },		// select page 0
     { 0x02, 0x10 },		// standby
     { 0x0d, 0x10 },		// use SCK for PLL
@@ -49,13 +45,12 @@ static const struct tas57xx_cmd_s tas57xx_init_sequence[] = {
 	{ 0x28, 0x00 },		// I2S length 16 bits
 #endif
 	{ 0x02, 0x00 },		// restart
-	{ 0xff, 0xff }		// end of table
 };
 
 // matching orders
 typedef enum { TAS57_ACTIVE = 0, TAS57_STANDBY, TAS57_DOWN, TAS57_ANALOGUE_OFF, TAS57_ANALOGUE_ON, TAS57_VOLUME } dac_cmd_e;
 
-static const struct tas57xx_cmd_s tas57xx_cmd[] = {
+static const adac_seq_t tas57xx_cmd[] = {
 	{ 0x02, 0x00 },	// TAS57_ACTIVE
 	{ 0x02, 0x10 },	// TAS57_STANDBY
 	{ 0x02, 0x01 },	// TAS57_DOWN
@@ -63,7 +58,7 @@ static const struct tas57xx_cmd_s tas57xx_cmd[] = {
 	{ 0x56, 0x00 },	// TAS57_ANALOGUE_ON
 };
 
-static uint8_t tas57_addr;
+static adac_dev_t tas57;
 
 static void dac_cmd(dac_cmd_e cmd, ...);
 static int tas57_detect(void);
@@ -73,7 +68,7 @@ static int tas57_detect(void);
  */
 static bool init(char *config, int i2c_port, i2s_config_t *i2s_config) {	 
 	// find which TAS we are using (if any)
-	tas57_addr = adac_init(config, i2c_port);
+	int tas57_addr = adac_init(config, i2c_port);
 	if (!tas57_addr) tas57_addr = tas57_detect();
 	
 	if (!tas57_addr) {
@@ -82,19 +77,8 @@ static bool init(char *config, int i2c_port, i2s_config_t *i2s_config) {
 		return false;
 	}
 
-	i2c_cmd_handle_t i2c_cmd = i2c_cmd_link_create();
-	
-	for (int i = 0; tas57xx_init_sequence[i].reg != 0xff; i++) {
-		i2c_master_start(i2c_cmd);
-		i2c_master_write_byte(i2c_cmd, (tas57_addr << 1) | I2C_MASTER_WRITE, I2C_MASTER_NACK);
-		i2c_master_write_byte(i2c_cmd, tas57xx_init_sequence[i].reg, I2C_MASTER_NACK);
-		i2c_master_write_byte(i2c_cmd, tas57xx_init_sequence[i].value, I2C_MASTER_NACK);
-		ESP_LOGD(TAG, "i2c write %x at %u", tas57xx_init_sequence[i].reg, tas57xx_init_sequence[i].value);
-	}
-
-	i2c_master_stop(i2c_cmd);	
-	esp_err_t res = i2c_master_cmd_begin(i2c_port, i2c_cmd, 500 / portTICK_RATE_MS);
-    i2c_cmd_link_delete(i2c_cmd);
+	adac_dev_init(&tas57, tas57_addr, ADAC_VAL8);
+	esp_err_t res = adac_dev_sequence(&tas57, tas57xx_init_sequence, sizeof(tas57xx_init_sequence) / sizeof(adac_seq_t));
 	
 	if (res != ESP_OK) {
 		ESP_LOGE(TAG, "could not intialize TAS57xx %d", res);
@@ -158,7 +142,7 @@ void dac_cmd(dac_cmd_e cmd, ...) {
 		ESP_LOGE(TAG, "DAC volume not handled yet");
 		break;
 	default:
-		ret = adac_write_byte(tas57_addr, tas57xx_cmd[cmd].reg, tas57xx_cmd[cmd].value);
+		ret = adac_dev_write(&tas57, tas57xx_cmd[cmd].reg, tas57xx_cmd[cmd].value);
 	}
 	
   	if (ret != ESP_OK) {
@@ -0,0 +1,163 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "squeezelite.h"
+#include "accounting.h"
+
+#define TEST_RATE			44100
+#define TEST_TICK_MS		10
+#define TEST_FRAMES_TICK	(TEST_RATE * TEST_TICK_MS / 1000)
+#define TEST_STREAM_SIZE	(16 * 1024)
+#define TEST_OUTPUT_MS		200
+#define TEST_OUTPUT_SIZE	(TEST_FRAMES_TICK * (TEST_OUTPUT_MS / TEST_TICK_MS) * BYTES_PER_FRAME)
+#define TEST_START_FRAMES	(TEST_FRAMES_TICK * 10)
+// in ticks: network stall longer than what buffers hold, decode stall longer than outputbuf
+#define TEST_NET_STALL		60, 140
+#define TEST_DECODE_STALL	200, 240
+#define TEST_END_OF_STREAM	300
+#define TEST_TICKS			420
+
+extern struct outputstate output;
+extern struct buffer *streambuf;
+extern struct buffer *outputbuf;
+extern struct streamstate stream;
+extern struct decodestate decode;
+
+/*
+ The stream, decoder and output are simulated in one task, one TEST_TICK_MS step at a time.
+ The network and the decoder both run at twice real time, one stream byte decodes to one
+ frame and output plays TEST_FRAMES_TICK per step. Network and decoder stalls are injected
+ and the simulation measures starvation on its own, to be compared with accounting
+*/
+static struct {
+	bool starved;
+	u32_t starved_at, starved_ms;
+	u32_t start_ms;
+	int underruns;
+} sim;
+
+static bool in(int tick, int start, int end) {
+	return tick >= start && tick < end;
+}
+
+/****************************************************************************************
+ *
+ */
+static void sim_tick(int tick, u32_t started) {
+	u32_t now = gettime_ms();
+	unsigned n, frames;
+
+	mutex_lock(streambuf->mutex);
+	mutex_lock(outputbuf->mutex);
+
+	// network
+	if (tick == TEST_END_OF_STREAM) stream.state = DISCONNECT;
+	if (stream.state > DISCONNECT && !in(tick, TEST_NET_STALL)) {
+		n = min(_buf_space(streambuf), 2 * TEST_FRAMES_TICK);
+		_buf_inc_writep(streambuf, n);
+	}
+
+	// decoder
+	if (decode.state == DECODE_RUNNING && !in(tick, TEST_DECODE_STALL)) {
+		n = min(_buf_used(streambuf), _buf_space(outputbuf) / BYTES_PER_FRAME);
+		n = min(n, 2 * TEST_FRAMES_TICK);
+		_buf_inc_readp(streambuf, n);
+		_buf_inc_writep(outputbuf, n * BYTES_PER_FRAME);
+		if (stream.state <= DISCONNECT && !_buf_used(streambuf)) decode.state = DECODE_COMPLETE;
+	}
+
+	// output
+	frames = _buf_used(outputbuf) / BYTES_PER_FRAME;
+
+	if (output.state == OUTPUT_BUFFER && frames >= TEST_START_FRAMES) {
+		output.state = OUTPUT_RUNNING;
+		sim.start_ms = now - started;
+		_accounting_track_start();
+	}
+
+	if (output.state == OUTPUT_RUNNING) {
+		_accounting_output(frames);
+
+		if (frames && sim.starved) {
+			sim.starved = false;
+			sim.starved_ms += now - sim.starved_at;
+		} else if (!frames && !sim.starved && (decode.state == DECODE_RUNNING || stream.state > DISCONNECT)) {
+			sim.starved = true;
+			sim.starved_at = now;
+			sim.underruns++;
+		}
+
+		_buf_inc_readp(outputbuf, min(frames, TEST_FRAMES_TICK) * BYTES_PER_FRAME);
+	}
+
+	mutex_unlock(outputbuf->mutex);
+	mutex_unlock(streambuf->mutex);
+}
+
+TEST_CASE("Accounting classifies injected network and decode stalls", "[accounting]")
+{
+	struct outputstate saved_output = output;
+	stream_state saved_stream = stream.state;
+	decode_state saved_decode = decode.state;
+	bool own_stream = !streambuf->buf, own_output = !outputbuf->buf;
+	accounting_t track, before, after;
+	static char report[1024];
+	u32_t started;
+
+	// stream thread might exist from another test, it stays idle without a socket
+	if (own_stream) buf_init(streambuf, TEST_STREAM_SIZE);
+	if (own_output) buf_init(outputbuf, TEST_OUTPUT_SIZE);
+	buf_flush(streambuf);
+	buf_flush(outputbuf);
+	memset(&sim, 0, sizeof(sim));
+	accounting_get(NULL, &before);
+
+	output.state = OUTPUT_BUFFER;
+	output.current_sample_rate = TEST_RATE;
+	output.device_frames = output.frames_in_process = 0;
+	stream.state = STREAMING_HTTP;
+	decode.state = DECODE_RUNNING;
+
+	started = gettime_ms();
+	_accounting_stream_start();
+	for (int tick = 0; tick < TEST_TICKS; tick++) {
+		sim_tick(tick, started);
+		vTaskDelay(pdMS_TO_TICKS(TEST_TICK_MS));
+	}
+
+	accounting_get(&track, &after);
+	accounting_report(report, sizeof(report));
+
+	output = saved_output;
+	stream.state = saved_stream;
+	decode.state = saved_decode;
+	buf_flush(streambuf);
+	if (own_stream) buf_destroy(streambuf);
+	if (own_output) buf_destroy(outputbuf);
+
+	printf("%s\nsimulation: %d underruns, %u ms starved, started in %u ms\n", report, sim.underruns, sim.starved_ms, sim.start_ms);
+
+	TEST_ASSERT_EQUAL_INT_MESSAGE(2, sim.underruns, "stalls did not starve output, simulation is wrong");
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, track.underruns[UNDERRUN_STREAM], "network stall not reported as stream underrun");
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, track.underruns[UNDERRUN_DECODE], "decoder stall not reported as decode underrun");
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, track.underruns[UNDERRUN_OUTPUT], "output underrun reported, output never was late");
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, after.underruns[UNDERRUN_STREAM] - before.underruns[UNDERRUN_STREAM], "stream underrun not in totals");
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, after.underruns[UNDERRUN_DECODE] - before.underruns[UNDERRUN_DECODE], "decode underrun not in totals");
+	// both measure between the same output cycles
+	TEST_ASSERT_TRUE_MESSAGE(track.underrun_ms + 2 * TEST_TICK_MS >= sim.starved_ms && track.underrun_ms <= sim.starved_ms + 2 * TEST_TICK_MS,
+							 "starved time is wrong");
+	TEST_ASSERT_TRUE_MESSAGE(track.start_latency_ms + TEST_TICK_MS >= sim.start_ms && track.start_latency_ms <= sim.start_ms + TEST_TICK_MS,
+							 "start latency is wrong");
+	TEST_ASSERT_TRUE_MESSAGE(track.latency_max_ms >= TEST_START_FRAMES * 1000 / TEST_RATE && track.latency_max_ms <= TEST_OUTPUT_MS,
+							 "latency is not what outputbuf holds");
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, track.stream_min, "drained stream buffer not seen");
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, track.output_min, "drained output buffer not seen");
+}
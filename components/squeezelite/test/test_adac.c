@@ -0,0 +1,200 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <string.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/i2c.h"
+#include "adac.h"
+
+#define TEST_ADDR		0x1a
+#define TEST_DELAY_MS	10
+#define TOKEN_START		0x100
+
+/*
+ I2C stand-in: command link calls are wrapped at link time (see CMakeLists.txt). While the
+ bus is active, what is queued on a link is recorded and, instead of the real transaction,
+ decoded as register writes to a device that only has a register file. Transactions, writes
+ and payload bytes are counted and a given transaction can be made to fail. When not active,
+ calls go to the real driver
+*/
+static struct {
+	bool active;
+	adac_format_e format;
+	int fail_at;
+	uint16_t tokens[512];
+	int len;
+	uint16_t regs[256];
+	int transactions, writes, bytes;
+} bus;
+
+esp_err_t __real_i2c_master_start(i2c_cmd_handle_t cmd_handle);
+esp_err_t __real_i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en);
+esp_err_t __real_i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait);
+
+esp_err_t __wrap_i2c_master_start(i2c_cmd_handle_t cmd_handle) {
+	if (bus.active && bus.len < sizeof(bus.tokens) / sizeof(*bus.tokens)) bus.tokens[bus.len++] = TOKEN_START;
+	return __real_i2c_master_start(cmd_handle);
+}
+
+esp_err_t __wrap_i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en) {
+	if (bus.active && bus.len < sizeof(bus.tokens) / sizeof(*bus.tokens)) bus.tokens[bus.len++] = data;
+	return __real_i2c_master_write_byte(cmd_handle, data, ack_en);
+}
+
+/****************************************************************************************
+ * Decode what was queued, one write is START, address, then 2 or 3 bytes
+ */
+esp_err_t __wrap_i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait) {
+	int size = bus.format == ADAC_VAL16 ? 5 : 4;
+
+	if (!bus.active) return __real_i2c_master_cmd_begin(i2c_num, cmd_handle, ticks_to_wait);
+
+	if (++bus.transactions == bus.fail_at) {
+		bus.len = 0;
+		return ESP_FAIL;
+	}
+
+	for (int i = 0; i + size <= bus.len; i += size) {
+		uint16_t *t = bus.tokens + i;
+
+		TEST_ASSERT_EQUAL_HEX16_MESSAGE(TOKEN_START, t[0], "write does not begin with a START");
+		TEST_ASSERT_EQUAL_HEX16_MESSAGE(TEST_ADDR << 1, t[1], "write to wrong address");
+
+		switch (bus.format) {
+		case ADAC_VAL9:
+			bus.regs[t[2] >> 1] = ((t[2] & 0x01) << 8) | t[3];
+			break;
+		case ADAC_VAL16:
+			bus.regs[t[2]] = (t[3] << 8) | t[4];
+			break;
+		default:
+			bus.regs[t[2]] = t[3];
+			break;
+		}
+
+		bus.writes++;
+		bus.bytes += size - 2;
+	}
+
+	TEST_ASSERT_EQUAL_INT_MESSAGE(0, bus.len % size, "partial register write queued");
+	bus.len = 0;
+
+	return ESP_OK;
+}
+
+static void bus_start(adac_dev_t *dev, adac_format_e format) {
+	memset(&bus, 0, sizeof(bus));
+	bus.format = format;
+	bus.active = true;
+	adac_dev_init(dev, TEST_ADDR, format);
+}
+
+static void bus_count(int transactions, int writes, const char *message) {
+	TEST_ASSERT_EQUAL_INT_MESSAGE(transactions, bus.transactions, message);
+	TEST_ASSERT_EQUAL_INT_MESSAGE(writes, bus.writes, message);
+	bus.transactions = bus.writes = bus.bytes = 0;
+}
+
+static void bus_check(const adac_seq_t *seq, size_t count) {
+	for (int i = 0; i < count; i++) {
+		TEST_ASSERT_EQUAL_HEX16_MESSAGE(seq[i].value, bus.regs[seq[i].reg], "register has wrong value");
+	}
+}
+
+/****************************************************************************************
+ *
+ */
+static const adac_seq_t init_seq[] = {
+	{ 0x00, 0x80, TEST_DELAY_MS },	// reset
+	{ 0x01, 0x12, 0 }, { 0x02, 0x34, 0 }, { 0x03, 0x56, 0 }, { 0x04, 0x78, 0 },
+	{ 0x05, 0x9a, 0 }, { 0x06, 0xbc, 0 }, { 0x07, 0xde, 0 }, { 0x08, 0xf0, 0 },
+	{ 0x09, 0x01, TEST_DELAY_MS },	// power-up
+	{ 0x0a, 0x23, 0 }, { 0x0b, 0x45, 0 },
+};
+
+#define INIT_COUNT	(sizeof(init_seq) / sizeof(*init_seq))
+
+TEST_CASE("Register sequence is batched up to delays and cached", "[adac]")
+{
+	adac_dev_t dev;
+	adac_seq_t volume[] = { { 0x0a, 0x23, 0 }, { 0x0b, 0x46, 0 }, { 0x0c, 0x67, 0 } };
+
+	bus_start(&dev, ADAC_VAL8);
+
+	// one transaction per delay, plus one for the tail
+	TEST_ASSERT_EQUAL_INT(ESP_OK, adac_dev_sequence(&dev, init_seq, INIT_COUNT));
+	printf("init: %d writes in %d transactions, %d bytes\n", bus.writes, bus.transactions, bus.bytes);
+	bus_check(init_seq, INIT_COUNT);
+	bus_count(3, INIT_COUNT, "init sequence not batched");
+
+	// entries with delay are always written, everything else is cached
+	TEST_ASSERT_EQUAL_INT(ESP_OK, adac_dev_sequence(&dev, init_seq, INIT_COUNT));
+	bus_count(2, 2, "cached registers rewritten");
+
+	// only changed registers are sent
+	TEST_ASSERT_EQUAL_INT(ESP_OK, adac_dev_sequence(&dev, volume, 3));
+	bus_check(volume, 3);
+	bus_count(1, 2, "unchanged register rewritten");
+
+	TEST_ASSERT_EQUAL_INT(ESP_OK, adac_dev_write(&dev, 0x0c, 0x67));
+	bus_count(0, 0, "single cached write sent");
+
+	bus.active = false;
+}
+
+TEST_CASE("Failed register batch is invalidated", "[adac]")
+{
+	adac_dev_t dev;
+
+	bus_start(&dev, ADAC_VAL8);
+
+	// second batch (0x01 to 0x09) is lost
+	bus.fail_at = 2;
+	TEST_ASSERT_NOT_EQUAL(ESP_OK, adac_dev_sequence(&dev, init_seq, INIT_COUNT));
+	bus_count(3, 1 + 2, "failure stopped the sequence");
+	for (int i = 1; i <= 9; i++) TEST_ASSERT_FALSE_MESSAGE(adac_dev_cached(&dev, init_seq[i].reg, NULL), "failed write still cached");
+	TEST_ASSERT_TRUE_MESSAGE(adac_dev_cached(&dev, 0x0a, NULL), "successful write not cached");
+
+	// retry only resends what was lost (and the delays)
+	bus.fail_at = 0;
+	TEST_ASSERT_EQUAL_INT(ESP_OK, adac_dev_sequence(&dev, init_seq, INIT_COUNT));
+	bus_check(init_seq, INIT_COUNT);
+	bus_count(2, 1 + 9, "lost writes not resent");
+
+	bus.active = false;
+}
+
+TEST_CASE("Register formats and uncached device", "[adac]")
+{
+	static const adac_seq_t wide[] = { { 0x10, 0x1ff, 0 }, { 0x11, 0x0a5, 0 }, { 0x12, 0x100, 0 } };
+	adac_dev_t dev;
+
+	// Wolfson 9 bits values
+	bus_start(&dev, ADAC_VAL9);
+	TEST_ASSERT_EQUAL_INT(ESP_OK, adac_dev_sequence(&dev, wide, 3));
+	bus_check(wide, 3);
+	TEST_ASSERT_EQUAL_INT_MESSAGE(3 * 2, bus.bytes, "9 bits values not packed in 2 bytes");
+	bus_count(1, 3, "9 bits sequence not batched");
+
+	bus_start(&dev, ADAC_VAL16);
+	TEST_ASSERT_EQUAL_INT(ESP_OK, adac_dev_sequence(&dev, wide, 3));
+	bus_check(wide, 3);
+	TEST_ASSERT_EQUAL_INT_MESSAGE(3 * 3, bus.bytes, "16 bits values not sent in 3 bytes");
+	bus_count(1, 3, "16 bits sequence not batched");
+
+	// unknown codec, nothing is skipped
+	bus_start(&dev, ADAC_VAL8);
+	dev.nocache = true;
+	TEST_ASSERT_EQUAL_INT(ESP_OK, adac_dev_sequence(&dev, init_seq + 1, 8));
+	TEST_ASSERT_EQUAL_INT(ESP_OK, adac_dev_sequence(&dev, init_seq + 1, 8));
+	bus_count(2, 16, "uncached device skipped writes");
+
+	bus.active = false;
+}
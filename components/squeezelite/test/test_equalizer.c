@@ -0,0 +1,264 @@
+/* 
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <math.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "platform_config.h"
+#include "squeezelite.h"
+#include "equalizer.h"
+
+#define TEST_BLOCK_FRAMES	256
+#define TEST_AMPLITUDE		0.25	// of full scale, so that +6 dB does not clip
+#define TEST_BAND_1K		5
+#define TEST_BENCH_MS		1000	// of audio per rate
+#define TEST_BENCH_LOAD_MAX	50		// % of CPU at 44.1 kHz, with all bands active
+#define TEST_HAMMER_RATE	44100
+#define TEST_HAMMER_PERIOD	441		// frames, exactly 10 periods of 1 kHz
+#define TEST_HAMMER_BLOCKS	1000	// at least, and until there has been enough updates
+#define TEST_HAMMER_UPDATES	200
+#define TEST_HAMMER_LEVEL	0.05	// of full scale, all bands at max do not clip
+#define TEST_HAMMER_GAIN	6
+#define TEST_HAMMER_BURST	8		// updates between yields
+#define TEST_RESIDUE_MAX	0.15	// of level, a hard coefficient swap is above 0.4
+
+/****************************************************************************************
+ * Play a sine and return output over input level (dB) measured on an integer number of
+ * periods (100 ms or at least 8), once filters have settled for as long
+ */
+static double sine_gain(u32_t sample_rate, float freq) {
+	static ISAMPLE_T buf[TEST_BLOCK_FRAMES * 2];
+	double in = 0, out = 0;
+	int periods = freq >= 80 ? freq / 10 : 8;
+	u32_t settle = lrint(periods * sample_rate / freq), total = 2 * settle;
+
+	for (u32_t n = 0; n < total; ) {
+		u32_t count = min(TEST_BLOCK_FRAMES, total - n);
+
+		for (u32_t i = 0; i < count; i++) {
+			double x = TEST_AMPLITUDE * sin(2 * M_PI * freq * (n + i) / sample_rate);
+#if BYTES_PER_FRAME == 4
+			buf[2*i] = buf[2*i + 1] = lrint(x * 0x7fff);
+#else
+			buf[2*i] = buf[2*i + 1] = lrint(x * 0x7fffffff);
+#endif
+			if (n + i >= settle) in += x * x;
+		}
+
+		equalizer_process((u8_t*) buf, count * BYTES_PER_FRAME, sample_rate);
+
+		for (u32_t i = 0; i < count; i++) {
+#if BYTES_PER_FRAME == 4
+			double y = buf[2*i] / (double) 0x7fff;
+#else
+			double y = buf[2*i] / (double) 0x7fffffff;
+#endif
+			if (n + i >= settle) out += y * y;
+		}
+
+		n += count;
+	}
+
+	return 10 * log10(out / in);
+}
+
+TEST_CASE("Equalizer 1 kHz band gives +6 dB at every rate", "[equalizer]")
+{
+	const u32_t rates[] = { 32000, 44100, 48000, 88200, 96000, 176400, 192000 };
+	s8_t gain[10] = { };
+	char message[32];
+	// updating gains stores them, restore what was there
+	char *saved = config_alloc_get(NVS_TYPE_STR, "equalizer");
+
+	gain[TEST_BAND_1K] = 6;
+	equalizer_update(gain);
+
+	for (int i = 0; i < sizeof(rates) / sizeof(*rates); i++) {
+		equalizer_close();
+		snprintf(message, sizeof(message), "rate %u", rates[i]);
+		TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.1, 6.0, sine_gain(rates[i], 1000), message);
+	}
+
+	// flat equalizer must leave signal untouched
+	gain[TEST_BAND_1K] = 0;
+	equalizer_update(gain);
+	equalizer_close();
+	TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.01, 0.0, sine_gain(44100, 1000), "flat");
+
+	equalizer_close();
+	if (saved) config_set_value(NVS_TYPE_STR, "equalizer", saved);
+	free(saved);
+}
+
+TEST_CASE("Equalizer bands give their gain at 192 kHz", "[equalizer]")
+{
+	// centers of the bands, lowest ones are the hardest to get right at high rates
+	const float bands[10] = { 31.25, 62.5, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+	s8_t flat[10] = { };
+	char *saved = config_alloc_get(NVS_TYPE_STR, "equalizer");
+	char message[32];
+
+	for (int i = 0; i < 10; i++) {
+		s8_t gain[10] = { };
+		gain[i] = i & 0x01 ? -6 : 6;
+		equalizer_update(gain);
+		equalizer_close();
+		snprintf(message, sizeof(message), "band %g Hz", bands[i]);
+		TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.1, gain[i], sine_gain(192000, bands[i]), message);
+	}
+
+	equalizer_update(flat);
+	equalizer_close();
+	if (saved) config_set_value(NVS_TYPE_STR, "equalizer", saved);
+	free(saved);
+}
+
+TEST_CASE("Equalizer CPU load at every rate", "[equalizer]")
+{
+	const u32_t rates[] = { 44100, 96000, 192000 };
+	static ISAMPLE_T src[TEST_BLOCK_FRAMES * 2], buf[TEST_BLOCK_FRAMES * 2];
+	char *saved = config_alloc_get(NVS_TYPE_STR, "equalizer");
+	s8_t gain[10], flat[10] = { };
+	int load[3];
+
+	// all bands active, on a signal that does not clip
+	for (int i = 0; i < 10; i++) gain[i] = i & 0x01 ? -3 : 3;
+	for (int i = 0; i < TEST_BLOCK_FRAMES * 2; i++) src[i] = (i * 7919) % 0x1000;
+	equalizer_update(gain);
+
+	for (int i = 0; i < sizeof(rates) / sizeof(*rates); i++) {
+		u32_t blocks = rates[i] * TEST_BENCH_MS / 1000 / TEST_BLOCK_FRAMES;
+
+		equalizer_close();
+		equalizer_process((u8_t*) buf, TEST_BLOCK_FRAMES * BYTES_PER_FRAME, rates[i]);
+
+		int64_t start = esp_timer_get_time();
+		for (u32_t n = 0; n < blocks; n++) {
+			memcpy(buf, src, sizeof(buf));
+			equalizer_process((u8_t*) buf, TEST_BLOCK_FRAMES * BYTES_PER_FRAME, rates[i]);
+		}
+		int64_t elapsed = esp_timer_get_time() - start;
+
+		load[i] = elapsed * 100 / (blocks * TEST_BLOCK_FRAMES * 1000000LL / rates[i]);
+		printf("%u Hz: %lld us per %d frames, %d%% of CPU\n", rates[i], elapsed / blocks, TEST_BLOCK_FRAMES, load[i]);
+	}
+
+	equalizer_update(flat);
+	equalizer_close();
+	if (saved) config_set_value(NVS_TYPE_STR, "equalizer", saved);
+	free(saved);
+
+	// decoder and output need what is left
+	TEST_ASSERT_TRUE_MESSAGE(load[0] < TEST_BENCH_LOAD_MAX, "equalizer too slow at 44.1 kHz");
+}
+
+/*
+ A control task publishes random gains as fast as it can while the test task plays a 1 kHz
+ sine through the equalizer, as the output thread does. Allocations made by the test task
+ are counted through malloc being wrapped at link time (see CMakeLists.txt). For a pure sine
+ y[n] - 2.cos(w).y[n-1] + y[n-2] is 0 whatever its amplitude and phase, so that residue only
+ moves with the slow gain ramps and jumps when output is discontinuous
+*/
+static struct {
+	volatile bool run;
+	TaskHandle_t audio;
+	u32_t updates;
+	int allocs;
+} hammer;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	if (hammer.audio && xTaskGetCurrentTaskHandle() == hammer.audio) hammer.allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+	if (hammer.audio && xTaskGetCurrentTaskHandle() == hammer.audio) hammer.allocs++;
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	if (hammer.audio && xTaskGetCurrentTaskHandle() == hammer.audio) hammer.allocs++;
+	return __real_realloc(ptr, size);
+}
+
+static void hammer_task(void *arg) {
+	s8_t gain[10];
+
+	while (hammer.run) {
+		for (int i = 0; i < 10; i++) gain[i] = rand() % (2 * TEST_HAMMER_GAIN + 1) - TEST_HAMMER_GAIN;
+		equalizer_update(gain);
+		if (++hammer.updates % TEST_HAMMER_BURST == 0) vTaskDelay(1);
+	}
+
+	vTaskDelete(NULL);
+}
+
+TEST_CASE("Equalizer hammered with updates does not allocate or click", "[equalizer]")
+{
+	static ISAMPLE_T sine[TEST_HAMMER_PERIOD], buf[TEST_BLOCK_FRAMES * 2];
+	float c2 = 2 * cosf(2 * M_PI * 1000 / TEST_HAMMER_RATE), last = 0, prev = 0, residue = 0;
+	char *saved = config_alloc_get(NVS_TYPE_STR, "equalizer");
+	s8_t flat[10] = { };
+	u32_t n = 0;
+	int block;
+
+	for (int i = 0; i < TEST_HAMMER_PERIOD; i++) {
+#if BYTES_PER_FRAME == 4
+		sine[i] = lrint(TEST_HAMMER_LEVEL * sin(2 * M_PI * i * 10 / TEST_HAMMER_PERIOD) * 0x7fff);
+#else
+		sine[i] = lrint(TEST_HAMMER_LEVEL * sin(2 * M_PI * i * 10 / TEST_HAMMER_PERIOD) * 0x7fffffff);
+#endif
+	}
+
+	equalizer_update(flat);
+	equalizer_close();
+
+	memset(&hammer, 0, sizeof(hammer));
+	hammer.run = true;
+	xTaskCreatePinnedToCore(hammer_task, "tst_hammer", 4096, NULL, uxTaskPriorityGet(NULL), NULL, 1);
+	hammer.audio = xTaskGetCurrentTaskHandle();
+
+	for (block = 0; block < TEST_HAMMER_BLOCKS * 20 && (block < TEST_HAMMER_BLOCKS || hammer.updates < TEST_HAMMER_UPDATES); block++) {
+		for (int i = 0; i < TEST_BLOCK_FRAMES; i++, n++) buf[2*i] = buf[2*i + 1] = sine[n % TEST_HAMMER_PERIOD];
+
+		equalizer_process((u8_t*) buf, TEST_BLOCK_FRAMES * BYTES_PER_FRAME, TEST_HAMMER_RATE);
+
+		for (int i = 0; i < TEST_BLOCK_FRAMES; i++) {
+#if BYTES_PER_FRAME == 4
+			float y = buf[2*i] / (float) 0x7fff;
+#else
+			float y = buf[2*i] / (float) 0x7fffffff;
+#endif
+			if (block && fabsf(y - c2 * last + prev) > residue) residue = fabsf(y - c2 * last + prev);
+			prev = last;
+			last = y;
+		}
+	}
+
+	hammer.audio = NULL;
+	hammer.run = false;
+	vTaskDelay(pdMS_TO_TICKS(100));
+
+	printf("%u updates during %d blocks: %d allocations, largest residue %.4f of level\n",
+			hammer.updates, block, hammer.allocs, residue / TEST_HAMMER_LEVEL);
+
+	equalizer_update(flat);
+	equalizer_close();
+	if (saved) config_set_value(NVS_TYPE_STR, "equalizer", saved);
+	free(saved);
+
+	TEST_ASSERT_TRUE_MESSAGE(hammer.updates >= TEST_HAMMER_UPDATES, "control task did not hammer");
+	TEST_ASSERT_EQUAL_INT_MESSAGE(0, hammer.allocs, "output path allocated memory");
+	TEST_ASSERT_TRUE_MESSAGE(residue < TEST_RESIDUE_MAX * TEST_HAMMER_LEVEL, "output is discontinuous");
+}
@@ -0,0 +1,185 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <string.h>
+#include "unity.h"
+#include "driver/i2s.h"
+#include "squeezelite.h"
+
+#define TEST_DMA_COUNT		4
+#define TEST_DMA_FRAMES		300
+// a last DMA buffer only half filled
+#define TEST_FRAMES			(TEST_DMA_COUNT * TEST_DMA_FRAMES - TEST_DMA_FRAMES / 2)
+#define TEST_OUTPUT_SIZE	(TEST_FRAMES * BYTES_PER_FRAME * 8)
+
+extern struct outputstate output;
+extern struct buffer *outputbuf;
+
+extern int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
+							 s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
+extern frames_t _i2s_pack_start(bool in_dma, frames_t frames);
+extern size_t _i2s_pack_send(void);
+
+/*
+ DMA stand-in: I2S driver calls are wrapped at link time (see CMakeLists.txt). While active,
+ DMA descriptors are a ring of buffers that are handed out in order, as the driver does once
+ the previous one is full. Bytes committed in place and bytes the driver had to copy in are
+ counted separately, so that the number of copies of each frame is known. When not active,
+ calls go to the real driver
+*/
+static struct {
+	bool active;
+	u8_t buf[TEST_DMA_COUNT][TEST_DMA_FRAMES * BYTES_PER_FRAME];
+	int idx;
+	size_t pos, borrowed;
+	int buffers, borrows;
+	size_t committed, copied;
+	bool overrun;
+} dma;
+
+esp_err_t __real_i2s_dma_borrow(i2s_port_t i2s_num, void **ptr, size_t *size, TickType_t ticks_to_wait);
+esp_err_t __real_i2s_dma_commit(i2s_port_t i2s_num, size_t size);
+esp_err_t __real_i2s_write(i2s_port_t i2s_num, const void *src, size_t size, size_t *bytes_written, TickType_t ticks_to_wait);
+esp_err_t __real_i2s_write_expand(i2s_port_t i2s_num, const void *src, size_t size, size_t src_bits, size_t aim_bits,
+								  size_t *bytes_written, TickType_t ticks_to_wait);
+
+esp_err_t __wrap_i2s_dma_borrow(i2s_port_t i2s_num, void **ptr, size_t *size, TickType_t ticks_to_wait) {
+	if (!dma.active) return __real_i2s_dma_borrow(i2s_num, ptr, size, ticks_to_wait);
+
+	// current buffer is full, DMA gives the next one
+	if (dma.idx < 0 || dma.pos == sizeof(*dma.buf)) {
+		dma.idx = (dma.idx + 1) % TEST_DMA_COUNT;
+		dma.pos = 0;
+		dma.buffers++;
+	}
+
+	*ptr = dma.buf[dma.idx] + dma.pos;
+	*size = dma.borrowed = sizeof(*dma.buf) - dma.pos;
+	dma.borrows++;
+
+	return ESP_OK;
+}
+
+esp_err_t __wrap_i2s_dma_commit(i2s_port_t i2s_num, size_t size) {
+	if (!dma.active) return __real_i2s_dma_commit(i2s_num, size);
+
+	if (size > dma.borrowed) {
+		dma.overrun = true;
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	dma.pos += size;
+	dma.borrowed -= size;
+	dma.committed += size;
+
+	return ESP_OK;
+}
+
+/****************************************************************************************
+ * Copy into DMA buffers, which is what the driver does with anything that is not borrowed
+ */
+esp_err_t __wrap_i2s_write(i2s_port_t i2s_num, const void *src, size_t size, size_t *bytes_written, TickType_t ticks_to_wait) {
+	if (!dma.active) return __real_i2s_write(i2s_num, src, size, bytes_written, ticks_to_wait);
+
+	for (*bytes_written = 0; *bytes_written < size; ) {
+		void *ptr;
+		size_t space;
+		__wrap_i2s_dma_borrow(i2s_num, &ptr, &space, ticks_to_wait);
+		space = min(space, size - *bytes_written);
+		memcpy(ptr, (u8_t*) src + *bytes_written, space);
+		dma.pos += space;
+		dma.copied += space;
+		*bytes_written += space;
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t __wrap_i2s_write_expand(i2s_port_t i2s_num, const void *src, size_t size, size_t src_bits, size_t aim_bits,
+								  size_t *bytes_written, TickType_t ticks_to_wait) {
+	if (!dma.active) return __real_i2s_write_expand(i2s_num, src, size, src_bits, aim_bits, bytes_written, ticks_to_wait);
+
+	// only what is copied matters here, not how samples are expanded
+	dma.copied += size * aim_bits / src_bits;
+	*bytes_written = size;
+
+	return ESP_OK;
+}
+
+/****************************************************************************************
+ * Puts a known pattern in outputbuf, as the decoder would
+ */
+static void output_fill(u8_t *pattern, size_t size) {
+	for (int i = 0; i < size; i++) pattern[i] = i * 37 + 11;
+
+	for (size_t n = 0; n < size; ) {
+		size_t cont = min(_buf_cont_write(outputbuf), size - n);
+		memcpy(outputbuf->writep, pattern + n, cont);
+		_buf_inc_writep(outputbuf, cont);
+		n += cont;
+	}
+}
+
+TEST_CASE("Frames are packed in DMA buffers and never copied again", "[output]")
+{
+	static u8_t pattern[TEST_FRAMES * BYTES_PER_FRAME];
+	struct outputstate saved_output = output;
+	bool own_output = !outputbuf->buf;
+	size_t bytes = 0;
+	int blocks = 0;
+
+	if (own_output) buf_init(outputbuf, TEST_OUTPUT_SIZE);
+	// visualizer is not initialized and only takes frames when outputbuf is low
+	if (outputbuf->size < TEST_OUTPUT_SIZE) TEST_IGNORE_MESSAGE("outputbuf is too small");
+
+	buf_flush(outputbuf);
+	output_fill(pattern, sizeof(pattern));
+
+	memset(&dma, 0, sizeof(dma));
+	dma.idx = -1;
+	dma.active = true;
+
+	// plain playback at full volume, frames go as they are
+	output.state = OUTPUT_RUNNING;
+	output.write_cb = &_i2s_write_frames;
+	output.gainL = output.gainR = FIXED_ONE;
+	output.gain_ramp = 0;
+	output.current_replay_gain = 0;
+	output.invert = false;
+	output.channels = 0;
+	output.fade = FADE_INACTIVE;
+	output.track_start = NULL;
+	output.current_sample_rate = output.next_sample_rate = 44100;
+
+	// what output thread does for each block when DMA takes samples as they are
+	while (_buf_used(outputbuf)) {
+		frames_t frames = _i2s_pack_start(true, MAX_SILENCE_FRAMES);
+		mutex_lock(outputbuf->mutex);
+		_output_frames(frames);
+		mutex_unlock(outputbuf->mutex);
+		bytes += _i2s_pack_send();
+		blocks++;
+	}
+
+	dma.active = false;
+	output = saved_output;
+	buf_flush(outputbuf);
+	if (own_output) buf_destroy(outputbuf);
+
+	printf("%d frames in %d blocks over %d DMA buffers: %u bytes packed in place, %u bytes copied by driver\n",
+			TEST_FRAMES, blocks, dma.buffers, dma.committed, dma.copied);
+
+	TEST_ASSERT_FALSE_MESSAGE(dma.overrun, "committed more than borrowed");
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, dma.copied, "frames copied again into DMA");
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(sizeof(pattern), dma.committed, "frames not committed in place");
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(sizeof(pattern), bytes, "sent bytes not reported");
+	// one block per DMA buffer, none straddles two
+	TEST_ASSERT_EQUAL_INT_MESSAGE(TEST_DMA_COUNT, dma.buffers, "wrong number of DMA buffers used");
+	TEST_ASSERT_EQUAL_INT_MESSAGE(TEST_DMA_COUNT, blocks, "blocks do not match DMA buffers");
+	TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(pattern, dma.buf, sizeof(pattern), "DMA does not hold frames in order");
+}
@@ -0,0 +1,181 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_task.h"
+#include "tcpip_adapter.h"
+#include "lwip/sockets.h"
+#include "squeezelite.h"
+
+#define TEST_PORT			9123
+#define TEST_LENGTH			(48 * 1024)
+#define TEST_DROP_EVERY		(16 * 1024)
+#define TEST_TIMEOUT_MS		20000
+
+extern struct buffer *streambuf;
+extern struct streamstate stream;
+
+/*
+ Local HTTP server serving a known pattern with Range support. It closes the connection
+ every TEST_DROP_EVERY bytes and can answer a resume with a range that was not asked for
+*/
+static struct {
+	volatile bool running, done;
+	bool bad_range;
+	int connections;
+} server;
+
+static u8_t pattern(u32_t i) {
+	return i * 31 + (i >> 8);
+}
+
+/****************************************************************************************
+ *
+ */
+static void server_reply(int sock) {
+	char request[512], reply[256];
+	u32_t offset = 0, end;
+	int len = 0, n;
+	char *p;
+
+	// read request up to its empty line
+	while (len < sizeof(request) - 1 && (n = recv(sock, request + len, sizeof(request) - 1 - len, 0)) > 0) {
+		len += n;
+		request[len] = '\0';
+		if (strstr(request, "\r\n\r\n")) break;
+	}
+
+	if ((p = strcasestr(request, "\r\nRange: bytes=")) != NULL) offset = strtoul(p + 15, NULL, 10);
+
+	if (offset) {
+		// a broken server answers with another range than requested
+		u32_t start = server.bad_range ? offset + 1 : offset;
+		len = sprintf(reply, "HTTP/1.1 206 Partial Content\r\nContent-Length: %u\r\nAccept-Ranges: bytes\r\n"
+						     "Content-Range: bytes %u-%u/%u\r\n\r\n", TEST_LENGTH - start, start, TEST_LENGTH - 1, TEST_LENGTH);
+		offset = start;
+	} else {
+		len = sprintf(reply, "HTTP/1.1 200 OK\r\nContent-Length: %u\r\nAccept-Ranges: bytes\r\n\r\n", TEST_LENGTH);
+	}
+	send(sock, reply, len, 0);
+
+	// drop connection at next multiple of TEST_DROP_EVERY
+	end = min(TEST_LENGTH, (offset / TEST_DROP_EVERY + 1) * TEST_DROP_EVERY);
+	while (offset < end) {
+		u8_t chunk[256];
+		for (n = 0; n < sizeof(chunk) && offset + n < end; n++) chunk[n] = pattern(offset + n);
+		if (send(sock, chunk, n, 0) != n) break;
+		offset += n;
+	}
+}
+
+/****************************************************************************************
+ *
+ */
+static void server_task(void *arg) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(TEST_PORT), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	int listener = socket(AF_INET, SOCK_STREAM, 0), on = 1;
+
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	bind(listener, (struct sockaddr*) &addr, sizeof(addr));
+	listen(listener, 1);
+
+	while (server.running) {
+		struct timeval timeout = { 0, 100 * 1000 };
+		fd_set fds;
+		int sock;
+
+		FD_ZERO(&fds);
+		FD_SET(listener, &fds);
+		if (select(listener + 1, &fds, NULL, NULL, &timeout) <= 0) continue;
+		if ((sock = accept(listener, NULL, NULL)) < 0) continue;
+
+		server.connections++;
+		server_reply(sock);
+		closesocket(sock);
+	}
+
+	closesocket(listener);
+	server.done = true;
+	vTaskDelete(NULL);
+}
+
+/****************************************************************************************
+ * Stream from local server and check every byte, returns number of bytes received
+ */
+static u32_t stream_check(bool bad_range, disconnect_code *disconnect) {
+	static const char request[] = "GET /test HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+	static bool initialized;
+	u32_t received = 0, start = gettime_ms();
+	bool ok = true;
+
+	if (!initialized) {
+		tcpip_adapter_init();
+		stream_init(lINFO, 8 * 1024);
+		initialized = true;
+	}
+
+	memset(&server, 0, sizeof(server));
+	server.running = true;
+	server.bad_range = bad_range;
+	xTaskCreate(server_task, "test_http", 4096, NULL, ESP_TASK_PRIO_MIN + 2, NULL);
+
+	stream_sock(htonl(INADDR_LOOPBACK), htons(TEST_PORT), request, sizeof(request) - 1, 0, false);
+
+	// slimproto sets this once it has sent headers to LMS, only then streams can be resumed
+	mutex_lock(streambuf->mutex);
+	stream.sent_headers = true;
+	mutex_unlock(streambuf->mutex);
+
+	while (gettime_ms() - start < TEST_TIMEOUT_MS) {
+		unsigned bytes;
+		stream_state state;
+
+		mutex_lock(streambuf->mutex);
+		state = stream.state;
+		*disconnect = stream.disconnect;
+		bytes = min(_buf_used(streambuf), _buf_cont_read(streambuf));
+		for (unsigned i = 0; i < bytes; i++) ok &= streambuf->readp[i] == pattern(received + i);
+		_buf_inc_readp(streambuf, bytes);
+		received += bytes;
+		mutex_unlock(streambuf->mutex);
+
+		if (!bytes && state <= DISCONNECT) break;
+		if (!bytes) vTaskDelay(pdMS_TO_TICKS(10));
+	}
+
+	stream_disconnect();
+	server.running = false;
+	while (!server.done) vTaskDelay(pdMS_TO_TICKS(10));
+
+	TEST_ASSERT_TRUE_MESSAGE(ok, "stream content differs from what server sent");
+	return received;
+}
+
+TEST_CASE("Stream resumes after disconnects with Range requests", "[stream]")
+{
+	disconnect_code disconnect;
+	u32_t received = stream_check(false, &disconnect);
+
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(TEST_LENGTH, received, "stream incomplete");
+	TEST_ASSERT_EQUAL_INT_MESSAGE(DISCONNECT_OK, disconnect, "stream did not end normally");
+	TEST_ASSERT_EQUAL_INT_MESSAGE(TEST_LENGTH / TEST_DROP_EVERY, server.connections, "one connection expected per drop");
+}
+
+TEST_CASE("Stream is not resumed when server sends another range", "[stream]")
+{
+	disconnect_code disconnect;
+	u32_t received = stream_check(true, &disconnect);
+
+	// nothing from the wrong range must have reached streambuf
+	TEST_ASSERT_EQUAL_UINT32_MESSAGE(TEST_DROP_EVERY, received, "data after mismatched range was kept");
+	TEST_ASSERT_EQUAL_INT_MESSAGE(REMOTE_DISCONNECT, disconnect, "mismatched range must disconnect");
+}
@@ -0,0 +1,150 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdlib.h>
+#include "unity.h"
+#include "esp_timer.h"
+#include "squeezelite.h"
+
+#define TEST_EVENT_HZ		100
+#define TEST_EVENTS			200
+#define TEST_RAMP_MS		20
+#define TEST_BLOCK_FRAMES	1024
+#if BYTES_PER_FRAME == 4
+#define TEST_DC				0x7fff
+#else
+#define TEST_DC				0x3fffffff
+#endif
+
+extern struct outputstate output;
+
+/*
+ A constant signal goes through the output gain in blocks, as the output thread does, so
+ that each output sample is the gain applied at that frame. Volume changes happen at block
+ boundaries, which is when the output thread sees a new gain
+*/
+static ISAMPLE_T samples[TEST_BLOCK_FRAMES * 2];
+static struct buffer block = { .buf = (u8_t*) samples, .readp = (u8_t*) samples };
+
+static s32_t level(s32_t gain) {
+	return ((s64_t) gain * TEST_DC) >> 16;
+}
+
+static void gain_block(frames_t count, s32_t gain) {
+	for (int i = 0; i < count * 2; i++) samples[i] = TEST_DC;
+	_apply_gain(&block, count, gain, gain, 0);
+}
+
+static void gain_reset(u32_t rate, unsigned ramp_ms, s32_t gain) {
+	output.current_sample_rate = rate;
+	output.gain_ramp = 0;
+	gain_block(1, gain);
+	output.gain_ramp = ramp_ms;
+}
+
+/****************************************************************************************
+ * Runs a number of frames towards gain and returns the output level of the last one
+ */
+static s32_t ramp_run(s32_t gain, u32_t frames) {
+	s32_t value = 0;
+
+	for (u32_t n = 0; n < frames; ) {
+		frames_t count = min(TEST_BLOCK_FRAMES, frames - n);
+		gain_block(count, gain);
+		value = samples[(count - 1) * 2];
+		n += count;
+	}
+
+	return value;
+}
+
+TEST_CASE("Volume ramp lasts its configured time whatever the change and rate", "[volume]")
+{
+	static const struct {
+		u32_t rate;
+		unsigned ramp_ms;
+		s32_t from, to;
+	} cases[] = {
+		{ 44100, TEST_RAMP_MS, FIXED_ONE, FIXED_ONE / 4 },
+		{ 44100, TEST_RAMP_MS, FIXED_ONE, FIXED_ONE - 100 },	// a fixed slope would be done in 2 frames
+		{ 8000, TEST_RAMP_MS, FIXED_ONE / 4, FIXED_ONE },
+		{ 192000, 1000, 0, FIXED_ONE },							// ramp times rate does not fit in 32 bits
+	};
+	unsigned saved_ramp = output.gain_ramp;
+	u32_t saved_rate = output.current_sample_rate;
+	char message[64];
+
+	for (int i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+		u32_t length = (u64_t) cases[i].ramp_ms * cases[i].rate / 1000;
+		s32_t from = level(cases[i].from), to = level(cases[i].to), half = (from + to) / 2;
+		s32_t tolerance = abs(to - from) / 50 + 1;
+
+		snprintf(message, sizeof(message), "%u ms at %u Hz, from %d to %d", cases[i].ramp_ms, cases[i].rate, cases[i].from, cases[i].to);
+
+		// half way at half time, not there at 80% and there on time
+		gain_reset(cases[i].rate, cases[i].ramp_ms, cases[i].from);
+		TEST_ASSERT_INT_WITHIN_MESSAGE(tolerance, half, ramp_run(cases[i].to, length / 2), message);
+		TEST_ASSERT_TRUE_MESSAGE(ramp_run(cases[i].to, length * 3 / 10) != to, message);
+		TEST_ASSERT_EQUAL_INT_MESSAGE(to, ramp_run(cases[i].to, length - length / 2 - length * 3 / 10), message);
+	}
+
+	output.gain_ramp = saved_ramp;
+	output.current_sample_rate = saved_rate;
+	gain_reset(saved_rate, saved_ramp, FIXED_ONE);
+}
+
+TEST_CASE("Volume changed 100 times per second has no jumps", "[volume]")
+{
+	u32_t rate = 44100, frames = rate / TEST_EVENT_HZ, length = rate * TEST_RAMP_MS / 1000;
+	// a full scale change spread over the ramp, plus rounding
+	s32_t jump_max = level(FIXED_ONE / length + 1) + 1, jump = 0;
+	unsigned saved_ramp = output.gain_ramp;
+	u32_t saved_rate = output.current_sample_rate;
+	s32_t gain = FIXED_ONE, last;
+	int64_t cost = 0, cost_max = 0;
+	bool monotonic = true, bounded = true;
+
+	gain_reset(rate, TEST_RAMP_MS, gain);
+	last = level(gain);
+
+	for (int event = 0; event < TEST_EVENTS; event++) {
+		s32_t from = last, to;
+		// alternate large and small changes
+		gain = event & 1 ? abs(gain - (rand() % 2048)) : rand() % (FIXED_ONE + 1);
+		to = level(gain);
+
+		int64_t start = esp_timer_get_time();
+		gain_block(frames, gain);
+		int64_t elapsed = esp_timer_get_time() - start;
+
+		cost += elapsed;
+		if (elapsed > cost_max) cost_max = elapsed;
+
+		for (int i = 0; i < frames; i++) {
+			s32_t value = samples[2 * i];
+			if (abs(value - last) > jump) jump = abs(value - last);
+			// moving towards target, never beyond
+			if ((s64_t) (to - from) * (value - last) < 0) monotonic = false;
+			if (value < min(from, to) || value > (from > to ? from : to)) bounded = false;
+			last = value;
+		}
+	}
+
+	printf("%d volume changes at %d Hz: largest step %d (max %d), %lld us per %u frames (max %lld us)\n",
+			TEST_EVENTS, TEST_EVENT_HZ, jump, jump_max, cost / TEST_EVENTS, frames, cost_max);
+
+	TEST_ASSERT_TRUE_MESSAGE(jump <= jump_max, "volume jumped");
+	TEST_ASSERT_TRUE_MESSAGE(monotonic, "volume moved away from its target");
+	TEST_ASSERT_TRUE_MESSAGE(bounded, "volume overshot its target");
+	// last request is reached within the ramp time once changes stop
+	TEST_ASSERT_EQUAL_INT_MESSAGE(level(gain), ramp_run(gain, length), "last volume not reached");
+
+	output.gain_ramp = saved_ramp;
+	output.current_sample_rate = saved_rate;
+	gain_reset(saved_rate, saved_ramp, FIXED_ONE);
+}
@@ -24,14 +24,11 @@
 /* 
 *  with some low-end CPU, the decode call takes a fair bit of time and if the outputbuf is locked during that
 *  period, the output_thread (or equivalent) will be locked although there is plenty of samples available.
-*  Normally, with PRIO_INHERIT, that thread should increase decoder priority and get the lock quickly but it
-*  seems that when the streambuf has plenty of data, the decode thread grabs the CPU to much, even it the output
-*  thread has a higher priority. Using an interim buffer where vorbis decoder writes the output is not great from
-*  an efficiency (one extra memory copy) point of view, but it allows the lock to not be kept for too long
+*  Rather than decoding into an interim buffer and copying it afterwards, the decoder writes directly in the 
+*  free space of outputbuf with the lock released. This is safe because only the decode thread moves writep 
+*  and a flush always goes through decode_flush, which waits for LOCK_D to be released. The writep is checked 
+*  again once the lock is re-acquired, so frames decoded across an (external) flush are simply discarded
 */
-#if EMBEDDED
-#define FRAME_BUF 2048
-#endif
 
 #if BYTES_PER_FRAME == 4		
 #define ALIGN(n) 	(n)
@@ -55,9 +52,6 @@
 struct vorbis {
 	OggVorbis_File *vf;
 	bool opened;
-#if FRAME_BUF	
-	u8_t *write_buf;
-#endif	
 #if !LINKALL
 	// vorbis symbols to be dynamically loaded - from either vorbisfile or vorbisidec (tremor) version of library
 	vorbis_info *(* ov_info)(OggVorbis_File *vf, int link);
@@ -185,19 +179,12 @@ static decode_state vorbis_decode(void) {
 		}
 	}
 	
-#if FRAME_BUF
-	IF_DIRECT(
-		frames = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
-		frames = min(frames, FRAME_BUF);
-		write_buf = v->write_buf;
-	);
-#else
 	LOCK_O_direct;
 	IF_DIRECT(
 		frames = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
 		write_buf = outputbuf->writep;
 	);
-#endif
+	UNLOCK_O_direct;
 	IF_PROCESS(
 		frames = process.max_in_frames;
 		write_buf = process.inbuf;
@@ -222,9 +209,15 @@ static decode_state vorbis_decode(void) {
 	}
 #endif	
 
-#if FRAME_BUF
 	LOCK_O_direct;
-#endif	
+
+	// outputbuf has been flushed while we were decoding, discard these frames
+	IF_DIRECT(
+		if (write_buf != outputbuf->writep && n > 0) {
+			LOG_INFO("outputbuf flushed during decode, dropping %d bytes", n);
+			n = OV_HOLE;
+		}
+	);
 
 	if (n > 0) {
 		frames_t count;
@@ -244,14 +237,7 @@ static decode_state vorbis_decode(void) {
 		)
 
 		if (channels == 2) {
-#if BYTES_PER_FRAME == 4
-#if FRAME_BUF
-			// copy needed only when DIRECT and FRAME_BUF
-			IF_DIRECT(
-				memcpy(outputbuf->writep, write_buf, frames * BYTES_PER_FRAME);
-			)
-#endif			
-#else
+#if BYTES_PER_FRAME == 8
 			while (count--) {
 				*--optr = ALIGN(*--iptr);
 			}
@@ -302,9 +288,6 @@ static void vorbis_open(u8_t size, u8_t rate, u8_t chan, u8_t endianness) {
 	if (!v->vf) {
 		v->vf = malloc(sizeof(OggVorbis_File) + 128); // add some padding as struct size may be larger
 		memset(v->vf, 0, sizeof(OggVorbis_File) + 128);
-#if FRAME_BUF		
-		v->write_buf = malloc(FRAME_BUF * BYTES_PER_FRAME);
-#endif		
 	} else {
 		if (v->opened) {
 			OV(v, clear, v->vf);
@@ -319,10 +302,6 @@ static void vorbis_close(void) {
 		v->opened = false;
 	}
 	free(v->vf);
-#if FRAME_BUF	
-	free(v->write_buf);
-	v->write_buf = NULL;
-#endif	
 	v->vf = NULL;
 }
 
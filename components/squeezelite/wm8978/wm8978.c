@@ -25,10 +25,10 @@ static bool volume(unsigned left, unsigned right) { return false; }
 static void power(adac_power_e mode);
 static bool init(char *config, int i2c_port_num, i2s_config_t *i2s_config);
 
-static esp_err_t i2c_write_shadow(uint8_t reg, uint16_t val);
+static esp_err_t i2c_write_shadow(const adac_seq_t *seq, size_t count);
 static uint16_t i2c_read_shadow(uint8_t reg);
 
-static int WM8978;
+static adac_dev_t wm8978;
 
 const struct adac_s dac_wm8978 = { "WM8978", init, adac_deinit, power, speaker, headset, volume };
 
@@ -44,22 +44,23 @@ static uint16_t WM8978_REGVAL_TBL[58] =	{
 		0X0001, 0X0001
 };
 
+// reg 0 is a software reset
+static const adac_seq_t wm8978_init_sequence[] = {
+	{ 0, 0, 0 }, { 4, 16, 0 }, { 6, 0, 0 }, { 10, 8, 0 }, { 43, 16, 0 }, { 49, 102, 0 },
+};
+
 /****************************************************************************************
  * init
  */
 static bool init(char *config, int i2c_port, i2s_config_t *i2s_config) {	 
-	WM8978 = adac_init(config, i2c_port);
+	int addr = adac_init(config, i2c_port);
 	
-	if (!WM8978) WM8978 = 0x1a;
-	ESP_LOGI(TAG, "WM8978 detected @%d", WM8978);
+	if (!addr) addr = 0x1a;
+	ESP_LOGI(TAG, "WM8978 detected @%d", addr);
 
 	// init sequence
-	i2c_write_shadow(0, 0);
-	i2c_write_shadow(4, 16);
-	i2c_write_shadow(6, 0);
-	i2c_write_shadow(10, 8);
-	i2c_write_shadow(43, 16);
-	i2c_write_shadow(49, 102);
+	adac_dev_init(&wm8978, addr, ADAC_VAL9);
+	i2c_write_shadow(wm8978_init_sequence, sizeof(wm8978_init_sequence) / sizeof(adac_seq_t));
 	
 	// Configure system clk to GPIO0 for DAC MCLK input
     ESP_LOGI(TAG, "Configuring MCLK on GPIO0");
@@ -75,19 +76,16 @@ static bool init(char *config, int i2c_port, i2s_config_t *i2s_config) {
 static void power(adac_power_e mode) {
 	uint16_t *data, off[] = {0, 0, 0}, on[] = {11, 384, 111};
 	data = (mode == ADAC_STANDBY || mode == ADAC_OFF) ? off : on;
-	i2c_write_shadow(1, data[0]);
-	i2c_write_shadow(2, data[1]);
-	i2c_write_shadow(3, data[2]);
+	adac_seq_t seq[] = { { 1, data[0], 0 }, { 2, data[1], 0 }, { 3, data[2], 0 } };
+	i2c_write_shadow(seq, 3);
 }
 
 /****************************************************************************************
- *  Write with custom reg/value structure
+ *  Write a sequence and update shadow (9 bits format is handled by core)
  */
- static esp_err_t i2c_write_shadow(uint8_t reg, uint16_t val) {
-	WM8978_REGVAL_TBL[reg] = val;
-	reg = (reg << 1) | ((val >> 8) & 0x01);
-    val &= 0xff;  
-	return adac_write_byte(WM8978, reg, val);
+static esp_err_t i2c_write_shadow(const adac_seq_t *seq, size_t count) {
+	for (int i = 0; i < count; i++) WM8978_REGVAL_TBL[seq[i].reg] = seq[i].value;
+	return adac_dev_sequence(&wm8978, seq, count);
 }
 
 /****************************************************************************************
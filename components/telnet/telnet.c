@@ -66,6 +66,9 @@ static bool bIsEnabled=false;
 static int partnerSocket;
 static telnet_t *tnHandle;
 static bool bMirrorToUART;
+static char *out_buf;
+static size_t out_len, out_pos;
+static uint32_t dropped;
 
 /************************************
  * Forward declarations
@@ -75,7 +78,7 @@ static int 		stdout_open(const char * path, int flags, int mode);
 static int 		stdout_fstat(int fd, struct stat * st);
 static ssize_t 	stdout_write(int fd, const void * data, size_t size);
 static void 	handle_telnet_conn();
-static size_t 	process_logs( UBaseType_t bytes, bool make_room);
+static size_t 	process_logs(void);
 
 void init_telnet(){
 	char *val= get_nvs_value_alloc(NVS_TYPE_STR, "telnet_enable");
@@ -204,30 +207,55 @@ static void handle_telnet_events(telnet_t *thisTelnet, telnet_event_t *event, vo
 	}
 }
 
-static size_t process_logs(UBaseType_t bytes, bool make_room){
-	UBaseType_t pending;
+/* Same translation as telnet_send_text (CR -> CR NUL, LF -> CR LF, IAC doubled) 
+ * but done in bulk, so that a whole batch goes out in a single send */
+static size_t telnet_escape(char *dst, const char *src, size_t len) {
+	char *p = dst;
+
+	while (len--) {
+		unsigned char c = *src++;
+		if (c == '\n') { *p++ = '\r'; *p++ = '\n'; }
+		else if (c == '\r') { *p++ = '\r'; *p++ = '\0'; }
+		else if (c == TELNET_IAC) { *p++ = TELNET_IAC; *p++ = TELNET_IAC; }
+		else *p++ = c;
+	}
+
+	return p - dst;
+}
 
-	vRingbufferGetInfo(buf_handle, NULL, NULL, NULL, NULL, &pending);
+static size_t process_logs(void) {
+	UBaseType_t waiting;
 
-	// nothing to do or we can do 
-	if (!partnerSocket || (make_room && log_buf_size - pending > bytes)) return pending;
+	if (!out_buf) return 0;
 
-	// can't send more than what we have
-	if (bytes > pending) bytes = pending;
+	// refill output buffer only once previous batch is fully sent
+	if (out_pos == out_len) {
+		uint32_t lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+		size_t room = send_chunk;
 
-	while (bytes > 0) {
-		size_t size;
-		char *item = (char *)xRingbufferReceiveUpTo(buf_handle, &size, pdMS_TO_TICKS(50), bytes);
-		
-		if (!item || !partnerSocket) break;
+		out_pos = out_len = 0;
+		if (lost) out_len = sprintf(out_buf, "\r\n[telnet: %u bytes of log dropped]\r\n", lost);
 
-		bytes -= size;
-		telnet_send_text(tnHandle, item, size);
+		// gather up to send_chunk bytes, i.e. both sides of the ring's wrap
+		while (room) {
+			size_t size;
+			char *item = (char *)xRingbufferReceiveUpTo(buf_handle, &size, 0, room);
 
-		vRingbufferReturnItem(buf_handle, (void *)item);
+			if (!item) break;
+			out_len += telnet_escape(out_buf + out_len, item, size);
+			vRingbufferReturnItem(buf_handle, (void *)item);
+			room -= size;
+		}
 	}
 
-	return pending - bytes;
+	// never wait for a slow client, whatever is not sent now will be next time
+	if (out_pos < out_len) {
+		int sent = send(partnerSocket, out_buf + out_pos, out_len - out_pos, MSG_DONTWAIT);
+		if (sent > 0) out_pos += sent;
+	}
+
+	vRingbufferGetInfo(buf_handle, NULL, NULL, NULL, NULL, &waiting);
+	return waiting + out_len - out_pos;
 }
 
 static void handle_telnet_conn() {
@@ -249,6 +277,11 @@ static void handle_telnet_conn() {
 	pTelnetUserData->tnHandle = tnHandle;
 	pTelnetUserData->sockfd = partnerSocket;
 
+	// worst case escaping doubles the size, plus room for the dropped bytes notice
+	out_buf = (char *) heap_caps_malloc(2 * send_chunk + 64, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	out_pos = out_len = 0;
+	if (!out_buf) ESP_LOGE(TAG, "Failed to allocate telnet output buffer, logs won't be sent");
+
 	bool pending = true;
 
 	while(1) {
@@ -266,12 +299,12 @@ static void handle_telnet_conn() {
 
 		if (FD_ISSET(partnerSocket, &rfds)) { 
 			int len = recv(partnerSocket, pTelnetUserData->rxbuf, TELNET_RX_BUF, 0);
-			if (!len) break;
+			if (len <= 0) break;
 			telnet_recv(tnHandle, pTelnetUserData->rxbuf, len);
 		}
 
 		if (FD_ISSET(partnerSocket, &wfds)) {	
-			pending = process_logs(send_chunk, false) > 0;
+			pending = process_logs() > 0;
 		} else {
 			pending = true;
 		}
@@ -282,6 +315,7 @@ static void handle_telnet_conn() {
 
 	free(pTelnetUserData->rxbuf);
 	free(pTelnetUserData);
+	FREE_AND_NULL(out_buf);
 
 	close(partnerSocket);
 	partnerSocket = 0;
@@ -289,10 +323,9 @@ static void handle_telnet_conn() {
 
 // ******************* stdout/stderr Redirection to ringbuffer
 static ssize_t stdout_write(int fd, const void * data, size_t size) {
-	// flush the buffer and send item
-	if (buf_handle) {
-		process_logs(size, true);
-		xRingbufferSend(buf_handle, data, size, 0);
+	// writers only queue, the telnet task does the sending so a slow client never blocks a printf
+	if (buf_handle && xRingbufferSend(buf_handle, data, size, 0) != pdTRUE) {
+		__atomic_fetch_add(&dropped, size, __ATOMIC_RELAXED);
 	}
 	
 	// mirror to uart if required
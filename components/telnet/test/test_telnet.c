@@ -0,0 +1,139 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_task.h"
+#include "esp_timer.h"
+#include "tcpip_adapter.h"
+#include "lwip/sockets.h"
+#include "nvs_utilities.h"
+#include "telnet.h"
+
+#define TEST_LINES			1000
+#define TEST_READ_SIZE		32
+#define TEST_READ_EVERY_MS	50
+#define TEST_LATENCY_MAX_US	(10 * 1000)
+#define TEST_NOTICE			"bytes of log dropped"
+
+/*
+ A telnet client on loopback that reads TEST_READ_SIZE bytes every TEST_READ_EVERY_MS, far
+ slower than logs are produced, so the socket and then the log ring fill up while printf
+ latency is measured. Once told to, it reads at full speed to collect what is left
+*/
+static struct {
+	volatile bool fast, done;
+	uint32_t received;
+	bool dropped_notice;
+} client;
+
+static void client_task(void *arg) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(23), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	int sock = socket(AF_INET, SOCK_STREAM, 0), idle = 0;
+	char buf[TEST_READ_SIZE * 4];
+	size_t keep = 0;
+
+	if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) goto exit;
+
+	// stop once logs have been drained and nothing came for a while
+	while (!client.fast || idle < 10) {
+		struct timeval timeout = { 0, 50 * 1000 };
+		int n;
+
+		if (!client.fast) vTaskDelay(pdMS_TO_TICKS(TEST_READ_EVERY_MS));
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		n = recv(sock, buf + keep, client.fast ? sizeof(buf) - keep : TEST_READ_SIZE, 0);
+
+		if (n > 0) {
+			size_t len = keep + n;
+
+			client.received += n;
+			if (memmem(buf, len, TEST_NOTICE, strlen(TEST_NOTICE))) client.dropped_notice = true;
+			// notice may straddle two reads, keep a tail
+			keep = MIN(len, strlen(TEST_NOTICE));
+			memmove(buf, buf + len - keep, keep);
+			idle = 0;
+		} else if (n == 0) {
+			break;
+		} else {
+			idle++;
+		}
+	}
+
+exit:
+	closesocket(sock);
+	client.done = true;
+	vTaskDelete(NULL);
+}
+
+/****************************************************************************************
+ * stdout goes to telnet only (no UART mirror) during measurement, Unity needs it back
+ */
+static void stdout_to_telnet(void) {
+	static bool initialized;
+
+	if (initialized) {
+		freopen("/dev/pkspstdout", "wb", stdout);
+		freopen("/dev/pkspstdout", "wb", stderr);
+		return;
+	}
+
+	tcpip_adapter_init();
+	store_nvs_value(NVS_TYPE_STR, "telnet_enable", "Y");
+	init_telnet();
+	erase_nvs("telnet_enable");
+	start_telnet(NULL);
+	initialized = true;
+}
+
+static void stdout_to_uart(void) {
+	fflush(stdout);
+	fflush(stderr);
+	freopen("/dev/uart/0", "w", stdout);
+	freopen("/dev/uart/0", "w", stderr);
+}
+
+TEST_CASE("Printf latency stays low with a slow telnet client", "[telnet]")
+{
+	int64_t total = 0, worst = 0;
+
+	memset(&client, 0, sizeof(client));
+	stdout_to_telnet();
+	// let telnet task listen before connecting
+	vTaskDelay(pdMS_TO_TICKS(200));
+	xTaskCreate(client_task, "test_telnet", 3072, NULL, ESP_TASK_PRIO_MIN + 1, NULL);
+	vTaskDelay(pdMS_TO_TICKS(200));
+
+	for (int i = 0; i < TEST_LINES; i++) {
+		int64_t start = esp_timer_get_time();
+
+		printf("telnet latency test line %04d, padded to look like a regular log line ......\n", i);
+		fflush(stdout);
+
+		int64_t elapsed = esp_timer_get_time() - start;
+		if (elapsed > worst) worst = elapsed;
+		total += elapsed;
+	}
+
+	client.fast = true;
+	while (!client.done) vTaskDelay(pdMS_TO_TICKS(50));
+	stdout_to_uart();
+
+	printf("printf latency over %d lines: average %lld us, worst %lld us; slow client received %u bytes\n",
+			TEST_LINES, total / TEST_LINES, worst, client.received);
+
+	TEST_ASSERT_TRUE_MESSAGE(client.received > 0, "telnet client received nothing");
+	TEST_ASSERT_TRUE_MESSAGE(client.dropped_notice, "ring overflow not reported to client");
+	TEST_ASSERT_TRUE_MESSAGE(worst < TEST_LATENCY_MAX_US, "printf blocked on telnet client");
+}
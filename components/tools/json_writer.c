@@ -0,0 +1,197 @@
+/* 
+ *  Streaming JSON writer
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "json_writer.h"
+
+/****************************************************************************************
+ * Low level output
+ */
+static void put(json_writer_t *w, const char *data, size_t len) {
+	// in fixed mode, keep room for the final NUL
+	size_t room = w->flush ? w->size : w->size - 1;
+	
+	while (len && !w->error) {
+		if (w->len == room) {
+			if (!w->flush || !w->flush(w->ctx, w->buf, w->len)) {
+				w->error = true;
+				break;
+			}	
+			w->len = 0;
+		}
+		size_t chunk = room - w->len;
+		if (chunk > len) chunk = len;
+		memcpy(w->buf + w->len, data, chunk);
+		w->len += chunk;
+		w->total += chunk;
+		data += chunk;
+		len -= chunk;
+	}	
+}
+
+static void put_str(json_writer_t *w, const char *str) {
+	put(w, str, strlen(str));
+}
+
+static void put_escaped(json_writer_t *w, const char *str) {
+	const char *start = str;
+	
+	put(w, "\"", 1);
+	for (; *str; str++) {
+		unsigned char c = *str;
+		char esc[8];
+		
+		if (c >= 0x20 && c != '"' && c != '\\') continue;
+		put(w, start, str - start);
+		start = str + 1;
+		switch (c) {
+		case '"': put_str(w, "\\\""); break;
+		case '\\': put_str(w, "\\\\"); break;
+		case '\b': put_str(w, "\\b"); break;
+		case '\f': put_str(w, "\\f"); break;
+		case '\n': put_str(w, "\\n"); break;
+		case '\r': put_str(w, "\\r"); break;
+		case '\t': put_str(w, "\\t"); break;
+		default:
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			put_str(w, esc);
+			break;
+		}	
+	}	
+	put(w, start, str - start);
+	put(w, "\"", 1);
+}
+
+/****************************************************************************************
+ * Separator and key before any value
+ */
+static uint32_t level_bit(json_writer_t *w) {
+	// beyond max depth we are in error anyway, but never shift by 32 or more
+	return w->depth < JSON_WRITER_MAX_DEPTH ? 1u << w->depth : 0;
+}
+
+static void prefix(json_writer_t *w, const char *key) {
+	uint32_t bit = level_bit(w);
+	
+	if (w->has_items & bit) put(w, ",", 1);
+	w->has_items |= bit;
+	if (key) {
+		put_escaped(w, key);
+		put(w, ":", 1);
+	}	
+}
+
+static void nest_open(json_writer_t *w, const char *key, char c) {
+	prefix(w, key);
+	put(w, &c, 1);
+	if (w->depth < UINT8_MAX) w->depth++;
+	if (w->depth >= JSON_WRITER_MAX_DEPTH) w->error = true;
+	else w->has_items &= ~level_bit(w);
+}
+
+static void nest_close(json_writer_t *w, char c) {
+	if (w->depth) w->depth--;
+	else w->error = true;
+	put(w, &c, 1);
+}
+
+/****************************************************************************************
+ * API
+ */
+void json_writer_init(json_writer_t *w, char *buf, size_t size, json_writer_flush_f flush, void *ctx) {
+	memset(w, 0, sizeof(json_writer_t));
+	w->buf = buf;
+	w->size = size;
+	w->flush = flush;
+	w->ctx = ctx;
+	w->error = !buf || size < 2;
+}
+
+void json_writer_object_start(json_writer_t *w, const char *key) {
+	nest_open(w, key, '{');
+}
+
+void json_writer_object_end(json_writer_t *w) {
+	nest_close(w, '}');
+}
+
+void json_writer_array_start(json_writer_t *w, const char *key) {
+	nest_open(w, key, '[');
+}
+
+void json_writer_array_end(json_writer_t *w) {
+	nest_close(w, ']');
+}
+
+void json_writer_string(json_writer_t *w, const char *key, const char *value) {
+	prefix(w, key);
+	if (value) put_escaped(w, value);
+	else put_str(w, "null");
+}
+
+void json_writer_number(json_writer_t *w, const char *key, double value) {
+	char number[32];
+	
+	// same rendering as cJSON: integers when exact, otherwise shortest round-trip
+	if (isnan(value) || isinf(value)) strcpy(number, "null");
+	else if (fabs(value) < 1e15 && value == (double) (long long) value) snprintf(number, sizeof(number), "%lld", (long long) value);
+	else {
+		snprintf(number, sizeof(number), "%1.15g", value);
+		if (strtod(number, NULL) != value) snprintf(number, sizeof(number), "%1.17g", value);
+	}	
+	prefix(w, key);
+	put_str(w, number);
+}
+
+void json_writer_bool(json_writer_t *w, const char *key, bool value) {
+	prefix(w, key);
+	put_str(w, value ? "true" : "false");
+}
+
+void json_writer_null(json_writer_t *w, const char *key) {
+	prefix(w, key);
+	put_str(w, "null");
+}
+
+void json_writer_raw(json_writer_t *w, const char *key, const char *json) {
+	prefix(w, key);
+	put_str(w, json ? json : "null");
+}
+
+void json_writer_item(json_writer_t *w, const char *key, const cJSON *item) {
+	const cJSON *child;
+	
+	if (!item) json_writer_null(w, key);
+	else if (cJSON_IsObject(item)) {
+		json_writer_object_start(w, key);
+		cJSON_ArrayForEach(child, item) json_writer_item(w, child->string, child);
+		json_writer_object_end(w);
+	} else if (cJSON_IsArray(item)) {
+		json_writer_array_start(w, key);
+		cJSON_ArrayForEach(child, item) json_writer_item(w, NULL, child);
+		json_writer_array_end(w);
+	} 
+	else if (cJSON_IsString(item)) json_writer_string(w, key, item->valuestring);
+	else if (cJSON_IsNumber(item)) json_writer_number(w, key, item->valuedouble);
+	else if (cJSON_IsBool(item)) json_writer_bool(w, key, cJSON_IsTrue(item));
+	else if (cJSON_IsRaw(item)) json_writer_raw(w, key, item->valuestring);
+	else json_writer_null(w, key);
+}
+
+bool json_writer_finish(json_writer_t *w) {
+	if (w->depth) w->error = true;
+	if (w->flush) {
+		if (w->len && !w->error && !w->flush(w->ctx, w->buf, w->len)) w->error = true;
+		w->len = 0;
+	} else if (w->buf && w->size) {
+		w->buf[w->len] = '\0';
+	}	
+	return !w->error;
+}
@@ -0,0 +1,54 @@
+/* 
+ *  Streaming JSON writer
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+ 
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cJSON.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Output is accumulated in a caller-provided buffer and handed to flush() each 
+ * time it is full, so peak memory is the buffer size whatever the document size.
+ * Without flush(), the buffer must hold the whole document, which is then NUL
+ * terminated by json_writer_finish(). A NULL key adds to an array (or is the 
+ * top-level value), any error is sticky and reported by json_writer_finish() */
+typedef bool (*json_writer_flush_f)(void *ctx, const char *data, size_t len);
+
+#define JSON_WRITER_MAX_DEPTH 32
+
+typedef struct {
+	char *buf;
+	size_t size, len, total;
+	json_writer_flush_f flush;
+	void *ctx;
+	uint32_t has_items;		// one bit per nesting level
+	uint8_t depth;
+	bool error;
+} json_writer_t;
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size, json_writer_flush_f flush, void *ctx);
+void json_writer_object_start(json_writer_t *w, const char *key);
+void json_writer_object_end(json_writer_t *w);
+void json_writer_array_start(json_writer_t *w, const char *key);
+void json_writer_array_end(json_writer_t *w);
+void json_writer_string(json_writer_t *w, const char *key, const char *value);
+void json_writer_number(json_writer_t *w, const char *key, double value);
+void json_writer_bool(json_writer_t *w, const char *key, bool value);
+void json_writer_null(json_writer_t *w, const char *key);
+void json_writer_raw(json_writer_t *w, const char *key, const char *json);
+void json_writer_item(json_writer_t *w, const char *key, const cJSON *item);
+bool json_writer_finish(json_writer_t *w);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,167 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  (c) Philippe G. 2019, philippe_44@outlook.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "perf_trace.h"
+
+static const char TAG[] = "perf";
+
+#if CONFIG_PERF_TRACE
+
+static const char *perf_names[PERF_POINTS] = {
+	"stream recv", "decode", "process", "equalizer",
+	"output fill", "output write", "display update",
+	"stream level", "output level", "output frames", "underrun",
+};
+
+// must be a power of 2
+#define PERF_RING_SIZE	1024
+
+typedef struct {
+	uint32_t timestamp, value;
+	uint32_t seq;
+	uint8_t point;
+} perf_event_t;
+
+typedef struct {
+	uint32_t count, min, max;
+	uint64_t total;
+} perf_stat_t;
+
+/* One ring per core, so writers only compete with tasks (or ISR) of the same core. The
+ * slot is claimed atomically and its sequence is written last, so a reader can tell
+ * a slot being overwritten from a consistent one without ever blocking a writer.
+ * Atomic read-modify-write does not work on PSRAM, so head (and stats) stay in internal
+ * memory, only events (plain stores) are in SPIRAM */
+static struct {
+	uint32_t head;
+	perf_stat_t stats[PERF_POINTS];
+} rings[portNUM_PROCESSORS];
+static EXT_RAM_ATTR perf_event_t events[portNUM_PROCESSORS][PERF_RING_SIZE];
+
+/****************************************************************************************
+ *
+ */
+void perf_trace_record(perf_point_t point, uint32_t timestamp, uint32_t value) {
+	int core = xPortGetCoreID();
+	uint32_t index = __atomic_fetch_add(&rings[core].head, 1, __ATOMIC_RELAXED);
+	perf_event_t *event = events[core] + (index & (PERF_RING_SIZE - 1));
+	perf_stat_t *stat = rings[core].stats + point;
+
+	__atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+	event->timestamp = timestamp;
+	event->value = value;
+	event->point = point;
+	__atomic_store_n(&event->seq, index + 1, __ATOMIC_RELEASE);
+
+	// stats might be slightly off when preempted by the same point, no big deal
+	if (!stat->count || value < stat->min) stat->min = value;
+	if (value > stat->max) stat->max = value;
+	stat->total += value;
+	stat->count++;
+}
+
+/****************************************************************************************
+ *
+ */
+bool perf_trace_json(json_writer_t *w) {
+	json_writer_object_start(w, NULL);
+	json_writer_string(w, "displayTimeUnit", "ms");
+	json_writer_array_start(w, "traceEvents");
+
+	for (int core = 0; core < portNUM_PROCESSORS; core++) {
+		char name[8];
+		uint32_t head = __atomic_load_n(&rings[core].head, __ATOMIC_ACQUIRE);
+		uint32_t index = head > PERF_RING_SIZE ? head - PERF_RING_SIZE : 0;
+
+		snprintf(name, sizeof(name), "core %d", core);
+		json_writer_object_start(w, NULL);
+		json_writer_string(w, "name", "thread_name");
+		json_writer_string(w, "ph", "M");
+		json_writer_number(w, "pid", 1);
+		json_writer_number(w, "tid", core);
+		json_writer_object_start(w, "args");
+		json_writer_string(w, "name", name);
+		json_writer_object_end(w);
+		json_writer_object_end(w);
+
+		for (; index < head; index++) {
+			perf_event_t *slot = events[core] + (index & (PERF_RING_SIZE - 1)), event;
+
+			// copy then check that slot has not been recycled meanwhile
+			memcpy(&event, slot, sizeof(event));
+			if (event.seq != index + 1 || __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != index + 1) continue;
+
+			json_writer_object_start(w, NULL);
+			json_writer_string(w, "name", perf_names[event.point]);
+			json_writer_number(w, "pid", 1);
+			json_writer_number(w, "tid", core);
+			json_writer_number(w, "ts", event.timestamp);
+			if (event.point < PERF_FIRST_VALUE) {
+				json_writer_string(w, "ph", "X");
+				json_writer_number(w, "dur", event.value);
+			} else {
+				json_writer_string(w, "ph", "C");
+				json_writer_object_start(w, "args");
+				json_writer_number(w, "value", event.value);
+				json_writer_object_end(w);
+			}
+			json_writer_object_end(w);
+		}
+	}
+
+	json_writer_array_end(w);
+	json_writer_object_end(w);
+	return true;
+}
+
+/****************************************************************************************
+ *
+ */
+void perf_trace_summary(void) {
+	ESP_LOGI(TAG, "%16s|%10s|%10s|%10s|%10s|", "", "max", "min", "avg", "count");
+
+	for (int point = 0; point < PERF_POINTS; point++) {
+		perf_stat_t stat = { 0 };
+
+		// merge cores, then reset
+		for (int core = 0; core < portNUM_PROCESSORS; core++) {
+			perf_stat_t *p = rings[core].stats + point;
+			if (!p->count) continue;
+			if (!stat.count || p->min < stat.min) stat.min = p->min;
+			if (p->max > stat.max) stat.max = p->max;
+			stat.total += p->total;
+			stat.count += p->count;
+			memset(p, 0, sizeof(*p));
+		}
+
+		if (stat.count) {
+			ESP_LOGI(TAG, "%16s|%10u|%10u|%10u|%10u|", perf_names[point], stat.max, stat.min,
+					 (uint32_t) (stat.total / stat.count), stat.count);
+		}
+	}
+}
+
+#else
+
+bool perf_trace_json(json_writer_t *w) {
+	return false;
+}
+
+void perf_trace_summary(void) {
+	ESP_LOGI(TAG, "tracing is not compiled in (CONFIG_PERF_TRACE)");
+}
+
+#endif
@@ -41,9 +41,11 @@ function to process requests, decode URLs, serve files, etc. etc.
 #include <stdio.h>
 #include <stdlib.h>
 #include "cJSON.h"
+#include "json_writer.h"
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 #include "platform_config.h"
 #include "sys/param.h"
 #include "esp_vfs.h"
@@ -55,6 +57,8 @@ function to process requests, decode URLs, serve files, etc. etc.
 #include "platform_console.h"
 #include "accessors.h"
 #include "webapp/webpack.h"
+#include "monitor.h"
+#include "perf_trace.h"
  
 #define HTTP_STACK_SIZE	(5*1024)
 const char str_na[]="N/A";
@@ -63,14 +67,18 @@ const char str_na[]="N/A";
 static const char TAG[] = "httpd_handlers";
 /* @brief task handle for the http server */
 
+static void events_client_closed(int fd);
+
 SemaphoreHandle_t http_server_config_mutex = NULL;
-extern RingbufHandle_t messaging;
+extern messaging_handle_t messaging;
 #define AUTH_TOKEN_SIZE 50
 typedef struct session_context {
     char * auth_token;
     bool authenticated;
     char * sess_ip_address;
     u16_t port;
+    bool events;
+    int events_fd;
 } session_context_t;
 
 
@@ -221,6 +229,7 @@ void free_ctx_func(void *ctx)
 	session_context_t * context = (session_context_t *)ctx;
     if(context){
     	ESP_LOGD(TAG, "Freeing up socket context");
+    	if(context->events) events_client_closed(context->events_fd);
     	FREE_AND_NULL(context->auth_token);
     	FREE_AND_NULL(context->sess_ip_address);
     	free(context);
@@ -330,6 +339,8 @@ static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filena
         return httpd_resp_set_type(req, "text/javascript");
     } else if (IS_FILE_EXT(filename, ".json")) {
         return httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+    } else if (IS_FILE_EXT(filename, ".csv")) {
+        return httpd_resp_set_type(req, "text/csv");
     }
 
     /* This is a limited set only */
@@ -366,6 +377,31 @@ int resource_get_index(const char * fileName){
 	}
 	return -1;
 }
+/* Embedded resources are sent straight from flash in chunks, tagged with their build-time
+ * content hash. Bundle names carry the webpack hash so they never change and can be cached
+ * for good, anything else is revalidated and answered with a 304 when unchanged */
+#define RESOURCE_CHUNK_SIZE 4096
+static esp_err_t resource_send(httpd_req_t *req, int idx){
+	char etags[64];
+	const char *data = (const char *)resource_map_start[idx];
+	size_t len = resource_map_end[idx] - resource_map_start[idx];
+
+	httpd_resp_set_hdr(req, "ETag", resource_etags[idx]);
+	httpd_resp_set_hdr(req, "Cache-Control", strstr(resource_lookups[idx], ".bundle.") ? "public, max-age=31536000, immutable" : "no-cache");
+	if(httpd_req_get_hdr_value_str(req, "If-None-Match", etags, sizeof(etags)) == ESP_OK && strstr(etags, resource_etags[idx])){
+		ESP_LOGD_LOC(TAG, "[%s] not modified", resource_lookups[idx]);
+		httpd_resp_set_status(req, "304 Not Modified");
+		return httpd_resp_send(req, NULL, 0);
+	}
+	while(len){
+		size_t chunk = MIN(len, RESOURCE_CHUNK_SIZE);
+		esp_err_t err = httpd_resp_send_chunk(req, data, chunk);
+		if(err != ESP_OK) return err;
+		data += chunk;
+		len -= chunk;
+	}
+	return httpd_resp_send_chunk(req, NULL, 0);
+}
 esp_err_t root_get_handler(httpd_req_t *req){
 	esp_err_t err = ESP_OK;
     ESP_LOGD_LOC(TAG, "serving [%s]", req->uri);
@@ -377,11 +413,10 @@ esp_err_t root_get_handler(httpd_req_t *req){
     }
 	int idx=-1;
 	if((idx=resource_get_index("index.html"))>=0){
-		const size_t file_size = (resource_map_end[idx] - resource_map_start[idx]);
 		httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
 		err = set_content_type_from_req(req);
 		if(err == ESP_OK){
-			httpd_resp_send(req, (const char *)resource_map_start[idx], file_size);
+			err = resource_send(req, idx);
 		} 
 	}
     else{
@@ -419,8 +454,10 @@ esp_err_t resource_filehandler(httpd_req_t *req){
 		if(strstr(resource_lookups[idx], ".gz")) {
 			httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
 		}
-	    const size_t file_size = (resource_map_end[idx] - resource_map_start[idx]);
-	    httpd_resp_send(req, (const char *)resource_map_start[idx], file_size);
+	    if(resource_send(req, idx) != ESP_OK){
+	    	ESP_LOGE_LOC(TAG, "Error sending [%s]", filename);
+	    	return ESP_FAIL;
+	    }
 	}
 	else {
 	   ESP_LOGE_LOC(TAG, "Unknown resource [%s] from path [%s] ", filename,filepath);
@@ -447,6 +484,26 @@ esp_err_t ap_scan_handler(httpd_req_t *req){
 	return err;
 }
 
+/* JSON responses are streamed in chunks through the scratch buffer, which is free
+ * during GET requests, so the full document never has to be printed to the heap */
+#define JSON_CHUNK_SIZE 512
+static bool http_json_flush(void *ctx, const char *data, size_t len){
+	return httpd_resp_send_chunk((httpd_req_t *)ctx, data, len) == ESP_OK;
+}
+static void http_json_start(httpd_req_t *req, json_writer_t *w){
+	char *buf = ((rest_server_context_t *)(req->user_ctx))->scratch;
+	json_writer_init(w, buf, JSON_CHUNK_SIZE, http_json_flush, req);
+}
+static esp_err_t http_json_end(httpd_req_t *req, json_writer_t *w){
+	if(!json_writer_finish(w)){
+		// headers are gone already, all we can do is to drop the connection
+		ESP_LOGE_LOC(TAG, "Error streaming [%s] after %zu bytes", req->uri, w->total);
+		return ESP_FAIL;
+	}
+	ESP_LOGD_LOC(TAG, "Streamed %zu bytes for [%s]", w->total, req->uri);
+	return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 esp_err_t console_cmd_get_handler(httpd_req_t *req){
     ESP_LOGD_LOC(TAG, "serving [%s]", req->uri);
     if(!is_user_authenticated(req)){
@@ -455,17 +512,15 @@ esp_err_t console_cmd_get_handler(httpd_req_t *req){
     }
     /* if we can get the mutex, write the last version of the AP list */
 	esp_err_t err = set_content_type_from_req(req);
-	cJSON * cmdlist = get_cmd_list();
-	char * json_buffer = cJSON_Print(cmdlist);
-	if(json_buffer){
-		httpd_resp_send(req, (const char *)json_buffer, HTTPD_RESP_USE_STRLEN);
-		free(json_buffer);
-	}
-	else{
-		ESP_LOGD_LOC(TAG,  "Error retrieving command json string. ");
-		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to format command");
+	if(err != ESP_OK){
+		return err;
 	}
+	json_writer_t w;
+	cJSON * cmdlist = get_cmd_list();
+	http_json_start(req, &w);
+	json_writer_item(&w, NULL, cmdlist);
 	cJSON_Delete(cmdlist);
+	err = http_json_end(req, &w);
 	ESP_LOGD_LOC(TAG, "done serving [%s]", req->uri);
 	return err;
 }
@@ -558,25 +613,13 @@ esp_err_t config_get_handler(httpd_req_t *req){
     }
 	esp_err_t err = set_content_type_from_req(req);
 	if(err == ESP_OK){
-		char * json = config_alloc_get_json(false);
-		if(json==NULL){
-			ESP_LOGD_LOC(TAG,  "Error retrieving config json string. ");
-			httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error retrieving configuration object");
-			err=ESP_FAIL;
-		}
-		else {
-			ESP_LOGD_LOC(TAG,  "config json : %s",json );
-			cJSON * gplist=get_gpio_list(false);
-			char * gpliststr=cJSON_PrintUnformatted(gplist);
-			httpd_resp_sendstr_chunk(req,"{ \"gpio\":");
-			httpd_resp_sendstr_chunk(req,gpliststr);
-			httpd_resp_sendstr_chunk(req,", \"config\":");
-			httpd_resp_sendstr_chunk(req, (const char *)json);
-			httpd_resp_sendstr_chunk(req,"}");
-			httpd_resp_sendstr_chunk(req,NULL);
-			free(gpliststr);
-			free(json);
-		}
+		json_writer_t w;
+		http_json_start(req, &w);
+		json_writer_object_start(&w, NULL);
+		json_writer_item(&w, "gpio", get_gpio_list(false));
+		config_write_json(&w, "config");
+		json_writer_object_end(&w);
+		err = http_json_end(req, &w);
 	}
 	return err;
 }
@@ -1128,10 +1171,11 @@ esp_err_t messages_get_handler(httpd_req_t *req){
 	}
 	cJSON * json_messages=  messaging_retrieve_messages(messaging);
 	if(json_messages!=NULL){
-		char * json_text= cJSON_Print(json_messages);
-		httpd_resp_send(req, (const char *)json_text, strlen(json_text));
-		free(json_text);
+		json_writer_t w;
+		http_json_start(req, &w);
+		json_writer_item(&w, NULL, json_messages);
 		cJSON_Delete(json_messages);
+		return http_json_end(req, &w);
 	}
 	else {
 		httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR , "Unable to retrieve messages");
@@ -1139,6 +1183,71 @@ esp_err_t messages_get_handler(httpd_req_t *req){
 	return ESP_OK;
 }
 
+esp_err_t trace_get_handler(httpd_req_t *req){
+    ESP_LOGD_LOC(TAG, "serving [%s]", req->uri);
+    if(!is_user_authenticated(req)){
+    	// todo:  redirect to login page
+    	// return ESP_OK;
+    }
+	if(!PERF_TRACE_ENABLED){
+		httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Tracing not enabled");
+		return ESP_OK;
+	}
+    esp_err_t err = set_content_type_from_req(req);
+	if(err != ESP_OK){
+		return err;
+	}
+	// Chrome trace format, to be opened with chrome://tracing or ui.perfetto.dev
+	json_writer_t w;
+	http_json_start(req, &w);
+	perf_trace_json(&w);
+	return http_json_end(req, &w);
+}
+
+/* telemetry lines are small, so they are gathered in the scratch buffer and sent 
+ * as JSON_CHUNK_SIZE chunks */
+typedef struct {
+	httpd_req_t *req;
+	char *buf;
+	size_t len;
+} http_csv_ctx_t;
+
+static bool http_csv_write(void *ctx, const char *data, size_t len){
+	http_csv_ctx_t *csv = (http_csv_ctx_t *)ctx;
+	if(csv->len + len > JSON_CHUNK_SIZE){
+		if(httpd_resp_send_chunk(csv->req, csv->buf, csv->len) != ESP_OK) return false;
+		csv->len = 0;
+	}
+	memcpy(csv->buf + csv->len, data, len);
+	csv->len += len;
+	return true;
+}
+
+esp_err_t stats_csv_get_handler(httpd_req_t *req){
+    ESP_LOGD_LOC(TAG, "serving [%s]", req->uri);
+    if(!is_user_authenticated(req)){
+    	// todo:  redirect to login page
+    	// return ESP_OK;
+    }
+    esp_err_t err = set_content_type_from_req(req);
+	if(err != ESP_OK){
+		return err;
+	}
+	http_csv_ctx_t csv = { .req = req, .buf = ((rest_server_context_t *)(req->user_ctx))->scratch };
+	if(!monitor_telemetry_csv(http_csv_write, &csv)){
+		if(csv.len == 0) {
+			httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Telemetry not enabled");
+			return ESP_OK;
+		}	
+		ESP_LOGE_LOC(TAG, "Error streaming [%s]", req->uri);
+		return ESP_FAIL;
+	}
+	if(csv.len && httpd_resp_send_chunk(req, csv.buf, csv.len) != ESP_OK){
+		return ESP_FAIL;
+	}
+	return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 esp_err_t status_get_handler(httpd_req_t *req){
     ESP_LOGD_LOC(TAG, "serving [%s]", req->uri);
     if(!is_user_authenticated(req)){
@@ -1170,6 +1279,165 @@ esp_err_t status_get_handler(httpd_req_t *req){
 	return ESP_OK;
 }
 
+/* Server-sent events on /events: the response is left open and the httpd task
+ * pushes new messages and status changes on it, so the UI does not need to poll
+ * /status.json and /messages.json. Sockets are only written from the httpd task
+ * (through httpd_queue_work), the timer only schedules the work */
+#define EVENTS_MAX_CLIENTS	1
+#define EVENTS_PERIOD_MS	1000
+#define EVENTS_KEEPALIVE	15
+// same cadence as the UI polling of /status.json
+#define EVENTS_REFRESH		3
+
+static struct {
+	httpd_handle_t server;
+	TimerHandle_t timer;
+	messaging_handle_t messaging;
+	int fd[EVENTS_MAX_CLIENTS];
+	uint32_t status_version;
+	volatile bool pending;
+	int idle, refresh;
+} events;
+
+static int events_count(void){
+	int count = 0;
+	for(int i = 0; i < EVENTS_MAX_CLIENTS; i++) if(events.fd[i] >= 0) count++;
+	return count;
+}
+
+static bool events_write(int fd, const char *data, size_t len){
+	while(len){
+		int sent = httpd_socket_send(events.server, fd, data, len, 0);
+		if(sent <= 0) return false;
+		data += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+static void events_broadcast(const char *event, const char *data){
+	char header[32];
+	int len = event ? snprintf(header, sizeof(header), "event: %s\ndata: ", event) : 0;
+
+	for(int i = 0; i < EVENTS_MAX_CLIENTS; i++){
+		int fd = events.fd[i];
+		if(fd < 0) continue;
+		// JSON is printed unformatted, so data never spans more than one line
+		if(!events_write(fd, header, len) || !events_write(fd, data, strlen(data)) || !events_write(fd, "\n\n", 2)){
+			ESP_LOGW(TAG, "Closing events socket %d", fd);
+			events.fd[i] = -1;
+			httpd_sess_trigger_close(events.server, fd);
+		}
+	}
+	events.idle = 0;
+}
+
+static bool events_send_messages(void){
+	cJSON * json_messages = messaging_retrieve_messages(events.messaging);
+	bool sent = false;
+	if(json_messages && cJSON_GetArraySize(json_messages)){
+		char * json_text = cJSON_PrintUnformatted(json_messages);
+		if(json_text){
+			events_broadcast("messages", json_text);
+			free(json_text);
+			sent = true;
+		}
+	}
+	cJSON_Delete(json_messages);
+	return sent;
+}
+
+static bool events_send_status(bool force){
+	char *buff = NULL;
+	// status is only printed when its content has changed
+	if(!force && wifi_manager_get_status_version() == events.status_version) return false;
+	if(wifi_manager_lock_json_buffer(( TickType_t ) 50/portTICK_PERIOD_MS)) {
+		events.status_version = wifi_manager_get_status_version();
+		buff = wifi_manager_alloc_get_ip_info_json();
+		wifi_manager_unlock_json_buffer();
+	}
+	if(!buff) return false;
+	events_broadcast("status", buff);
+	free(buff);
+	return true;
+}
+
+static void events_work(void *arg){
+	events.pending = false;
+	if(!events_count()) return;
+	bool sent = events_send_messages();
+	sent |= events_send_status(false);
+	// comment line keeps proxies happy and lets us detect dead peers
+	if(!sent && ++events.idle >= EVENTS_KEEPALIVE) events_broadcast(NULL, ":");
+	// battery, jack and bt states are polled, a changed value bumps the status version
+	if(++events.refresh >= EVENTS_REFRESH){
+		events.refresh = 0;
+		wifi_manager_update_status();
+	}
+}
+
+static void events_timer(TimerHandle_t xTimer){
+	if(events.pending) return;
+	events.pending = true;
+	if(httpd_queue_work(events.server, events_work, NULL) != ESP_OK) events.pending = false;
+}
+
+static void events_client_closed(int fd){
+	for(int i = 0; i < EVENTS_MAX_CLIENTS; i++) if(events.fd[i] == fd) events.fd[i] = -1;
+	if(!events_count() && events.timer) xTimerStop(events.timer, 0);
+	ESP_LOGD(TAG, "Events client on socket %d gone, %d left", fd, events_count());
+}
+
+esp_err_t events_get_handler(httpd_req_t *req){
+	static const char headers[] = "HTTP/1.1 200 OK\r\n"
+								  "Content-Type: text/event-stream\r\n"
+								  "Cache-Control: no-cache\r\n"
+								  "Connection: keep-alive\r\n\r\n";
+	ESP_LOGD_LOC(TAG, "serving [%s]", req->uri);
+	if(!is_user_authenticated(req)){
+		// todo:  redirect to login page
+		// return ESP_OK;
+	}
+	// own subscriber, so that /messages.json polling by another client does not steal messages
+	if(!events.messaging && !(events.messaging = messaging_register_subscriber(10, "events"))){
+		return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to subscribe to messages");
+	}
+	if(!events.timer){
+		for(int i = 0; i < EVENTS_MAX_CLIENTS; i++) events.fd[i] = -1;
+		events.timer = xTimerCreate("events", pdMS_TO_TICKS(EVENTS_PERIOD_MS), pdTRUE, NULL, events_timer);
+		if(!events.timer){
+			return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to create events timer");
+		}
+	}
+
+	int fd = httpd_req_to_sockfd(req), slot = 0;
+	events.server = req->handle;
+	for(int i = 0; i < EVENTS_MAX_CLIENTS; i++) if(events.fd[i] < 0) { slot = i; break; }
+	// sockets are scarce (3 max), so a new client evicts the oldest one
+	if(events.fd[slot] >= 0) {
+		ESP_LOGI(TAG, "Replacing events client on socket %d", events.fd[slot]);
+		httpd_sess_trigger_close(events.server, events.fd[slot]);
+		events.fd[slot] = -1;
+	}
+
+	if(httpd_send(req, headers, sizeof(headers) - 1) != (int) sizeof(headers) - 1){
+		return ESP_FAIL;
+	}
+
+	session_context_t *ctx_data = get_session_context(req);
+	ctx_data->events = true;
+	ctx_data->events_fd = fd;
+	events.fd[slot] = fd;
+	events.idle = 0;
+
+	// first push is a full snapshot, then only deltas
+	events_send_messages();
+	events_send_status(true);
+	xTimerStart(events.timer, 0);
+
+	return ESP_OK;
+}
+
 
 esp_err_t err_handler(httpd_req_t *req, httpd_err_code_t error){
 	esp_err_t err = ESP_OK;
@@ -91,6 +91,9 @@ esp_err_t recovery_post_handler(httpd_req_t *req);
 esp_err_t flash_post_handler(httpd_req_t *req);
 esp_err_t status_get_handler(httpd_req_t *req);
 esp_err_t messages_get_handler(httpd_req_t *req);
+esp_err_t stats_csv_get_handler(httpd_req_t *req);
+esp_err_t trace_get_handler(httpd_req_t *req);
+esp_err_t events_get_handler(httpd_req_t *req);
 esp_err_t console_cmd_get_handler(httpd_req_t *req);
 esp_err_t console_cmd_post_handler(httpd_req_t *req);
 esp_err_t ap_scan_handler(httpd_req_t *req);
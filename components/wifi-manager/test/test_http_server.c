@@ -0,0 +1,136 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_http_server.h"
+#include "tcpip_adapter.h"
+#include "lwip/sockets.h"
+#include "http_server_handlers.h"
+#include "webpack.h"
+
+#define TEST_PORT		8124
+#define TEST_REPLY_MAX	(4 * 1024)
+
+/*
+ A web server on loopback with the resource handlers only. Embedded resources are requested
+ with no validator, with their own ETag and with a stale one. The raw reply is kept (up to
+ TEST_REPLY_MAX) to check status, caching headers and that a 304 carries no body
+*/
+static struct {
+	char data[TEST_REPLY_MAX + 1];
+	int len;
+	char *body;
+} reply;
+
+static httpd_handle_t server_start(void) {
+	static httpd_handle_t server;
+	httpd_uri_t resources = { .uri = "/*", .method = HTTP_GET, .handler = resource_filehandler };
+	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+	if (server) return server;
+
+	tcpip_adapter_init();
+	config.server_port = TEST_PORT;
+	config.ctrl_port = TEST_PORT + 1;
+	config.uri_match_fn = httpd_uri_match_wildcard;
+	TEST_ASSERT_EQUAL_INT_MESSAGE(ESP_OK, httpd_start(&server, &config), "can't start web server");
+	httpd_register_uri_handler(server, &resources);
+
+	return server;
+}
+
+/****************************************************************************************
+ * Reads until the server has been silent for a while, as it keeps the connection alive
+ */
+static int request(const char *uri, const char *etag) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(TEST_PORT), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	struct timeval timeout = { 0, 300 * 1000 };
+	int sock = socket(AF_INET, SOCK_STREAM, 0), status = -1, n;
+	char buf[256];
+
+	memset(&reply, 0, sizeof(reply));
+	TEST_ASSERT_TRUE_MESSAGE(connect(sock, (struct sockaddr*) &addr, sizeof(addr)) == 0, "can't connect to web server");
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	n = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n", uri);
+	if (etag) n += snprintf(buf + n, sizeof(buf) - n, "If-None-Match: %s\r\n", etag);
+	n += snprintf(buf + n, sizeof(buf) - n, "\r\n");
+	send(sock, buf, n, 0);
+
+	while (reply.len < TEST_REPLY_MAX && (n = recv(sock, reply.data + reply.len, TEST_REPLY_MAX - reply.len, 0)) > 0) reply.len += n;
+	closesocket(sock);
+
+	reply.data[reply.len] = '\0';
+	if ((reply.body = strstr(reply.data, "\r\n\r\n")) != NULL) reply.body += 4;
+	sscanf(reply.data, "HTTP/1.1 %d", &status);
+
+	return status;
+}
+
+static bool has_header(const char *header) {
+	char *p = strstr(reply.data, header);
+	return p && (!reply.body || p < reply.body);
+}
+
+/****************************************************************************************
+ * Smallest resource of a kind, its uri is its name without the compression suffix
+ */
+static int find_resource(bool bundle, char *uri, size_t size) {
+	int idx = -1;
+
+	for (int i = 0; *resource_lookups[i]; i++) {
+		if (!strstr(resource_lookups[i], ".bundle.") != !bundle) continue;
+		if (idx < 0 || resource_map_end[i] - resource_map_start[i] < resource_map_end[idx] - resource_map_start[idx]) idx = i;
+	}
+
+	if (idx >= 0) {
+		strlcpy(uri, resource_lookups[idx], size);
+		char *gz = strstr(uri, ".gz");
+		if (gz) *gz = '\0';
+	}
+
+	return idx;
+}
+
+static void check_revalidation(bool bundle) {
+	char uri[64], header[96];
+	int idx = find_resource(bundle, uri, sizeof(uri));
+
+	TEST_ASSERT_TRUE_MESSAGE(idx >= 0, "no such embedded resource");
+	server_start();
+
+	TEST_ASSERT_EQUAL_INT_MESSAGE(200, request(uri, NULL), "resource not served");
+	snprintf(header, sizeof(header), "ETag: %s", resource_etags[idx]);
+	TEST_ASSERT_TRUE_MESSAGE(has_header(header), "ETag missing or wrong");
+	TEST_ASSERT_TRUE_MESSAGE(has_header(bundle ? "immutable" : "no-cache"), "wrong Cache-Control");
+	printf("%s: %d bytes for a full reply", uri, reply.len);
+
+	TEST_ASSERT_EQUAL_INT_MESSAGE(304, request(uri, resource_etags[idx]), "matching If-None-Match not answered with 304");
+	TEST_ASSERT_TRUE_MESSAGE(has_header(header), "ETag missing from 304");
+	TEST_ASSERT_TRUE_MESSAGE(reply.body && *reply.body == '\0', "304 carries a body");
+	printf(", %d bytes when not modified\n", reply.len);
+
+	// browsers send a list of validators
+	snprintf(header, sizeof(header), "\"0000000000000000\", %s", resource_etags[idx]);
+	TEST_ASSERT_EQUAL_INT_MESSAGE(304, request(uri, header), "ETag in a list not matched");
+	TEST_ASSERT_EQUAL_INT_MESSAGE(200, request(uri, "\"0000000000000000\""), "stale ETag not answered with resource");
+}
+
+TEST_CASE("Unchanged resource is answered with 304", "[http]")
+{
+	check_revalidation(false);
+}
+
+TEST_CASE("Unchanged bundle is answered with 304", "[http]")
+{
+	check_revalidation(true);
+}
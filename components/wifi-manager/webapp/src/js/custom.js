@@ -449,6 +449,7 @@ let releaseURL =
 let recovery = false;
 const commandHeader = 'squeezelite -b 500:2000 -d all=info -C 30 -W';
 let blockAjax = false;
+let eventSource = null;
 //let blockFlashButton = false;
 let apList = null;
 //let selectedSSID = '';
@@ -493,8 +494,23 @@ Promise.prototype.delay = function(duration) {
   );
 };
 
+function startEvents() {
+  if (!window.EventSource || eventSource) {
+    return;
+  }
+  // polling in checkStatus stays as the fallback while this is not open
+  eventSource = new EventSource('/events');
+  eventSource.addEventListener('messages', function(e) {
+    handleMessages(JSON.parse(e.data));
+  });
+  eventSource.addEventListener('status', function(e) {
+    handleStatus(JSON.parse(e.data));
+  });
+}
+
 function startCheckStatusInterval() {
   StatusIntervalActive = true;
+  startEvents();
   setTimeout(checkStatus, 3000);
 }
 
@@ -1200,96 +1216,98 @@ function btExists(name){
 function getBTSinkOpt(name){
   return $(`${btSinkNamesOptSel} option:contains('${name}')`);
 }
-function getMessages() {
-  $.getJSON('/messages.json', async function(data) {
-    for (const msg of data) {
-      const msgAge = msg.current_time - msg.sent_time;
-      var msgTime = new Date();
-      msgTime.setTime(msgTime.getTime() - msgAge);
-      switch (msg.class) {
-        case 'MESSAGING_CLASS_OTA':
-          var otaData = JSON.parse(msg.message);
-          handle_flash_state({
-            ota_pct: (otaData.ota_pct ?? -1),
-            ota_dsc: (otaData.ota_dsc ??''),
-            event: flash_events.PROCESS_OTA
-          });
-          break;
-        case 'MESSAGING_CLASS_STATS':
-          // for task states, check structure : task_state_t
-          var statsData = JSON.parse(msg.message);
-          console.debug(
-            msgTime.toLocalShort() +
-              ' - Number of running tasks: ' +
-              statsData.ntasks
-          );
-          console.debug(
-            msgTime.toLocalShort() +
-              '\tname' +
-              '\tcpu' +
-              '\tstate' +
-              '\tminstk' +
-              '\tbprio' +
-              '\tcprio' +
-              '\tnum'
-          );
-          if (statsData.tasks) {
-            if ($('#tasks_sect').css('visibility') === 'collapse') {
-              $('#tasks_sect').css('visibility', 'visible');
-            }
-            $('tbody#tasks').html('');
-            statsData.tasks
-              .sort(function(a, b) {
-                return b.cpu - a.cpu;
-              })
-              .forEach(showTask, msgTime);
-          } else if ($('#tasks_sect').css('visibility') === 'visible') {
-            $('tbody#tasks').empty();
-            $('#tasks_sect').css('visibility', 'collapse');
-          }
-          break;
-        case 'MESSAGING_CLASS_SYSTEM':
-          showMessage(msg, msgTime);
-          break;
-        case 'MESSAGING_CLASS_CFGCMD':
-          var msgparts = msg.message.split(/([^\n]*)\n(.*)/gs);
-          showCmdMessage(msgparts[1], msg.type, msgparts[2], true);
-          break;
-        case 'MESSAGING_CLASS_BT':
-          if($("#cfg-audio-bt_source-sink_name").is('input')){
-          var attr=$("#cfg-audio-bt_source-sink_name")[0].attributes;
-          var attrs='';
-          for (var j = 0; j < attr.length; j++) {
-              if(attr.item(j).name!="type"){
-                attrs+=`${attr.item(j).name } = "${attr.item(j).value}" `;
-              }
-          }
-          var curOpt=$("#cfg-audio-bt_source-sink_name")[0].value;
-            $("#cfg-audio-bt_source-sink_name").replaceWith(`<select id="cfg-audio-bt_source-sink_name" ${attrs}><option value="${curOpt}" data-description="${curOpt}">${curOpt}</option></select> `);
+async function handleMessages(data) {
+  for (const msg of data) {
+    const msgAge = msg.current_time - msg.sent_time;
+    var msgTime = new Date();
+    msgTime.setTime(msgTime.getTime() - msgAge);
+    switch (msg.class) {
+      case 'MESSAGING_CLASS_OTA':
+        var otaData = JSON.parse(msg.message);
+        handle_flash_state({
+          ota_pct: (otaData.ota_pct ?? -1),
+          ota_dsc: (otaData.ota_dsc ??''),
+          event: flash_events.PROCESS_OTA
+        });
+        break;
+      case 'MESSAGING_CLASS_STATS':
+        // for task states, check structure : task_state_t
+        var statsData = JSON.parse(msg.message);
+        console.debug(
+          msgTime.toLocalShort() +
+            ' - Number of running tasks: ' +
+            statsData.ntasks
+        );
+        console.debug(
+          msgTime.toLocalShort() +
+            '\tname' +
+            '\tcpu' +
+            '\tstate' +
+            '\tminstk' +
+            '\tbprio' +
+            '\tcprio' +
+            '\tnum'
+        );
+        if (statsData.tasks) {
+          if ($('#tasks_sect').css('visibility') === 'collapse') {
+            $('#tasks_sect').css('visibility', 'visible');
           }
-          JSON.parse(msg.message).forEach(function(btEntry) {
-            //<input type="text" class="form-control bg-success" placeholder="name" hasvalue="true" longopts="sink_name" shortopts="n" checkbox="false" cmdname="cfg-audio-bt_source" id="cfg-audio-bt_source-sink_name" name="cfg-audio-bt_source-sink_name">
-            //<select hasvalue="true" longopts="jack_behavior" shortopts="j" checkbox="false" cmdname="cfg-audio-general" id="cfg-audio-general-jack_behavior" name="cfg-audio-general-jack_behavior" class="form-control "><option>--</option><option>Headphones</option><option>Subwoofer</option></select>            
-            if(!btExists(btEntry.name)){
-              $("#cfg-audio-bt_source-sink_name").append(`<option>${btEntry.name}</option>`);
-              showMessage({ type:msg.type, message:`BT Audio device found: ${btEntry.name} RSSI: ${btEntry.rssi} `}, msgTime);
+          $('tbody#tasks').html('');
+          statsData.tasks
+            .sort(function(a, b) {
+              return b.cpu - a.cpu;
+            })
+            .forEach(showTask, msgTime);
+        } else if ($('#tasks_sect').css('visibility') === 'visible') {
+          $('tbody#tasks').empty();
+          $('#tasks_sect').css('visibility', 'collapse');
+        }
+        break;
+      case 'MESSAGING_CLASS_SYSTEM':
+        showMessage(msg, msgTime);
+        break;
+      case 'MESSAGING_CLASS_CFGCMD':
+        var msgparts = msg.message.split(/([^\n]*)\n(.*)/gs);
+        showCmdMessage(msgparts[1], msg.type, msgparts[2], true);
+        break;
+      case 'MESSAGING_CLASS_BT':
+        if($("#cfg-audio-bt_source-sink_name").is('input')){
+        var attr=$("#cfg-audio-bt_source-sink_name")[0].attributes;
+        var attrs='';
+        for (var j = 0; j < attr.length; j++) {
+            if(attr.item(j).name!="type"){
+              attrs+=`${attr.item(j).name } = "${attr.item(j).value}" `;
             }
-            getBTSinkOpt(btEntry.name).attr('data-description', `${btEntry.name} (${btEntry.rssi}dB)`)
-                                      .attr('rssi',btEntry.rssi)
-                                      .attr('value',btEntry.name)
-                                      .text(`${btEntry.name} [${btEntry.rssi}dB]`).trigger('change');
-            
-          });
-          $(btSinkNamesOptSel).append($(`${btSinkNamesOptSel} option`).remove().sort(function(a, b) { 
-              console.log(`${parseInt($(a).attr('rssi'))} < ${parseInt( $(b).attr('rssi'))} ? `);
-              return parseInt($(a).attr('rssi')) < parseInt( $(b).attr('rssi')) ? 1 : -1; 
-            }));
-          break;
-        default:
-          break;
-      }
+        }
+        var curOpt=$("#cfg-audio-bt_source-sink_name")[0].value;
+          $("#cfg-audio-bt_source-sink_name").replaceWith(`<select id="cfg-audio-bt_source-sink_name" ${attrs}><option value="${curOpt}" data-description="${curOpt}">${curOpt}</option></select> `);
+        }
+        JSON.parse(msg.message).forEach(function(btEntry) {
+          //<input type="text" class="form-control bg-success" placeholder="name" hasvalue="true" longopts="sink_name" shortopts="n" checkbox="false" cmdname="cfg-audio-bt_source" id="cfg-audio-bt_source-sink_name" name="cfg-audio-bt_source-sink_name">
+          //<select hasvalue="true" longopts="jack_behavior" shortopts="j" checkbox="false" cmdname="cfg-audio-general" id="cfg-audio-general-jack_behavior" name="cfg-audio-general-jack_behavior" class="form-control "><option>--</option><option>Headphones</option><option>Subwoofer</option></select>            
+          if(!btExists(btEntry.name)){
+            $("#cfg-audio-bt_source-sink_name").append(`<option>${btEntry.name}</option>`);
+            showMessage({ type:msg.type, message:`BT Audio device found: ${btEntry.name} RSSI: ${btEntry.rssi} `}, msgTime);
+          }
+          getBTSinkOpt(btEntry.name).attr('data-description', `${btEntry.name} (${btEntry.rssi}dB)`)
+                                    .attr('rssi',btEntry.rssi)
+                                    .attr('value',btEntry.name)
+                                    .text(`${btEntry.name} [${btEntry.rssi}dB]`).trigger('change');
+          
+        });
+        $(btSinkNamesOptSel).append($(`${btSinkNamesOptSel} option`).remove().sort(function(a, b) { 
+            console.log(`${parseInt($(a).attr('rssi'))} < ${parseInt( $(b).attr('rssi'))} ? `);
+            return parseInt($(a).attr('rssi')) < parseInt( $(b).attr('rssi')) ? 1 : -1; 
+          }));
+        break;
+      default:
+        break;
     }
-  }).fail(function(xhr, ajaxOptions, thrownError){
+  }
+}
+
+function getMessages() {
+  $.getJSON('/messages.json', handleMessages).fail(function(xhr, ajaxOptions, thrownError){
       if(xhr.status==404){
         $('.orec').hide(); // system commands won't be available either
       } 
@@ -1450,67 +1468,75 @@ function batteryToIcon(voltage) {
     }
   }
 }
+function handleStatus(data) {
+  handleRecoveryMode(data);
+  handleWifiStatus(data);
+  handlebtstate(data);
+  handle_flash_state({
+    ota_pct: (data.ota_pct ?? -1),
+    ota_dsc: (data.ota_dsc ??''),
+    event: flash_events.PROCESS_OTA_STATUS
+  });
+  if (data.project_name && data.project_name !== '') {
+    project_name = data.project_name;
+  }
+  if(data.platform_name && data.platform_name!==''){
+    platform_name = data.platform_name;
+  }
+  if (data.version && data.version !== '') {
+    versionName=data.version;
+    $("#navtitle").html(`${project_name}${recovery?'<br>[recovery]':''}`);
+    $('span#foot-fw').html(`fw: <strong>${versionName}</strong>, mode: <strong>${recovery?"Recovery":project_name}</strong>`);
+  } else {
+    $('span#flash-status').html('');
+  }
+  if (data.Voltage) {
+   $('#battery').attr('xlink:href', `#${batteryToIcon(data.Voltage)}`);
+   $('#battery').show();
+  } else {
+    $('#battery').hide();
+  }
+  if((data.message??'')!='' && prevmessage != data.message){
+    // supporting older recovery firmwares - messages will come from the status.json structure
+    prevmessage = data.message;
+    showLocalMessage(data.message, 'MESSAGING_INFO')
+  }
+  $("button[onclick*='handleReboot']").removeClass('rebooting');
+
+  if (typeof lmsBaseUrl == "undefined" || data.lms_ip != prevLMSIP && data.lms_ip && data.lms_port) {
+    const baseUrl = 'http://' + data.lms_ip + ':' + data.lms_port;
+    prevLMSIP=data.lms_ip;
+    $.ajax({
+      url: baseUrl + '/plugins/SqueezeESP32/firmware/-check.bin', 
+      type: 'HEAD',
+      dataType: 'text',
+      cache: false,
+      error: function() {
+        // define the value, so we don't check it any more.
+        lmsBaseUrl = '';
+      },
+      success: function() {
+        lmsBaseUrl = baseUrl;
+      }
+    });
+  }
+  
+  $('#o_jack').attr('display', Number(data.Jack) ? 'inline' : 'none');
+}
+
 function checkStatus() {
   RepeatCheckStatusInterval();
+  if (eventSource && eventSource.readyState === EventSource.OPEN) {
+    // the firmware pushes messages and status on /events
+    return;
+  }
   if (blockAjax) {
     return;
   }
   blockAjax = true;
   getMessages();
   $.getJSON('/status.json', function(data) {
-    handleRecoveryMode(data);
-    handleWifiStatus(data);
-    handlebtstate(data);
-    handle_flash_state({
-      ota_pct: (data.ota_pct ?? -1),
-      ota_dsc: (data.ota_dsc ??''),
-      event: flash_events.PROCESS_OTA_STATUS
-    });
-    if (data.project_name && data.project_name !== '') {
-      project_name = data.project_name;
-    }
-    if(data.platform_name && data.platform_name!==''){
-      platform_name = data.platform_name;
-    }
-    if (data.version && data.version !== '') {
-      versionName=data.version;
-      $("#navtitle").html(`${project_name}${recovery?'<br>[recovery]':''}`);
-      $('span#foot-fw').html(`fw: <strong>${versionName}</strong>, mode: <strong>${recovery?"Recovery":project_name}</strong>`);
-    } else {
-      $('span#flash-status').html('');
-    }
-    if (data.Voltage) {
-     $('#battery').attr('xlink:href', `#${batteryToIcon(data.Voltage)}`);
-     $('#battery').show();
-    } else {
-      $('#battery').hide();
-    }
-    if((data.message??'')!='' && prevmessage != data.message){
-      // supporting older recovery firmwares - messages will come from the status.json structure
-      prevmessage = data.message;
-      showLocalMessage(data.message, 'MESSAGING_INFO')
-    }
-    $("button[onclick*='handleReboot']").removeClass('rebooting');
-
-    if (typeof lmsBaseUrl == "undefined" || data.lms_ip != prevLMSIP && data.lms_ip && data.lms_port) {
-      const baseUrl = 'http://' + data.lms_ip + ':' + data.lms_port;
-      prevLMSIP=data.lms_ip;
-      $.ajax({
-        url: baseUrl + '/plugins/SqueezeESP32/firmware/-check.bin', 
-        type: 'HEAD',
-        dataType: 'text',
-        cache: false,
-        error: function() {
-          // define the value, so we don't check it any more.
-          lmsBaseUrl = '';
-        },
-        success: function() {
-          lmsBaseUrl = baseUrl;
-        }
-      });
-    }
-    
-    $('#o_jack').attr('display', Number(data.Jack) ? 'inline' : 'none');
+    handleStatus(data);
     blockAjax = false;
   }).fail(function(xhr, ajaxOptions, thrownError) {
     handleExceptionResponse(xhr, ajaxOptions, thrownError);
@@ -32,3 +32,10 @@ const uint8_t * resource_map_end[] = {
 	_node_modules_0e064e_bundle_js_gz_end,
 	_runtime_0e064e_bundle_js_gz_end
 };
+const char * resource_etags[] = {
+	"\"18e271b984b42232\"",
+	"\"33ce0c2eab27f8d7\"",
+	"\"d7d5a996ca1d4299\"",
+	"\"8394ae092708b7cb\"",
+	"\"22e568c2f413fe57\""
+};
@@ -70,3 +70,4 @@ Child html-webpack-plugin for "index.html":
 extern const char * resource_lookups[];
 extern const uint8_t * resource_map_start[];
 extern const uint8_t * resource_map_end[];
+extern const char * resource_etags[];
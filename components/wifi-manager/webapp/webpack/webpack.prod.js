@@ -13,6 +13,7 @@ const OptimizeCSSAssetsPlugin = require('optimize-css-assets-webpack-plugin');
 const CompressionPlugin = require('compression-webpack-plugin');
 
 const fs = require('fs');
+const crypto = require('crypto');
 const glob = require('glob');
 var WebpackOnBuildPlugin = require('on-build-webpack');
 const BundleAnalyzerPlugin = require('webpack-bundle-analyzer').BundleAnalyzerPlugin;
@@ -148,12 +149,14 @@ module.exports = merge(common, {
                     '#include <inttypes.h>\n'+
                     'extern const char * resource_lookups[];\n'+
                     'extern const uint8_t * resource_map_start[];\n'+
-                    'extern const uint8_t * resource_map_end[];\n';
+                    'extern const uint8_t * resource_map_end[];\n'+
+                    'extern const char * resource_etags[];\n';
                     let exportDef=  '// Automatically generated. Do not edit manually!.\n'+
                                     '#include <inttypes.h>\n';
                     let lookupDef='const char * resource_lookups[] = {\n';
                     let lookupMapStart='const uint8_t * resource_map_start[] = {\n';
                     let lookupMapEnd='const uint8_t * resource_map_end[] = {\n';
+                    let lookupEtags='const char * resource_etags[] = {\n';
                     let cMake='';
                     list.forEach(fileName=>{
                             let exportName=fileName.match(regex)[2].replace(/[\. \-]/gm,'_');
@@ -163,15 +166,19 @@ module.exports = merge(common, {
                             lookupDef+='\t"/'+relativeName+'",\n';
                             lookupMapStart+='\t_'+ exportName+'_start,\n';
                             lookupMapEnd+= '\t_'+ exportName+'_end,\n';
+                            // content hash, so the browser can revalidate without a download
+                            let etag=crypto.createHash('sha1').update(fs.readFileSync(fileName)).digest('hex').substring(0,16);
+                            lookupEtags+='\t"\\"'+etag+'\\"",\n';
                             cMake+='target_add_binary_data( __idf_wifi-manager ./webapp'+fileName.match(makePathRegex)[1]+' BINARY)\n';
                     });
 
                     lookupDef+='""\n};\n';
                     lookupMapStart=lookupMapStart.substring(0,lookupMapStart.length-2)+'\n};\n';
                     lookupMapEnd=lookupMapEnd.substring(0,lookupMapEnd.length-2)+'\n};\n';
+                    lookupEtags=lookupEtags.substring(0,lookupEtags.length-2)+'\n};\n';
                     try {
                         fs.writeFileSync('webapp.cmake', cMake);
-                        fs.writeFileSync('webpack.c', exportDef+lookupDef+lookupMapStart+lookupMapEnd);
+                        fs.writeFileSync('webpack.c', exportDef+lookupDef+lookupMapStart+lookupMapEnd+lookupEtags);
                         fs.writeFileSync('webpack.h', exportDefHead);
                         //file written successfully
                         } catch (e) {
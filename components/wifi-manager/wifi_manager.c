@@ -98,6 +98,8 @@ static uint16_t num_disconnect=0;
 static char lms_server_ip[IP4ADDR_STRLEN_MAX]={0};
 static uint16_t lms_server_port=0;
 static uint16_t lms_server_cport=0;
+// bumped every time the content of ip_info_cjson changes
+static uint32_t ip_info_version=0;
 
 void (**cb_ptr_arr)(void*) = NULL;
 
@@ -201,6 +203,9 @@ char * get_disconnect_code_desc(uint8_t reason){
 void wifi_manager_update_status(){
 	wifi_manager_send_message(ORDER_UPDATE_STATUS,NULL);
 }
+uint32_t wifi_manager_get_status_version(){
+	return ip_info_version;
+}
 void set_host_name(){
 	esp_err_t err;
 	ESP_LOGD(TAG, "Retrieving host name from nvs");
@@ -479,52 +484,46 @@ cJSON * wifi_manager_get_new_array_json(cJSON **old){
 	ESP_LOGV(TAG,  "wifi_manager_get_new_array_json done");
 	return cJSON_CreateArray();
 }
+static bool wifi_manager_set_number(cJSON * item, double value){
+	if(!item || item->valuedouble == value) return false;
+	cJSON_SetNumberValue(item, value);
+	return true;
+}
 void wifi_manager_update_basic_info(){
 	if(wifi_manager_lock_json_buffer( portMAX_DELAY )){
-
+		bool changed = false;
 		monitor_gpio_t *mgpio= get_jack_insertion_gpio(); 
 		
-		cJSON * voltage = cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "Voltage");
-		if(voltage){
-			cJSON_SetNumberValue(voltage,	battery_value_svc());
-		}
-		cJSON * bt_status = cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "bt_status");
-		if(bt_status){
-			cJSON_SetNumberValue(bt_status,	bt_app_source_get_a2d_state());
-		}
-		cJSON * bt_sub_status = cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "bt_sub_status");
-		if(bt_sub_status){
-			cJSON_SetNumberValue(bt_sub_status,	bt_app_source_get_media_state());
-		}
+		changed |= wifi_manager_set_number(cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "Voltage"), battery_value_svc());
+		changed |= wifi_manager_set_number(cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "bt_status"), bt_app_source_get_a2d_state());
+		changed |= wifi_manager_set_number(cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "bt_sub_status"), bt_app_source_get_media_state());
 		cJSON * jack = cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "Jack");
 		if(jack){
-			jack->type=mgpio->gpio>=0 && jack_inserted_svc()?cJSON_True:cJSON_False;
-		}
-		cJSON * disconnect_count = cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "disconnect_count");
-		if(disconnect_count){
-			cJSON_SetNumberValue(disconnect_count,	num_disconnect);
+			int type = mgpio->gpio>=0 && jack_inserted_svc()?cJSON_True:cJSON_False;
+			changed |= jack->type != type;
+			jack->type = type;
 		}
-		cJSON * avg_conn_time = cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "avg_conn_time");
-		if(avg_conn_time){
-			cJSON_SetNumberValue(avg_conn_time,	num_disconnect>0?(total_connected_time/num_disconnect):0);
-		}	
+		changed |= wifi_manager_set_number(cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "disconnect_count"), num_disconnect);
+		changed |= wifi_manager_set_number(cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "avg_conn_time"), num_disconnect>0?(total_connected_time/num_disconnect):0);
 		if(lms_server_cport>0){
 			cJSON * value = cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "lms_cport");
 			if(value){
-				cJSON_SetNumberValue(value,lms_server_cport);
+				changed |= wifi_manager_set_number(value,lms_server_cport);
 			}			
 			else {
 				cJSON_AddNumberToObject(ip_info_cjson,"lms_cport",lms_server_cport);
+				changed = true;
 			}
 		}
 
 		if(lms_server_port>0){
 			cJSON * value = cJSON_GetObjectItemCaseSensitive(ip_info_cjson, "lms_port");
 			if(value){
-				cJSON_SetNumberValue(value,lms_server_port);
+				changed |= wifi_manager_set_number(value,lms_server_port);
 			}			
 			else {
 				cJSON_AddNumberToObject(ip_info_cjson,"lms_port",lms_server_port);
+				changed = true;
 			}
 		}
 
@@ -535,8 +534,10 @@ void wifi_manager_update_basic_info(){
 				// only create if it does not exist. Since we're creating a reference 
 				// to a char buffer, updates to cJSON aren't needed
 				cJSON_AddItemToObject(ip_info_cjson, "lms_ip", cJSON_CreateStringReference(lms_server_ip));
+				changed = true;
 			}			
 		}		
+		if(changed) ip_info_version++;
 		wifi_manager_unlock_json_buffer();
 	}
 }
@@ -570,6 +571,7 @@ cJSON * wifi_manager_get_basic_info(cJSON **old){
 cJSON * wifi_manager_clear_ip_info_json(cJSON **old){
 	ESP_LOGV(TAG,  "wifi_manager_clear_ip_info_json called");
 	cJSON *root = wifi_manager_get_basic_info(old);
+	ip_info_version++;
 	ESP_LOGV(TAG,  "wifi_manager_clear_ip_info_json done");
  	 return root;
 }
@@ -586,6 +588,7 @@ void wifi_manager_generate_ip_info_json(update_reason_code_t update_reason_code)
 	ESP_LOGD(TAG,  "wifi_manager_generate_ip_info_json called");
 	wifi_config_t *config = wifi_manager_get_wifi_sta_config();
 	ip_info_cjson = wifi_manager_get_basic_info(&ip_info_cjson);
+	ip_info_version++;
 
 	cJSON_AddNumberToObject(ip_info_cjson, "urc", update_reason_code);
 	if(config){
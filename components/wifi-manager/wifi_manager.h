@@ -204,6 +204,11 @@ typedef enum reboot_type_t{
 void wifi_manager_reboot(reboot_type_t rtype);
 void wifi_manager_reboot_ota(char * url);
 void wifi_manager_update_status();
+/**
+ * @brief Returns a counter that changes every time the status json content changes.
+ * @note Read it while holding the json buffer lock to match it with the content.
+ */
+uint32_t wifi_manager_get_status_version();
 
 
 /**
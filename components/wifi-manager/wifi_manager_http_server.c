@@ -34,7 +34,7 @@ static const char TAG[] = "http_server";
 
 static httpd_handle_t _server = NULL;
 rest_server_context_t *rest_context = NULL;
-RingbufHandle_t messaging=NULL;
+messaging_handle_t messaging=NULL;
 
 void register_common_handlers(httpd_handle_t server){
 	httpd_uri_t css_get = { .uri = "/css/*", .method = HTTP_GET, .handler = resource_filehandler, .user_ctx = rest_context };
@@ -61,6 +61,12 @@ void register_regular_handlers(httpd_handle_t server){
 	httpd_register_uri_handler(server, &status_get);
 	httpd_uri_t messages_get = { .uri = "/messages.json", .method = HTTP_GET, .handler = messages_get_handler, .user_ctx = rest_context };
 	httpd_register_uri_handler(server, &messages_get);
+	httpd_uri_t stats_get = { .uri = "/stats.csv", .method = HTTP_GET, .handler = stats_csv_get_handler, .user_ctx = rest_context };
+	httpd_register_uri_handler(server, &stats_get);
+	httpd_uri_t trace_get = { .uri = "/trace.json", .method = HTTP_GET, .handler = trace_get_handler, .user_ctx = rest_context };
+	httpd_register_uri_handler(server, &trace_get);
+	httpd_uri_t events_get = { .uri = "/events", .method = HTTP_GET, .handler = events_get_handler, .user_ctx = rest_context };
+	httpd_register_uri_handler(server, &events_get);
 
 	httpd_uri_t commands_get = { .uri = "/commands.json", .method = HTTP_GET, .handler = console_cmd_get_handler, .user_ctx = rest_context };
 	httpd_register_uri_handler(server, &commands_get);
@@ -133,7 +139,7 @@ esp_err_t http_server_start()
     strlcpy(rest_context->base_path, "/res/", sizeof(rest_context->base_path));
 
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.max_uri_handlers = 25;
+    config.max_uri_handlers = 28;
     config.max_open_sockets = 3;
 	config.lru_purge_enable = true;
 	config.backlog_conn = 1;
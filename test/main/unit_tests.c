@@ -68,9 +68,11 @@ extern void services_init(void);
 const char * str_or_unknown(const char * str) { return (str?str:unknown_string_placeholder); }
 const char * str_or_null(const char * str) { return (str?str:null_string_placeholder); }
 bool is_recovery_running;
+bool bypass_wifi_manager;
 extern void initialize_console();
 /* brief this is an exemple of a callback that you can setup in your own app to get notified of wifi manager event */
 esp_err_t update_certificates(bool force){return ESP_OK; }
+const char * get_certificate(){ return NULL; }
 void init_commands(){
 	initialize_console();
 	/* Register commands */